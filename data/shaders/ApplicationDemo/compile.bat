@@ -3,4 +3,8 @@ echo compiling %%i
 ..\glslc.exe %%i -o %%i.spv
 )
 
+rem shader variants (see variants.txt)
+echo compiling test.frag VERTEX_COLOR
+..\glslc.exe -DVERTEX_COLOR=1 test.frag -o test.frag.1.spv
+
 pause
@@ -0,0 +1,28 @@
+#version 450
+
+#include "..\shaderCommon.h"
+
+layout(set = PASS_SET, binding = UNIFORM_BUFFER_SLOT(0)) uniform UBO
+{
+	mat4x4 viewProj;
+} ubo;
+
+// written by the render queue, firstInstance points at the first transform of the batch
+layout(std430, set = PASS_SET, binding = STORAGE_BUFFER_SLOT(0)) readonly buffer Instances
+{
+	mat4x4 transforms[];
+};
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec4 inColor;
+layout(location = 2) in vec2 inTexCoord;
+
+layout(location = 0) out vec4 outColor;
+layout(location = 1) out vec2 texCoord;
+
+void main()
+{
+	gl_Position = ubo.viewProj * transforms[gl_InstanceIndex] * vec4(inPosition, 1.0);
+	outColor = inColor;
+	texCoord = inTexCoord;
+}
@@ -2,7 +2,7 @@
 
 #include "..\shaderCommon.h"
 
-layout(set = 0, binding = TEXTURE_SLOT(0)) uniform sampler2D texSampler;
+layout(set = MATERIAL_SET, binding = TEXTURE_SLOT(0)) uniform sampler2D texSampler;
 
 layout(location = 0) in vec4 inColor;
 layout(location = 1) in vec2 inTexCoord;
@@ -11,5 +11,9 @@ layout(location = 0) out vec4 OutColor;
 
 void main()
 {
-	OutColor = texture(texSampler, inTexCoord).rgba; //inColor;
+#ifdef VERTEX_COLOR
+	OutColor = texture(texSampler, inTexCoord).rgba * inColor;
+#else
+	OutColor = texture(texSampler, inTexCoord).rgba;
+#endif
 }
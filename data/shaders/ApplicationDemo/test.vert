@@ -14,7 +14,7 @@ vec4 vertColors[3] = vec4[](
 	vec4(0.0, 0.0, 1.0, 1.0)
 	);
 
-layout(set = 0, binding = UNIFORM_BUFFER_SLOT(0)) uniform UBO
+layout(set = DRAW_SET, binding = UNIFORM_BUFFER_SLOT(0)) uniform UBO
 {
 	mat4x4 transform;
 	vec4 testColor;
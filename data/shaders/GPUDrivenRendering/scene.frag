@@ -0,0 +1,17 @@
+#version 450
+
+#include "..\shaderCommon.h"
+
+layout(location = 0) in vec3 worldPosition;
+layout(location = 1) in vec4 inColor;
+
+layout(location = 0) out vec4 outColor;
+
+void main()
+{
+	// flat shading, no need for vertex normals
+	vec3 normal = normalize(cross(dFdx(worldPosition), dFdy(worldPosition)));
+	float lighting = 0.3 + 0.7 * abs(dot(normal, normalize(vec3(0.5, 0.3, 1.0))));
+
+	outColor = vec4(inColor.rgb * lighting, 1.0);
+}
@@ -0,0 +1,35 @@
+#version 450
+
+#include "..\shaderCommon.h"
+
+layout(set = PASS_SET, binding = UNIFORM_BUFFER_SLOT(0)) uniform UBO
+{
+	mat4x4 viewProj;
+} ubo;
+
+struct ObjectData
+{
+	vec4 positionRadius;
+	vec4 color;
+};
+
+layout(std430, set = PASS_SET, binding = STORAGE_BUFFER_SLOT(0)) readonly buffer Objects
+{
+	ObjectData objects[];
+};
+
+layout(location = 0) in vec3 inPosition;
+
+layout(location = 0) out vec3 worldPosition;
+layout(location = 1) out vec4 outColor;
+
+void main()
+{
+	// one instance per draw, firstInstance is the object index
+	ObjectData object = objects[gl_InstanceIndex];
+
+	worldPosition = inPosition + object.positionRadius.xyz;
+	outColor = object.color;
+
+	gl_Position = ubo.viewProj * vec4(worldPosition, 1.0);
+}
@@ -0,0 +1,27 @@
+#version 450
+
+#include "..\shaderCommon.h"
+#include "..\bindless.h"
+
+layout(location = 0) in vec3 worldPosition;
+layout(location = 1) in vec3 localPosition;
+layout(location = 2) in vec4 inColor;
+layout(location = 3) flat in uint textureIndex;
+
+layout(location = 0) out vec4 outColor;
+
+void main()
+{
+	// flat shading, no need for vertex normals
+	vec3 normal = normalize(cross(dFdx(worldPosition), dFdy(worldPosition)));
+	float lighting = 0.3 + 0.7 * abs(dot(normal, normalize(vec3(0.5, 0.3, 1.0))));
+
+	// no UVs either, project the cube face
+	vec3 axis = abs(normal);
+	vec2 uv = (axis.x > axis.y && axis.x > axis.z) ? localPosition.yz : ((axis.y > axis.z) ? localPosition.xz : localPosition.xy);
+
+	// the texture index can change between the objects of a draw
+	vec4 albedo = SampleBindless(textureIndex, bindlessConstants.indices.z, uv + 0.5);
+
+	outColor = vec4(albedo.rgb * inColor.rgb * lighting, 1.0);
+}
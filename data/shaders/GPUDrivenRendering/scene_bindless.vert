@@ -0,0 +1,42 @@
+#version 450
+
+#include "..\shaderCommon.h"
+#include "..\bindless.h"
+
+// bindless variant of scene.vert: the object and material buffers are picked from the bindless arrays with the push constant indices
+// indices.x: object buffer, indices.y: material buffer, indices.z: sampler
+
+layout(set = PASS_SET, binding = UNIFORM_BUFFER_SLOT(0)) uniform UBO
+{
+	mat4x4 viewProj;
+} ubo;
+
+struct ObjectData
+{
+	vec4 positionRadius;
+	vec4 color;
+};
+
+BINDLESS_STORAGE_BUFFER(Objects, ObjectData objects[]);
+// bindless index of the texture of each object
+BINDLESS_STORAGE_BUFFER(Materials, uint textureIndices[]);
+
+layout(location = 0) in vec3 inPosition;
+
+layout(location = 0) out vec3 worldPosition;
+layout(location = 1) out vec3 localPosition;
+layout(location = 2) out vec4 outColor;
+layout(location = 3) flat out uint textureIndex;
+
+void main()
+{
+	// one instance per draw, firstInstance is the object index
+	ObjectData object = bindlessObjects[bindlessConstants.indices.x].objects[gl_InstanceIndex];
+
+	localPosition = inPosition;
+	worldPosition = inPosition + object.positionRadius.xyz;
+	outColor = object.color;
+	textureIndex = bindlessMaterials[bindlessConstants.indices.y].textureIndices[gl_InstanceIndex];
+
+	gl_Position = ubo.viewProj * vec4(worldPosition, 1.0);
+}
@@ -2,15 +2,17 @@
 
 #include "..\shaderCommon.h"
 
-layout(set = 0, binding = UNIFORM_BUFFER_SLOT(0)) uniform UBO
+PUSH_CONSTANTS Consts
 {
 	float nearPlane;
 	float farPlane;
-} ubo;
+} consts;
 
-layout(set = 0, binding = TEXTURE_SLOT(0)) uniform sampler2D offscreenTex;
-layout(set = 0, binding = TEXTURE_SLOT(1)) uniform sampler2D depthTex;
-layout(set = 0, binding = TEXTURE_SLOT(2)) uniform sampler2D vignetteTex;
+layout(set = DRAW_SET, binding = SAMPLED_IMAGE_SLOT(0)) uniform texture2D offscreenTex;
+layout(set = DRAW_SET, binding = SAMPLED_IMAGE_SLOT(1)) uniform texture2D depthTex;
+layout(set = DRAW_SET, binding = SAMPLED_IMAGE_SLOT(2)) uniform texture2D vignetteTex;
+
+IMMUTABLE_SAMPLERS(DRAW_SET);
 
 layout(location = 0) in vec2 inTexCoord;
 
@@ -18,15 +20,16 @@ layout(location = 0) out vec4 OutColor;
 
 float LinearizeDepth(float depth)
 {
-  float n = ubo.nearPlane; // camera z near
-  float f = ubo.farPlane; // camera z far
+  float n = consts.nearPlane; // camera z near
+  float f = consts.farPlane; // camera z far
   float z = depth;
   return (2.0 * n) / (f + n - z * (f - n));	
 }
 
 void main()
 {
-	float depth = LinearizeDepth(texture(depthTex, inTexCoord).r);
+	float depth = LinearizeDepth(texture(sampler2D(depthTex, immutableSamplers[SAMPLER_POINT_CLAMP]), inTexCoord).r);
 
-	OutColor = texture(offscreenTex, inTexCoord).rgba + texture(vignetteTex, inTexCoord).rgba * 0.05;
+	OutColor = texture(sampler2D(offscreenTex, immutableSamplers[SAMPLER_LINEAR_CLAMP]), inTexCoord).rgba +
+		texture(sampler2D(vignetteTex, immutableSamplers[SAMPLER_LINEAR_CLAMP]), inTexCoord).rgba * 0.05;
 }
@@ -2,7 +2,7 @@
 
 #include "..\shaderCommon.h"
 
-layout(set = 0, binding = TEXTURE_SLOT(0)) uniform sampler2D texSampler;
+layout(set = DRAW_SET, binding = TEXTURE_SLOT(0)) uniform sampler2D texSampler;
 
 layout(location = 0) in vec2 inTexCoord;
 
@@ -2,10 +2,10 @@
 
 #include "..\shaderCommon.h"
 
-layout(set = 0, binding = UNIFORM_BUFFER_SLOT(0)) uniform UBO
+PUSH_CONSTANTS Consts
 {
 	mat4x4 transform;
-} ubo;
+} consts;
 
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec2 inTexCoord;
@@ -14,6 +14,6 @@ layout(location = 0) out vec2 texCoord;
 
 void main()
 {
-	gl_Position = ubo.transform * vec4(inPosition, 1.0);
+	gl_Position = consts.transform * vec4(inPosition, 1.0);
 	texCoord = inTexCoord;
 }
@@ -0,0 +1,23 @@
+// bindless resources, see the BINDLESS_* values in shaderCommon.h. Include after shaderCommon.h
+// Indices that can diverge within a draw (i.e. read from a buffer in a fragment shader) must be wrapped in nonuniformEXT
+
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(set = BINDLESS_SET, binding = BINDLESS_TEXTURE_BINDING) uniform texture2D bindlessTextures[];
+layout(set = BINDLESS_SET, binding = BINDLESS_SAMPLER_BINDING) uniform sampler bindlessSamplers[];
+
+// storage buffers alias the same binding, declare one array per struct type:
+// BINDLESS_STORAGE_BUFFER(ObjectBuffers, ObjectData objects[]); ... bindlessObjectBuffers[index].objects[i]
+#define BINDLESS_STORAGE_BUFFER(name, contents) \
+	layout(std430, set = BINDLESS_SET, binding = BINDLESS_STORAGE_BUFFER_BINDING) readonly buffer name { contents; } bindless##name[]
+
+// per draw/dispatch indices, set with ContextVK::SetPushConstants. Shaders that need other push constants declare their own block instead
+PUSH_CONSTANTS BindlessConstants
+{
+	uvec4 indices;
+} bindlessConstants;
+
+vec4 SampleBindless(uint textureIndex, uint samplerIndex, vec2 uv)
+{
+	return texture(sampler2D(bindlessTextures[nonuniformEXT(textureIndex)], bindlessSamplers[nonuniformEXT(samplerIndex)]), uv);
+}
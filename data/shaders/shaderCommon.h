@@ -1,10 +1,68 @@
-// remember to rebuild shaders manually if changing the values! (until I provide a decent shader building solution...)
+// remember to rebuild shaders manually if changing the values! Except the ones created with ShaderVK::CreateFromSource when built with runtime compilation:
+// their includes are watched too (see ShaderCompilerVK)
 
+// descriptor sets by update frequency. They all have the slots below, and all the pipeline layouts are the same: a set stays bound across pipeline
+// changes until its bindings change, so bind the resources at the frequency they change with (i.e. layout(set = PASS_SET, binding = TEXTURE_SLOT(0)))
+#define FRAME_SET 0
+#define PASS_SET 1
+#define MATERIAL_SET 2
+#define DRAW_SET 3
+#define NUM_DESCRIPTOR_SETS 4
+
+// slots of each set. The uniform buffers are dynamic, NUM_DESCRIPTOR_SETS * MAX_UNIFORM_BUFFER_SLOTS must fit maxDescriptorSetUniformBuffersDynamic (8 at least)
 #define UNIFORM_BUFFER_SLOT(n) 0 + n
-#define MAX_UNIFORM_BUFFER_SLOTS 1
+#define MAX_UNIFORM_BUFFER_SLOTS 2
 #define TEXTURE_SLOT(n) UNIFORM_BUFFER_SLOT(MAX_UNIFORM_BUFFER_SLOTS) + n
-#define MAX_TEXTURE_SLOTS 16
+#define MAX_TEXTURE_SLOTS 8
 #define STORAGE_IMAGE_SLOT(n) TEXTURE_SLOT(MAX_TEXTURE_SLOTS) + n
-#define MAX_STORAGE_IMAGE_SLOTS 8
+#define MAX_STORAGE_IMAGE_SLOTS 4
+#define STORAGE_BUFFER_SLOT(n) STORAGE_IMAGE_SLOT(MAX_STORAGE_IMAGE_SLOTS) + n
+#define MAX_STORAGE_BUFFER_SLOTS 4
+// typed views of buffers (samplerBuffer / imageBuffer), for large arrays of formatted elements: uniform texel buffers are read only
+// and converted by the format like a texture fetch, storage texel buffers support image load, store and atomics.
+// Storage buffers have no separate read only slots: declare them readonly (or writeonly) in the shader instead
+#define UNIFORM_TEXEL_BUFFER_SLOT(n) STORAGE_BUFFER_SLOT(MAX_STORAGE_BUFFER_SLOTS) + n
+#define MAX_UNIFORM_TEXEL_BUFFER_SLOTS 2
+#define STORAGE_TEXEL_BUFFER_SLOT(n) UNIFORM_TEXEL_BUFFER_SLOT(MAX_UNIFORM_TEXEL_BUFFER_SLOTS) + n
+#define MAX_STORAGE_TEXEL_BUFFER_SLOTS 2
+// images without a sampler (texture2D), sampled with one of the immutable samplers below: the descriptors carry no sampler state,
+// and the same image can be read with different filtering through a single binding
+#define SAMPLED_IMAGE_SLOT(n) STORAGE_TEXEL_BUFFER_SLOT(MAX_STORAGE_TEXEL_BUFFER_SLOTS) + n
+#define MAX_SAMPLED_IMAGE_SLOTS 4
+
+#define MAX_NUM_BINDINGS (MAX_UNIFORM_BUFFER_SLOTS + MAX_TEXTURE_SLOTS + MAX_STORAGE_IMAGE_SLOTS + MAX_STORAGE_BUFFER_SLOTS + MAX_UNIFORM_TEXEL_BUFFER_SLOTS + \
+	MAX_STORAGE_TEXEL_BUFFER_SLOTS + MAX_SAMPLED_IMAGE_SLOTS)
+
+// immutable samplers, baked into the layout of every set after the slots: nothing to bind, they are available in any set the pipeline uses.
+// Declare them with IMMUTABLE_SAMPLERS(DRAW_SET) (usually the set of the images) and sample with i.e. sampler2D(image, immutableSamplers[SAMPLER_LINEAR_CLAMP])
+#define IMMUTABLE_SAMPLERS_BINDING MAX_NUM_BINDINGS
+#define SAMPLER_LINEAR_WRAP 0
+#define SAMPLER_LINEAR_CLAMP 1
+#define SAMPLER_POINT_WRAP 2
+#define SAMPLER_POINT_CLAMP 3
+// linear wrap with the device max anisotropy (16 at most), when supported
+#define SAMPLER_ANISOTROPIC 4
+#define NUM_IMMUTABLE_SAMPLERS 5
+
+#define IMMUTABLE_SAMPLERS(s) layout(set = s, binding = IMMUTABLE_SAMPLERS_BINDING) uniform sampler immutableSamplers[NUM_IMMUTABLE_SAMPLERS]
+
+// push constants: a single range shared by all the stages, of MAX_PUSH_CONSTANTS_SIZE bytes or the device maxPushConstantsSize if smaller (128 at least).
+// Declare the block with PUSH_CONSTANTS: when the data is too big for the device, ContextVK::SetPushConstants binds it as a uniform buffer at
+// PUSH_CONSTANTS_FALLBACK_SLOT of DRAW_SET instead, and the shaders need to be compiled with PUSH_CONSTANTS_FALLBACK defined
+#define MAX_PUSH_CONSTANTS_SIZE 256
+#define PUSH_CONSTANTS_FALLBACK_SLOT UNIFORM_BUFFER_SLOT(1)
+
+#ifdef PUSH_CONSTANTS_FALLBACK
+#define PUSH_CONSTANTS layout(set = DRAW_SET, binding = PUSH_CONSTANTS_FALLBACK_SLOT) uniform
+#else
+#define PUSH_CONSTANTS layout(push_constant) uniform
+#endif
 
-#define MAX_NUM_BINDINGS (MAX_UNIFORM_BUFFER_SLOTS + MAX_TEXTURE_SLOTS + MAX_STORAGE_IMAGE_SLOTS)
+// bindless resources (VK_EXT_descriptor_indexing, when supported): large update after bind arrays in their own set, indexed with push constants (see bindless.h)
+#define BINDLESS_SET NUM_DESCRIPTOR_SETS
+#define BINDLESS_TEXTURE_BINDING 0
+#define BINDLESS_SAMPLER_BINDING 1
+#define BINDLESS_STORAGE_BUFFER_BINDING 2
+#define MAX_BINDLESS_TEXTURES 4096
+#define MAX_BINDLESS_SAMPLERS 64
+#define MAX_BINDLESS_STORAGE_BUFFERS 4096
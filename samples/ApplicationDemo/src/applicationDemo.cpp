@@ -1,5 +1,7 @@
 #include "applicationDemo.h"
 
+#include <iostream>
+
 namespace MBRF
 {
 
@@ -11,10 +13,14 @@ void ApplicationDemo::OnInit()
 	CreateShaders();
 
 	CreateGraphicsPipelines();
+
+	CreateScene();
 }
 
 void ApplicationDemo::OnCleanup()
 {
+	DestroyScene();
+
 	DestroyGraphicsPipelines();
 	DestroyShaders();
 
@@ -24,23 +30,58 @@ void ApplicationDemo::OnCleanup()
 
 void ApplicationDemo::OnResize()
 {
+	// viewport and scissor are dynamic: the pipelines don't depend on the back buffer size
+}
+
+void ApplicationDemo::OnShadersReloaded()
+{
+	// the pipelines may be in use by the frames in flight
+	m_rendererVK.WaitForDevice();
+
 	DestroyGraphicsPipelines();
 	CreateGraphicsPipelines();
 }
 
 void ApplicationDemo::OnUpdate(double dt)
 {
-	m_uboTest.m_testColor.x += (float)dt;
-	if (m_uboTest.m_testColor.x > 1.0f)
-		m_uboTest.m_testColor.x = 0.0f;
+	// toggle merging of identical draws into instanced ones
+	bool keyPressed = (glfwGetKey(m_window, GLFW_KEY_I) == GLFW_PRESS);
+
+	if (keyPressed && !m_instancingKeyPressed)
+		m_renderQueue.SetInstancing(!m_renderQueue.IsInstancing());
+
+	m_instancingKeyPressed = keyPressed;
+
+	// toggle redundant state filtering in the context
+	keyPressed = (glfwGetKey(m_window, GLFW_KEY_F) == GLFW_PRESS);
+
+	if (keyPressed && !m_filteringKeyPressed)
+		m_stateFiltering = !m_stateFiltering;
+
+	m_filteringKeyPressed = keyPressed;
+
+	// cycle descriptor set cache modes: none, per frame, persistent
+	keyPressed = (glfwGetKey(m_window, GLFW_KEY_C) == GLFW_PRESS);
+
+	if (keyPressed && !m_cacheKeyPressed)
+		m_descriptorSetCacheMode = ContextVK::DescriptorSetCacheMode((m_descriptorSetCacheMode + 1) % (ContextVK::DESCRIPTOR_SET_CACHE_PERSISTENT + 1));
+
+	m_cacheKeyPressed = keyPressed;
+
+	// toggle writing the descriptor sets with vkUpdateDescriptorSets or update templates
+	keyPressed = (glfwGetKey(m_window, GLFW_KEY_U) == GLFW_PRESS);
+
+	if (keyPressed && !m_updateModeKeyPressed)
+		m_descriptorUpdateMode = (m_descriptorUpdateMode == ContextVK::DESCRIPTOR_UPDATE_TEMPLATE) ? ContextVK::DESCRIPTOR_UPDATE_WRITES : ContextVK::DESCRIPTOR_UPDATE_TEMPLATE;
+
+	m_updateModeKeyPressed = keyPressed;
 
 	m_testCubeRotation += (float)dt;
 
 	FrameBufferVK* backBuffer = m_rendererVK.GetCurrentBackBuffer();
 
-	glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, 0.0f, 0.0f)) * glm::rotate(glm::mat4(1.0f), m_testCubeRotation * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 4.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	glm::mat4 proj = glm::perspective(glm::radians(45.0f), backBuffer->GetWidth() / float(backBuffer->GetHeight()), 0.1f, 10.0f);
+	m_view = glm::lookAt(glm::vec3(0.0f, 40.0f, 25.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	glm::mat4 proj = glm::perspective(glm::radians(45.0f), backBuffer->GetWidth() / float(backBuffer->GetHeight()), 0.1f, 100.0f);
 
 	// Vulkan clip space has inverted Y and half Z.
 	glm::mat4 clip = glm::mat4(1.0f, 0.0f, 0.0f, 0.0f,
@@ -48,49 +89,98 @@ void ApplicationDemo::OnUpdate(double dt)
 		0.0f, 0.0f, 0.5f, 0.0f,
 		0.0f, 0.0f, 0.5f, 1.0f);
 
-	m_uboTest.m_mvpTransform = clip * proj * view * model;
+	m_viewProj = clip * proj * m_view;
+
+	// stats
+
+	m_statsTimer += dt;
+
+	if (m_statsTimer >= 1.0)
+	{
+		const RenderQueueStatsVK& stats = m_renderQueue.GetStats();
+
+		std::cout << stats.m_numItems << " items. Submission order: " << stats.m_unsortedDrawCalls << " draws, " << stats.m_unsortedStateChanges << " state changes. ";
+		std::cout << (m_renderQueue.IsInstancing() ? "Sorted + instanced: " : "Sorted: ") << stats.m_drawCalls << " draws, " << stats.m_stateChanges << " state changes" << std::endl;
+
+		if (m_numRecordedDraws > 0)
+		{
+			std::cout << "State filtering " << (m_stateFiltering ? "on" : "off") << ": " << (m_recordTime * 1000.0 / m_numRecordedDraws) << " us CPU per draw. ";
+			std::cout << "Pipeline binds: " << m_contextStats.m_pipelineBinds << " (" << m_contextStats.m_skippedPipelineBinds << " skipped), ";
+			std::cout << "buffer binds: " << m_contextStats.m_bufferBinds << " (" << m_contextStats.m_skippedBufferBinds << " skipped), ";
+			std::cout << "descriptor sets: " << m_contextStats.m_descriptorSetsAllocated << ", writes: " << m_contextStats.m_descriptorWrites << ", copies: " << m_contextStats.m_descriptorCopies << std::endl;
+
+			const char* cacheModes[] = { "off", "per frame", "persistent" };
+			uint32_t lookups = m_descriptorSetCacheHits + m_descriptorSetCacheMisses;
+
+			std::cout << "Descriptor set cache " << cacheModes[m_descriptorSetCacheMode] << ": ";
+			std::cout << (lookups > 0 ? 100.0 * m_descriptorSetCacheHits / lookups : 0.0) << "% hit rate, ";
+			std::cout << (double(m_descriptorSetCacheHits) / m_numRecordedFrames) << " vkUpdateDescriptorSets avoided per frame" << std::endl;
+
+			bool templates = (m_descriptorUpdateMode == ContextVK::DESCRIPTOR_UPDATE_TEMPLATE) && m_rendererVK.GetDevice()->SupportsDescriptorUpdateTemplates();
 
-	model = glm::translate(glm::mat4(1.0f), glm::vec3(-1.0f, 0.0f, 0.0f)) * glm::rotate(glm::mat4(1.0f), m_testCubeRotation * glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+			std::cout << "Descriptor updates " << (templates ? "with templates" : "with writes/copies") << ": ";
+			std::cout << (m_descriptorSetUpdates > 0 ? m_descriptorUpdateTime * 1000.0 / m_descriptorSetUpdates : 0.0) << " us CPU per set, ";
+			std::cout << (double(m_descriptorSetUpdates) / m_numRecordedFrames) << " sets per frame" << std::endl;
 
-	m_uboTest2.m_mvpTransform = clip * proj * view * model;
+			DeviceVK* device = m_rendererVK.GetDevice();
+
+			std::cout << "Descriptor pools: " << m_descriptorAllocatorStats.m_numPools << " used by the context (" << m_descriptorAllocatorStats.m_poolGrowths << " chained), ";
+			std::cout << device->GetNumDescriptorPools() << " in total, " << device->GetDescriptorPoolSize() << " sets per new pool" << std::endl;
+		}
+
+		m_statsTimer = 0.0;
+		m_recordTime = 0.0;
+		m_numRecordedDraws = 0;
+		m_numRecordedFrames = 0;
+		m_descriptorSetCacheHits = 0;
+		m_descriptorSetCacheMisses = 0;
+		m_descriptorSetUpdates = 0;
+		m_descriptorUpdateTime = 0.0;
+	}
 }
 
 void ApplicationDemo::OnDraw()
 {
+	DeviceVK* device = m_rendererVK.GetDevice();
+
 	// TODO: store current swapchain FBO as a global
 	FrameBufferVK* currentRenderTarget = m_rendererVK.GetCurrentBackBuffer();
 
-	ContextVK* context = m_rendererVK.GetDevice()->GetCurrentGraphicsContext();
-
-	context->BeginPass(currentRenderTarget);
-
-	context->ClearRenderTarget(0, 0, currentRenderTarget->GetWidth(), currentRenderTarget->GetHeight(), { 0.3f, 0.3f, 0.3f, 1.0f }, { 1.0f, 0 });
+	ContextVK* context = device->GetCurrentGraphicsContext();
 
-	// TODO: need to write PSO wrapper. After replace this with context->SetPSO. Orset individual states + final ApplyState call?
-	context->SetPipeline(&m_graphicsPipeline);
+	m_renderQueue.Begin(m_view);
 
-	context->SetVertexBuffer(&m_testVertexBuffer, 0);
-	context->SetIndexBuffer(&m_testIndexBuffer, 0);
+	for (const Object& object : m_objects)
+	{
+		glm::mat4 transform = glm::translate(glm::mat4(1.0f), object.m_position) * glm::rotate(glm::mat4(1.0f), m_testCubeRotation * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
 
-	// Draw first test cube
+		m_renderQueue.Submit(0, &m_cubeMesh, &m_materials[object.m_material], transform);
+	}
 
-	context->SetUniformBuffer(m_rendererVK.GetDevice(), &m_uboTest, sizeof(UBOTest), 0);
-	context->SetTexture(&m_testTexture, 0);
+	m_renderQueue.End(device);
 
-	context->CommitBindings(m_rendererVK.GetDevice());
-
-	context->DrawIndexed(m_testIndexBuffer.GetNumIndices(), 1, 0, 0, 0);
+	context->BeginPass(currentRenderTarget);
 
-	// Draw second test cube
+	context->ClearRenderTarget(0, 0, currentRenderTarget->GetWidth(), currentRenderTarget->GetHeight(), { 0.3f, 0.3f, 0.3f, 1.0f }, { 1.0f, 0 });
 
-	context->SetPipeline(&m_testGraphicsPipeline2);
+	context->SetStateFiltering(m_stateFiltering);
+	context->SetDescriptorSetCacheMode(m_descriptorSetCacheMode);
+	context->SetDescriptorUpdateMode(m_descriptorUpdateMode);
 
-	context->SetUniformBuffer(m_rendererVK.GetDevice(), &m_uboTest2, sizeof(UBOTest), 0);
-	context->SetTexture(&m_testTexture2, 0);
+	auto recordStart = std::chrono::steady_clock::now();
+	uint32_t firstDraw = context->GetStats().m_drawCalls;
 
-	context->CommitBindings(m_rendererVK.GetDevice());
+	m_renderQueue.Draw(device, context, 0, &m_viewProj, sizeof(glm::mat4));
 
-	context->DrawIndexed(m_testIndexBuffer.GetNumIndices(), 1, 0, 0, 0);
+	m_recordTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordStart).count();
+	m_numRecordedDraws += context->GetStats().m_drawCalls - firstDraw;
+	m_contextStats = context->GetStats();
+	m_descriptorAllocatorStats = context->GetDescriptorAllocatorStats();
+	m_descriptorSetCacheHits += m_contextStats.m_descriptorSetCacheHits;
+	m_descriptorSetCacheMisses += m_contextStats.m_descriptorSetCacheMisses;
+	m_descriptorSetUpdates += m_contextStats.m_descriptorSetUpdates;
+	m_descriptorUpdateTime += m_contextStats.m_descriptorUpdateTime;
+	m_numRecordedFrames++;
 
 	context->EndPass();
 }
@@ -106,10 +196,11 @@ bool ApplicationDemo::CreateShaders()
 	bool result = true;
 
 	// TODO: put common data/shader dir path in a variable or define
-	result &= m_vertexShader.CreateFromFile(m_rendererVK.GetDevice(), "../../data/shaders/ApplicationDemo/test.vert.spv", SHADER_STAGE_VERTEX);
-	result &= m_fragmentShader.CreateFromFile(m_rendererVK.GetDevice(), "../../data/shaders/ApplicationDemo/test.frag.spv", SHADER_STAGE_FRAGMENT);
+	result &= m_vertexShader.CreateFromFile(m_rendererVK.GetDevice(), "../../data/shaders/ApplicationDemo/instanced.vert.spv", SHADER_STAGE_VERTEX);
 
-	result &= m_fragmentShader2.CreateFromFile(m_rendererVK.GetDevice(), "../../data/shaders/ApplicationDemo/test2.frag.spv", SHADER_STAGE_FRAGMENT);
+	// the variants the materials use are listed in the manifest, compiled at startup rather than on the first draw
+	m_fragmentShaders.Create("../../data/shaders/ApplicationDemo/test.frag", SHADER_STAGE_FRAGMENT, { "VERTEX_COLOR" });
+	result &= m_fragmentShaders.PrewarmFromManifest(m_rendererVK.GetDevice(), "../../data/shaders/ApplicationDemo/variants.txt");
 
 	assert(result);
 
@@ -121,12 +212,12 @@ bool ApplicationDemo::CreateGraphicsPipelines()
 	GraphicsPipelineDesc desc;
 	desc.m_vertexFormat = &m_vertexFormat;
 	desc.m_frameBuffer = m_rendererVK.GetCurrentBackBuffer();
-	desc.m_shaders = { m_vertexShader, m_fragmentShader };
+	desc.m_shaders = { m_vertexShader, *m_fragmentShaders.GetVariant(m_rendererVK.GetDevice(), 0) };
 	desc.m_cullMode = CULL_MODE_BACK;
 
 	m_graphicsPipeline.Create(m_rendererVK.GetDevice(), desc);
 
-	desc.m_shaders = { m_vertexShader, m_fragmentShader2 };
+	desc.m_shaders = { m_vertexShader, *m_fragmentShaders.GetVariant(m_rendererVK.GetDevice(), m_fragmentShaders.GetMask({ "VERTEX_COLOR" })) };
 
 	m_testGraphicsPipeline2.Create(m_rendererVK.GetDevice(), desc);
 
@@ -154,12 +245,44 @@ void ApplicationDemo::CreateTestVertexAndTriangleBuffers()
 	m_vertexFormat.AddAttribute(VertexAttributeVK(2, VK_FORMAT_R32G32_SFLOAT, offsetof(Vertex, m_texcoord), sizeof(Vertex::m_texcoord)));
 }
 
+void ApplicationDemo::CreateScene()
+{
+	m_renderQueue.Create(m_rendererVK.GetDevice(), s_gridSize * s_gridSize);
+
+	m_cubeMesh.m_vertexBuffer = &m_testVertexBuffer;
+	m_cubeMesh.m_indexBuffer = &m_testIndexBuffer;
+	m_cubeMesh.m_indexCount = m_testIndexBuffer.GetNumIndices();
+
+	// every pipeline with every texture
+	PipelineVK* pipelines[] = { &m_graphicsPipeline, &m_testGraphicsPipeline2 };
+	TextureVK* textures[] = { &m_testTexture, &m_testTexture2 };
+
+	for (uint32_t i = 0; i < s_numMaterials; ++i)
+	{
+		m_materials[i].m_pipeline = pipelines[i / 2];
+		m_materials[i].m_textures = { textures[i % 2] };
+	}
+
+	const float spacing = 1.5f;
+
+	m_objects.resize(s_gridSize * s_gridSize);
+
+	for (uint32_t y = 0; y < s_gridSize; ++y)
+	{
+		for (uint32_t x = 0; x < s_gridSize; ++x)
+		{
+			Object& object = m_objects[y * s_gridSize + x];
+
+			object.m_position = glm::vec3(x - s_gridSize * 0.5f, y - s_gridSize * 0.5f, 0.0f) * spacing;
+			object.m_material = (x * 7 + y * 3) % s_numMaterials;
+		}
+	}
+}
+
 void ApplicationDemo::DestroyShaders()
 {
 	m_vertexShader.Destroy(m_rendererVK.GetDevice());
-	m_fragmentShader.Destroy(m_rendererVK.GetDevice());
-
-	m_fragmentShader2.Destroy(m_rendererVK.GetDevice());
+	m_fragmentShaders.Destroy(m_rendererVK.GetDevice());
 }
 
 void ApplicationDemo::DestroyGraphicsPipelines()
@@ -175,6 +298,13 @@ void ApplicationDemo::DestroyTestVertexAndTriangleBuffers()
 	m_testIndexBuffer.Destroy(m_rendererVK.GetDevice());
 }
 
+void ApplicationDemo::DestroyScene()
+{
+	m_renderQueue.Destroy(m_rendererVK.GetDevice());
+
+	m_objects.clear();
+}
+
 void ApplicationDemo::DestroyTextures()
 {
 	m_testTexture.Destroy(m_rendererVK.GetDevice());
@@ -12,12 +12,15 @@ class ApplicationDemo : public Application
 	void OnResize();
 	void OnUpdate(double dt);
 	void OnDraw();
+	void OnShadersReloaded();
 
 	void CreateTextures();
 	void CreateTestVertexAndTriangleBuffers();
+	void CreateScene();
 
 	void DestroyTextures();
 	void DestroyTestVertexAndTriangleBuffers();
+	void DestroyScene();
 
 	bool CreateShaders();
 	bool CreateGraphicsPipelines();
@@ -26,9 +29,8 @@ class ApplicationDemo : public Application
 	void DestroyGraphicsPipelines();
 
 	ShaderVK m_vertexShader;
-	ShaderVK m_fragmentShader;
-
-	ShaderVK m_fragmentShader2;
+	// textured, VERTEX_COLOR modulates by the vertex color
+	ShaderPermutationsVK m_fragmentShaders;
 
 	GraphicsPipelineVK m_graphicsPipeline;
 	GraphicsPipelineVK m_testGraphicsPipeline2;
@@ -83,18 +85,49 @@ class ApplicationDemo : public Application
 	VertexBufferVK m_testVertexBuffer;
 	IndexBufferVK m_testIndexBuffer;
 
-	// TODO: make sure of alignment requirements
-	struct UBOTest
+	TextureVK m_testTexture;
+	TextureVK m_testTexture2;
+
+	// grid of cubes drawn through the render queue, with the materials interleaved in submission order
+
+	static const uint32_t s_gridSize = 32;
+	static const uint32_t s_numMaterials = 4;
+
+	MeshVK m_cubeMesh;
+	MaterialVK m_materials[s_numMaterials];
+
+	struct Object
 	{
-		glm::mat4 m_mvpTransform;
-		glm::vec4 m_testColor;
+		glm::vec3 m_position;
+		uint32_t m_material;
 	};
 
-	UBOTest m_uboTest = { glm::mat4(), {1, 0, 1, 1} };
-	UBOTest m_uboTest2 = { glm::mat4(), {1, 0, 1, 1} };
-
-	TextureVK m_testTexture;
-	TextureVK m_testTexture2;
+	std::vector<Object> m_objects;
+
+	RenderQueueVK m_renderQueue;
+
+	glm::mat4 m_view;
+	glm::mat4 m_viewProj;
+
+	bool m_instancingKeyPressed = false;
+	bool m_filteringKeyPressed = false;
+	bool m_stateFiltering = true;
+	bool m_cacheKeyPressed = false;
+	ContextVK::DescriptorSetCacheMode m_descriptorSetCacheMode = ContextVK::DESCRIPTOR_SET_CACHE_FRAME;
+	bool m_updateModeKeyPressed = false;
+	ContextVK::DescriptorUpdateMode m_descriptorUpdateMode = ContextVK::DESCRIPTOR_UPDATE_TEMPLATE;
+
+	// CPU cost of recording the render queue draws, accumulated between stats prints
+	double m_statsTimer = 0.0;
+	double m_recordTime = 0.0;
+	uint32_t m_numRecordedDraws = 0;
+	uint32_t m_numRecordedFrames = 0;
+	ContextStatsVK m_contextStats;
+	DescriptorAllocatorStatsVK m_descriptorAllocatorStats;
+	uint32_t m_descriptorSetCacheHits = 0;
+	uint32_t m_descriptorSetCacheMisses = 0;
+	uint32_t m_descriptorSetUpdates = 0;
+	double m_descriptorUpdateTime = 0.0;
 };
 
 }
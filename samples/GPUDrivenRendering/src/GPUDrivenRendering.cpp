@@ -0,0 +1,451 @@
+#include "GPUDrivenRendering.h"
+
+#include <iostream>
+
+namespace MBRF
+{
+
+// planes from the rows of the view projection matrix, normals pointing inside. Vulkan depth range is [0, 1]
+static void ExtractFrustumPlanes(const glm::mat4& viewProj, glm::vec4 planes[6])
+{
+	glm::vec4 rows[4];
+
+	for (int i = 0; i < 4; ++i)
+		rows[i] = glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]);
+
+	planes[0] = rows[3] + rows[0]; // left
+	planes[1] = rows[3] - rows[0]; // right
+	planes[2] = rows[3] + rows[1]; // bottom
+	planes[3] = rows[3] - rows[1]; // top
+	planes[4] = rows[2];           // near
+	planes[5] = rows[3] - rows[2]; // far
+
+	for (int i = 0; i < 6; ++i)
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
+void GPUDrivenRendering::OnInit()
+{
+	m_bindless = m_rendererVK.GetDevice()->IsBindlessEnabled();
+
+	std::cout << (m_bindless ? "Bindless materials" : "Bindless not supported, drawing untextured objects") << std::endl;
+
+	CreateObjects();
+	CreateMaterials();
+	CreateTestVertexAndTriangleBuffers();
+
+	CreateShaders();
+
+	CreateGraphicsPipelines();
+
+	DeviceVK* device = m_rendererVK.GetDevice();
+
+	// the vertex shader fetches the object data with the firstInstance of each draw
+	if (!device->GetEnabledFeatures().drawIndirectFirstInstance)
+		std::cout << "drawIndirectFirstInstance not supported, GPU driven path won't render correctly" << std::endl;
+
+	if (!device->SupportsDrawIndirectCount())
+		std::cout << "VK_KHR_draw_indirect_count not supported, drawing all the indirect commands" << std::endl;
+}
+
+void GPUDrivenRendering::OnCleanup()
+{
+	DestroyGraphicsPipelines();
+	DestroyShaders();
+
+	DestroyTestVertexAndTriangleBuffers();
+	DestroyMaterials();
+	DestroyObjects();
+}
+
+void GPUDrivenRendering::OnResize()
+{
+	// viewport and scissor are dynamic: the pipelines don't depend on the back buffer size
+}
+
+void GPUDrivenRendering::OnUpdate(double dt)
+{
+	// toggle GPU/CPU driven rendering
+	bool keyPressed = (glfwGetKey(m_window, GLFW_KEY_G) == GLFW_PRESS);
+
+	if (keyPressed && !m_toggleKeyPressed)
+	{
+		m_gpuDriven = !m_gpuDriven;
+		m_statsTimer = 0.0;
+		m_drawTime = 0.0;
+		m_numDrawnFrames = 0;
+	}
+
+	m_toggleKeyPressed = keyPressed;
+
+	// camera in the middle of the grid, looking around
+	m_cameraRotation += (float)dt * 0.2f;
+
+	FrameBufferVK* backBuffer = m_rendererVK.GetCurrentBackBuffer();
+
+	glm::vec3 eye = glm::vec3(0.0f, 0.0f, 0.0f);
+	glm::vec3 target = glm::vec3(cos(m_cameraRotation), sin(m_cameraRotation), 0.2f);
+
+	glm::mat4 view = glm::lookAt(eye, target, glm::vec3(0.0f, 0.0f, 1.0f));
+	glm::mat4 proj = glm::perspective(glm::radians(60.0f), backBuffer->GetWidth() / float(backBuffer->GetHeight()), 0.1f, 300.0f);
+
+	// Vulkan clip space has inverted Y and half Z.
+	glm::mat4 clip = glm::mat4(1.0f, 0.0f, 0.0f, 0.0f,
+		0.0f, -1.0f, 0.0f, 0.0f,
+		0.0f, 0.0f, 0.5f, 0.0f,
+		0.0f, 0.0f, 0.5f, 1.0f);
+
+	m_viewProj = clip * proj * view;
+
+	ExtractFrustumPlanes(m_viewProj, m_frustumPlanes);
+
+	// stats
+
+	m_statsTimer += dt;
+
+	if (m_statsTimer >= 1.0 && m_numDrawnFrames > 0)
+	{
+		std::cout << (m_gpuDriven ? "GPU driven" : "CPU driven") << ": " << (m_drawTime / m_numDrawnFrames) << " ms CPU per frame";
+
+		if (!m_gpuDriven)
+			std::cout << ", " << m_numCPUDraws << " draws";
+
+		std::cout << std::endl;
+
+		m_statsTimer = 0.0;
+		m_drawTime = 0.0;
+		m_numDrawnFrames = 0;
+	}
+}
+
+void GPUDrivenRendering::OnDraw()
+{
+	using namespace std::chrono;
+
+	auto drawStart = steady_clock::now();
+
+	ContextVK* context = m_rendererVK.GetDevice()->GetCurrentGraphicsContext();
+	FrameBufferVK* currentRenderTarget = m_rendererVK.GetCurrentBackBuffer();
+
+	if (m_gpuDriven)
+		DrawGPUDriven(context, currentRenderTarget);
+	else
+		DrawCPUDriven(context, currentRenderTarget);
+
+	m_drawTime += duration<double, milliseconds::period>(steady_clock::now() - drawStart).count();
+	m_numDrawnFrames++;
+}
+
+// 2 passes:
+// - culling compute pass, writing the draw commands of the visible objects and their count
+// - a single indirect draw call for the whole scene
+
+void GPUDrivenRendering::DrawGPUDriven(ContextVK* context, FrameBufferVK* renderTarget)
+{
+	DeviceVK* device = m_rendererVK.GetDevice();
+
+	// Culling Pass
+
+	// the previous frame might still be drawing with the buffers
+	context->BufferBarrier(&m_drawCommandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	context->BufferBarrier(&m_drawCountBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+	context->FillBuffer(&m_drawCountBuffer, 0, sizeof(uint32_t), 0);
+
+	// without draw indirect count all the commands are drawn, the culled ones need to be empty
+	if (!device->SupportsDrawIndirectCount())
+		context->FillBuffer(&m_drawCommandBuffer, 0, VK_WHOLE_SIZE, 0);
+
+	context->BufferBarrier(&m_drawCountBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	context->BufferBarrier(&m_drawCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+	context->SetPipeline(&m_cullPipeline);
+
+	struct CullConsts
+	{
+		glm::vec4 frustumPlanes[6];
+		uint32_t numObjects;
+		uint32_t indexCount;
+	} cullConsts;
+
+	for (int i = 0; i < 6; ++i)
+		cullConsts.frustumPlanes[i] = m_frustumPlanes[i];
+
+	cullConsts.numObjects = s_numObjects;
+	cullConsts.indexCount = m_cubeIndexBuffer.GetNumIndices();
+
+	context->SetUniformBuffer(&cullConsts, sizeof(CullConsts), 0, PASS_SET);
+	context->SetStorageBuffer(&m_objectBuffer, 0, PASS_SET);
+	context->SetStorageBuffer(&m_drawCommandBuffer, 1, PASS_SET);
+	context->SetStorageBuffer(&m_drawCountBuffer, 2, PASS_SET);
+
+	context->CommitBindings(device);
+
+	uint32_t threadGroupSize = m_cullPipeline.GetWorkgroupSize()[0];
+	context->Dispatch((s_numObjects + threadGroupSize - 1) / threadGroupSize, 1, 1);
+
+	context->BufferBarrier(&m_drawCommandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+	context->BufferBarrier(&m_drawCountBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+
+	// Draw scene
+
+	context->BeginPass(renderTarget);
+
+	context->ClearRenderTarget(0, 0, renderTarget->GetWidth(), renderTarget->GetHeight(), { 0.3f, 0.3f, 0.3f, 1.0f }, { 1.0f, 0 });
+
+	context->SetPipeline(&m_scenePipeline);
+
+	context->SetVertexBuffer(&m_cubeVertexBuffer, 0);
+	context->SetIndexBuffer(&m_cubeIndexBuffer, 0);
+
+	SetSceneBindings(device, context);
+
+	context->DrawIndexedIndirectCount(device, &m_drawCommandBuffer, 0, &m_drawCountBuffer, 0, s_numObjects);
+
+	context->EndPass();
+}
+
+void GPUDrivenRendering::DrawCPUDriven(ContextVK* context, FrameBufferVK* renderTarget)
+{
+	DeviceVK* device = m_rendererVK.GetDevice();
+
+	context->BeginPass(renderTarget);
+
+	context->ClearRenderTarget(0, 0, renderTarget->GetWidth(), renderTarget->GetHeight(), { 0.3f, 0.3f, 0.3f, 1.0f }, { 1.0f, 0 });
+
+	context->SetPipeline(&m_scenePipeline);
+
+	context->SetVertexBuffer(&m_cubeVertexBuffer, 0);
+	context->SetIndexBuffer(&m_cubeIndexBuffer, 0);
+
+	SetSceneBindings(device, context);
+
+	m_numCPUDraws = 0;
+
+	for (uint32_t objectIndex = 0; objectIndex < s_numObjects; ++objectIndex)
+	{
+		const glm::vec4& sphere = m_objects[objectIndex].m_positionRadius;
+
+		bool visible = true;
+
+		for (int i = 0; i < 6 && visible; ++i)
+			visible = (glm::dot(glm::vec3(m_frustumPlanes[i]), glm::vec3(sphere)) + m_frustumPlanes[i].w >= -sphere.w);
+
+		if (!visible)
+			continue;
+
+		context->DrawIndexed(m_cubeIndexBuffer.GetNumIndices(), 1, 0, 0, objectIndex);
+		m_numCPUDraws++;
+	}
+
+	context->EndPass();
+}
+
+// the bindless shaders find the object and material buffers through the push constants, only the frame constants go through the descriptor set
+void GPUDrivenRendering::SetSceneBindings(DeviceVK* device, ContextVK* context)
+{
+	context->SetUniformBuffer(&m_viewProj, sizeof(glm::mat4), 0, PASS_SET);
+
+	if (m_bindless)
+	{
+		BindlessConstants constants;
+		constants.m_objectBufferIndex = m_objectBuffer.GetBindlessIndex();
+		constants.m_materialBufferIndex = m_materialBuffer.GetBindlessIndex();
+		constants.m_samplerIndex = m_textures[0].GetBindlessSamplerIndex();
+		constants.m_unused = 0;
+
+		context->SetPushConstants(&constants, sizeof(BindlessConstants));
+	}
+	else
+	{
+		context->SetStorageBuffer(&m_objectBuffer, 0, PASS_SET);
+	}
+
+	context->CommitBindings(device);
+}
+
+void GPUDrivenRendering::CreateObjects()
+{
+	DeviceVK* device = m_rendererVK.GetDevice();
+
+	const float spacing = 3.0f;
+	const float radius = 0.5f * sqrt(3.0f);
+
+	m_objects.resize(s_numObjects);
+
+	for (uint32_t z = 0; z < s_gridLayers; ++z)
+	{
+		for (uint32_t y = 0; y < s_gridSize; ++y)
+		{
+			for (uint32_t x = 0; x < s_gridSize; ++x)
+			{
+				ObjectData& object = m_objects[(z * s_gridSize + y) * s_gridSize + x];
+
+				glm::vec3 position = (glm::vec3(float(x), float(y), float(z)) - glm::vec3(float(s_gridSize), float(s_gridSize), float(s_gridLayers)) * 0.5f) * spacing;
+
+				object.m_positionRadius = glm::vec4(position, radius);
+				object.m_color = glm::vec4(x / float(s_gridSize), y / float(s_gridSize), z / float(s_gridLayers), 1.0f);
+			}
+		}
+	}
+
+	uint64_t size = sizeof(ObjectData) * s_numObjects;
+
+	m_objectBuffer.Create(device, size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	m_objectBuffer.Update(device, size, m_objects.data());
+
+	// written by the culling pass, read by the indirect draw
+
+	size = sizeof(VkDrawIndexedIndirectCommand) * s_numObjects;
+	m_drawCommandBuffer.Create(device, size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	size = sizeof(uint32_t);
+	m_drawCountBuffer.Create(device, size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+}
+
+void GPUDrivenRendering::CreateMaterials()
+{
+	if (!m_bindless)
+		return;
+
+	DeviceVK* device = m_rendererVK.GetDevice();
+
+	m_textures[0].LoadFromFile(device, "../../data/textures/test.jpg");
+	m_textures[1].LoadFromFile(device, "../../data/textures/test2.png");
+	m_textures[2].LoadFromFile(device, "../../data/textures/vignette.jpg");
+
+	std::vector<uint32_t> textureIndices(s_numObjects);
+
+	for (uint32_t i = 0; i < s_numObjects; ++i)
+		textureIndices[i] = m_textures[(i / 7) % s_numTextures].GetBindlessIndex();
+
+	uint64_t size = sizeof(uint32_t) * s_numObjects;
+
+	m_materialBuffer.Create(device, size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	m_materialBuffer.Update(device, size, textureIndices.data());
+}
+
+bool GPUDrivenRendering::CreateShaders()
+{
+	bool result = true;
+
+	// TODO: put common data/shader dir path in a variable or define
+	result &= m_sceneVertexShader.CreateFromFile(m_rendererVK.GetDevice(), "../../data/shaders/GPUDrivenRendering/scene.vert.spv", SHADER_STAGE_VERTEX);
+	result &= m_sceneFragmentShader.CreateFromFile(m_rendererVK.GetDevice(), "../../data/shaders/GPUDrivenRendering/scene.frag.spv", SHADER_STAGE_FRAGMENT);
+
+	result &= m_cullShader.CreateFromFile(m_rendererVK.GetDevice(), "../../data/shaders/GPUDrivenRendering/cull.comp.spv", SHADER_STAGE_COMPUTE);
+
+	if (m_bindless)
+	{
+		result &= m_sceneBindlessVertexShader.CreateFromFile(m_rendererVK.GetDevice(), "../../data/shaders/GPUDrivenRendering/scene_bindless.vert.spv", SHADER_STAGE_VERTEX);
+		result &= m_sceneBindlessFragmentShader.CreateFromFile(m_rendererVK.GetDevice(), "../../data/shaders/GPUDrivenRendering/scene_bindless.frag.spv", SHADER_STAGE_FRAGMENT);
+	}
+
+	assert(result);
+
+	return result;
+}
+
+bool GPUDrivenRendering::CreateGraphicsPipelines()
+{
+	// SCENE
+
+	GraphicsPipelineDesc desc;
+
+	desc.m_vertexFormat = &m_vertexFormat;
+	desc.m_frameBuffer = m_rendererVK.GetCurrentBackBuffer();
+	if (m_bindless)
+		desc.m_shaders = { m_sceneBindlessVertexShader, m_sceneBindlessFragmentShader };
+	else
+		desc.m_shaders = { m_sceneVertexShader, m_sceneFragmentShader };
+	desc.m_cullMode = CULL_MODE_NONE;
+
+	m_scenePipeline.Create(m_rendererVK.GetDevice(), desc);
+
+	// CULLING
+
+	m_cullPipeline.Create(m_rendererVK.GetDevice(), &m_cullShader);
+
+	return true;
+}
+
+void GPUDrivenRendering::CreateTestVertexAndTriangleBuffers()
+{
+	// vertex buffer
+
+	uint32_t size = sizeof(m_cubeVerts);
+
+	m_cubeVertexBuffer.Create(m_rendererVK.GetDevice(), size, m_cubeVerts);
+
+	// index buffer
+
+	size = sizeof(m_cubeIndices);
+
+	m_cubeIndexBuffer.Create(m_rendererVK.GetDevice(), size, size / sizeof(uint32_t), false, m_cubeIndices);
+
+	// vertex format
+
+	m_vertexFormat.AddAttribute(VertexAttributeVK(0, VK_FORMAT_R32G32B32_SFLOAT, 0, sizeof(glm::vec3)));
+}
+
+void GPUDrivenRendering::DestroyShaders()
+{
+	m_sceneVertexShader.Destroy(m_rendererVK.GetDevice());
+	m_sceneFragmentShader.Destroy(m_rendererVK.GetDevice());
+
+	m_cullShader.Destroy(m_rendererVK.GetDevice());
+
+	if (m_bindless)
+	{
+		m_sceneBindlessVertexShader.Destroy(m_rendererVK.GetDevice());
+		m_sceneBindlessFragmentShader.Destroy(m_rendererVK.GetDevice());
+	}
+}
+
+void GPUDrivenRendering::DestroyGraphicsPipelines()
+{
+	m_scenePipeline.Destroy(m_rendererVK.GetDevice());
+
+	m_cullPipeline.Destroy(m_rendererVK.GetDevice());
+}
+
+void GPUDrivenRendering::DestroyTestVertexAndTriangleBuffers()
+{
+	m_cubeVertexBuffer.Destroy(m_rendererVK.GetDevice());
+	m_cubeIndexBuffer.Destroy(m_rendererVK.GetDevice());
+}
+
+void GPUDrivenRendering::DestroyObjects()
+{
+	m_objectBuffer.Destroy(m_rendererVK.GetDevice());
+	m_drawCommandBuffer.Destroy(m_rendererVK.GetDevice());
+	m_drawCountBuffer.Destroy(m_rendererVK.GetDevice());
+}
+
+void GPUDrivenRendering::DestroyMaterials()
+{
+	if (!m_bindless)
+		return;
+
+	for (uint32_t i = 0; i < s_numTextures; ++i)
+		m_textures[i].Destroy(m_rendererVK.GetDevice());
+
+	m_materialBuffer.Destroy(m_rendererVK.GetDevice());
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	MBRF::GPUDrivenRendering app;
+
+	app.ParseCommandLineArguments(argc, argv);
+
+	app.Run();
+
+	return 0;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "application.h"
+
+namespace MBRF
+{
+
+// 100k cubes, frustum culled and drawn either:
+// - GPU driven: culling compute pass writing indirect draws + count, drawn with a single DrawIndexedIndirectCount
+// - CPU driven: culling on the CPU and one DrawIndexed per visible object
+// Press G to switch between the two, the CPU time spent recording the frame is printed every second
+// With bindless support the objects are also textured: each object picks its texture by bindless index from a material buffer, so the single
+// indirect draw still covers all the materials. The per draw bindings reduce to a push constant of buffer indices
+
+class GPUDrivenRendering : public Application
+{
+	void OnInit();
+	void OnCleanup();
+	void OnResize();
+	void OnUpdate(double dt);
+	void OnDraw();
+
+	void CreateObjects();
+	void CreateTestVertexAndTriangleBuffers();
+
+	void DestroyObjects();
+
+	void CreateMaterials();
+	void DestroyMaterials();
+	void DestroyTestVertexAndTriangleBuffers();
+
+	bool CreateShaders();
+	bool CreateGraphicsPipelines();
+
+	void DestroyShaders();
+	void DestroyGraphicsPipelines();
+
+	void DrawGPUDriven(ContextVK* context, FrameBufferVK* renderTarget);
+	void DrawCPUDriven(ContextVK* context, FrameBufferVK* renderTarget);
+	void SetSceneBindings(DeviceVK* device, ContextVK* context);
+
+	ShaderVK m_sceneVertexShader;
+	ShaderVK m_sceneFragmentShader;
+	ShaderVK m_cullShader;
+
+	ShaderVK m_sceneBindlessVertexShader;
+	ShaderVK m_sceneBindlessFragmentShader;
+
+	GraphicsPipelineVK m_scenePipeline;
+	ComputePipelineVK m_cullPipeline;
+
+	glm::vec3 m_cubeVerts[8] =
+	{
+		{-0.5, -0.5,  0.5},
+		{ 0.5, -0.5,  0.5},
+		{ 0.5,  0.5,  0.5},
+		{-0.5,  0.5,  0.5},
+		{-0.5, -0.5, -0.5},
+		{ 0.5, -0.5, -0.5},
+		{ 0.5,  0.5, -0.5},
+		{-0.5,  0.5, -0.5}
+	};
+
+	uint32_t m_cubeIndices[36] =
+	{
+		0, 1, 2, 2, 3, 0,
+		1, 5, 6, 6, 2, 1,
+		7, 6, 5, 5, 4, 7,
+		4, 0, 3, 3, 7, 4,
+		4, 5, 1, 1, 0, 4,
+		3, 2, 6, 6, 7, 3
+	};
+
+	VertexFormatVK m_vertexFormat;
+
+	VertexBufferVK m_cubeVertexBuffer;
+	IndexBufferVK m_cubeIndexBuffer;
+
+	// matches ObjectData in the shaders (std430)
+	struct ObjectData
+	{
+		glm::vec4 m_positionRadius;
+		glm::vec4 m_color;
+	};
+
+	static const uint32_t s_gridSize = 50;
+	static const uint32_t s_gridLayers = 40;
+	static const uint32_t s_numObjects = s_gridSize * s_gridSize * s_gridLayers;
+
+	std::vector<ObjectData> m_objects;
+
+	BufferVK m_objectBuffer;
+	BufferVK m_drawCommandBuffer;
+	BufferVK m_drawCountBuffer;
+
+	// bindless only: the textures, and the bindless texture index of each object
+	static const uint32_t s_numTextures = 3;
+
+	TextureVK m_textures[s_numTextures];
+	BufferVK m_materialBuffer;
+
+	// matches the bindless.h push constants
+	struct BindlessConstants
+	{
+		uint32_t m_objectBufferIndex;
+		uint32_t m_materialBufferIndex;
+		uint32_t m_samplerIndex;
+		uint32_t m_unused;
+	};
+
+	bool m_bindless = false;
+
+	glm::mat4 m_viewProj;
+	glm::vec4 m_frustumPlanes[6];
+
+	float m_cameraRotation = 0.0f;
+
+	bool m_gpuDriven = true;
+	bool m_toggleKeyPressed = false;
+
+	// CPU recording time stats
+	double m_statsTimer = 0.0;
+	double m_drawTime = 0.0;
+	uint32_t m_numDrawnFrames = 0;
+	uint32_t m_numCPUDraws = 0;
+};
+
+}
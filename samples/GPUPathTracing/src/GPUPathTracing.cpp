@@ -1,5 +1,7 @@
 #include "GPUPathTracing.h"
 
+#include <iostream>
+
 namespace MBRF
 {
 
@@ -11,8 +13,11 @@ void GPUPathTracing::OnInit()
 	CreateShaders();
 
 	CreateGraphicsPipelines();
+	UpdatePathTracingConstants();
 
 	m_cubemap.LoadFromKTXFile(m_rendererVK.GetDevice(), "../../data/textures/cubemap_yokohama_bc3_unorm.ktx", VK_FORMAT_BC3_SRGB_BLOCK);
+	// the cubemap is only sampled by the path tracer
+	m_cubemap.TransferOwnershipAndSubmit(m_rendererVK.GetDevice(), ContextVK::CONTEXT_TYPE_GRAPHICS, ContextVK::CONTEXT_TYPE_COMPUTE, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 }
 
 void GPUPathTracing::OnCleanup()
@@ -31,55 +36,126 @@ void GPUPathTracing::OnResize()
 	DestroyRenderTargets();
 	CreateRenderTargets();
 
-	DestroyGraphicsPipelines();
-	CreateGraphicsPipelines();
-
 	m_numFrames = 0;
+	m_accumulationStart = 0;
 }
 
 void GPUPathTracing::OnUpdate(double dt)
 {
+	static const int bounceCounts[] = { 1, 2, 4, 8 };
+
+	bool bouncesKeyPressed = (glfwGetKey(m_window, GLFW_KEY_B) == GLFW_PRESS);
+	bool specializeKeyPressed = (glfwGetKey(m_window, GLFW_KEY_S) == GLFW_PRESS);
+
+	if (bouncesKeyPressed && !m_bouncesKeyPressed)
+	{
+		int index = 0;
+
+		while (bounceCounts[index] != m_numBounces)
+			index++;
+
+		m_numBounces = bounceCounts[(index + 1) % 4];
+		UpdatePathTracingConstants();
+	}
 
+	if (specializeKeyPressed && !m_specializeKeyPressed)
+	{
+		m_specializeBounces = !m_specializeBounces;
+		UpdatePathTracingConstants();
+	}
+
+	m_bouncesKeyPressed = bouncesKeyPressed;
+	m_specializeKeyPressed = specializeKeyPressed;
+
+	m_statsTimer += dt;
+
+	if (m_statsTimer < 1.0)
+		return;
+
+	m_statsTimer = 0.0;
+
+	const AsyncComputeStatsVK& stats = m_rendererVK.GetDevice()->GetAsyncComputeStats();
+
+	std::cout << "Frame: " << stats.m_frameTime << " ms, Graphics: " << stats.m_graphicsTime << " ms, Compute: " << stats.m_computeTime << " ms, Overlap: at least " << stats.m_overlapTime << " ms";
+	std::cout << (m_rendererVK.GetDevice()->HasAsyncComputeQueue() ? "" : " (no async compute queue)");
+	std::cout << ". " << m_numBounces << " bounces, " << (m_specializeBounces ? "specialized" : "push constant") << std::endl;
+}
+
+void GPUPathTracing::UpdatePathTracingConstants()
+{
+	m_pathTracingConstants.SetUInt(PATH_TRACING_CONSTANT_WORKGROUP_SIZE_X, 16);
+	m_pathTracingConstants.SetUInt(PATH_TRACING_CONSTANT_WORKGROUP_SIZE_Y, 16);
+	m_pathTracingConstants.SetBool(PATH_TRACING_CONSTANT_SPECIALIZE_BOUNCES, m_specializeBounces);
+	// the push constant one is used when not specialized: the pipeline doesn't change with the count then
+	m_pathTracingConstants.SetInt(PATH_TRACING_CONSTANT_NUM_BOUNCES, m_specializeBounces ? m_numBounces : 8);
+	m_pathTracingConstants.SetInt(PATH_TRACING_CONSTANT_NUM_RENDERS_PER_FRAME, 50);
+
+	m_accumulationStart = m_numFrames;
 }
 
 // 2 passes:
-// - Path Tracing compute pass
-// - render the result to a full screen quad
+// - Path Tracing compute pass, recorded on the async compute queue
+// - render the result of the previous frame's compute pass to a full screen quad
 
 void GPUPathTracing::OnDraw()
 {
 	// TODO: implement transitions batching!
 
-	ContextVK* context = m_rendererVK.GetDevice()->GetCurrentGraphicsContext();
+	DeviceVK* device = m_rendererVK.GetDevice();
+
+	ContextVK* context = device->GetCurrentGraphicsContext();
+	ContextVK* computeContext = device->GetCurrentComputeContext();
+
+	// compute writes one display target while graphics reads the one written last frame
+	TextureVK* computeOutput = &m_displayTargets[m_numFrames % 2];
+	TextureVK* displayTarget = &m_displayTargets[(m_numFrames + 1) % 2];
 
 	// Compute Pass: Path Tracing
 
-	context->TransitionImageLayout(m_rendererVK.GetDevice(), &m_computeTarget, VK_IMAGE_LAYOUT_GENERAL);
+	computeContext->AcquireOwnership(device, computeOutput);
 
-	context->SetPipeline(&m_computePipeline);
+	// GENERAL -> GENERAL also orders this dispatch after the previous frame's one
+	computeContext->TransitionImageLayout(device, &m_accumulationTarget, VK_IMAGE_LAYOUT_GENERAL);
+
+	if (computeOutput->GetCurrentLayout() != VK_IMAGE_LAYOUT_GENERAL)
+		computeContext->TransitionImageLayout(device, computeOutput, VK_IMAGE_LAYOUT_GENERAL);
+
+	// a new variant is compiled on first use
+	ComputePipelineVK* computePipeline = PipelineStateCache::GetComputePipeline(device, &m_computeShader, false, m_pathTracingConstants);
+
+	computeContext->SetPipeline(computePipeline);
 
 	struct ComputeConsts
 	{
 		glm::vec2 resolution;
 		int numFrame;
+		int numBounces;
 	} compConsts;
 
-	compConsts.numFrame = m_numFrames;
-	compConsts.resolution = glm::vec2(m_computeTarget.GetWidth(), m_computeTarget.GetHeight());
+	compConsts.numFrame = m_numFrames - m_accumulationStart;
+	compConsts.numBounces = m_numBounces;
+	compConsts.resolution = glm::vec2(m_accumulationTarget.GetWidth(), m_accumulationTarget.GetHeight());
+
+	computeContext->SetPushConstants(&compConsts, sizeof(ComputeConsts));
+	computeContext->SetStorageImage(&m_accumulationTarget, 0);
+	computeContext->SetStorageImage(computeOutput, 1);
+	computeContext->SetTexture(&m_cubemap, 0);
 
-	context->SetUniformBuffer(m_rendererVK.GetDevice(), &compConsts, sizeof(ComputeConsts), 0);
-	context->SetStorageImage(&m_computeTarget, 0);
-	context->SetTexture(&m_cubemap, 0);
+	computeContext->CommitBindings(device);
 
-	context->CommitBindings(m_rendererVK.GetDevice());
+	const uint32_t* threadGroupSize = computePipeline->GetWorkgroupSize();
+	uint32_t dispatchSizes[3] = { m_accumulationTarget.GetWidth() / threadGroupSize[0], m_accumulationTarget.GetHeight() / threadGroupSize[1], 1 };
+	computeContext->Dispatch(dispatchSizes[0], dispatchSizes[1], dispatchSizes[2]);
 
-	uint32_t threadGroupSize = 16;
-	uint32_t dispatchSizes[3] = { m_computeTarget.GetWidth() / threadGroupSize, m_computeTarget.GetHeight() / threadGroupSize, 1 };
-	context->Dispatch(dispatchSizes[0], dispatchSizes[1], dispatchSizes[2]);
+	computeContext->ReleaseOwnership(device, computeOutput, context->GetQueueFamily(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
 	// Draw fullscreen quad
 
-	context->TransitionImageLayout(m_rendererVK.GetDevice(), &m_computeTarget, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	// nothing to display until the first compute pass has completed
+	bool hasDisplayTarget = (m_numFrames > 0);
+
+	if (hasDisplayTarget)
+		context->AcquireOwnership(device, displayTarget);
 
 	FrameBufferVK* currentRenderTarget = m_rendererVK.GetCurrentBackBuffer();
 
@@ -87,19 +163,26 @@ void GPUPathTracing::OnDraw()
 
 	context->ClearRenderTarget(0, 0, currentRenderTarget->GetWidth(), currentRenderTarget->GetHeight(), { 0.3f, 0.3f, 0.3f, 1.0f }, { 1.0f, 0 });
 
-	context->SetPipeline(&m_postProcPipeline);
+	if (hasDisplayTarget)
+	{
+		context->SetPipeline(&m_postProcPipeline);
 
-	context->SetVertexBuffer(&m_quadVertexBuffer, 0);
-	context->SetIndexBuffer(&m_quadIndexBuffer, 0);
+		context->SetVertexBuffer(&m_quadVertexBuffer, 0);
+		context->SetIndexBuffer(&m_quadIndexBuffer, 0);
 
-	context->SetTexture(&m_computeTarget, 0);
+		context->SetTexture(displayTarget, 0);
 
-	context->CommitBindings(m_rendererVK.GetDevice());
+		context->CommitBindings(device);
 
-	context->DrawIndexed(m_quadIndexBuffer.GetNumIndices(), 1, 0, 0, 0);
+		context->DrawIndexed(m_quadIndexBuffer.GetNumIndices(), 1, 0, 0, 0);
+	}
 
 	context->EndPass();
 
+	// hand the display target back to compute, it will be written again next frame
+	if (hasDisplayTarget)
+		context->ReleaseOwnership(device, displayTarget, computeContext->GetQueueFamily(), VK_IMAGE_LAYOUT_GENERAL);
+
 	m_numFrames++;
 }
 
@@ -108,8 +191,11 @@ void GPUPathTracing::CreateRenderTargets()
 	uint32_t width = m_rendererVK.GetCurrentBackBuffer()->GetWidth();
 	uint32_t height = m_rendererVK.GetCurrentBackBuffer()->GetHeight();
 
-	m_computeTarget.Create(m_rendererVK.GetDevice(), VK_FORMAT_R32G32B32A32_SFLOAT, width, height, 1, 1, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
-	m_computeTarget.TransitionImageLayoutAndSubmit(m_rendererVK.GetDevice(), VK_IMAGE_LAYOUT_GENERAL);
+	// layouts are transitioned on the compute queue on first use
+	m_accumulationTarget.Create(m_rendererVK.GetDevice(), VK_FORMAT_R32G32B32A32_SFLOAT, width, height, 1, 1, VK_IMAGE_USAGE_STORAGE_BIT);
+
+	for (int i = 0; i < 2; ++i)
+		m_displayTargets[i].Create(m_rendererVK.GetDevice(), VK_FORMAT_R32G32B32A32_SFLOAT, width, height, 1, 1, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
 }
 
 bool GPUPathTracing::CreateShaders()
@@ -140,10 +226,6 @@ bool GPUPathTracing::CreateGraphicsPipelines()
 
 	m_postProcPipeline.Create(m_rendererVK.GetDevice(), desc);
 
-	// COMPUTE
-
-	m_computePipeline.Create(m_rendererVK.GetDevice(), &m_computeShader);
-
 	return true;
 }
 
@@ -178,8 +260,6 @@ void GPUPathTracing::DestroyShaders()
 void GPUPathTracing::DestroyGraphicsPipelines()
 {
 	m_postProcPipeline.Destroy(m_rendererVK.GetDevice());
-
-	m_computePipeline.Destroy(m_rendererVK.GetDevice());
 }
 
 void GPUPathTracing::DestroyTestVertexAndTriangleBuffers()
@@ -190,7 +270,10 @@ void GPUPathTracing::DestroyTestVertexAndTriangleBuffers()
 
 void GPUPathTracing::DestroyRenderTargets()
 {
-	m_computeTarget.Destroy(m_rendererVK.GetDevice());
+	m_accumulationTarget.Destroy(m_rendererVK.GetDevice());
+
+	for (int i = 0; i < 2; ++i)
+		m_displayTargets[i].Destroy(m_rendererVK.GetDevice());
 }
 
 }
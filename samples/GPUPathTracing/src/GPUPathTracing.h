@@ -25,6 +25,8 @@ class GPUPathTracing : public Application
 	void DestroyShaders();
 	void DestroyGraphicsPipelines();
 
+	void UpdatePathTracingConstants();
+
 	ShaderVK m_computeShader;
 
 	ShaderVK m_quadVertexShader;
@@ -32,7 +34,23 @@ class GPUPathTracing : public Application
 
 	GraphicsPipelineVK m_postProcPipeline;
 
-	ComputePipelineVK m_computePipeline;
+	// constant ids of pathTracing.comp. The pipeline of each variant comes from the PipelineStateCache
+	enum PathTracingConstant
+	{
+		PATH_TRACING_CONSTANT_WORKGROUP_SIZE_X,
+		PATH_TRACING_CONSTANT_WORKGROUP_SIZE_Y,
+		PATH_TRACING_CONSTANT_SPECIALIZE_BOUNCES,
+		PATH_TRACING_CONSTANT_NUM_BOUNCES,
+		PATH_TRACING_CONSTANT_NUM_RENDERS_PER_FRAME
+	};
+
+	SpecializationConstantsVK m_pathTracingConstants;
+
+	// B cycles the bounce count, S toggles between the specialized bounce count and the push constant one, to compare the compute times
+	int m_numBounces = 8;
+	bool m_specializeBounces = true;
+	bool m_bouncesKeyPressed = false;
+	bool m_specializeKeyPressed = false;
 
 	struct VertexPosUV
 	{
@@ -57,10 +75,16 @@ class GPUPathTracing : public Application
 	VertexBufferVK m_quadVertexBuffer;
 	IndexBufferVK m_quadIndexBuffer;
 
-	TextureVK m_computeTarget;
+	// the accumulation target never leaves the compute queue, the display targets ping-pong between the compute and graphics queues
+	TextureVK m_accumulationTarget;
+	TextureVK m_displayTargets[2];
 	TextureVK m_cubemap;
 
 	int m_numFrames = 0;
+	// frame the accumulation restarted at, when the constants changed
+	int m_accumulationStart = 0;
+
+	double m_statsTimer = 0.0;
 };
 
 }
@@ -9,12 +9,15 @@ void HelloTriangle::OnInit()
 
 	CreateShaders();
 
-	CreateGraphicsPipelines();
+	InitPipelineDesc();
+
+	m_staticPass.Create(m_rendererVK.GetDevice());
 }
 
 void HelloTriangle::OnCleanup()
 {
-	DestroyGraphicsPipelines();
+	m_staticPass.Destroy(m_rendererVK.GetDevice());
+
 	DestroyShaders();
 
 	DestroyTestVertexAndTriangleBuffers();
@@ -22,8 +25,8 @@ void HelloTriangle::OnCleanup()
 
 void HelloTriangle::OnResize()
 {
-	DestroyGraphicsPipelines();
-	CreateGraphicsPipelines();
+	// the recording has the viewport of the old size
+	m_staticPass.Invalidate();
 }
 
 void HelloTriangle::OnUpdate(double dt)
@@ -35,19 +38,32 @@ void HelloTriangle::OnDraw()
 {
 	FrameBufferVK* currentRenderTarget = m_rendererVK.GetCurrentBackBuffer();
 
-	ContextVK* context = m_rendererVK.GetDevice()->GetCurrentGraphicsContext();
+	DeviceVK* device = m_rendererVK.GetDevice();
+
+	ContextVK* context = device->GetCurrentGraphicsContext();
+
+	if (!m_staticPass.IsValid(currentRenderTarget))
+	{
+		ContextVK* staticContext = m_staticPass.BeginRecording(device, currentRenderTarget);
+
+		staticContext->ClearRenderTarget(0, 0, currentRenderTarget->GetWidth(), currentRenderTarget->GetHeight(), { 0.3f, 0.3f, 0.3f, 1.0f }, { 1.0f, 0 });
+
+		m_pipelineDesc.m_frameBuffer = currentRenderTarget;
+		// compiled in the background: the triangle appears once the pipeline is ready, the recording is stale then
+		staticContext->RequestPipeline(device, m_pipelineDesc);
 
-	context->BeginPass(currentRenderTarget);
+		staticContext->SetVertexBuffer(&m_testVertexBuffer, 0);
 
-	context->ClearRenderTarget(0, 0, currentRenderTarget->GetWidth(), currentRenderTarget->GetHeight(), { 0.3f, 0.3f, 0.3f, 1.0f }, { 1.0f, 0 });
+		staticContext->SetIndexBuffer(&m_testIndexBuffer, 0);
 
-	context->SetPipeline(&m_graphicsPipeline);
+		staticContext->DrawIndexed(m_testIndexBuffer.GetNumIndices(), 1, 0, 0, 0);
 
-	context->SetVertexBuffer(&m_testVertexBuffer, 0);
+		m_staticPass.EndRecording();
+	}
 
-	context->SetIndexBuffer(&m_testIndexBuffer, 0);
+	context->BeginPass(currentRenderTarget, true);
 
-	context->DrawIndexed(m_testIndexBuffer.GetNumIndices(), 1, 0, 0, 0);
+	m_staticPass.Execute(device, context);
 
 	context->EndPass();
 }
@@ -65,17 +81,12 @@ bool HelloTriangle::CreateShaders()
 	return result;
 }
 
-bool HelloTriangle::CreateGraphicsPipelines()
+void HelloTriangle::InitPipelineDesc()
 {
-	GraphicsPipelineDesc desc;
-	desc.m_vertexFormat = &m_vertexFormat;
-	desc.m_frameBuffer = m_rendererVK.GetCurrentBackBuffer();
-	desc.m_shaders = { m_vertexShader, m_fragmentShader };
-	desc.m_cullMode = CULL_MODE_NONE;
-
-	m_graphicsPipeline.Create(m_rendererVK.GetDevice(), desc);
-
-	return true;
+	// the frame buffer is set at recording, the back buffers all share the same render pass and size
+	m_pipelineDesc.m_vertexFormat = &m_vertexFormat;
+	m_pipelineDesc.m_shaders = { m_vertexShader, m_fragmentShader };
+	m_pipelineDesc.m_cullMode = CULL_MODE_NONE;
 }
 
 void HelloTriangle::CreateTestVertexAndTriangleBuffers()
@@ -104,11 +115,6 @@ void HelloTriangle::DestroyShaders()
 	m_fragmentShader.Destroy(m_rendererVK.GetDevice());
 }
 
-void HelloTriangle::DestroyGraphicsPipelines()
-{
-	m_graphicsPipeline.Destroy(m_rendererVK.GetDevice());
-}
-
 void HelloTriangle::DestroyTestVertexAndTriangleBuffers()
 {
 	m_testVertexBuffer.Destroy(m_rendererVK.GetDevice());
@@ -17,15 +17,15 @@ class HelloTriangle : public Application
 	void DestroyTestVertexAndTriangleBuffers();
 
 	bool CreateShaders();
-	bool CreateGraphicsPipelines();
+	void InitPipelineDesc();
 
 	void DestroyShaders();
-	void DestroyGraphicsPipelines();
 
 	ShaderVK m_vertexShader;
 	ShaderVK m_fragmentShader;
 
-	GraphicsPipelineVK m_graphicsPipeline;
+	// resolved through the PipelineStateCache, which owns the pipelines
+	GraphicsPipelineDesc m_pipelineDesc;
 
 	struct Vertex
 	{
@@ -46,6 +46,9 @@ class HelloTriangle : public Application
 
 	VertexBufferVK m_testVertexBuffer;
 	IndexBufferVK m_testIndexBuffer;
+
+	// the whole pass never changes: record it once and replay it every frame
+	StaticCommandBufferVK m_staticPass;
 };
 
 }
@@ -1,5 +1,7 @@
 #include "postProcessing.h"
 
+#include <iostream>
+
 namespace MBRF
 {
 
@@ -11,10 +13,14 @@ void PostProcessing::OnInit()
 	CreateShaders();
 
 	CreateGraphicsPipelines();
+
+	m_quadPass.Create(m_rendererVK.GetDevice());
 }
 
 void PostProcessing::OnCleanup()
 {
+	m_quadPass.Destroy(m_rendererVK.GetDevice());
+
 	DestroyGraphicsPipelines();
 	DestroyShaders();
 
@@ -27,13 +33,31 @@ void PostProcessing::OnResize()
 	DestroyRenderTargets();
 	CreateRenderTargets();
 
+	// the pipelines stay valid: the new offscreen frame buffer gets the same render pass from the RenderPassCache
+	m_quadPass.Invalidate();
+}
+
+void PostProcessing::OnShadersReloaded()
+{
+	// the pipelines may be in use by the frames in flight
+	m_rendererVK.WaitForDevice();
 
 	DestroyGraphicsPipelines();
 	CreateGraphicsPipelines();
+
+	m_quadPass.Invalidate();
 }
 
 void PostProcessing::OnUpdate(double dt)
 {
+	// toggle the blur between pooled descriptor sets and push descriptors
+	bool keyPressed = (glfwGetKey(m_window, GLFW_KEY_P) == GLFW_PRESS);
+
+	if (keyPressed && !m_pushDescriptorsKeyPressed)
+		m_pushDescriptors = !m_pushDescriptors;
+
+	m_pushDescriptorsKeyPressed = keyPressed;
+
 	m_cubeRotation += (float)dt;
 
 	FrameBufferVK* backBuffer = m_rendererVK.GetCurrentBackBuffer();
@@ -49,6 +73,27 @@ void PostProcessing::OnUpdate(double dt)
 		0.0f, 0.0f, 0.5f, 1.0f);
 
 	m_sceneUniforms.m_mvpTransform = clip * proj * view * model;
+
+	// stats
+
+	m_statsTimer += dt;
+
+	if (m_statsTimer >= 1.0)
+	{
+		if (m_numRecordedFrames > 0)
+		{
+			bool pushDescriptors = m_pushDescriptors && m_rendererVK.GetDevice()->SupportsPushDescriptors();
+
+			std::cout << "Blur " << (pushDescriptors ? "with push descriptors" : "with pooled sets") << ": " << (m_blurRecordTime * 1000.0 / m_numRecordedFrames) << " us CPU per frame, ";
+			std::cout << (double(m_descriptorSetsAllocated) / m_numRecordedFrames) << " sets allocated and " << (double(m_pushDescriptorSets) / m_numRecordedFrames) << " pushed per frame" << std::endl;
+		}
+
+		m_statsTimer = 0.0;
+		m_blurRecordTime = 0.0;
+		m_numRecordedFrames = 0;
+		m_descriptorSetsAllocated = 0;
+		m_pushDescriptorSets = 0;
+	}
 }
 
 // 3 passes:
@@ -76,7 +121,7 @@ void PostProcessing::OnDraw()
 
 	context->SetVertexBuffer(&m_cubeVertexBuffer, 0);
 	context->SetIndexBuffer(&m_cubeIndexBuffer, 0);
-	context->SetUniformBuffer(m_rendererVK.GetDevice(), &m_sceneUniforms, sizeof(SceneUniforms), 0);
+	context->SetPushConstants(&m_sceneUniforms, sizeof(SceneUniforms));
 	context->SetTexture(&m_sceneTexture, 0);
 
 	context->CommitBindings(m_rendererVK.GetDevice());
@@ -90,7 +135,12 @@ void PostProcessing::OnDraw()
 	context->TransitionImageLayout(m_rendererVK.GetDevice(), &m_renderTarget, VK_IMAGE_LAYOUT_GENERAL);
 	context->TransitionImageLayout(m_rendererVK.GetDevice(), &m_computeTarget, VK_IMAGE_LAYOUT_GENERAL);
 
-	context->SetPipeline(&m_computePipeline);
+	auto recordStart = std::chrono::steady_clock::now();
+	ContextStatsVK statsBefore = context->GetStats();
+
+	ComputePipelineVK* computePipeline = m_pushDescriptors ? &m_computePushPipeline : &m_computePipeline;
+
+	context->SetPipeline(computePipeline);
 
 	// Horizontal
 
@@ -102,21 +152,21 @@ void PostProcessing::OnDraw()
 	compConsts.horizontal = 1;
 
 
-	context->SetUniformBuffer(m_rendererVK.GetDevice(), &compConsts, sizeof(ComputeConsts), 0);
+	context->SetPushConstants(&compConsts, sizeof(ComputeConsts));
 	context->SetStorageImage(&m_renderTarget, 0);
 	context->SetStorageImage(&m_computeTarget, 1);
 
 	context->CommitBindings(m_rendererVK.GetDevice());
 
-	uint32_t threadGroupSize = 16;
-	uint32_t dispatchSizes[3] = { m_computeTarget.GetWidth() / threadGroupSize, m_computeTarget.GetHeight() / threadGroupSize, 1 };
+	const uint32_t* threadGroupSize = computePipeline->GetWorkgroupSize();
+	uint32_t dispatchSizes[3] = { m_computeTarget.GetWidth() / threadGroupSize[0], m_computeTarget.GetHeight() / threadGroupSize[1], 1 };
 	context->Dispatch(dispatchSizes[0], dispatchSizes[1], dispatchSizes[2]);
 
 	// Vertical
 
 	compConsts.horizontal = 0;
 
-	context->SetUniformBuffer(m_rendererVK.GetDevice(), &compConsts, sizeof(ComputeConsts), 0);
+	context->SetPushConstants(&compConsts, sizeof(ComputeConsts));
 	context->SetStorageImage(&m_computeTarget, 0);
 	context->SetStorageImage(&m_renderTarget, 1);
 
@@ -124,6 +174,11 @@ void PostProcessing::OnDraw()
 
 	context->Dispatch(dispatchSizes[0], dispatchSizes[1], dispatchSizes[2]);
 
+	m_blurRecordTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordStart).count();
+	m_descriptorSetsAllocated += context->GetStats().m_descriptorSetsAllocated - statsBefore.m_descriptorSetsAllocated;
+	m_pushDescriptorSets += context->GetStats().m_pushDescriptorSets - statsBefore.m_pushDescriptorSets;
+	m_numRecordedFrames++;
+
 	// Draw fullscreen quad
 
 	context->TransitionImageLayout(m_rendererVK.GetDevice(), &m_renderTarget, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
@@ -131,32 +186,43 @@ void PostProcessing::OnDraw()
 
 	currentRenderTarget = m_rendererVK.GetCurrentBackBuffer();
 
-	context->BeginPass(currentRenderTarget);
+	// recorded after the transitions above, so the descriptors get the right image layouts
+	if (!m_quadPass.IsValid(currentRenderTarget))
+	{
+		ContextVK* quadContext = m_quadPass.BeginRecording(m_rendererVK.GetDevice(), currentRenderTarget);
 
-	context->ClearRenderTarget(0, 0, currentRenderTarget->GetWidth(), currentRenderTarget->GetHeight(), { 0.3f, 0.3f, 0.3f, 1.0f }, { 1.0f, 0 });
+		quadContext->ClearRenderTarget(0, 0, currentRenderTarget->GetWidth(), currentRenderTarget->GetHeight(), { 0.3f, 0.3f, 0.3f, 1.0f }, { 1.0f, 0 });
 
-	context->SetPipeline(&m_postProcPipeline);
+		quadContext->SetPipeline(&m_postProcPipeline);
 
-	context->SetVertexBuffer(&m_quadVertexBuffer, 0);
-	context->SetIndexBuffer(&m_quadIndexBuffer, 0);
+		quadContext->SetVertexBuffer(&m_quadVertexBuffer, 0);
+		quadContext->SetIndexBuffer(&m_quadIndexBuffer, 0);
 
-	struct PostProcConsts
-	{
-		float nearPlane;
-		float farPlane;
-	}postProcConsts;
+		struct PostProcConsts
+		{
+			float nearPlane;
+			float farPlane;
+		}postProcConsts;
 
-	postProcConsts.nearPlane = m_nearPlane;
-	postProcConsts.farPlane = m_farPlane;
+		postProcConsts.nearPlane = m_nearPlane;
+		postProcConsts.farPlane = m_farPlane;
 
-	context->SetUniformBuffer(m_rendererVK.GetDevice(), &postProcConsts, sizeof(PostProcConsts), 0);
-	context->SetTexture(&m_renderTarget, 0);
-	context->SetTexture(&m_offscreenDepthStencil, 1);
-	context->SetTexture(&m_vignetteTexture, 2);
+		quadContext->SetPushConstants(&postProcConsts, sizeof(PostProcConsts));
+		// images only, the shader picks the immutable samplers
+		quadContext->SetSampledImage(&m_renderTarget, 0);
+		quadContext->SetSampledImage(&m_offscreenDepthStencil, 1);
+		quadContext->SetSampledImage(&m_vignetteTexture, 2);
 
-	context->CommitBindings(m_rendererVK.GetDevice());
+		quadContext->CommitBindings(m_rendererVK.GetDevice());
+
+		quadContext->DrawIndexed(m_quadIndexBuffer.GetNumIndices(), 1, 0, 0, 0);
 
-	context->DrawIndexed(m_quadIndexBuffer.GetNumIndices(), 1, 0, 0, 0);
+		m_quadPass.EndRecording();
+	}
+
+	context->BeginPass(currentRenderTarget, true);
+
+	m_quadPass.Execute(m_rendererVK.GetDevice(), context);
 
 	context->EndPass();
 }
@@ -193,13 +259,14 @@ bool PostProcessing::CreateShaders()
 	bool result = true;
 
 	// TODO: put common data/shader dir path in a variable or define
-	result &= m_offscreenVertexShader.CreateFromFile(m_rendererVK.GetDevice(), "../../data/shaders/PostProcessing/scene.vert.spv", SHADER_STAGE_VERTEX);
-	result &= m_offscreenFragmentShader.CreateFromFile(m_rendererVK.GetDevice(), "../../data/shaders/PostProcessing/scene.frag.spv", SHADER_STAGE_FRAGMENT);
+	// compiled at runtime when available, edit them while the sample runs
+	result &= m_offscreenVertexShader.CreateFromSource(m_rendererVK.GetDevice(), "../../data/shaders/PostProcessing/scene.vert", SHADER_STAGE_VERTEX);
+	result &= m_offscreenFragmentShader.CreateFromSource(m_rendererVK.GetDevice(), "../../data/shaders/PostProcessing/scene.frag", SHADER_STAGE_FRAGMENT);
 
-	result &= m_quadVertexShader.CreateFromFile(m_rendererVK.GetDevice(), "../../data/shaders/PostProcessing/quad.vert.spv", SHADER_STAGE_VERTEX);
-	result &= m_quadFragmentShader.CreateFromFile(m_rendererVK.GetDevice(), "../../data/shaders/PostProcessing/quad.frag.spv", SHADER_STAGE_FRAGMENT);
+	result &= m_quadVertexShader.CreateFromSource(m_rendererVK.GetDevice(), "../../data/shaders/PostProcessing/quad.vert", SHADER_STAGE_VERTEX);
+	result &= m_quadFragmentShader.CreateFromSource(m_rendererVK.GetDevice(), "../../data/shaders/PostProcessing/quad.frag", SHADER_STAGE_FRAGMENT);
 
-	result &= m_computeShader.CreateFromFile(m_rendererVK.GetDevice(), "../../data/shaders/PostProcessing/blur.comp.spv", SHADER_STAGE_COMPUTE);
+	result &= m_computeShader.CreateFromSource(m_rendererVK.GetDevice(), "../../data/shaders/PostProcessing/blur.comp", SHADER_STAGE_COMPUTE);
 
 	assert(result);
 
@@ -223,12 +290,19 @@ bool PostProcessing::CreateGraphicsPipelines()
 	desc.m_frameBuffer = m_rendererVK.GetCurrentBackBuffer();
 	desc.m_shaders = { m_quadVertexShader, m_quadFragmentShader };
 	desc.m_cullMode = CULL_MODE_NONE;
+	// a single draw with its own textures: nothing to gain from allocating a set
+	desc.m_pushDescriptors = true;
 
 	m_postProcPipeline.Create(m_rendererVK.GetDevice(), desc);
 
 	// COMPUTE
 
-	m_computePipeline.Create(m_rendererVK.GetDevice(), &m_computeShader);
+	// blur radius (constant_id 0 of blur.comp), in pixels
+	SpecializationConstantsVK blurConstants;
+	blurConstants.SetInt(0, 4);
+
+	m_computePipeline.Create(m_rendererVK.GetDevice(), &m_computeShader, false, blurConstants);
+	m_computePushPipeline.Create(m_rendererVK.GetDevice(), &m_computeShader, true, blurConstants);
 
 	return true;
 }
@@ -284,6 +358,7 @@ void PostProcessing::DestroyGraphicsPipelines()
 	m_postProcPipeline.Destroy(m_rendererVK.GetDevice());
 
 	m_computePipeline.Destroy(m_rendererVK.GetDevice());
+	m_computePushPipeline.Destroy(m_rendererVK.GetDevice());
 }
 
 void PostProcessing::DestroyTestVertexAndTriangleBuffers()
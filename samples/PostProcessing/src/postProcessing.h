@@ -12,6 +12,7 @@ class PostProcessing: public Application
 	void OnResize();
 	void OnUpdate(double dt);
 	void OnDraw();
+	void OnShadersReloaded();
 
 	void CreateTextures();
 	void CreateTestVertexAndTriangleBuffers();
@@ -40,6 +41,8 @@ class PostProcessing: public Application
 	GraphicsPipelineVK m_postProcPipeline;
 
 	ComputePipelineVK m_computePipeline;
+	// same, with push descriptors (when supported)
+	ComputePipelineVK m_computePushPipeline;
 
 	struct VertexPosUV
 	{
@@ -119,10 +122,22 @@ class PostProcessing: public Application
 
 	TextureVK m_computeTarget;
 
+	// the full screen quad pass only depends on the render targets: recorded again when they are recreated
+	StaticCommandBufferVK m_quadPass;
+
 	TextureVK m_sceneTexture;
 	TextureVK m_vignetteTexture;
 
 	FrameBufferVK m_offscreenFramebuffer;
+
+	// blur dispatches with pooled sets or push descriptors (P key), CPU cost of recording them accumulated between stats prints
+	bool m_pushDescriptorsKeyPressed = false;
+	bool m_pushDescriptors = true;
+	double m_statsTimer = 0.0;
+	double m_blurRecordTime = 0.0;
+	uint32_t m_numRecordedFrames = 0;
+	uint32_t m_descriptorSetsAllocated = 0;
+	uint32_t m_pushDescriptorSets = 0;
 };
 
 }
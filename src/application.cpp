@@ -1,5 +1,12 @@
 #include "application.h"
 
+#include "pipelineVK.h"
+#include "shaderCompilerVK.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
 const uint32_t s_windowWidth = 800;
 const uint32_t s_windowHeight = 600;
 
@@ -17,6 +24,8 @@ void Application::ParseCommandLineArguments(int argc, char **argv)
 
 		if (param == "-vulkan_validation")
 			m_enableVulkanValidation = true;
+		else if (param == "-frames_in_flight" && i + 1 < argc)
+			m_maxFramesInFlight = std::max(1, std::atoi(argv[++i]));
 	}
 }
 
@@ -25,17 +34,31 @@ void Application::Init()
 	int width, height;
 	glfwGetFramebufferSize(m_window, &width, &height);
 
-	m_rendererVK.Init(m_window, width, height, m_enableVulkanValidation);
+	auto startupStart = std::chrono::steady_clock::now();
+
+	m_rendererVK.Init(m_window, width, height, m_maxFramesInFlight, m_enableVulkanValidation);
 
 	m_lastFrameTime = std::chrono::steady_clock::now();
 
 	OnInit();
+
+	// cold (no pipeline cache file yet) vs warm startup: run the sample twice to compare
+	const PipelineCacheStatsVK& cacheStats = m_rendererVK.GetDevice()->GetPipelineCacheStats();
+	double startupTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startupStart).count();
+
+	std::cout << "Startup: " << startupTime << " ms, " << (cacheStats.m_loadedSize > 0 ? "warm" : "cold") << " pipeline cache. " << cacheStats.m_numPipelines << " pipelines in " <<
+		cacheStats.m_creationTime << " ms, " << cacheStats.m_cacheHits << " cache hits" << std::endl;
+
+	if (ShaderCompilerVK::IsAvailable())
+		std::cout << "Shaders: " << ShaderCompilerVK::GetNumCompilations() << " compiled, " << ShaderCompilerVK::GetNumCacheHits() << " from the SPIR-V cache" << std::endl;
 }
 
 void Application::Cleanup()
 {
 	m_rendererVK.WaitForDevice();
 
+	PipelineStateCache::PrintStats();
+
 	OnCleanup();
 
 	m_rendererVK.Cleanup();
@@ -53,6 +76,9 @@ void Application::Update()
 		
 	//m_rendererVK.Update(dt);
 
+	if (ShaderCompilerVK::Update(m_rendererVK.GetDevice()))
+		OnShadersReloaded();
+
 	OnUpdate(dt);
 }
 
@@ -5,7 +5,10 @@
 #include "bufferVK.h"
 #include "frameBufferVK.h"
 #include "pipelineVK.h"
+#include "renderQueueVK.h"
+#include "shaderPermutationsVK.h"
 #include "shaderVK.h"
+#include "staticCommandBufferVK.h"
 #include "textureVK.h"
 #include "vertexBufferVK.h"
 #include "vertexFormatVK.h"
@@ -39,10 +42,14 @@ protected:
 	virtual void OnResize() = 0;
 	virtual void OnUpdate(double dt) = 0;
 	virtual void OnDraw() = 0;
+	// shaders changed on disk and recompiled (see ShaderCompilerVK): the pipelines not coming from the PipelineStateCache have to be recreated
+	virtual void OnShadersReloaded() {};
 
 protected:
 	RendererVK m_rendererVK;
 	bool m_enableVulkanValidation = false;
+	// number of frames the CPU can record ahead of the GPU, independent from the swapchain image count
+	uint32_t m_maxFramesInFlight = 2;
 
 	GLFWwindow* m_window;
 
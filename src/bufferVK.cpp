@@ -3,12 +3,14 @@
 #include "deviceVK.h"
 #include "utilsVK.h"
 
+#include <iostream>
+
 namespace MBRF
 {
 
 // ------------------------------- BufferVK -------------------------------
 
-bool BufferVK::Create(DeviceVK* device, uint64_t size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryProperties)
+bool BufferVK::Create(DeviceVK* device, uint64_t size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryProperties, VkFormat texelFormat)
 {
 	assert(m_buffer == VK_NULL_HANDLE);
 
@@ -21,6 +23,24 @@ bool BufferVK::Create(DeviceVK* device, uint64_t size, VkBufferUsageFlags usage,
 	m_hasCpuAccess = memoryProperties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
 	m_hasCoherentMemory = memoryProperties & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
 
+	// before creating anything, so that nothing is left behind
+	if (m_usage & (VK_BUFFER_USAGE_UNIFORM_TEXEL_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT))
+	{
+		assert(texelFormat != VK_FORMAT_UNDEFINED);
+
+		VkFormatProperties formatProperties;
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, texelFormat, &formatProperties);
+
+		VkFormatFeatureFlags requiredFeatures = ((m_usage & VK_BUFFER_USAGE_UNIFORM_TEXEL_BUFFER_BIT) ? VK_FORMAT_FEATURE_UNIFORM_TEXEL_BUFFER_BIT : 0) |
+			((m_usage & VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT) ? VK_FORMAT_FEATURE_STORAGE_TEXEL_BUFFER_BIT : 0);
+
+		if ((formatProperties.bufferFeatures & requiredFeatures) != requiredFeatures)
+		{
+			std::cout << "texel buffer format " << texelFormat << " not supported by the device for this usage" << std::endl;
+			return false;
+		}
+	}
+
 	VkBufferCreateInfo createInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
 	createInfo.pNext = nullptr;
 	createInfo.flags = 0;
@@ -71,6 +91,22 @@ bool BufferVK::Create(DeviceVK* device, uint64_t size, VkBufferUsageFlags usage,
 	m_descriptor.offset = 0;
 	m_descriptor.range = size;
 
+	if (m_usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+		m_bindlessIndex = device->AllocateBindlessStorageBuffer(m_buffer);
+
+	if (m_usage & (VK_BUFFER_USAGE_UNIFORM_TEXEL_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT))
+	{
+		VkBufferViewCreateInfo viewInfo = { VK_STRUCTURE_TYPE_BUFFER_VIEW_CREATE_INFO };
+		viewInfo.pNext = nullptr;
+		viewInfo.flags = 0;
+		viewInfo.buffer = m_buffer;
+		viewInfo.format = texelFormat;
+		viewInfo.offset = 0;
+		viewInfo.range = VK_WHOLE_SIZE;
+
+		VK_CHECK(vkCreateBufferView(logicDevice, &viewInfo, nullptr, &m_texelView));
+	}
+
 	return true;
 }
 
@@ -136,11 +172,18 @@ void BufferVK::Destroy(DeviceVK* device)
 {
 	VkDevice logicDevice = device->GetDevice();
 
+	device->FreeBindlessIndex(DeviceVK::BINDLESS_TYPE_STORAGE_BUFFER, m_bindlessIndex);
+	m_bindlessIndex = DeviceVK::s_invalidBindlessIndex;
+
+	if (m_texelView != VK_NULL_HANDLE)
+		vkDestroyBufferView(logicDevice, m_texelView, nullptr);
+
 	vkFreeMemory(logicDevice, m_memory, nullptr);
 	vkDestroyBuffer(logicDevice, m_buffer, nullptr);
 
 	m_buffer = VK_NULL_HANDLE;
 	m_memory = VK_NULL_HANDLE;
+	m_texelView = VK_NULL_HANDLE;
 }
 
 // ------------------------------- BufferRegionVK -------------------------------
@@ -11,7 +11,8 @@ class DeviceVK;
 class BufferVK : public Resource
 {
 public:
-	bool Create(DeviceVK* device, uint64_t size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryProperties);
+	// texelFormat: format of the buffer view, for the buffers with uniform or storage texel usage
+	bool Create(DeviceVK* device, uint64_t size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryProperties, VkFormat texelFormat = VK_FORMAT_UNDEFINED);
 	bool Update(DeviceVK* device, uint64_t size, void* data, uint32_t offset=0);
 	void Destroy(DeviceVK* device);
 
@@ -19,10 +20,16 @@ public:
 	void* GetData() { return m_data; };
 
 	const VkDescriptorBufferInfo& GetDescriptor() const { return m_descriptor; };
+	// whole buffer view, for the uniform and storage texel buffer bindings
+	VkBufferView GetTexelView() const { return m_texelView; };
+
+	// stable index in the bindless storage buffer array, for the buffers with storage usage. DeviceVK::s_invalidBindlessIndex if bindless is disabled
+	uint32_t GetBindlessIndex() const { return m_bindlessIndex; };
 	
 private:
 	VkBuffer m_buffer = VK_NULL_HANDLE;
 	VkDeviceMemory m_memory = VK_NULL_HANDLE;
+	VkBufferView m_texelView = VK_NULL_HANDLE;
 	uint64_t m_size = 0;
 
 	VkDescriptorBufferInfo m_descriptor = {};
@@ -32,6 +39,8 @@ private:
 
 	bool m_hasCpuAccess = false;
 	bool m_hasCoherentMemory = false;
+
+	uint32_t m_bindlessIndex = 0xFFFFFFFF;
 };
 
 class BufferRegionVK : public Resource
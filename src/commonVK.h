@@ -6,3 +6,62 @@
 #include <vector>
 
 #define VK_CHECK(func) { VkResult res = func; assert(res == VK_SUCCESS); }
+
+// VK_KHR_pipeline_library and VK_EXT_graphics_pipeline_library, from the Vulkan registry: the bundled headers (1.2.131) predate them
+#ifndef VK_KHR_pipeline_library
+#define VK_KHR_pipeline_library 1
+#define VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME "VK_KHR_pipeline_library"
+
+static const VkStructureType VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR = VkStructureType(1000290000);
+static const VkPipelineCreateFlagBits VK_PIPELINE_CREATE_LIBRARY_BIT_KHR = VkPipelineCreateFlagBits(0x00000800);
+
+typedef struct VkPipelineLibraryCreateInfoKHR
+{
+	VkStructureType sType;
+	const void* pNext;
+	uint32_t libraryCount;
+	const VkPipeline* pLibraries;
+} VkPipelineLibraryCreateInfoKHR;
+#endif
+
+#ifndef VK_EXT_graphics_pipeline_library
+#define VK_EXT_graphics_pipeline_library 1
+#define VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME "VK_EXT_graphics_pipeline_library"
+
+static const VkStructureType VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT = VkStructureType(1000320000);
+static const VkStructureType VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_PROPERTIES_EXT = VkStructureType(1000320001);
+static const VkStructureType VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT = VkStructureType(1000320002);
+static const VkPipelineCreateFlagBits VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT = VkPipelineCreateFlagBits(0x00800000);
+static const VkPipelineCreateFlagBits VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT = VkPipelineCreateFlagBits(0x00000400);
+
+typedef enum VkGraphicsPipelineLibraryFlagBitsEXT
+{
+	VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT = 0x00000001,
+	VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT = 0x00000002,
+	VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT = 0x00000004,
+	VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT = 0x00000008
+} VkGraphicsPipelineLibraryFlagBitsEXT;
+typedef VkFlags VkGraphicsPipelineLibraryFlagsEXT;
+
+typedef struct VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT
+{
+	VkStructureType sType;
+	void* pNext;
+	VkBool32 graphicsPipelineLibrary;
+} VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT;
+
+typedef struct VkPhysicalDeviceGraphicsPipelineLibraryPropertiesEXT
+{
+	VkStructureType sType;
+	void* pNext;
+	VkBool32 graphicsPipelineLibraryFastLinking;
+	VkBool32 graphicsPipelineLibraryIndependentInterpolationDecoration;
+} VkPhysicalDeviceGraphicsPipelineLibraryPropertiesEXT;
+
+typedef struct VkGraphicsPipelineLibraryCreateInfoEXT
+{
+	VkStructureType sType;
+	const void* pNext;
+	VkGraphicsPipelineLibraryFlagsEXT flags;
+} VkGraphicsPipelineLibraryCreateInfoEXT;
+#endif
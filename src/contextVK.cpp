@@ -7,33 +7,125 @@
 #include "textureVK.h"
 #include "vertexBufferVK.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
 namespace MBRF
 {
 
-bool ContextVK::Create(DeviceVK* device)
+// a bit per slot in the binding masks
+static_assert(MAX_UNIFORM_BUFFER_SLOTS <= 32 && MAX_TEXTURE_SLOTS <= 32 && MAX_STORAGE_IMAGE_SLOTS <= 32 && MAX_STORAGE_BUFFER_SLOTS <= 32 &&
+	MAX_UNIFORM_TEXEL_BUFFER_SLOTS <= 32 && MAX_STORAGE_TEXEL_BUFFER_SLOTS <= 32 && MAX_SAMPLED_IMAGE_SLOTS <= 32, "Too many slots per binding type");
+
+static bool operator==(const VkDescriptorBufferInfo& a, const VkDescriptorBufferInfo& b)
+{
+	return (a.buffer == b.buffer) && (a.offset == b.offset) && (a.range == b.range);
+}
+
+static bool operator==(const VkDescriptorImageInfo& a, const VkDescriptorImageInfo& b)
+{
+	return (a.sampler == b.sampler) && (a.imageView == b.imageView) && (a.imageLayout == b.imageLayout);
+}
+
+static uint32_t CountBits(uint32_t mask)
+{
+	uint32_t count = 0;
+
+	for (; mask != 0; mask &= mask - 1)
+		count++;
+
+	return count;
+}
+
+static void AppendDescriptorKeys(std::vector<uint64_t>& key, uint32_t boundSlots, const VkDescriptorBufferInfo* descriptors)
+{
+	for (uint32_t slot = 0; slot < 32 && (boundSlots >> slot); ++slot)
+	{
+		if (!(boundSlots & (1u << slot)))
+			continue;
+
+		key.push_back((uint64_t)descriptors[slot].buffer);
+		key.push_back(descriptors[slot].offset);
+		key.push_back(descriptors[slot].range);
+	}
+}
+
+static void AppendDescriptorKeys(std::vector<uint64_t>& key, uint32_t boundSlots, const VkDescriptorImageInfo* descriptors)
+{
+	for (uint32_t slot = 0; slot < 32 && (boundSlots >> slot); ++slot)
+	{
+		if (!(boundSlots & (1u << slot)))
+			continue;
+
+		key.push_back((uint64_t)descriptors[slot].sampler);
+		key.push_back((uint64_t)descriptors[slot].imageView);
+		key.push_back(descriptors[slot].imageLayout);
+	}
+}
+
+static void AppendDescriptorKeys(std::vector<uint64_t>& key, uint32_t boundSlots, const VkBufferView* descriptors)
+{
+	for (uint32_t slot = 0; slot < 32 && (boundSlots >> slot); ++slot)
+	{
+		if (boundSlots & (1u << slot))
+			key.push_back((uint64_t)descriptors[slot]);
+	}
+}
+
+// FNV-1a over the key words
+size_t ContextVK::DescriptorSetKeyHash::operator()(const std::vector<uint64_t>& key) const
+{
+	uint64_t hash = 14695981039346656037ull;
+
+	for (uint64_t word : key)
+	{
+		hash ^= word;
+		hash *= 1099511628211ull;
+	}
+
+	return size_t(hash);
+}
+
+bool ContextVK::Create(DeviceVK* device, ContextType type, VkCommandBufferLevel level)
 {
 	VkDevice logicDevice = device->GetDevice();
 
+	m_type = type;
+	m_level = level;
+	m_queueFamily = device->GetQueueFamily(type);
+	m_multiDrawIndirect = (device->GetEnabledFeatures().multiDrawIndirect == VK_TRUE);
+	m_bindlessDescriptorSet = device->GetBindlessDescriptorSet();
+	m_pushConstantsSize = device->GetPushConstantsSize();
+
 	VkCommandBufferAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
 	allocateInfo.pNext = nullptr;
-	allocateInfo.commandPool = device->GetGraphicsCommandPool();
-	allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocateInfo.commandPool = device->GetCommandPool(type);
+	allocateInfo.level = level;
 	allocateInfo.commandBufferCount = 1;
 
 	VK_CHECK(vkAllocateCommandBuffers(logicDevice, &allocateInfo, &m_commandBuffer));
 
-	VkFenceCreateInfo fenceCreateInfo = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
-	fenceCreateInfo.pNext = nullptr;
-	fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-	VK_CHECK(vkCreateFence(logicDevice, &fenceCreateInfo, nullptr, &m_fence));
+	m_submittedValue = 0;
 
 	CreateDescriptorPools(device);
 
+	// GPU timings are measured on the primary command buffers only
+	if (m_level == VK_COMMAND_BUFFER_LEVEL_PRIMARY)
+		CreateQueryPools(device);
+
 	uint32_t size = 1024 * 1024;
+	m_scratchBufferSize = size;
 	m_uniformScratchBuffer.Create(device, size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-	m_uniformBufferRegions.resize(MAX_UNIFORM_BUFFER_SLOTS);
+	const VkPhysicalDeviceLimits& limits = device->GetPhysicalDeviceProperties().limits;
+
+	m_scratchBufferAlignment = uint32_t(limits.minUniformBufferOffsetAlignment);
+
+	// all the scratch regions share the same descriptor, the range is the biggest region that can be set
+	m_scratchBufferDescriptor.buffer = m_uniformScratchBuffer.GetBuffer();
+	m_scratchBufferDescriptor.offset = 0;
+	m_scratchBufferDescriptor.range = std::min(limits.maxUniformBufferRange, s_maxScratchUniformBufferRange);
 
 	return true;
 }
@@ -42,64 +134,142 @@ void ContextVK::Destroy(DeviceVK* device)
 {
 	m_uniformScratchBuffer.Destroy(device);
 
+	DestroyQueryPools(device);
 	DestroyDescriptorPools(device);
 
-	vkDestroyFence(device->GetDevice(), m_fence, nullptr);
+	vkFreeCommandBuffers(device->GetDevice(), device->GetCommandPool(m_type), 1, &m_commandBuffer);
 
 	m_commandBuffer = VK_NULL_HANDLE;
-	m_fence = VK_NULL_HANDLE;
+	m_submittedValue = 0;
+	m_recordedResourceChecks.clear();
 }
 
 bool ContextVK::CreateDescriptorPools(DeviceVK* device)
 {
-	uint32_t numUniformBuffers = MAX_UNIFORM_BUFFER_SLOTS;
-	uint32_t numCombinedImageSamplers = MAX_TEXTURE_SLOTS;
-	uint32_t numStorageImages = MAX_STORAGE_IMAGE_SLOTS;
-
-	// Create Descriptor Pool
-	VkDescriptorPoolSize poolSizes[3];
-	// UBOs
-	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	poolSizes[0].descriptorCount = numUniformBuffers * s_descriptorPoolMaxSets;
-	// Texture + Samplers TODO: create separate samplers?
-	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	poolSizes[1].descriptorCount = numCombinedImageSamplers * s_descriptorPoolMaxSets;
-	// Storage Images
-	poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-	poolSizes[2].descriptorCount = numStorageImages * s_descriptorPoolMaxSets;
-
-	VkDescriptorPoolCreateInfo createInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+	return m_descriptorAllocator.Create(device);
+}
+
+void ContextVK::DestroyDescriptorPools(DeviceVK* device)
+{
+	m_descriptorAllocator.Destroy(device);
+}
+
+void ContextVK::ResetDescriptorPools(DeviceVK* device)
+{
+	// the sets allocated by the previous frames of this context are not in use anymore: the persistent cache keeps them until there are too many
+	bool keepSets = (m_descriptorSetCacheMode == DESCRIPTOR_SET_CACHE_PERSISTENT) && !m_descriptorSetCacheInvalidated &&
+		(m_descriptorAllocator.GetNumAllocatedSets() < s_descriptorSetCacheMaxSets);
+
+	if (!keepSets)
+	{
+		m_descriptorAllocator.Reset(device);
+
+		m_descriptorSetCache.clear();
+		m_descriptorSetCacheInvalidated = false;
+	}
+
+	for (uint32_t set = 0; set < NUM_DESCRIPTOR_SETS; ++set)
+	{
+		for (uint32_t i = 0; i < NUM_BINDING_TYPES; ++i)
+		{
+			m_boundSlots[set][i] = 0;
+			m_dirtySlots[set][i] = 0;
+			m_writtenSlots[set][i] = 0;
+		}
+
+		for (uint32_t i = 0; i < MAX_UNIFORM_BUFFER_SLOTS; ++i)
+			m_dynamicOffsets[set][i] = 0;
+
+		m_currentDescriptorSets[set] = VK_NULL_HANDLE;
+	}
+
+	for (uint32_t i = 0; i < NUM_BINDING_TYPES; ++i)
+		m_pushDirtySlots[i] = 0;
+}
+
+void ContextVK::InvalidateState()
+{
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		m_boundPipelines[i] = VK_NULL_HANDLE;
+		m_boundBindlessSets[i] = false;
+		m_boundPushLayouts[i] = false;
+
+		for (uint32_t set = 0; set < NUM_DESCRIPTOR_SETS; ++set)
+			m_boundDescriptorSets[i][set] = VK_NULL_HANDLE;
+
+		for (uint32_t type = 0; type < NUM_BINDING_TYPES; ++type)
+			m_pushedSlots[i][type] = 0;
+	}
+
+	m_boundVertexBuffer = VK_NULL_HANDLE;
+	m_boundIndexBuffer = VK_NULL_HANDLE;
+
+	// push constants need to be sent again too
+	m_pushConstantsDirtyBegin = 0;
+	m_pushConstantsDirtyEnd = m_pushConstantsWrittenSize;
+}
+
+bool ContextVK::CreateQueryPools(DeviceVK* device)
+{
+	// timestamps are not supported by every queue family
+	if (device->GetQueueFamilyProperties(m_queueFamily).timestampValidBits == 0)
+		return false;
+
+	VkQueryPoolCreateInfo createInfo = { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
 	createInfo.pNext = nullptr;
 	createInfo.flags = 0;
-	createInfo.maxSets = s_descriptorPoolMaxSets;
-	createInfo.poolSizeCount = sizeof(poolSizes) / sizeof(VkDescriptorPoolSize);
-	createInfo.pPoolSizes = poolSizes;
+	createInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	createInfo.queryCount = 2;
+	createInfo.pipelineStatistics = 0;
 
-	VK_CHECK(vkCreateDescriptorPool(device->GetDevice(), &createInfo, nullptr, &m_descriptorPool));
+	VK_CHECK(vkCreateQueryPool(device->GetDevice(), &createInfo, nullptr, &m_timestampQueryPool));
 
 	return true;
 }
 
-void ContextVK::DestroyDescriptorPools(DeviceVK* device)
+void ContextVK::DestroyQueryPools(DeviceVK* device)
 {
-	vkDestroyDescriptorPool(device->GetDevice(), m_descriptorPool, nullptr);
+	vkDestroyQueryPool(device->GetDevice(), m_timestampQueryPool, nullptr);
 
-	m_descriptorPool = VK_NULL_HANDLE;
+	m_timestampQueryPool = VK_NULL_HANDLE;
+	m_timestampsPending = false;
+	m_hasGPUTimings = false;
 }
 
-void ContextVK::ResetDescriptorPools(DeviceVK* device)
+void ContextVK::ReadTimestamps(DeviceVK* device)
 {
-	VK_CHECK(vkResetDescriptorPool(device->GetDevice(), m_descriptorPool, 0));
+	m_hasGPUTimings = false;
+
+	if (!m_timestampsPending)
+		return;
+
+	m_timestampsPending = false;
+
+	uint64_t timestamps[2];
+	VkResult result = vkGetQueryPoolResults(device->GetDevice(), m_timestampQueryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
 
-	m_uniformBufferBindings.clear();
-	m_textureBindings.clear();
+	if (result != VK_SUCCESS)
+		return;
+
+	// timestampPeriod: number of nanoseconds per timestamp tick
+	double period = double(device->GetPhysicalDeviceProperties().limits.timestampPeriod) * 1e-6;
+
+	m_gpuBeginTime = double(timestamps[0]) * period;
+	m_gpuEndTime = double(timestamps[1]) * period;
+	m_hasGPUTimings = true;
 }
 
 void ContextVK::Begin(DeviceVK* device)
 {
 	m_currentPipeline = nullptr;
+	m_skipDraws = false;
+	m_pushConstantsWrittenSize = 0;
+	InvalidateState();
 	ResetDescriptorPools(device);
 
+	m_stats = {};
+
 	m_currentScratchBufferOffset = 0;
 
 	VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
@@ -107,41 +277,115 @@ void ContextVK::Begin(DeviceVK* device)
 	beginInfo.pInheritanceInfo = nullptr; // Optional: only relevant for secondary command buffers. It specifies which state to inherit from the calling primary command buffers
 
 	VK_CHECK(vkBeginCommandBuffer(m_commandBuffer, &beginInfo));
+
+	if (m_timestampQueryPool != VK_NULL_HANDLE)
+	{
+		vkCmdResetQueryPool(m_commandBuffer, m_timestampQueryPool, 0, 2);
+		vkCmdWriteTimestamp(m_commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_timestampQueryPool, 0);
+	}
+}
+
+void ContextVK::BeginSecondary(DeviceVK* device, FrameBufferVK* renderTarget)
+{
+	assert(m_level == VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+
+	m_currentPipeline = nullptr;
+	m_skipDraws = false;
+	m_pushConstantsWrittenSize = 0;
+	InvalidateState();
+	ResetDescriptorPools(device);
+
+	m_stats = {};
+
+	m_currentScratchBufferOffset = 0;
+	m_recordedResourceChecks.clear();
+
+	// no framebuffer: the recording is valid for any framebuffer compatible with the render pass (i.e. all the swapchain back buffers)
+	VkCommandBufferInheritanceInfo inheritanceInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO };
+	inheritanceInfo.pNext = nullptr;
+	inheritanceInfo.renderPass = renderTarget->GetRenderPass();
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = VK_NULL_HANDLE;
+	inheritanceInfo.occlusionQueryEnable = VK_FALSE;
+	inheritanceInfo.queryFlags = 0;
+	inheritanceInfo.pipelineStatistics = 0;
+
+	// simultaneous use: the same recording can be executed by all the frames in flight
+	VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+	VK_CHECK(vkBeginCommandBuffer(m_commandBuffer, &beginInfo));
+
+	m_currentFrameBuffer = renderTarget;
+
+	// dynamic state isn't inherited from the primary command buffer
+	SetViewport(0.0f, 0.0f, float(renderTarget->GetWidth()), float(renderTarget->GetHeight()));
+	SetScissor(0, 0, renderTarget->GetWidth(), renderTarget->GetHeight());
 }
 
 void ContextVK::End()
 {
+	if (m_timestampQueryPool != VK_NULL_HANDLE)
+		vkCmdWriteTimestamp(m_commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_timestampQueryPool, 1);
+
 	VK_CHECK(vkEndCommandBuffer(m_commandBuffer));
+
+	if (m_level == VK_COMMAND_BUFFER_LEVEL_SECONDARY)
+		m_currentFrameBuffer = nullptr;
 }
 
+// timeline values start at 0, so waiting on a context that hasn't been submitted returns immediately
 void ContextVK::WaitForLastFrame(DeviceVK* device)
 {
-	VkDevice logicDevice = device->GetDevice();
+	device->WaitForTimeline(m_type, m_submittedValue);
 
-	VK_CHECK(vkWaitForFences(logicDevice, 1, &m_fence, VK_TRUE, UINT64_MAX));
-	VK_CHECK(vkResetFences(logicDevice, 1, &m_fence));
+	ReadTimestamps(device);
 }
 
-void ContextVK::Submit(VkQueue queue, VkSemaphore waitSemaphore, VkSemaphore signalSemaphore)
+bool ContextVK::IsComplete(DeviceVK* device)
 {
-	VkSemaphore waitSemaphores[] = { waitSemaphore };
-	VkSemaphore signalSemaphores[] = { signalSemaphore };
-	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+	return device->GetCompletedTimelineValue(m_type) >= m_submittedValue;
+}
+
+void ContextVK::Submit(DeviceVK* device, const std::vector<VkSemaphore> &waitSemaphores, const std::vector<VkPipelineStageFlags> &waitStages, const std::vector<uint64_t> &waitValues,
+	const std::vector<VkSemaphore> &signalSemaphores)
+{
+	assert(waitSemaphores.size() == waitStages.size());
+	assert(waitSemaphores.size() == waitValues.size());
+
+	// signal the queue timeline on top of the binary semaphores. Values of binary semaphores are ignored
+	m_submittedValue = device->AdvanceTimeline(m_type);
+
+	std::vector<VkSemaphore> signals = signalSemaphores;
+	std::vector<uint64_t> signalValues(signalSemaphores.size(), 0);
+
+	signals.emplace_back(device->GetTimelineSemaphore(m_type));
+	signalValues.emplace_back(m_submittedValue);
+
+	VkTimelineSemaphoreSubmitInfoKHR timelineInfo = { VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR };
+	timelineInfo.pNext = nullptr;
+	timelineInfo.waitSemaphoreValueCount = uint32_t(waitValues.size());
+	timelineInfo.pWaitSemaphoreValues = waitValues.data();
+	timelineInfo.signalSemaphoreValueCount = uint32_t(signalValues.size());
+	timelineInfo.pSignalSemaphoreValues = signalValues.data();
 
 	VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
-	submitInfo.pNext = nullptr;
-	submitInfo.waitSemaphoreCount = (waitSemaphore == VK_NULL_HANDLE) ? 0 : 1;
-	submitInfo.pWaitSemaphores = waitSemaphores;
-	submitInfo.pWaitDstStageMask = waitStages;
+	submitInfo.pNext = &timelineInfo;
+	submitInfo.waitSemaphoreCount = uint32_t(waitSemaphores.size());
+	submitInfo.pWaitSemaphores = waitSemaphores.data();
+	submitInfo.pWaitDstStageMask = waitStages.data();
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &m_commandBuffer;
-	submitInfo.signalSemaphoreCount = (signalSemaphore == VK_NULL_HANDLE) ? 0 : 1;
-	submitInfo.pSignalSemaphores = signalSemaphores;
+	submitInfo.signalSemaphoreCount = uint32_t(signals.size());
+	submitInfo.pSignalSemaphores = signals.data();
+
+	VK_CHECK(vkQueueSubmit(device->GetQueue(m_type), 1, &submitInfo, VK_NULL_HANDLE));
 
-	VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, m_fence));
+	m_timestampsPending = (m_timestampQueryPool != VK_NULL_HANDLE);
 }
 
-void ContextVK::BeginPass(FrameBufferVK* renderTarget)
+void ContextVK::BeginPass(FrameBufferVK* renderTarget, bool secondaryContents)
 {
 	assert(m_currentFrameBuffer == nullptr);
 
@@ -162,7 +406,14 @@ void ContextVK::BeginPass(FrameBufferVK* renderTarget)
 	renderPassInfo.clearValueCount = 0;
 	renderPassInfo.pClearValues = nullptr;
 
-	vkCmdBeginRenderPass(m_commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBeginRenderPass(m_commandBuffer, &renderPassInfo, secondaryContents ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+
+	// only vkCmdExecuteCommands is allowed in a pass with secondary contents: the secondary contexts set their own
+	if (!secondaryContents)
+	{
+		SetViewport(0.0f, 0.0f, float(rtExtent.width), float(rtExtent.height));
+		SetScissor(0, 0, rtExtent.width, rtExtent.height);
+	}
 }
 
 void ContextVK::EndPass()
@@ -173,6 +424,31 @@ void ContextVK::EndPass()
 	m_currentFrameBuffer = nullptr;
 }
 
+void ContextVK::ExecuteCommands(ContextVK* secondaryContext)
+{
+	assert(m_currentFrameBuffer != nullptr);
+	assert(secondaryContext->m_level == VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+
+	vkCmdExecuteCommands(m_commandBuffer, 1, &secondaryContext->m_commandBuffer);
+
+	// the state of the primary command buffer is undefined after executing secondary ones
+	InvalidateState();
+}
+
+void ContextVK::SetViewport(float x, float y, float width, float height, float minDepth, float maxDepth)
+{
+	VkViewport viewport = { x, y, width, height, minDepth, maxDepth };
+
+	vkCmdSetViewport(m_commandBuffer, 0, 1, &viewport);
+}
+
+void ContextVK::SetScissor(int32_t x, int32_t y, uint32_t width, uint32_t height)
+{
+	VkRect2D scissor = { { x, y }, { width, height } };
+
+	vkCmdSetScissor(m_commandBuffer, 0, 1, &scissor);
+}
+
 void ContextVK::ClearRenderTarget(int32_t x, int32_t y, uint32_t width, uint32_t height, VkClearColorValue clearColor, VkClearDepthStencilValue clearDepthStencil)
 {
 	assert(m_currentFrameBuffer != nullptr);
@@ -209,24 +485,277 @@ void ContextVK::ClearRenderTarget(int32_t x, int32_t y, uint32_t width, uint32_t
 
 void ContextVK::DrawIndexed(uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, uint32_t vertexOffset, uint32_t firstInstance)
 {
+	if (m_skipDraws)
+	{
+		m_stats.m_skippedDraws++;
+		return;
+	}
+
+	FlushPushConstants();
+
 	vkCmdDrawIndexed(m_commandBuffer, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+
+	m_stats.m_drawCalls++;
+}
+
+void ContextVK::DrawIndexedIndirect(BufferVK* buffer, uint64_t offset, uint32_t drawCount, uint32_t stride)
+{
+	if (m_skipDraws)
+	{
+		m_stats.m_skippedDraws++;
+		return;
+	}
+
+	FlushPushConstants();
+
+	if (drawCount > 1 && !m_multiDrawIndirect)
+	{
+		for (uint32_t i = 0; i < drawCount; ++i)
+			vkCmdDrawIndexedIndirect(m_commandBuffer, buffer->GetBuffer(), offset + uint64_t(i) * stride, 1, stride);
+
+		m_stats.m_drawCalls += drawCount;
+
+		return;
+	}
+
+	vkCmdDrawIndexedIndirect(m_commandBuffer, buffer->GetBuffer(), offset, drawCount, stride);
+
+	m_stats.m_drawCalls++;
+}
+
+void ContextVK::DrawIndexedIndirectCount(DeviceVK* device, BufferVK* buffer, uint64_t offset, BufferVK* countBuffer, uint64_t countOffset, uint32_t maxDrawCount, uint32_t stride)
+{
+	if (m_skipDraws)
+	{
+		m_stats.m_skippedDraws++;
+		return;
+	}
+
+	if (device->SupportsDrawIndirectCount())
+	{
+		FlushPushConstants();
+
+		device->CmdDrawIndexedIndirectCount(m_commandBuffer, buffer->GetBuffer(), offset, countBuffer->GetBuffer(), countOffset, maxDrawCount, stride);
+
+		m_stats.m_drawCalls++;
+
+		return;
+	}
+
+	// fallback: draw all the commands, the ones past the count need to have been zeroed
+	DrawIndexedIndirect(buffer, offset, maxDrawCount, stride);
 }
 
 void ContextVK::Dispatch(uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ)
 {
+	if (m_skipDraws)
+	{
+		m_stats.m_skippedDraws++;
+		return;
+	}
+
+	FlushPushConstants();
+
 	vkCmdDispatch(m_commandBuffer, groupCountX, groupCountY, groupCountZ);
+
+	m_stats.m_dispatches++;
+}
+
+void ContextVK::FillBuffer(BufferVK* buffer, uint64_t offset, uint64_t size, uint32_t data)
+{
+	vkCmdFillBuffer(m_commandBuffer, buffer->GetBuffer(), offset, size, data);
+}
+
+void ContextVK::BufferBarrier(BufferVK* buffer, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+{
+	VkBufferMemoryBarrier barrier = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+	barrier.pNext = nullptr;
+	barrier.srcAccessMask = srcAccess;
+	barrier.dstAccessMask = dstAccess;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = buffer->GetBuffer();
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+
+	vkCmdPipelineBarrier(m_commandBuffer, srcStage, dstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
 }
 
 void ContextVK::TransitionImageLayout(DeviceVK* device, TextureVK* texture, VkImageLayout newLayout)
 {
-	texture->TransitionImageLayout(device, m_commandBuffer, newLayout);
+	texture->TransitionImageLayout(device, m_commandBuffer, newLayout, m_queueFamily);
+}
+
+void ContextVK::ReleaseOwnership(DeviceVK* device, TextureVK* texture, uint32_t dstQueueFamily, VkImageLayout newLayout)
+{
+	texture->ReleaseOwnership(device, m_commandBuffer, m_queueFamily, dstQueueFamily, newLayout);
+}
+
+void ContextVK::AcquireOwnership(DeviceVK* device, TextureVK* texture)
+{
+	texture->AcquireOwnership(device, m_commandBuffer, m_queueFamily);
 }
 
 void ContextVK::SetPipeline(PipelineVK* pipeline)
 {
 	m_currentPipeline = pipeline;
+	m_skipDraws = false;
+
+	VkPipelineBindPoint bindPoint = pipeline->GetBindPoint();
+	VkPipeline handle = pipeline->GetPipeline();
+
+	// the bindless set stays bound across pipeline changes, until sets are bound with a layout without it (see BindDescriptorSets)
+	if (pipeline->UsesBindless())
+		UpdateBoundLayout(bindPoint);
+
+	if (pipeline->UsesBindless() && (!m_stateFiltering || !m_boundBindlessSets[bindPoint]))
+	{
+		vkCmdBindDescriptorSets(m_commandBuffer, bindPoint, pipeline->GetLayout(), BINDLESS_SET, 1, &m_bindlessDescriptorSet, 0, nullptr);
+
+		m_boundBindlessSets[bindPoint] = true;
+		m_stats.m_descriptorSetBinds++;
+	}
+
+	if (m_stateFiltering && m_boundPipelines[bindPoint] == handle)
+	{
+		m_stats.m_skippedPipelineBinds++;
+		return;
+	}
+
+	vkCmdBindPipeline(m_commandBuffer, bindPoint, handle);
+
+	m_boundPipelines[bindPoint] = handle;
+	m_stats.m_pipelineBinds++;
+
+	if (m_level == VK_COMMAND_BUFFER_LEVEL_SECONDARY)
+		m_recordedResourceChecks.emplace_back([pipeline, handle]() { return pipeline->GetPipeline() == handle; });
+}
+
+bool ContextVK::SetPipeline(DeviceVK* device, const GraphicsPipelineDesc& desc)
+{
+	PipelineVK* pipeline = PipelineStateCache::GetGraphicsPipeline(device, desc);
+
+	if (!pipeline)
+		return false;
+
+	SetPipeline(pipeline);
+
+	return true;
+}
+
+bool ContextVK::SetPipeline(DeviceVK* device, ShaderVK* computeShader, bool pushDescriptors, const SpecializationConstantsVK& specializationConstants)
+{
+	PipelineVK* pipeline = PipelineStateCache::GetComputePipeline(device, computeShader, pushDescriptors, specializationConstants);
+
+	if (!pipeline)
+		return false;
+
+	SetPipeline(pipeline);
+
+	return true;
+}
+
+bool ContextVK::RequestPipeline(DeviceVK* device, const GraphicsPipelineDesc& desc)
+{
+	bool pending = false;
+	PipelineVK* pipeline = PipelineStateCache::RequestGraphicsPipeline(device, desc, pending);
+
+	if (pipeline)
+	{
+		SetPipeline(pipeline);
+		return true;
+	}
+
+	// the creation failed, nothing to draw with
+	if (!pending)
+	{
+		m_skipDraws = true;
+		return false;
+	}
 
-	vkCmdBindPipeline(m_commandBuffer, m_currentPipeline->GetBindPoint(), pipeline->GetPipeline());
+	// a recording made meanwhile is stale once the pipeline is ready
+	if (m_level == VK_COMMAND_BUFFER_LEVEL_SECONDARY)
+	{
+		std::vector<uint64_t> pipelineKey = PipelineStateCache::GetPipelineKey(desc);
+		m_recordedResourceChecks.emplace_back([pipelineKey]() { return PipelineStateCache::IsGraphicsPipelinePending(pipelineKey); });
+	}
+
+	if (m_fallbackPipeline)
+	{
+		SetPipeline(m_fallbackPipeline);
+		m_stats.m_fallbackPipelineBinds++;
+	}
+	else
+	{
+		m_skipDraws = true;
+	}
+
+	return false;
+}
+
+bool ContextVK::RequestPipeline(DeviceVK* device, ShaderVK* computeShader, bool pushDescriptors, const SpecializationConstantsVK& specializationConstants)
+{
+	bool pending = false;
+	PipelineVK* pipeline = PipelineStateCache::RequestComputePipeline(device, computeShader, pushDescriptors, specializationConstants, pending);
+
+	if (pipeline)
+	{
+		SetPipeline(pipeline);
+		return true;
+	}
+
+	// pending or failed. A fallback compute pipeline wouldn't write the expected results, the dispatches are skipped
+	m_skipDraws = true;
+
+	return false;
+}
+
+bool ContextVK::SetPushConstants(const void* data, uint32_t size, uint32_t offset)
+{
+	if (offset + size > m_pushConstantsSize)
+	{
+		assert(offset == 0);
+
+		SetUniformBuffer(const_cast<void*>(data), size, PUSH_CONSTANTS_FALLBACK_SLOT, DRAW_SET);
+		m_stats.m_pushConstantFallbacks++;
+
+		return false;
+	}
+
+	std::memcpy(m_pushConstants + offset, data, size);
+
+	if (m_pushConstantsDirtyBegin == m_pushConstantsDirtyEnd)
+	{
+		m_pushConstantsDirtyBegin = offset;
+		m_pushConstantsDirtyEnd = offset + size;
+	}
+	else
+	{
+		m_pushConstantsDirtyBegin = std::min(m_pushConstantsDirtyBegin, offset);
+		m_pushConstantsDirtyEnd = std::max(m_pushConstantsDirtyEnd, offset + size);
+	}
+
+	m_pushConstantsWrittenSize = std::max(m_pushConstantsWrittenSize, offset + size);
+
+	return true;
+}
+
+// all the pipeline layouts share the same push constant range, so the values stay valid across pipeline changes
+void ContextVK::FlushPushConstants()
+{
+	if (m_pushConstantsDirtyBegin == m_pushConstantsDirtyEnd)
+		return;
+
+	assert(m_currentPipeline);
+
+	VkShaderStageFlags stages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+
+	vkCmdPushConstants(m_commandBuffer, m_currentPipeline->GetLayout(), stages, m_pushConstantsDirtyBegin, m_pushConstantsDirtyEnd - m_pushConstantsDirtyBegin, m_pushConstants + m_pushConstantsDirtyBegin);
+
+	m_pushConstantsDirtyBegin = 0;
+	m_pushConstantsDirtyEnd = 0;
+
+	m_stats.m_pushConstantFlushes++;
 }
 
 void ContextVK::SetVertexBuffer(const VertexBufferVK* vertexBuffer, uint64_t offset)
@@ -234,150 +763,591 @@ void ContextVK::SetVertexBuffer(const VertexBufferVK* vertexBuffer, uint64_t off
 	VkBuffer vbs[] = { vertexBuffer->GetBuffer().GetBuffer() };
 	VkDeviceSize offsets[] = { offset };
 
+	if (m_stateFiltering && m_boundVertexBuffer == vbs[0] && m_boundVertexBufferOffset == offset)
+	{
+		m_stats.m_skippedBufferBinds++;
+		return;
+	}
+
 	vkCmdBindVertexBuffers(m_commandBuffer, 0, 1, vbs, offsets);
+
+	m_boundVertexBuffer = vbs[0];
+	m_boundVertexBufferOffset = offset;
+	m_stats.m_bufferBinds++;
+
+	if (m_level == VK_COMMAND_BUFFER_LEVEL_SECONDARY)
+	{
+		VkBuffer handle = vbs[0];
+		m_recordedResourceChecks.emplace_back([vertexBuffer, handle]() { return vertexBuffer->GetBuffer().GetBuffer() == handle; });
+	}
 }
 
 void ContextVK::SetIndexBuffer(const IndexBufferVK* indexBuffer, uint64_t offset)
 {
-	vkCmdBindIndexBuffer(m_commandBuffer, indexBuffer->GetBuffer().GetBuffer(), offset, indexBuffer->Use16Bits() ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32);
+	VkBuffer handle = indexBuffer->GetBuffer().GetBuffer();
+	VkIndexType indexType = indexBuffer->Use16Bits() ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+
+	if (m_stateFiltering && m_boundIndexBuffer == handle && m_boundIndexBufferOffset == offset && m_boundIndexType == indexType)
+	{
+		m_stats.m_skippedBufferBinds++;
+		return;
+	}
+
+	vkCmdBindIndexBuffer(m_commandBuffer, handle, offset, indexType);
+
+	m_boundIndexBuffer = handle;
+	m_boundIndexBufferOffset = offset;
+	m_boundIndexType = indexType;
+	m_stats.m_bufferBinds++;
+
+	if (m_level == VK_COMMAND_BUFFER_LEVEL_SECONDARY)
+		m_recordedResourceChecks.emplace_back([indexBuffer, handle]() { return indexBuffer->GetBuffer().GetBuffer() == handle; });
+}
+
+// returns false if the slot already had the same descriptor
+template<typename DescriptorInfo>
+bool ContextVK::UpdateBinding(uint32_t set, BindingType type, DescriptorInfo* descriptors, uint32_t bindingSlot, const DescriptorInfo& descriptor)
+{
+	uint32_t slotBit = 1u << bindingSlot;
+
+	if (m_stateFiltering && (m_boundSlots[set][type] & slotBit) && descriptors[bindingSlot] == descriptor)
+		return false;
+
+	descriptors[bindingSlot] = descriptor;
+
+	m_boundSlots[set][type] |= slotBit;
+	m_dirtySlots[set][type] |= slotBit;
+
+	if (set == DRAW_SET)
+		m_pushDirtySlots[type] |= slotBit;
+
+	return true;
 }
 
-void ContextVK::SetUniformBuffer(BufferVK* buffer, uint32_t bindingSlot)
+void ContextVK::SetUniformBuffer(BufferVK* buffer, uint32_t bindingSlot, uint32_t set)
 {
-	assert(bindingSlot < MAX_UNIFORM_BUFFER_SLOTS);
+	assert(bindingSlot < MAX_UNIFORM_BUFFER_SLOTS && set < NUM_DESCRIPTOR_SETS);
+
+	m_dynamicOffsets[set][bindingSlot] = 0;
 
-	DescriptorBinding binding = {buffer, bindingSlot};
+	if (!UpdateBinding(set, BINDING_TYPE_UNIFORM_BUFFER, m_descriptors[set].m_uniformBuffers, bindingSlot, buffer->GetDescriptor()))
+		return;
 
-	m_uniformBufferBindings[bindingSlot] = binding;
+	if (m_level == VK_COMMAND_BUFFER_LEVEL_SECONDARY)
+	{
+		VkBuffer handle = buffer->GetDescriptor().buffer;
+		m_recordedResourceChecks.emplace_back([buffer, handle]() { return buffer->GetDescriptor().buffer == handle; });
+	}
 }
 
-void ContextVK::SetUniformBuffer(DeviceVK* device, void* data, uint64_t size, uint32_t bindingSlot)
+bool ContextVK::SetUniformBuffer(void* data, uint64_t size, uint32_t bindingSlot, uint32_t set)
 {
-	assert(bindingSlot < MAX_UNIFORM_BUFFER_SLOTS);
+	assert(bindingSlot < MAX_UNIFORM_BUFFER_SLOTS && set < NUM_DESCRIPTOR_SETS);
+
+	// the descriptor range is read from the dynamic offset, it must stay within the buffer
+	bool fits = (size <= m_scratchBufferDescriptor.range && m_currentScratchBufferOffset + m_scratchBufferDescriptor.range <= m_scratchBufferSize);
 
-	DescriptorBinding binding = { &m_uniformBufferRegions[bindingSlot], bindingSlot };
+	assert(fits);
 
-	uint32_t minUniformBufferOffsetAlignment = uint32_t(device->GetPhysicalDeviceProperties().limits.minUniformBufferOffsetAlignment);
+	if (!fits)
+	{
+		// the shaders would read stale data
+		m_skipDraws = true;
+
+		return false;
+	}
+
+	std::memcpy(static_cast<uint8_t*>(m_uniformScratchBuffer.GetData()) + m_currentScratchBufferOffset, data, size);
 
-	m_uniformBufferRegions[bindingSlot].Create(device, &m_uniformScratchBuffer, size, m_currentScratchBufferOffset, data);
-	m_currentScratchBufferOffset += uint32_t(size + (minUniformBufferOffsetAlignment - (size % minUniformBufferOffsetAlignment)));
+	// a new region of the scratch buffer is only a new dynamic offset: the descriptor, and so the descriptor set, stay the same
+	m_dynamicOffsets[set][bindingSlot] = m_currentScratchBufferOffset;
+	m_currentScratchBufferOffset += uint32_t((size + m_scratchBufferAlignment - 1) / m_scratchBufferAlignment * m_scratchBufferAlignment);
 
-	m_uniformBufferBindings[bindingSlot] = binding;
+	UpdateBinding(set, BINDING_TYPE_UNIFORM_BUFFER, m_descriptors[set].m_uniformBuffers, bindingSlot, m_scratchBufferDescriptor);
+
+	return true;
+}
+
+void ContextVK::SetStorageBuffer(BufferVK* buffer, uint32_t bindingSlot, uint32_t set)
+{
+	assert(bindingSlot < MAX_STORAGE_BUFFER_SLOTS && set < NUM_DESCRIPTOR_SETS);
+
+	if (!UpdateBinding(set, BINDING_TYPE_STORAGE_BUFFER, m_descriptors[set].m_storageBuffers, bindingSlot, buffer->GetDescriptor()))
+		return;
+
+	if (m_level == VK_COMMAND_BUFFER_LEVEL_SECONDARY)
+	{
+		VkBuffer handle = buffer->GetDescriptor().buffer;
+		m_recordedResourceChecks.emplace_back([buffer, handle]() { return buffer->GetDescriptor().buffer == handle; });
+	}
 }
 
-void ContextVK::SetTexture(TextureVK* texture, uint32_t bindingSlot)
+void ContextVK::SetUniformTexelBuffer(BufferVK* buffer, uint32_t bindingSlot, uint32_t set)
 {
-	assert(bindingSlot < MAX_TEXTURE_SLOTS);
+	assert(bindingSlot < MAX_UNIFORM_TEXEL_BUFFER_SLOTS && set < NUM_DESCRIPTOR_SETS);
+	assert(buffer->GetTexelView() != VK_NULL_HANDLE);
 
-	DescriptorBinding binding = { texture, bindingSlot };
+	if (!UpdateBinding(set, BINDING_TYPE_UNIFORM_TEXEL_BUFFER, m_descriptors[set].m_uniformTexelBuffers, bindingSlot, buffer->GetTexelView()))
+		return;
 
-	m_textureBindings[bindingSlot] = binding;
+	if (m_level == VK_COMMAND_BUFFER_LEVEL_SECONDARY)
+	{
+		VkBufferView handle = buffer->GetTexelView();
+		m_recordedResourceChecks.emplace_back([buffer, handle]() { return buffer->GetTexelView() == handle; });
+	}
 }
 
-void ContextVK::SetStorageImage(TextureVK* texture, uint32_t bindingSlot)
+void ContextVK::SetStorageTexelBuffer(BufferVK* buffer, uint32_t bindingSlot, uint32_t set)
 {
-	assert(bindingSlot < MAX_STORAGE_IMAGE_SLOTS);
+	assert(bindingSlot < MAX_STORAGE_TEXEL_BUFFER_SLOTS && set < NUM_DESCRIPTOR_SETS);
+	assert(buffer->GetTexelView() != VK_NULL_HANDLE);
 
-	DescriptorBinding binding = { texture, bindingSlot };
+	if (!UpdateBinding(set, BINDING_TYPE_STORAGE_TEXEL_BUFFER, m_descriptors[set].m_storageTexelBuffers, bindingSlot, buffer->GetTexelView()))
+		return;
 
-	m_storageImageBindings[bindingSlot] = binding;
+	if (m_level == VK_COMMAND_BUFFER_LEVEL_SECONDARY)
+	{
+		VkBufferView handle = buffer->GetTexelView();
+		m_recordedResourceChecks.emplace_back([buffer, handle]() { return buffer->GetTexelView() == handle; });
+	}
+}
+
+void ContextVK::SetTexture(TextureVK* texture, uint32_t bindingSlot, uint32_t set)
+{
+	assert(bindingSlot < MAX_TEXTURE_SLOTS && set < NUM_DESCRIPTOR_SETS);
+
+	if (!UpdateBinding(set, BINDING_TYPE_TEXTURE, m_descriptors[set].m_textures, bindingSlot, texture->GetDescriptor()))
+		return;
+
+	if (m_level == VK_COMMAND_BUFFER_LEVEL_SECONDARY)
+	{
+		VkImageView handle = texture->GetDescriptor().imageView;
+		m_recordedResourceChecks.emplace_back([texture, handle]() { return texture->GetDescriptor().imageView == handle; });
+	}
+}
+
+void ContextVK::SetSampledImage(TextureVK* texture, uint32_t bindingSlot, uint32_t set)
+{
+	assert(bindingSlot < MAX_SAMPLED_IMAGE_SLOTS && set < NUM_DESCRIPTOR_SETS);
+
+	VkDescriptorImageInfo descriptor = texture->GetDescriptor();
+	descriptor.sampler = VK_NULL_HANDLE;
+
+	if (!UpdateBinding(set, BINDING_TYPE_SAMPLED_IMAGE, m_descriptors[set].m_sampledImages, bindingSlot, descriptor))
+		return;
+
+	if (m_level == VK_COMMAND_BUFFER_LEVEL_SECONDARY)
+	{
+		VkImageView handle = texture->GetDescriptor().imageView;
+		m_recordedResourceChecks.emplace_back([texture, handle]() { return texture->GetDescriptor().imageView == handle; });
+	}
+}
+
+void ContextVK::SetStorageImage(TextureVK* texture, uint32_t bindingSlot, uint32_t set)
+{
+	assert(bindingSlot < MAX_STORAGE_IMAGE_SLOTS && set < NUM_DESCRIPTOR_SETS);
+
+	if (!UpdateBinding(set, BINDING_TYPE_STORAGE_IMAGE, m_descriptors[set].m_storageImages, bindingSlot, texture->GetDescriptor()))
+		return;
+
+	if (m_level == VK_COMMAND_BUFFER_LEVEL_SECONDARY)
+	{
+		VkImageView handle = texture->GetDescriptor().imageView;
+		m_recordedResourceChecks.emplace_back([texture, handle]() { return texture->GetDescriptor().imageView == handle; });
+	}
 }
 
 // TODO: remove the pipelineLayout and add PSO information to ContextVK
 void ContextVK::CommitBindings(DeviceVK* device)
 {
-	if (m_uniformBufferBindings.empty() && m_textureBindings.empty() && m_storageImageBindings.empty())
+	// no pipeline to commit for, the draw will be skipped too
+	if (m_skipDraws)
 		return;
 
-	// TODO: cache descriptor sets?
+	assert(m_currentPipeline != nullptr);
 
-	// Create Descriptor Set
+	VkPipelineBindPoint bindPoint = m_currentPipeline->GetBindPoint();
+
+	bool needsBind[NUM_DESCRIPTOR_SETS] = {};
+	bool anyBind = false;
+
+	for (uint32_t set = 0; set < m_currentPipeline->GetNumDescriptorSets(); ++set)
+	{
+		const uint32_t* usedSlots = m_currentPipeline->GetUsedSlots(set);
+
+		// without filtering every bound slot is rewritten
+		if (!m_stateFiltering)
+		{
+			for (uint32_t i = 0; i < NUM_BINDING_TYPES; ++i)
+				m_dirtySlots[set][i] = m_boundSlots[set][i];
+		}
+
+		if (set == DRAW_SET && m_currentPipeline->UsesPushDescriptors())
+		{
+			anyBind |= PushDescriptorSet(device, bindPoint);
+			continue;
+		}
+
+		// only the slots the pipeline reads need to be in the set: the others are written when a pipeline using them comes,
+		// and until then the valid ones of the previous set are carried over
+		uint32_t contentSlots[NUM_BINDING_TYPES];
+		uint32_t requiredSlots = 0;
+		uint32_t missingSlots = 0;
+
+		for (uint32_t i = 0; i < NUM_BINDING_TYPES; ++i)
+		{
+			uint32_t required = m_boundSlots[set][i] & usedSlots[i];
+
+			contentSlots[i] = required | (m_writtenSlots[set][i] & ~m_dirtySlots[set][i]);
+			requiredSlots |= required;
+			missingSlots |= required & (m_dirtySlots[set][i] | ~m_writtenSlots[set][i]);
+		}
+
+		// nothing read at this frequency. The immutable samplers need no binding, but a set to be bound
+		if (requiredSlots == 0 && !m_currentPipeline->UsesImmutableSamplers(set))
+			continue;
+
+		if (missingSlots != 0 || m_currentDescriptorSets[set] == VK_NULL_HANDLE)
+			CommitDescriptorSet(device, set, contentSlots);
+
+		bool isBound = (m_boundDescriptorSets[bindPoint][set] == m_currentDescriptorSets[set]);
+		bool sameOffsets = (std::memcmp(m_boundDynamicOffsets[bindPoint][set], m_dynamicOffsets[set], sizeof(m_dynamicOffsets[set])) == 0);
+
+		// already bound (the pipeline layouts are compatible, see DeviceVK::GetPipelineLayout)
+		if (m_stateFiltering && isBound && sameOffsets)
+			continue;
+
+		// same set with new scratch buffer regions: no allocation or update, just a bind with the new offsets
+		if (missingSlots == 0 && isBound)
+			m_stats.m_dynamicOffsetRebinds++;
+
+		needsBind[set] = true;
+		anyBind = true;
+	}
+
+	if (!anyBind)
+	{
+		m_stats.m_skippedCommits++;
+		return;
+	}
+
+	// consecutive sets are bound together, the others stay bound
+	for (uint32_t firstSet = 0; firstSet < NUM_DESCRIPTOR_SETS; ++firstSet)
+	{
+		if (!needsBind[firstSet])
+			continue;
+
+		uint32_t numSets = 1;
+		while (firstSet + numSets < NUM_DESCRIPTOR_SETS && needsBind[firstSet + numSets])
+			numSets++;
+
+		BindDescriptorSets(bindPoint, firstSet, numSets);
+
+		firstSet += numSets - 1;
+	}
+}
+
+// makes m_currentDescriptorSets[set] hold the current descriptors of contentSlots: from the cache or a newly written one
+void ContextVK::CommitDescriptorSet(DeviceVK* device, uint32_t set, const uint32_t* contentSlots)
+{
+	if (m_descriptorSetCacheMode != DESCRIPTOR_SET_CACHE_NONE)
+	{
+		BuildDescriptorSetKey(set, contentSlots);
 
-	VkDescriptorSetLayout layout = device->GetDescriptorSetLayout();
+		// all the sets share the same layout, so a cached set can be used at any frequency
+		auto it = m_descriptorSetCache.find(m_descriptorSetKey);
 
-	VkDescriptorSetAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
-	allocInfo.pNext = nullptr;
-	allocInfo.descriptorSetCount = 1;
-	allocInfo.pSetLayouts = &layout;
+		if (it != m_descriptorSetCache.end())
+		{
+			for (uint32_t i = 0; i < NUM_BINDING_TYPES; ++i)
+			{
+				m_writtenSlots[set][i] = contentSlots[i];
+				m_dirtySlots[set][i] &= ~contentSlots[i];
+			}
 
-	allocInfo.descriptorPool = m_descriptorPool;
+			m_currentDescriptorSets[set] = it->second;
+			m_stats.m_descriptorSetCacheHits++;
 
-	VkDescriptorSet descriptorSet;
+			return;
+		}
 
-	VK_CHECK(vkAllocateDescriptorSets(device->GetDevice(), &allocInfo, &descriptorSet));
+		m_stats.m_descriptorSetCacheMisses++;
+	}
+
+	// Create Descriptor Set
+
+	VkDescriptorSet descriptorSet = m_descriptorAllocator.Allocate(device, device->GetDescriptorSetLayout());
 
-	// Update Descriptors
+	auto updateStart = std::chrono::steady_clock::now();
 
-	std::vector<VkWriteDescriptorSet> descriptorWrites;
+	bool hasContent = false;
 
-	// UBOs
-	for (auto it : m_uniformBufferBindings)
+	for (uint32_t i = 0; i < NUM_BINDING_TYPES; ++i)
+		hasContent |= (contentSlots[i] != 0);
+
+	// a set with only the immutable samplers has nothing to write, and no template
+	if (hasContent && m_descriptorUpdateMode == DESCRIPTOR_UPDATE_TEMPLATE && device->SupportsDescriptorUpdateTemplates())
 	{
-		DescriptorBinding descBinding = it.second;
+		// Update Descriptors: a single call writing all the slots straight from the packed descriptors, no write structs to build or parse
+
+		VkDescriptorUpdateTemplateKHR updateTemplate = device->GetDescriptorUpdateTemplate(contentSlots);
+
+		device->UpdateDescriptorSetWithTemplate(descriptorSet, updateTemplate, &m_descriptors[set]);
 
-		VkWriteDescriptorSet wds = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
-		wds.pNext = nullptr;
-		wds.dstSet = descriptorSet;
-		wds.dstBinding = UNIFORM_BUFFER_SLOT(descBinding.m_bindingSlot);
-		wds.dstArrayElement = 0;
-		wds.descriptorCount = 1;
-		wds.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		wds.pImageInfo = nullptr;
-		wds.pBufferInfo = &((BufferVK*)descBinding.m_resource)->GetDescriptor();
-		wds.pTexelBufferView = nullptr;
+		for (uint32_t i = 0; i < NUM_BINDING_TYPES; ++i)
+			m_stats.m_descriptorWrites += CountBits(contentSlots[i]);
 
-		descriptorWrites.emplace_back(wds);
+		m_stats.m_descriptorTemplateUpdates++;
 	}
+	else
+	{
+		UpdateDescriptorSet(device, set, descriptorSet, contentSlots);
+	}
+
+	for (uint32_t i = 0; i < NUM_BINDING_TYPES; ++i)
+	{
+		m_writtenSlots[set][i] = contentSlots[i];
+		m_dirtySlots[set][i] &= ~contentSlots[i];
+	}
+
+	m_stats.m_descriptorUpdateTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - updateStart).count();
 
-	m_uniformBufferBindings.clear();
-	
-	// Texture + Samplers
-	for (auto it : m_textureBindings)
+	m_currentDescriptorSets[set] = descriptorSet;
+
+	if (m_descriptorSetCacheMode != DESCRIPTOR_SET_CACHE_NONE)
+		m_descriptorSetCache.emplace(m_descriptorSetKey, descriptorSet);
+
+	m_stats.m_descriptorSetsAllocated++;
+	m_stats.m_descriptorSetUpdates++;
+}
+
+// Update Descriptors: write the changed or not yet written slots, copy the others from the previous set
+void ContextVK::UpdateDescriptorSet(DeviceVK* device, uint32_t set, VkDescriptorSet descriptorSet, const uint32_t* contentSlots)
+{
+	VkWriteDescriptorSet descriptorWrites[MAX_NUM_BINDINGS];
+	VkCopyDescriptorSet descriptorCopies[MAX_NUM_BINDINGS];
+	uint32_t numWrites = 0;
+	uint32_t numCopies = 0;
+
+	VkDescriptorSet previousSet = m_currentDescriptorSets[set];
+
+	auto updateSlots = [&](BindingType type, VkDescriptorType descriptorType, uint32_t firstBinding, const VkDescriptorBufferInfo* bufferInfos, const VkDescriptorImageInfo* imageInfos, const VkBufferView* texelBufferViews)
+	{
+		uint32_t write = contentSlots[type] & (m_dirtySlots[set][type] | ~m_writtenSlots[set][type]);
+		uint32_t copy = contentSlots[type] & ~write;
+
+		assert(copy == 0 || previousSet != VK_NULL_HANDLE);
+
+		for (uint32_t slot = 0; slot < 32 && ((write | copy) >> slot); ++slot)
+		{
+			uint32_t slotBit = 1u << slot;
+
+			if (write & slotBit)
+			{
+				VkWriteDescriptorSet& wds = descriptorWrites[numWrites++];
+				wds = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+				wds.pNext = nullptr;
+				wds.dstSet = descriptorSet;
+				wds.dstBinding = firstBinding + slot;
+				wds.dstArrayElement = 0;
+				wds.descriptorCount = 1;
+				wds.descriptorType = descriptorType;
+				wds.pImageInfo = imageInfos ? &imageInfos[slot] : nullptr;
+				wds.pBufferInfo = bufferInfos ? &bufferInfos[slot] : nullptr;
+				wds.pTexelBufferView = texelBufferViews ? &texelBufferViews[slot] : nullptr;
+			}
+			else if (copy & slotBit)
+			{
+				VkCopyDescriptorSet& cds = descriptorCopies[numCopies++];
+				cds = { VK_STRUCTURE_TYPE_COPY_DESCRIPTOR_SET };
+				cds.pNext = nullptr;
+				cds.srcSet = previousSet;
+				cds.srcBinding = firstBinding + slot;
+				cds.srcArrayElement = 0;
+				cds.dstSet = descriptorSet;
+				cds.dstBinding = firstBinding + slot;
+				cds.dstArrayElement = 0;
+				cds.descriptorCount = 1;
+			}
+		}
+	};
+
+	const DescriptorPayloadVK& descriptors = m_descriptors[set];
+
+	updateSlots(BINDING_TYPE_UNIFORM_BUFFER, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, UNIFORM_BUFFER_SLOT(0), descriptors.m_uniformBuffers, nullptr, nullptr);
+	updateSlots(BINDING_TYPE_TEXTURE, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, TEXTURE_SLOT(0), nullptr, descriptors.m_textures, nullptr);
+	updateSlots(BINDING_TYPE_STORAGE_IMAGE, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, STORAGE_IMAGE_SLOT(0), nullptr, descriptors.m_storageImages, nullptr);
+	updateSlots(BINDING_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, STORAGE_BUFFER_SLOT(0), descriptors.m_storageBuffers, nullptr, nullptr);
+	updateSlots(BINDING_TYPE_UNIFORM_TEXEL_BUFFER, VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER, UNIFORM_TEXEL_BUFFER_SLOT(0), nullptr, nullptr, descriptors.m_uniformTexelBuffers);
+	updateSlots(BINDING_TYPE_STORAGE_TEXEL_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER, STORAGE_TEXEL_BUFFER_SLOT(0), nullptr, nullptr, descriptors.m_storageTexelBuffers);
+	updateSlots(BINDING_TYPE_SAMPLED_IMAGE, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, SAMPLED_IMAGE_SLOT(0), nullptr, descriptors.m_sampledImages, nullptr);
+
+	vkUpdateDescriptorSets(device->GetDevice(), numWrites, descriptorWrites, numCopies, descriptorCopies);
+
+	m_stats.m_descriptorWrites += numWrites;
+	m_stats.m_descriptorCopies += numCopies;
+}
+
+void ContextVK::BindDescriptorSets(VkPipelineBindPoint bindPoint, uint32_t firstSet, uint32_t numSets)
+{
+	UpdateBoundLayout(bindPoint);
+
+	VkDescriptorSet descriptorSets[NUM_DESCRIPTOR_SETS];
+
+	for (uint32_t i = 0; i < numSets; ++i)
 	{
-		DescriptorBinding descBinding = it.second;
+		uint32_t set = firstSet + i;
 
-		VkWriteDescriptorSet wds = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
-		wds.pNext = nullptr;
-		wds.dstSet = descriptorSet;
-		wds.dstBinding = TEXTURE_SLOT(descBinding.m_bindingSlot);
-		wds.dstArrayElement = 0;
-		wds.descriptorCount = 1;
-		wds.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		wds.pImageInfo = &((TextureVK*)descBinding.m_resource)->GetDescriptor();
-		wds.pBufferInfo = nullptr;
-		wds.pTexelBufferView = nullptr;
+		descriptorSets[i] = m_currentDescriptorSets[set];
 
-		descriptorWrites.emplace_back(wds);
+		m_boundDescriptorSets[bindPoint][set] = m_currentDescriptorSets[set];
+		std::memcpy(m_boundDynamicOffsets[bindPoint][set], m_dynamicOffsets[set], sizeof(m_dynamicOffsets[set]));
 	}
 
-	m_textureBindings.clear();
+	// one offset per dynamic binding, in set and binding order: the UBO slots of each set
+	vkCmdBindDescriptorSets(m_commandBuffer, bindPoint, m_currentPipeline->GetLayout(), firstSet, numSets, descriptorSets, numSets * MAX_UNIFORM_BUFFER_SLOTS, m_dynamicOffsets[firstSet]);
 
-	// Storage Images
-	for (auto it : m_storageImageBindings)
+	// the layouts only differ in their number of sets: the sets beyond the ones of this layout are disturbed by the bind
+	for (uint32_t set = m_currentPipeline->GetNumDescriptorSets(); set < NUM_DESCRIPTOR_SETS; ++set)
+		m_boundDescriptorSets[bindPoint][set] = VK_NULL_HANDLE;
+
+	if (!m_currentPipeline->UsesBindless())
+		m_boundBindlessSets[bindPoint] = false;
+
+	m_stats.m_descriptorSetBinds++;
+}
+
+// writes the used slots of DRAW_SET straight into the command buffer, when any changed since the last push. Returns false if nothing needed to be pushed
+bool ContextVK::PushDescriptorSet(DeviceVK* device, VkPipelineBindPoint bindPoint)
+{
+	// pushing with a layout of the other kind disturbs the previous push
+	UpdateBoundLayout(bindPoint);
+
+	const uint32_t* usedSlots = m_currentPipeline->GetUsedSlots(DRAW_SET);
+
+	uint32_t requiredSlots[NUM_BINDING_TYPES];
+	uint32_t missingSlots = 0;
+
+	for (uint32_t i = 0; i < NUM_BINDING_TYPES; ++i)
+	{
+		requiredSlots[i] = m_boundSlots[DRAW_SET][i] & usedSlots[i];
+		missingSlots |= requiredSlots[i] & (m_pushDirtySlots[i] | ~m_pushedSlots[bindPoint][i]);
+	}
+
+	// the scratch buffer offsets are part of the pushed descriptors
+	for (uint32_t slot = 0; slot < MAX_UNIFORM_BUFFER_SLOTS; ++slot)
 	{
-		DescriptorBinding descBinding = it.second;
+		if ((requiredSlots[BINDING_TYPE_UNIFORM_BUFFER] & (1u << slot)) && m_pushedDynamicOffsets[bindPoint][slot] != m_dynamicOffsets[DRAW_SET][slot])
+			missingSlots |= 1u << slot;
+	}
+
+	if (m_stateFiltering && missingSlots == 0)
+		return false;
 
-		VkWriteDescriptorSet wds = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
-		wds.pNext = nullptr;
-		wds.dstSet = descriptorSet;
-		wds.dstBinding = STORAGE_IMAGE_SLOT(descBinding.m_bindingSlot);
-		wds.dstArrayElement = 0;
-		wds.descriptorCount = 1;
-		wds.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-		wds.pImageInfo = &((TextureVK*)descBinding.m_resource)->GetDescriptor();
-		wds.pBufferInfo = nullptr;
-		wds.pTexelBufferView = nullptr;
+	auto updateStart = std::chrono::steady_clock::now();
 
-		descriptorWrites.emplace_back(wds);
+	VkWriteDescriptorSet descriptorWrites[MAX_NUM_BINDINGS];
+	VkDescriptorBufferInfo uniformBuffers[MAX_UNIFORM_BUFFER_SLOTS];
+	uint32_t numWrites = 0;
+
+	const DescriptorPayloadVK& descriptors = m_descriptors[DRAW_SET];
+
+	for (uint32_t slot = 0; slot < MAX_UNIFORM_BUFFER_SLOTS; ++slot)
+	{
+		uniformBuffers[slot] = descriptors.m_uniformBuffers[slot];
+		uniformBuffers[slot].offset += m_dynamicOffsets[DRAW_SET][slot];
 	}
 
-	m_storageImageBindings.clear();
-	
-	vkUpdateDescriptorSets(device->GetDevice(), uint32_t(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+	// every used slot is pushed again, not only the changed ones
+	auto pushSlots = [&](BindingType type, VkDescriptorType descriptorType, uint32_t firstBinding, const VkDescriptorBufferInfo* bufferInfos, const VkDescriptorImageInfo* imageInfos, const VkBufferView* texelBufferViews)
+	{
+		uint32_t slots = requiredSlots[type];
+
+		for (uint32_t slot = 0; slot < 32 && (slots >> slot); ++slot)
+		{
+			if (!(slots & (1u << slot)))
+				continue;
+
+			VkWriteDescriptorSet& wds = descriptorWrites[numWrites++];
+			wds = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+			wds.pNext = nullptr;
+			wds.dstSet = VK_NULL_HANDLE; // ignored
+			wds.dstBinding = firstBinding + slot;
+			wds.dstArrayElement = 0;
+			wds.descriptorCount = 1;
+			wds.descriptorType = descriptorType;
+			wds.pImageInfo = imageInfos ? &imageInfos[slot] : nullptr;
+			wds.pBufferInfo = bufferInfos ? &bufferInfos[slot] : nullptr;
+			wds.pTexelBufferView = texelBufferViews ? &texelBufferViews[slot] : nullptr;
+		}
+
+		m_pushedSlots[bindPoint][type] = slots;
+		m_pushDirtySlots[type] &= ~slots;
+	};
+
+	pushSlots(BINDING_TYPE_UNIFORM_BUFFER, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, UNIFORM_BUFFER_SLOT(0), uniformBuffers, nullptr, nullptr);
+	pushSlots(BINDING_TYPE_TEXTURE, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, TEXTURE_SLOT(0), nullptr, descriptors.m_textures, nullptr);
+	pushSlots(BINDING_TYPE_STORAGE_IMAGE, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, STORAGE_IMAGE_SLOT(0), nullptr, descriptors.m_storageImages, nullptr);
+	pushSlots(BINDING_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, STORAGE_BUFFER_SLOT(0), descriptors.m_storageBuffers, nullptr, nullptr);
+	pushSlots(BINDING_TYPE_UNIFORM_TEXEL_BUFFER, VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER, UNIFORM_TEXEL_BUFFER_SLOT(0), nullptr, nullptr, descriptors.m_uniformTexelBuffers);
+	pushSlots(BINDING_TYPE_STORAGE_TEXEL_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER, STORAGE_TEXEL_BUFFER_SLOT(0), nullptr, nullptr, descriptors.m_storageTexelBuffers);
+	pushSlots(BINDING_TYPE_SAMPLED_IMAGE, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, SAMPLED_IMAGE_SLOT(0), nullptr, descriptors.m_sampledImages, nullptr);
+
+	std::memcpy(m_pushedDynamicOffsets[bindPoint], m_dynamicOffsets[DRAW_SET], sizeof(m_pushedDynamicOffsets[bindPoint]));
+
+	device->CmdPushDescriptorSet(m_commandBuffer, bindPoint, m_currentPipeline->GetLayout(), DRAW_SET, numWrites, descriptorWrites);
+
+	m_stats.m_descriptorUpdateTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - updateStart).count();
+	m_stats.m_descriptorWrites += numWrites;
+	m_stats.m_pushDescriptorSets++;
 
-	assert(m_currentPipeline != nullptr);
+	return true;
+}
+
+// the pooled and push descriptors layouts differ at DRAW_SET: binding or pushing with the other kind than the last time disturbs DRAW_SET and the bindless set
+void ContextVK::UpdateBoundLayout(VkPipelineBindPoint bindPoint)
+{
+	bool pushLayout = m_currentPipeline->UsesPushDescriptors();
+
+	if (m_boundPushLayouts[bindPoint] == pushLayout)
+		return;
+
+	m_boundPushLayouts[bindPoint] = pushLayout;
+
+	m_boundDescriptorSets[bindPoint][DRAW_SET] = VK_NULL_HANDLE;
+	m_boundBindlessSets[bindPoint] = false;
 
-	vkCmdBindDescriptorSets(m_commandBuffer, m_currentPipeline->GetBindPoint(), m_currentPipeline->GetLayout(), 0, 1, &descriptorSet, 0, nullptr);
+	for (uint32_t i = 0; i < NUM_BINDING_TYPES; ++i)
+		m_pushedSlots[bindPoint][i] = 0;
+}
+
+void ContextVK::BuildDescriptorSetKey(uint32_t set, const uint32_t* contentSlots)
+{
+	m_descriptorSetKey.clear();
+
+	for (uint32_t i = 0; i < NUM_BINDING_TYPES; ++i)
+		m_descriptorSetKey.push_back(contentSlots[i]);
+
+	const DescriptorPayloadVK& descriptors = m_descriptors[set];
+
+	AppendDescriptorKeys(m_descriptorSetKey, contentSlots[BINDING_TYPE_UNIFORM_BUFFER], descriptors.m_uniformBuffers);
+	AppendDescriptorKeys(m_descriptorSetKey, contentSlots[BINDING_TYPE_TEXTURE], descriptors.m_textures);
+	AppendDescriptorKeys(m_descriptorSetKey, contentSlots[BINDING_TYPE_STORAGE_IMAGE], descriptors.m_storageImages);
+	AppendDescriptorKeys(m_descriptorSetKey, contentSlots[BINDING_TYPE_STORAGE_BUFFER], descriptors.m_storageBuffers);
+	AppendDescriptorKeys(m_descriptorSetKey, contentSlots[BINDING_TYPE_UNIFORM_TEXEL_BUFFER], descriptors.m_uniformTexelBuffers);
+	AppendDescriptorKeys(m_descriptorSetKey, contentSlots[BINDING_TYPE_STORAGE_TEXEL_BUFFER], descriptors.m_storageTexelBuffers);
+	AppendDescriptorKeys(m_descriptorSetKey, contentSlots[BINDING_TYPE_SAMPLED_IMAGE], descriptors.m_sampledImages);
+}
+
+bool ContextVK::AreRecordedResourcesValid() const
+{
+	for (auto& check : m_recordedResourceChecks)
+	{
+		if (!check())
+			return false;
+	}
+
+	return true;
 }
 
 }
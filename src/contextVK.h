@@ -2,7 +2,11 @@
 
 #include "bufferVK.h"
 #include "commonVK.h"
+#include "descriptorAllocatorVK.h"
+#include "shaderCommon.h"
+#include "shaderVK.h"
 
+#include <functional>
 #include <unordered_map>
 
 namespace MBRF
@@ -15,78 +19,340 @@ class Resource;
 class PipelineVK;
 class TextureVK;
 class VertexBufferVK;
+struct GraphicsPipelineDesc;
+
+// per context counters, reset at Begin. Skipped = redundant with the current state
+struct ContextStatsVK
+{
+	uint32_t m_drawCalls = 0;
+	uint32_t m_dispatches = 0;
+
+	uint32_t m_pipelineBinds = 0;
+	uint32_t m_skippedPipelineBinds = 0;
+	uint32_t m_bufferBinds = 0;
+	uint32_t m_skippedBufferBinds = 0;
+
+	uint32_t m_descriptorSetBinds = 0;
+	uint32_t m_skippedCommits = 0;
+	uint32_t m_descriptorSetsAllocated = 0;
+	uint32_t m_descriptorWrites = 0;
+	uint32_t m_descriptorCopies = 0;
+
+	// descriptor set cache. Every hit saves an allocation and a vkUpdateDescriptorSets call
+	uint32_t m_descriptorSetCacheHits = 0;
+	uint32_t m_descriptorSetCacheMisses = 0;
+	uint32_t m_descriptorSetUpdates = 0;
+
+	// commits that only changed the dynamic offsets of the scratch uniform buffer regions
+	uint32_t m_dynamicOffsetRebinds = 0;
+
+	// sets written with vkUpdateDescriptorSetWithTemplate, and the CPU time (ms) spent writing the new sets with either path (and pushing them)
+	uint32_t m_descriptorTemplateUpdates = 0;
+	double m_descriptorUpdateTime = 0.0;
+
+	// vkCmdPushDescriptorSetKHR calls, for the pipelines using push descriptors
+	uint32_t m_pushDescriptorSets = 0;
+
+	// vkCmdPushConstants calls, and SetPushConstants calls that went to the uniform buffer because the data didn't fit
+	uint32_t m_pushConstantFlushes = 0;
+	uint32_t m_pushConstantFallbacks = 0;
+
+	// requested pipelines still compiling (see RequestPipeline): binds of the fallback pipeline instead, and draws and dispatches skipped without one
+	uint32_t m_fallbackPipelineBinds = 0;
+	uint32_t m_skippedDraws = 0;
+};
+
+// descriptors of a set (see shaderCommon.h), grouped by type in binding order. Read directly by the descriptor update templates
+struct DescriptorPayloadVK
+{
+	VkDescriptorBufferInfo m_uniformBuffers[MAX_UNIFORM_BUFFER_SLOTS];
+	VkDescriptorImageInfo m_textures[MAX_TEXTURE_SLOTS];
+	VkDescriptorImageInfo m_storageImages[MAX_STORAGE_IMAGE_SLOTS];
+	VkDescriptorBufferInfo m_storageBuffers[MAX_STORAGE_BUFFER_SLOTS];
+	VkBufferView m_uniformTexelBuffers[MAX_UNIFORM_TEXEL_BUFFER_SLOTS];
+	VkBufferView m_storageTexelBuffers[MAX_STORAGE_TEXEL_BUFFER_SLOTS];
+	VkDescriptorImageInfo m_sampledImages[MAX_SAMPLED_IMAGE_SLOTS];
+};
 
 // TODO: add anything related to command buffers recording and submission to this class
-// TODO: implement different types: graphics, compute, transfer
+// TODO: implement transfer type
 class ContextVK
 {
 public:
-	bool Create(DeviceVK* device);
+	enum ContextType
+	{
+		CONTEXT_TYPE_GRAPHICS,
+		CONTEXT_TYPE_COMPUTE,
+		NUM_CONTEXT_TYPES
+	};
+
+	enum DescriptorSetCacheMode
+	{
+		DESCRIPTOR_SET_CACHE_NONE,
+		// sets reused within the frame, all freed at Begin
+		DESCRIPTOR_SET_CACHE_FRAME,
+		// sets kept across the frames of the context until there are s_descriptorSetCacheMaxSets. Call InvalidateDescriptorSetCache when destroying resources that might be cached
+		DESCRIPTOR_SET_CACHE_PERSISTENT
+	};
+
+	enum DescriptorUpdateMode
+	{
+		// vkUpdateDescriptorSets, writing the changed slots and copying the others from the previous set
+		DESCRIPTOR_UPDATE_WRITES,
+		// vkUpdateDescriptorSetWithTemplate, writing all the bound slots from the packed descriptors. Needs VK_KHR_descriptor_update_template
+		DESCRIPTOR_UPDATE_TEMPLATE
+	};
+
+	// secondary contexts record commands executed from a primary context render pass (see StaticCommandBufferVK)
+	bool Create(DeviceVK* device, ContextType type = CONTEXT_TYPE_GRAPHICS, VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
 	void Destroy(DeviceVK* device);
 
 	void Begin(DeviceVK* device);
+	// secondary contexts only: record inside renderTarget's render pass. The commands can be executed with any compatible framebuffer
+	void BeginSecondary(DeviceVK* device, FrameBufferVK* renderTarget);
 	void End();
 
+	// blocks until the last submission of this context has completed on the GPU. IsComplete is the non blocking version
 	void WaitForLastFrame(DeviceVK* device);
-	void Submit(VkQueue queue, VkSemaphore waitSemaphore = VK_NULL_HANDLE, VkSemaphore signalSemaphore = VK_NULL_HANDLE);
+	bool IsComplete(DeviceVK* device);
+
+	// submits to the queue of the context type and signals its timeline semaphore. waitValues are only used by timeline semaphores (use 0 for binary ones)
+	void Submit(DeviceVK* device, const std::vector<VkSemaphore> &waitSemaphores, const std::vector<VkPipelineStageFlags> &waitStages, const std::vector<uint64_t> &waitValues,
+		const std::vector<VkSemaphore> &signalSemaphores);
+
+	// timeline value signaled by the last submission
+	uint64_t GetSubmittedValue() const { return m_submittedValue; };
+
+	ContextType GetType() const { return m_type; };
+	uint32_t GetQueueFamily() const { return m_queueFamily; };
 
-	void BeginPass(FrameBufferVK* renderTarget);
+	// GPU execution time of the last submission (ms), measured with timestamps written at Begin and End. Only valid after WaitForLastFrame
+	bool HasGPUTimings() const { return m_hasGPUTimings; };
+	double GetGPUBeginTime() const { return m_gpuBeginTime; };
+	double GetGPUEndTime() const { return m_gpuEndTime; };
+
+	// secondaryContents: the pass content is only recorded in secondary contexts, executed with ExecuteCommands
+	void BeginPass(FrameBufferVK* renderTarget, bool secondaryContents = false);
 	void EndPass();
 
+	void ExecuteCommands(ContextVK* secondaryContext);
+
+	// viewport and scissor are dynamic state, set to the whole render target by BeginPass (and BeginSecondary). Override them inside the pass
+	void SetViewport(float x, float y, float width, float height, float minDepth = 0.0f, float maxDepth = 1.0f);
+	void SetScissor(int32_t x, int32_t y, uint32_t width, uint32_t height);
+
 	void ClearRenderTarget(int32_t x, int32_t y, uint32_t width, uint32_t height, VkClearColorValue clearColor, VkClearDepthStencilValue clearDepthStencil);
 	void DrawIndexed(uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, uint32_t vertexOffset, uint32_t firstInstance);
+	// stride defaults to tightly packed VkDrawIndexedIndirectCommands. Emulated with one call per draw without the multiDrawIndirect feature
+	void DrawIndexedIndirect(BufferVK* buffer, uint64_t offset, uint32_t drawCount, uint32_t stride = sizeof(VkDrawIndexedIndirectCommand));
+	// the draw count is read from countBuffer (VK_KHR_draw_indirect_count). Without the extension it draws maxDrawCount commands, so the unused ones must be zeroed
+	void DrawIndexedIndirectCount(DeviceVK* device, BufferVK* buffer, uint64_t offset, BufferVK* countBuffer, uint64_t countOffset, uint32_t maxDrawCount, uint32_t stride = sizeof(VkDrawIndexedIndirectCommand));
 	void Dispatch(uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ);
 
+	void FillBuffer(BufferVK* buffer, uint64_t offset, uint64_t size, uint32_t data);
+	void BufferBarrier(BufferVK* buffer, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess);
+
 	void TransitionImageLayout(DeviceVK* device, TextureVK* texture, VkImageLayout newLayout);
 
+	// queue family ownership transfer: release on the context that last used the texture, acquire on the one that is going to use it next.
+	// They are plain layout transitions when both contexts share the same queue family
+	void ReleaseOwnership(DeviceVK* device, TextureVK* texture, uint32_t dstQueueFamily, VkImageLayout newLayout);
+	void AcquireOwnership(DeviceVK* device, TextureVK* texture);
+
+	// also binds the bindless set, when the pipeline uses it
 	void SetPipeline(PipelineVK* pipeline);
+	// the pipeline is looked up in the PipelineStateCache, and created the first time. Returns false if the creation failed
+	bool SetPipeline(DeviceVK* device, const GraphicsPipelineDesc& desc);
+	bool SetPipeline(DeviceVK* device, ShaderVK* computeShader, bool pushDescriptors = false, const SpecializationConstantsVK& specializationConstants = SpecializationConstantsVK());
+	// non-blocking versions: while the pipeline compiles on the PipelineStateCache workers, the fallback pipeline is bound instead, or the following draws
+	// and dispatches are skipped if there's none (or for compute). Returns true if the requested pipeline is bound
+	bool RequestPipeline(DeviceVK* device, const GraphicsPipelineDesc& desc);
+	bool RequestPipeline(DeviceVK* device, ShaderVK* computeShader, bool pushDescriptors = false, const SpecializationConstantsVK& specializationConstants = SpecializationConstantsVK());
+	// must be compatible with the requested pipelines: same render pass and vertex format, and reading a subset of their bindings
+	void SetFallbackPipeline(PipelineVK* pipeline) { m_fallbackPipeline = pipeline; };
+
+	// small per draw/dispatch constants, declared with PUSH_CONSTANTS in the shaders. The writes are batched and flushed at the next draw or dispatch,
+	// and persist across pipeline changes. Returns false if the data didn't fit in the device push constants and went to the uniform buffer at
+	// PUSH_CONSTANTS_FALLBACK_SLOT instead (the shaders need the PUSH_CONSTANTS_FALLBACK variant then, and offset must be 0)
+	bool SetPushConstants(const void* data, uint32_t size, uint32_t offset = 0);
 
 	void SetVertexBuffer(const VertexBufferVK* vertexBuffer, uint64_t offset);
 	void SetIndexBuffer(const IndexBufferVK* indexBuffer, uint64_t offset);
 
-	void SetUniformBuffer(BufferVK* buffer, uint32_t bindingSlot);
-	void SetUniformBuffer(DeviceVK* device, void* data, uint64_t size, uint32_t bindingSlot);
-	void SetTexture(TextureVK* texture, uint32_t bindingSlot);
-	void SetStorageImage(TextureVK* texture, uint32_t bindingSlot);
+	// set: the update frequency of the binding, FRAME_SET, PASS_SET, MATERIAL_SET or DRAW_SET (see shaderCommon.h). Each has its own slots
+	void SetUniformBuffer(BufferVK* buffer, uint32_t bindingSlot, uint32_t set = DRAW_SET);
+	// copies the data to the scratch buffer. Returns false if it doesn't fit (larger than the descriptor range, or the scratch buffer is full for this frame):
+	// nothing is bound and the draws are skipped until the next SetPipeline
+	bool SetUniformBuffer(void* data, uint64_t size, uint32_t bindingSlot, uint32_t set = DRAW_SET);
+	void SetStorageBuffer(BufferVK* buffer, uint32_t bindingSlot, uint32_t set = DRAW_SET);
+	// the buffer needs the texel usage and format (see BufferVK::Create)
+	void SetUniformTexelBuffer(BufferVK* buffer, uint32_t bindingSlot, uint32_t set = DRAW_SET);
+	void SetStorageTexelBuffer(BufferVK* buffer, uint32_t bindingSlot, uint32_t set = DRAW_SET);
+	void SetTexture(TextureVK* texture, uint32_t bindingSlot, uint32_t set = DRAW_SET);
+	void SetStorageImage(TextureVK* texture, uint32_t bindingSlot, uint32_t set = DRAW_SET);
+	// the image only, without the texture sampler: sampled with the immutable samplers of the layout (see shaderCommon.h)
+	void SetSampledImage(TextureVK* texture, uint32_t bindingSlot, uint32_t set = DRAW_SET);
 
+	// bindings persist until they are replaced or the context is begun again. Only the sets and slots the current pipeline reads are considered
+	// (see PipelineVK::GetUsedSlots): a new set is written for the frequencies with one of those changed since the last commit, or never written yet.
+	// With a template (see DescriptorUpdateMode), or writing the changed slots and copying the rest from the previous set.
+	// Only the changed sets are bound, the others stay bound across pipeline changes. Nothing is done if nothing changed.
+	// For the pipelines using push descriptors DRAW_SET isn't allocated: its used slots are pushed into the command buffer when any changed
 	void CommitBindings(DeviceVK* device);
 
+	// disabling the filtering issues every bind and rewrites every bound slot at commit. For measuring its benefit
+	void SetStateFiltering(bool enabled) { m_stateFiltering = enabled; };
+	bool IsStateFiltering() const { return m_stateFiltering; };
+
+	const ContextStatsVK& GetStats() const { return m_stats; };
+	const DescriptorAllocatorStatsVK& GetDescriptorAllocatorStats() const { return m_descriptorAllocator.GetStats(); };
+
+	// committed bindings are looked up by their contents (slots and descriptors) before allocating and writing a new set
+	void SetDescriptorSetCacheMode(DescriptorSetCacheMode mode) { m_descriptorSetCacheMode = mode; };
+	DescriptorSetCacheMode GetDescriptorSetCacheMode() const { return m_descriptorSetCacheMode; };
+	// the cache is cleared at the next Begin
+	void InvalidateDescriptorSetCache() { m_descriptorSetCacheInvalidated = true; };
+
+	// how new sets are written. Templates fall back to writes when the device doesn't support them
+	void SetDescriptorUpdateMode(DescriptorUpdateMode mode) { m_descriptorUpdateMode = mode; };
+	DescriptorUpdateMode GetDescriptorUpdateMode() const { return m_descriptorUpdateMode; };
+
+	// secondary contexts only: false if any pipeline, buffer or texture used in the recording has been recreated since
+	bool AreRecordedResourcesValid() const;
+
 //private:
+	enum BindingType
+	{
+		BINDING_TYPE_UNIFORM_BUFFER,
+		BINDING_TYPE_TEXTURE,
+		BINDING_TYPE_STORAGE_IMAGE,
+		BINDING_TYPE_STORAGE_BUFFER,
+		BINDING_TYPE_UNIFORM_TEXEL_BUFFER,
+		BINDING_TYPE_STORAGE_TEXEL_BUFFER,
+		BINDING_TYPE_SAMPLED_IMAGE,
+		NUM_BINDING_TYPES
+	};
+
 	bool CreateDescriptorPools(DeviceVK* device);
 	void DestroyDescriptorPools(DeviceVK* device);
 	void ResetDescriptorPools(DeviceVK* device);
 
+	bool CreateQueryPools(DeviceVK* device);
+	void DestroyQueryPools(DeviceVK* device);
+	void ReadTimestamps(DeviceVK* device);
+
+	template<typename DescriptorInfo>
+	bool UpdateBinding(uint32_t set, BindingType type, DescriptorInfo* descriptors, uint32_t bindingSlot, const DescriptorInfo& descriptor);
+
+	// contentSlots: per BindingType, the slots the new set must hold
+	void CommitDescriptorSet(DeviceVK* device, uint32_t set, const uint32_t* contentSlots);
+	void UpdateDescriptorSet(DeviceVK* device, uint32_t set, VkDescriptorSet descriptorSet, const uint32_t* contentSlots);
+	void BindDescriptorSets(VkPipelineBindPoint bindPoint, uint32_t firstSet, uint32_t numSets);
+	bool PushDescriptorSet(DeviceVK* device, VkPipelineBindPoint bindPoint);
+	void UpdateBoundLayout(VkPipelineBindPoint bindPoint);
+	void BuildDescriptorSetKey(uint32_t set, const uint32_t* contentSlots);
+
+	// forget the currently bound state (i.e. after executing secondary command buffers, which leaves it undefined)
+	void InvalidateState();
+
+	void FlushPushConstants();
+
 public:
+	ContextType m_type = CONTEXT_TYPE_GRAPHICS;
+	VkCommandBufferLevel m_level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	uint32_t m_queueFamily = 0;
+	bool m_multiDrawIndirect = false;
+
 	VkCommandBuffer m_commandBuffer = VK_NULL_HANDLE;
-	VkFence m_fence = VK_NULL_HANDLE;
+	uint64_t m_submittedValue = 0;
+
+	// 2 timestamps per submission: begin and end of the command buffer
+	VkQueryPool m_timestampQueryPool = VK_NULL_HANDLE;
+	bool m_timestampsPending = false;
+	bool m_hasGPUTimings = false;
+	double m_gpuBeginTime = 0.0;
+	double m_gpuEndTime = 0.0;
 
 	PipelineVK* m_currentPipeline = nullptr;
 	FrameBufferVK* m_currentFrameBuffer = nullptr;
 
-	// scratch buffer used for storing frame uniform data
+	PipelineVK* m_fallbackPipeline = nullptr;
+	// the requested pipeline isn't ready and there's no fallback
+	bool m_skipDraws = false;
+
+	// scratch buffer used for storing frame uniform data. The UBO slots are dynamic: every region is bound with the same descriptor and its own offset
 	BufferVK m_uniformScratchBuffer;
 	uint32_t m_currentScratchBufferOffset = 0;
-	// trackers for the (sub)resources using the scatch buffer memory
-	std::vector<BufferRegionVK> m_uniformBufferRegions;
+	uint32_t m_scratchBufferSize = 0;
+	uint32_t m_scratchBufferAlignment = 256;
+	VkDescriptorBufferInfo m_scratchBufferDescriptor = {};
+
+	// sets of the layout based on shaderCommon.h, from pools chained as needed. Reset every frame
+	DescriptorAllocatorVK m_descriptorAllocator;
+
+	// shadow state, to skip redundant binds. Indexed by VkPipelineBindPoint (graphics and compute only)
+	VkPipeline m_boundPipelines[2] = {};
+	VkDescriptorSet m_boundDescriptorSets[2][NUM_DESCRIPTOR_SETS] = {};
+	bool m_boundBindlessSets[2] = {};
+	// whether the last bind or push used a push descriptors layout, and the DRAW_SET slots pushed with their scratch buffer offsets
+	bool m_boundPushLayouts[2] = {};
+	uint32_t m_pushedSlots[2][NUM_BINDING_TYPES] = {};
+	uint32_t m_pushedDynamicOffsets[2][MAX_UNIFORM_BUFFER_SLOTS] = {};
 
-	VkDescriptorPool m_descriptorPool = VK_NULL_HANDLE;
-	// layout is going to be fixed, based on shaderCommon.h
-	// consider using a freelist of descriptor pools so can allocate as many descriptor sets as we want. Reset every frame
+	// VK_NULL_HANDLE when bindless is disabled
+	VkDescriptorSet m_bindlessDescriptorSet = VK_NULL_HANDLE;
 
-	// add create/update descriptor set functionality
+	VkBuffer m_boundVertexBuffer = VK_NULL_HANDLE;
+	uint64_t m_boundVertexBufferOffset = 0;
+	VkBuffer m_boundIndexBuffer = VK_NULL_HANDLE;
+	uint64_t m_boundIndexBufferOffset = 0;
+	VkIndexType m_boundIndexType = VK_INDEX_TYPE_UINT32;
 
-	struct DescriptorBinding
+	// per set (indexed by FRAME_SET...DRAW_SET): descriptors of the bound resources, with a bit per slot for the bound and the changed since the last commit ones
+	DescriptorPayloadVK m_descriptors[NUM_DESCRIPTOR_SETS] = {};
+	uint32_t m_boundSlots[NUM_DESCRIPTOR_SETS][NUM_BINDING_TYPES] = {};
+	uint32_t m_dirtySlots[NUM_DESCRIPTOR_SETS][NUM_BINDING_TYPES] = {};
+	// slots holding a descriptor in m_currentDescriptorSets (not dirty ones are up to date)
+	uint32_t m_writtenSlots[NUM_DESCRIPTOR_SETS][NUM_BINDING_TYPES] = {};
+	// DRAW_SET slots changed since the last push
+	uint32_t m_pushDirtySlots[NUM_BINDING_TYPES] = {};
+
+	// offsets of the UBO slots, 0 for the buffers set with SetUniformBuffer(buffer). Bound ones indexed by VkPipelineBindPoint
+	uint32_t m_dynamicOffsets[NUM_DESCRIPTOR_SETS][MAX_UNIFORM_BUFFER_SLOTS] = {};
+	uint32_t m_boundDynamicOffsets[2][NUM_DESCRIPTOR_SETS][MAX_UNIFORM_BUFFER_SLOTS] = {};
+
+	// last committed sets, sources of the copies for the unchanged slots
+	VkDescriptorSet m_currentDescriptorSets[NUM_DESCRIPTOR_SETS] = {};
+
+	// push constants written since Begin, with the range not yet sent
+	uint8_t m_pushConstants[MAX_PUSH_CONSTANTS_SIZE] = {};
+	uint32_t m_pushConstantsSize = 0;
+	uint32_t m_pushConstantsWrittenSize = 0;
+	uint32_t m_pushConstantsDirtyBegin = 0;
+	uint32_t m_pushConstantsDirtyEnd = 0;
+
+	bool m_stateFiltering = true;
+	ContextStatsVK m_stats;
+
+	struct DescriptorSetKeyHash
 	{
-		Resource* m_resource;
-		uint32_t m_bindingSlot;
+		size_t operator()(const std::vector<uint64_t>& key) const;
 	};
 
-	std::unordered_map<uint32_t, DescriptorBinding> m_uniformBufferBindings;
-	std::unordered_map<uint32_t, DescriptorBinding> m_textureBindings;
-	std::unordered_map<uint32_t, DescriptorBinding> m_storageImageBindings;
+	// key: slot masks followed by the descriptors of those slots
+	std::unordered_map<std::vector<uint64_t>, VkDescriptorSet, DescriptorSetKeyHash> m_descriptorSetCache;
+	std::vector<uint64_t> m_descriptorSetKey;
+	DescriptorSetCacheMode m_descriptorSetCacheMode = DESCRIPTOR_SET_CACHE_FRAME;
+	bool m_descriptorSetCacheInvalidated = false;
+
+	DescriptorUpdateMode m_descriptorUpdateMode = DESCRIPTOR_UPDATE_TEMPLATE;
+
+	// secondary contexts: the Vulkan handles baked in the recording, checked against the current ones of the resources
+	std::vector<std::function<bool()>> m_recordedResourceChecks;
 
 private:
-	static const uint32_t s_descriptorPoolMaxSets = 1024;
+	static const uint32_t s_descriptorSetCacheMaxSets = 1024;
+	static const uint32_t s_maxScratchUniformBufferRange = 64 * 1024;
 };
 
 }
@@ -0,0 +1,115 @@
+#include "descriptorAllocatorVK.h"
+
+#include "deviceVK.h"
+
+namespace MBRF
+{
+
+bool DescriptorAllocatorVK::Create(DeviceVK* device)
+{
+	m_pools.push_back(device->AcquireDescriptorPool());
+	m_currentPool = 0;
+	m_numAllocatedSets = 0;
+
+	m_stats = {};
+	m_stats.m_numPools = 1;
+
+	return m_pools[0].m_pool != VK_NULL_HANDLE;
+}
+
+void DescriptorAllocatorVK::Destroy(DeviceVK* device)
+{
+	for (DescriptorPoolVK& pool : m_pools)
+	{
+		if (pool.m_numAllocatedSets > 0)
+			VK_CHECK(vkResetDescriptorPool(device->GetDevice(), pool.m_pool, 0));
+
+		pool.m_numAllocatedSets = 0;
+
+		device->ReleaseDescriptorPool(pool);
+	}
+
+	m_pools.clear();
+	m_currentPool = 0;
+	m_numAllocatedSets = 0;
+}
+
+void DescriptorAllocatorVK::Reset(DeviceVK* device)
+{
+	device->ReportDescriptorSetUsage(m_numAllocatedSets);
+
+	for (DescriptorPoolVK& pool : m_pools)
+	{
+		if (pool.m_numAllocatedSets > 0)
+			VK_CHECK(vkResetDescriptorPool(device->GetDevice(), pool.m_pool, 0));
+
+		pool.m_numAllocatedSets = 0;
+	}
+
+	// keep the first pool, unless the pools are now sized bigger: then it goes back too, and a frame should fit in the new one
+	size_t numKeptPools = (m_pools[0].m_maxSets < device->GetDescriptorPoolSize()) ? 0 : 1;
+
+	for (size_t i = numKeptPools; i < m_pools.size(); ++i)
+		device->ReleaseDescriptorPool(m_pools[i]);
+
+	m_pools.resize(numKeptPools);
+
+	if (m_pools.empty())
+		m_pools.push_back(device->AcquireDescriptorPool());
+
+	m_currentPool = 0;
+	m_numAllocatedSets = 0;
+
+	m_stats.m_numPools = 1;
+	m_stats.m_poolGrowths = 0;
+}
+
+VkDescriptorSet DescriptorAllocatorVK::Allocate(DeviceVK* device, VkDescriptorSetLayout layout)
+{
+	// every set is a full set of the layout the pools are sized for, so counting the sets is enough to know when a pool is full
+	if (m_pools[m_currentPool].m_numAllocatedSets == m_pools[m_currentPool].m_maxSets)
+		NextPool(device);
+
+	VkDescriptorSetAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+	allocInfo.pNext = nullptr;
+	allocInfo.descriptorPool = m_pools[m_currentPool].m_pool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &layout;
+
+	VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+	VkResult result = vkAllocateDescriptorSets(device->GetDevice(), &allocInfo, &descriptorSet);
+
+	// shouldn't happen given the above, but drivers are allowed to fail on fragmentation: try once more with a new pool
+	if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL)
+	{
+		NextPool(device);
+
+		allocInfo.descriptorPool = m_pools[m_currentPool].m_pool;
+		result = vkAllocateDescriptorSets(device->GetDevice(), &allocInfo, &descriptorSet);
+	}
+
+	assert(result == VK_SUCCESS);
+
+	m_pools[m_currentPool].m_numAllocatedSets++;
+	m_numAllocatedSets++;
+
+	return descriptorSet;
+}
+
+bool DescriptorAllocatorVK::NextPool(DeviceVK* device)
+{
+	m_currentPool++;
+
+	if (m_currentPool == m_pools.size())
+	{
+		m_pools.push_back(device->AcquireDescriptorPool());
+
+		m_stats.m_numPools++;
+		m_stats.m_poolGrowths++;
+	}
+
+	return m_pools[m_currentPool].m_pool != VK_NULL_HANDLE;
+}
+
+}
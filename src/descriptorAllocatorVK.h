@@ -0,0 +1,55 @@
+#pragma once
+
+#include "commonVK.h"
+
+#include <vector>
+
+namespace MBRF
+{
+
+class DeviceVK;
+
+// pools for the sets of the main descriptor set layout (see shaderCommon.h), with room for maxSets full sets
+struct DescriptorPoolVK
+{
+	VkDescriptorPool m_pool = VK_NULL_HANDLE;
+	uint32_t m_maxSets = 0;
+	uint32_t m_numAllocatedSets = 0;
+};
+
+struct DescriptorAllocatorStatsVK
+{
+	uint32_t m_numPools = 0;
+	// pools chained since the last reset because the current one was full
+	uint32_t m_poolGrowths = 0;
+};
+
+// Linear descriptor set allocator: sets are allocated from the current pool, and another pool is chained when it runs out.
+// Reset frees all the sets at once, resetting the pools and returning the extra ones to the device free list (see DeviceVK::AcquireDescriptorPool)
+class DescriptorAllocatorVK
+{
+public:
+	bool Create(DeviceVK* device);
+	void Destroy(DeviceVK* device);
+
+	// the caller must make sure the GPU is done with all the allocated sets
+	void Reset(DeviceVK* device);
+
+	VkDescriptorSet Allocate(DeviceVK* device, VkDescriptorSetLayout layout);
+
+	// since the last reset
+	uint32_t GetNumAllocatedSets() const { return m_numAllocatedSets; };
+	const DescriptorAllocatorStatsVK& GetStats() const { return m_stats; };
+
+private:
+	bool NextPool(DeviceVK* device);
+
+	// the first one is kept across resets, the others go back to the device
+	std::vector<DescriptorPoolVK> m_pools;
+	uint32_t m_currentPool = 0;
+	uint32_t m_numAllocatedSets = 0;
+
+	DescriptorAllocatorStatsVK m_stats;
+};
+
+}
@@ -6,6 +6,13 @@
 
 #include "shaderCommon.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
 #include <iostream>
 #include <set>
 
@@ -75,7 +82,13 @@ void FrameDataVK::Destroy(DeviceVK* device)
 // ------------------------------- DeviceVK -------------------------------
 
 const std::vector<const char*> validationLayers = { "VK_LAYER_KHRONOS_validation" };
-const std::vector<const char*> requiredExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+const std::vector<const char*> requiredExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME };
+// enabled only when available, check IsExtensionEnabled before using them
+const std::vector<const char*> optionalExtensions = { VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME, VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME, VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME,
+	VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME };
+
+// relative to the working directory, so each sample has its own
+const char* DeviceVK::s_pipelineCacheFileName = "pipelineCache.bin";
 
 void DeviceVK::Init(SwapchainVK* swapchain, GLFWwindow* window, uint32_t width, uint32_t height, uint32_t maxFramesInFlight, bool enableValidation)
 {
@@ -90,18 +103,33 @@ void DeviceVK::Init(SwapchainVK* swapchain, GLFWwindow* window, uint32_t width,
 	m_swapchain->Create(this, width, height);
 	CreateCommandPools();
 	CreateDescriptorSetLayouts();
+	CreateBindlessDescriptors();
+	CreatePipelineLayouts();
+	CreatePipelineCache();
 
+	CreateTimelineSemaphores();
 	CreateFrameData();
 	CreateGraphicsContexts();
+	CreateComputeContexts();
 
 	m_swapchainImageCount = m_swapchain->m_imageCount;
 }
 
 void DeviceVK::Cleanup()
 {
+	WaitForDevice();
+	ProcessFrameCompletionCallbacks(true);
+
+	DestroyComputeContexts();
 	DestroyGraphicsContexts();
 	DestroyFrameData();
+	DestroyTimelineSemaphores();
 
+	DestroyDescriptorPools();
+	DestroyDescriptorUpdateTemplates();
+	DestroyPipelineCache();
+	DestroyPipelineLayouts();
+	DestroyBindlessDescriptors();
 	DestroyDescriptorSetLayouts();
 	DestroyCommandPools();
 	m_swapchain->Destroy(this);
@@ -113,12 +141,12 @@ void DeviceVK::Cleanup()
 void DeviceVK::RecreateSwapchain(uint32_t width, uint32_t height)
 {
 	// cleanup old swapchann
-	DestroyGraphicsContexts();
 	m_swapchain->Destroy(this, true);
 
 	// create new one
 	m_swapchain->Create(this, width, height);
-	CreateGraphicsContexts();
+
+	m_swapchainImageCount = m_swapchain->m_imageCount;
 }
 
 bool DeviceVK::CreateInstance(bool enableValidation)
@@ -144,6 +172,9 @@ bool DeviceVK::CreateInstance(bool enableValidation)
 
 	std::vector<const char*> requiredExtensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
 
+	// needed by VK_KHR_timeline_semaphore
+	requiredExtensions.emplace_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+
 	// add validation layer extension
 	if (m_validationLayerEnabled)
 		requiredExtensions.emplace_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -210,7 +241,7 @@ void DeviceVK::DestroyInstance()
 	vkDestroyInstance(m_instance, nullptr);
 }
 
-uint32_t DeviceVK::FindDeviceQueueFamilyIndex(VkPhysicalDevice device, VkQueueFlags desiredCapabilities, bool queryPresentationSupport)
+uint32_t DeviceVK::FindDeviceQueueFamilyIndex(VkPhysicalDevice device, VkQueueFlags desiredCapabilities, bool queryPresentationSupport, VkQueueFlags excludedCapabilities)
 {
 	uint32_t queueFamilyCount;
 	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
@@ -226,7 +257,7 @@ uint32_t DeviceVK::FindDeviceQueueFamilyIndex(VkPhysicalDevice device, VkQueueFl
 	{
 		VkQueueFamilyProperties queueFamily = queueFamilies[index];
 
-		if (queueFamily.queueCount > 0 && (queueFamily.queueFlags & desiredCapabilities) != 0)
+		if (queueFamily.queueCount > 0 && (queueFamily.queueFlags & desiredCapabilities) != 0 && (queueFamily.queueFlags & excludedCapabilities) == 0)
 		{
 			if (queryPresentationSupport)
 			{
@@ -350,40 +381,246 @@ bool DeviceVK::CreateDevice()
 	if (!m_physicalDevice)
 		return false;
 
+	uint32_t queueFamilyCount;
+	vkGetPhysicalDeviceQueueFamilyProperties(m_physicalDevice, &queueFamilyCount, nullptr);
+
+	m_queueFamilyProperties.resize(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(m_physicalDevice, &queueFamilyCount, m_queueFamilyProperties.data());
+
+	// async compute: prefer a dedicated compute family. Otherwise try to get a second queue from the graphics family, or fall back to sharing the graphics queue
+	m_computeQueueFamily = FindDeviceQueueFamilyIndex(m_physicalDevice, VK_QUEUE_COMPUTE_BIT, false, VK_QUEUE_GRAPHICS_BIT);
+	m_computeQueueIndex = 0;
+
+	if (m_computeQueueFamily == 0xFFFF)
+	{
+		m_computeQueueFamily = m_graphicsQueueFamily;
+		m_computeQueueIndex = (m_queueFamilyProperties[m_graphicsQueueFamily].queueCount > 1) ? 1 : 0;
+	}
+
+	std::cout << "Async compute queue family: " << m_computeQueueFamily << " (graphics queue family: " << m_graphicsQueueFamily << ")" << std::endl;
+
+	// Extensions
+
+	uint32_t extensionCount;
+	VK_CHECK(vkEnumerateDeviceExtensionProperties(m_physicalDevice, nullptr, &extensionCount, nullptr));
+
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	VK_CHECK(vkEnumerateDeviceExtensionProperties(m_physicalDevice, nullptr, &extensionCount, availableExtensions.data()));
+
+	std::vector<const char*> deviceExtensions = requiredExtensions;
+
+	for (const char* extension : optionalExtensions)
+	{
+		if (UtilsVK::IsExtensionSupported(extension, availableExtensions))
+			deviceExtensions.emplace_back(extension);
+		else
+			std::cout << "Optional extension " << extension << " not supported" << std::endl;
+	}
+
+	m_bindlessEnabled = CheckBindlessSupport(availableExtensions);
+
+	if (m_bindlessEnabled)
+	{
+		deviceExtensions.emplace_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+		deviceExtensions.emplace_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+	}
+
+	std::cout << "Bindless descriptors " << (m_bindlessEnabled ? "enabled" : "not supported") << std::endl;
+
+	m_graphicsPipelineLibraryEnabled = CheckGraphicsPipelineLibrarySupport(availableExtensions);
+
+	if (m_graphicsPipelineLibraryEnabled)
+	{
+		deviceExtensions.emplace_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+		deviceExtensions.emplace_back(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+	}
+
+	std::cout << "Graphics pipeline library " << (m_graphicsPipelineLibraryEnabled ? "enabled" : "not supported") << std::endl;
+
+	m_enabledExtensions.clear();
+	m_enabledExtensions.insert(deviceExtensions.begin(), deviceExtensions.end());
+
+	// Features: only enable the ones actually used
+
+	m_enabledFeatures = {};
+	// GPU driven rendering: multiple draws per indirect call, per draw data indexed by firstInstance
+	m_enabledFeatures.multiDrawIndirect = m_physicalDeviceFeatures.multiDrawIndirect;
+	m_enabledFeatures.drawIndirectFirstInstance = m_physicalDeviceFeatures.drawIndirectFirstInstance;
+	// SAMPLER_ANISOTROPIC immutable sampler
+	m_enabledFeatures.samplerAnisotropy = m_physicalDeviceFeatures.samplerAnisotropy;
+
 	// Create logical device
 
 	// graphics and presentation queue can have the same family index
-	std::set<uint32_t> uniqueQueueFamilies = { m_graphicsQueueFamily };
+	std::set<uint32_t> uniqueQueueFamilies = { m_graphicsQueueFamily, m_computeQueueFamily };
 
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 
-	float queuePriorities[1] = { 1.0f };
+	float queuePriorities[2] = { 1.0f, 1.0f };
 
 	for (auto queueFamily : uniqueQueueFamilies)
 	{
+		uint32_t queueCount = (queueFamily == m_computeQueueFamily) ? m_computeQueueIndex + 1 : 1;
+
 		VkDeviceQueueCreateInfo graphicsQueueCreateInfo = { VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO };
 		graphicsQueueCreateInfo.pNext = nullptr;
 		graphicsQueueCreateInfo.flags = 0;
 		graphicsQueueCreateInfo.queueFamilyIndex = queueFamily;
-		graphicsQueueCreateInfo.queueCount = 1;
+		graphicsQueueCreateInfo.queueCount = queueCount;
 		graphicsQueueCreateInfo.pQueuePriorities = queuePriorities;
 		queueCreateInfos.emplace_back(graphicsQueueCreateInfo);
 	}
 
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineSemaphoreFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR };
+	timelineSemaphoreFeatures.pNext = nullptr;
+	timelineSemaphoreFeatures.timelineSemaphore = VK_TRUE;
+
+	// only the descriptor indexing features used by the bindless set
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT };
+	descriptorIndexingFeatures.pNext = nullptr;
+	descriptorIndexingFeatures.runtimeDescriptorArray = VK_TRUE;
+	descriptorIndexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+	descriptorIndexingFeatures.shaderStorageBufferArrayNonUniformIndexing = VK_TRUE;
+	descriptorIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+	descriptorIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+	descriptorIndexingFeatures.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+	descriptorIndexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+
+	if (m_bindlessEnabled)
+		timelineSemaphoreFeatures.pNext = &descriptorIndexingFeatures;
+
+	VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT graphicsPipelineLibraryFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT };
+	graphicsPipelineLibraryFeatures.pNext = nullptr;
+	graphicsPipelineLibraryFeatures.graphicsPipelineLibrary = VK_TRUE;
+
+	if (m_graphicsPipelineLibraryEnabled)
+	{
+		graphicsPipelineLibraryFeatures.pNext = timelineSemaphoreFeatures.pNext;
+		timelineSemaphoreFeatures.pNext = &graphicsPipelineLibraryFeatures;
+	}
+
 	VkDeviceCreateInfo createInfo = { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO };
-	createInfo.pNext = nullptr;
+	createInfo.pNext = &timelineSemaphoreFeatures;
 	createInfo.flags = 0;
 	createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 	createInfo.pQueueCreateInfos = queueCreateInfos.data();
 	createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
 	createInfo.ppEnabledLayerNames = validationLayers.data();
-	createInfo.enabledExtensionCount = static_cast<uint32_t>(requiredExtensions.size());
-	createInfo.ppEnabledExtensionNames = requiredExtensions.data();
-	createInfo.pEnabledFeatures = nullptr;
+	createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
+	createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+	createInfo.pEnabledFeatures = &m_enabledFeatures;
 
 	VK_CHECK(vkCreateDevice(m_physicalDevice, &createInfo, nullptr, &m_device));
 
 	vkGetDeviceQueue(m_device, m_graphicsQueueFamily, 0, &m_graphicsQueue);
+	vkGetDeviceQueue(m_device, m_computeQueueFamily, m_computeQueueIndex, &m_computeQueue);
+
+	m_vkWaitSemaphoresKHR = (PFN_vkWaitSemaphoresKHR)vkGetDeviceProcAddr(m_device, "vkWaitSemaphoresKHR");
+	m_vkGetSemaphoreCounterValueKHR = (PFN_vkGetSemaphoreCounterValueKHR)vkGetDeviceProcAddr(m_device, "vkGetSemaphoreCounterValueKHR");
+
+	assert(m_vkWaitSemaphoresKHR && m_vkGetSemaphoreCounterValueKHR);
+
+	if (IsExtensionEnabled(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME))
+		m_vkCmdDrawIndexedIndirectCountKHR = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(m_device, "vkCmdDrawIndexedIndirectCountKHR");
+
+	if (IsExtensionEnabled(VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME))
+	{
+		m_vkCreateDescriptorUpdateTemplateKHR = (PFN_vkCreateDescriptorUpdateTemplateKHR)vkGetDeviceProcAddr(m_device, "vkCreateDescriptorUpdateTemplateKHR");
+		m_vkDestroyDescriptorUpdateTemplateKHR = (PFN_vkDestroyDescriptorUpdateTemplateKHR)vkGetDeviceProcAddr(m_device, "vkDestroyDescriptorUpdateTemplateKHR");
+		m_vkUpdateDescriptorSetWithTemplateKHR = (PFN_vkUpdateDescriptorSetWithTemplateKHR)vkGetDeviceProcAddr(m_device, "vkUpdateDescriptorSetWithTemplateKHR");
+	}
+
+	if (IsExtensionEnabled(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME))
+		m_vkCmdPushDescriptorSetKHR = (PFN_vkCmdPushDescriptorSetKHR)vkGetDeviceProcAddr(m_device, "vkCmdPushDescriptorSetKHR");
+
+	std::cout << "Push descriptors " << (SupportsPushDescriptors() ? "enabled" : "not supported") << std::endl;
+
+	return true;
+}
+
+bool DeviceVK::CheckBindlessSupport(const std::vector<VkExtensionProperties>& availableExtensions)
+{
+	if (!UtilsVK::IsExtensionSupported(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME, availableExtensions) || !UtilsVK::IsExtensionSupported(VK_KHR_MAINTENANCE3_EXTENSION_NAME, availableExtensions))
+		return false;
+
+	// VK_KHR_get_physical_device_properties2 is enabled on the instance
+	auto getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(m_instance, "vkGetPhysicalDeviceFeatures2KHR");
+	auto getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(m_instance, "vkGetPhysicalDeviceProperties2KHR");
+
+	if (!getFeatures2 || !getProperties2)
+		return false;
+
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT };
+	indexingFeatures.pNext = nullptr;
+
+	VkPhysicalDeviceFeatures2KHR features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR };
+	features.pNext = &indexingFeatures;
+
+	getFeatures2(m_physicalDevice, &features);
+
+	VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProperties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT };
+	indexingProperties.pNext = nullptr;
+
+	VkPhysicalDeviceProperties2KHR properties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR };
+	properties.pNext = &indexingProperties;
+
+	getProperties2(m_physicalDevice, &properties);
+
+	bool featuresSupported = indexingFeatures.runtimeDescriptorArray && indexingFeatures.shaderSampledImageArrayNonUniformIndexing && indexingFeatures.shaderStorageBufferArrayNonUniformIndexing &&
+		indexingFeatures.descriptorBindingPartiallyBound && indexingFeatures.descriptorBindingSampledImageUpdateAfterBind && indexingFeatures.descriptorBindingStorageBufferUpdateAfterBind &&
+		indexingFeatures.descriptorBindingUpdateUnusedWhilePending;
+
+	// the update after bind limits count all the descriptors of the pipeline layout, including the regular sets ones (combined samplers count as both)
+	const uint32_t textureSlots = NUM_DESCRIPTOR_SETS * MAX_TEXTURE_SLOTS;
+	const uint32_t samplerSlots = textureSlots + NUM_DESCRIPTOR_SETS * NUM_IMMUTABLE_SAMPLERS;
+	const uint32_t sampledImageSlots = textureSlots + NUM_DESCRIPTOR_SETS * (MAX_UNIFORM_TEXEL_BUFFER_SLOTS + MAX_SAMPLED_IMAGE_SLOTS);
+	const uint32_t storageBufferSlots = NUM_DESCRIPTOR_SETS * MAX_STORAGE_BUFFER_SLOTS;
+
+	bool limitsSupported = indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages >= MAX_BINDLESS_TEXTURES + sampledImageSlots &&
+		indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers >= MAX_BINDLESS_SAMPLERS + samplerSlots &&
+		indexingProperties.maxPerStageDescriptorUpdateAfterBindStorageBuffers >= MAX_BINDLESS_STORAGE_BUFFERS + storageBufferSlots &&
+		indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages >= MAX_BINDLESS_TEXTURES + sampledImageSlots &&
+		indexingProperties.maxDescriptorSetUpdateAfterBindSamplers >= MAX_BINDLESS_SAMPLERS + samplerSlots &&
+		indexingProperties.maxDescriptorSetUpdateAfterBindStorageBuffers >= MAX_BINDLESS_STORAGE_BUFFERS + storageBufferSlots &&
+		indexingProperties.maxUpdateAfterBindDescriptorsInAllPools >= MAX_BINDLESS_TEXTURES + MAX_BINDLESS_SAMPLERS + MAX_BINDLESS_STORAGE_BUFFERS &&
+		properties.properties.limits.maxBoundDescriptorSets > BINDLESS_SET;
+
+	return featuresSupported && limitsSupported;
+}
+
+bool DeviceVK::CheckGraphicsPipelineLibrarySupport(const std::vector<VkExtensionProperties>& availableExtensions)
+{
+	if (!UtilsVK::IsExtensionSupported(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME, availableExtensions) || !UtilsVK::IsExtensionSupported(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME, availableExtensions))
+		return false;
+
+	auto getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(m_instance, "vkGetPhysicalDeviceFeatures2KHR");
+	auto getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(m_instance, "vkGetPhysicalDeviceProperties2KHR");
+
+	if (!getFeatures2 || !getProperties2)
+		return false;
+
+	VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT libraryFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT };
+	libraryFeatures.pNext = nullptr;
+
+	VkPhysicalDeviceFeatures2KHR features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR };
+	features.pNext = &libraryFeatures;
+
+	getFeatures2(m_physicalDevice, &features);
+
+	if (!libraryFeatures.graphicsPipelineLibrary)
+		return false;
+
+	VkPhysicalDeviceGraphicsPipelineLibraryPropertiesEXT libraryProperties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_PROPERTIES_EXT };
+	libraryProperties.pNext = nullptr;
+
+	VkPhysicalDeviceProperties2KHR properties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR };
+	properties.pNext = &libraryProperties;
+
+	getProperties2(m_physicalDevice, &properties);
+
+	// without fast linking the link is still cheaper than a full compile, but may not be fast enough to do on the draw thread
+	if (!libraryProperties.graphicsPipelineLibraryFastLinking)
+		std::cout << "Graphics pipeline library without fast linking" << std::endl;
 
 	return true;
 }
@@ -398,10 +635,6 @@ bool DeviceVK::CreateFrameData()
 {
 	m_frameData.resize(m_maxFramesInFlight);
 
-	VkSemaphoreCreateInfo semaphoreCreateInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
-	semaphoreCreateInfo.pNext = nullptr;
-	semaphoreCreateInfo.flags = 0;
-
 	for (int i = 0; i < m_frameData.size(); ++i)
 		m_frameData[i].Create(this);
 
@@ -414,6 +647,87 @@ void DeviceVK::DestroyFrameData()
 		m_frameData[i].Destroy(this);
 }
 
+bool DeviceVK::CreateTimelineSemaphores()
+{
+	VkSemaphoreTypeCreateInfoKHR typeCreateInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR };
+	typeCreateInfo.pNext = nullptr;
+	typeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+	typeCreateInfo.initialValue = 0;
+
+	VkSemaphoreCreateInfo semaphoreCreateInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+	semaphoreCreateInfo.pNext = &typeCreateInfo;
+	semaphoreCreateInfo.flags = 0;
+
+	for (int i = 0; i < ContextVK::NUM_CONTEXT_TYPES; ++i)
+	{
+		VK_CHECK(vkCreateSemaphore(m_device, &semaphoreCreateInfo, nullptr, &m_timelineSemaphores[i]));
+
+		m_timelineValues[i] = 0;
+	}
+
+	m_pendingComputeValue = 0;
+
+	return true;
+}
+
+void DeviceVK::DestroyTimelineSemaphores()
+{
+	for (int i = 0; i < ContextVK::NUM_CONTEXT_TYPES; ++i)
+	{
+		vkDestroySemaphore(m_device, m_timelineSemaphores[i], nullptr);
+
+		m_timelineSemaphores[i] = VK_NULL_HANDLE;
+	}
+}
+
+uint64_t DeviceVK::GetCompletedTimelineValue(ContextVK::ContextType type)
+{
+	uint64_t value = 0;
+	VK_CHECK(m_vkGetSemaphoreCounterValueKHR(m_device, m_timelineSemaphores[type], &value));
+
+	return value;
+}
+
+void DeviceVK::WaitForTimeline(ContextVK::ContextType type, uint64_t value)
+{
+	if (value == 0)
+		return;
+
+	VkSemaphoreWaitInfoKHR waitInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR };
+	waitInfo.pNext = nullptr;
+	waitInfo.flags = 0;
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &m_timelineSemaphores[type];
+	waitInfo.pValues = &value;
+
+	VK_CHECK(m_vkWaitSemaphoresKHR(m_device, &waitInfo, UINT64_MAX));
+}
+
+void DeviceVK::AddFrameCompletionCallback(uint64_t frameValue, std::function<void()> const &callback)
+{
+	m_frameCompletionCallbacks.push_back({ frameValue, callback });
+}
+
+void DeviceVK::ProcessFrameCompletionCallbacks(bool flushAll)
+{
+	if (m_frameCompletionCallbacks.empty())
+		return;
+
+	uint64_t completedValue = flushAll ? UINT64_MAX : GetCompletedFrameValue();
+
+	// callbacks can register new callbacks, so move the completed ones out first
+	std::vector<FrameCompletionCallback> completedCallbacks;
+
+	auto it = std::stable_partition(m_frameCompletionCallbacks.begin(), m_frameCompletionCallbacks.end(),
+		[completedValue](const FrameCompletionCallback& callback) { return callback.m_frameValue > completedValue; });
+
+	std::move(it, m_frameCompletionCallbacks.end(), std::back_inserter(completedCallbacks));
+	m_frameCompletionCallbacks.erase(it, m_frameCompletionCallbacks.end());
+
+	for (auto& callback : completedCallbacks)
+		callback.m_callback();
+}
+
 bool DeviceVK::CreateCommandPools()
 {
 	VkCommandPoolCreateInfo createInfo = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
@@ -423,24 +737,43 @@ bool DeviceVK::CreateCommandPools()
 
 	VK_CHECK(vkCreateCommandPool(m_device, &createInfo, nullptr, &m_graphicsCommandPool));
 
+	createInfo.queueFamilyIndex = m_computeQueueFamily;
+
+	VK_CHECK(vkCreateCommandPool(m_device, &createInfo, nullptr, &m_computeCommandPool));
+
 	return true;
 }
 
 void DeviceVK::DestroyCommandPools()
 {
+	vkDestroyCommandPool(m_device, m_computeCommandPool, nullptr);
 	vkDestroyCommandPool(m_device, m_graphicsCommandPool, nullptr);
 }
 
 bool DeviceVK::CreateDescriptorSetLayouts()
 {
-	VkDescriptorSetLayoutBinding bindings[MAX_NUM_BINDINGS];
+	// every pipeline layout has NUM_DESCRIPTOR_SETS sets of this layout
+	const VkPhysicalDeviceLimits& limits = m_physicalDeviceProperties.limits;
+
+	// uniform texel buffers count as sampled images, storage texel buffers as storage images
+	if (limits.maxBoundDescriptorSets < NUM_DESCRIPTOR_SETS || limits.maxDescriptorSetUniformBuffersDynamic < NUM_DESCRIPTOR_SETS * MAX_UNIFORM_BUFFER_SLOTS ||
+		limits.maxPerStageDescriptorSamplers < NUM_DESCRIPTOR_SETS * (MAX_TEXTURE_SLOTS + NUM_IMMUTABLE_SAMPLERS) ||
+		limits.maxPerStageDescriptorSampledImages < NUM_DESCRIPTOR_SETS * (MAX_TEXTURE_SLOTS + MAX_UNIFORM_TEXEL_BUFFER_SLOTS + MAX_SAMPLED_IMAGE_SLOTS) ||
+		limits.maxPerStageDescriptorStorageImages < NUM_DESCRIPTOR_SETS * (MAX_STORAGE_IMAGE_SLOTS + MAX_STORAGE_TEXEL_BUFFER_SLOTS) ||
+		limits.maxPerStageDescriptorStorageBuffers < NUM_DESCRIPTOR_SETS * MAX_STORAGE_BUFFER_SLOTS)
+		std::cout << "device descriptor limits lower than the slots of shaderCommon.h need, pipeline layouts creation may fail" << std::endl;
+
+	if (!CreateImmutableSamplers())
+		return false;
+
+	VkDescriptorSetLayoutBinding bindings[MAX_NUM_BINDINGS + 1];
 	int currentBinding = 0;
 
-	// UBOs
+	// UBOs, dynamic: the per draw scratch buffer regions only change the offsets passed at bind time
 	for (int i = 0; i < MAX_UNIFORM_BUFFER_SLOTS; ++i)
 	{
 		bindings[currentBinding].binding = UNIFORM_BUFFER_SLOT(i);
-		bindings[currentBinding].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		bindings[currentBinding].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 		bindings[currentBinding].descriptorCount = 1;
 		bindings[currentBinding].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT; // TODO: set all stages?
 		bindings[currentBinding].pImmutableSamplers = nullptr;
@@ -448,7 +781,7 @@ bool DeviceVK::CreateDescriptorSetLayouts()
 		currentBinding++;
 	}
 	
-	// Textures + Samplers TODO: create separate samplers?
+	// Textures + Samplers (see the sampled images below for the images without their own sampler)
 	for (int i = 0; i < MAX_TEXTURE_SLOTS; ++i)
 	{
 		bindings[currentBinding].binding = TEXTURE_SLOT(i);
@@ -472,6 +805,63 @@ bool DeviceVK::CreateDescriptorSetLayouts()
 		currentBinding++;
 	}
 
+	// Storage Buffers (vertex stage too, for per object data)
+	for (int i = 0; i < MAX_STORAGE_BUFFER_SLOTS; ++i)
+	{
+		bindings[currentBinding].binding = STORAGE_BUFFER_SLOT(i);
+		bindings[currentBinding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[currentBinding].descriptorCount = 1;
+		bindings[currentBinding].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+		bindings[currentBinding].pImmutableSamplers = nullptr;
+
+		currentBinding++;
+	}
+
+	// Uniform Texel Buffers
+	for (int i = 0; i < MAX_UNIFORM_TEXEL_BUFFER_SLOTS; ++i)
+	{
+		bindings[currentBinding].binding = UNIFORM_TEXEL_BUFFER_SLOT(i);
+		bindings[currentBinding].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+		bindings[currentBinding].descriptorCount = 1;
+		bindings[currentBinding].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+		bindings[currentBinding].pImmutableSamplers = nullptr;
+
+		currentBinding++;
+	}
+
+	// Storage Texel Buffers
+	for (int i = 0; i < MAX_STORAGE_TEXEL_BUFFER_SLOTS; ++i)
+	{
+		bindings[currentBinding].binding = STORAGE_TEXEL_BUFFER_SLOT(i);
+		bindings[currentBinding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER;
+		bindings[currentBinding].descriptorCount = 1;
+		bindings[currentBinding].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+		bindings[currentBinding].pImmutableSamplers = nullptr;
+
+		currentBinding++;
+	}
+
+	// Sampled Images (no sampler)
+	for (int i = 0; i < MAX_SAMPLED_IMAGE_SLOTS; ++i)
+	{
+		bindings[currentBinding].binding = SAMPLED_IMAGE_SLOT(i);
+		bindings[currentBinding].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+		bindings[currentBinding].descriptorCount = 1;
+		bindings[currentBinding].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+		bindings[currentBinding].pImmutableSamplers = nullptr;
+
+		currentBinding++;
+	}
+
+	// Immutable Samplers: part of the layout, never written
+	bindings[currentBinding].binding = IMMUTABLE_SAMPLERS_BINDING;
+	bindings[currentBinding].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+	bindings[currentBinding].descriptorCount = NUM_IMMUTABLE_SAMPLERS;
+	bindings[currentBinding].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+	bindings[currentBinding].pImmutableSamplers = m_immutableSamplers;
+
+	currentBinding++;
+
 	VkDescriptorSetLayoutCreateInfo layoutCreateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
 	layoutCreateInfo.pNext = nullptr;
 	layoutCreateInfo.flags = 0;
@@ -480,17 +870,658 @@ bool DeviceVK::CreateDescriptorSetLayouts()
 
 	VK_CHECK(vkCreateDescriptorSetLayout(m_device, &layoutCreateInfo, nullptr, &m_descriptorSetLayout));
 
+	// same bindings for the push descriptors set, but push descriptors can't be dynamic: the scratch buffer offsets go in the descriptors instead.
+	// maxPushDescriptors is at least 32
+	static_assert(MAX_NUM_BINDINGS + NUM_IMMUTABLE_SAMPLERS <= 32, "The push descriptors set has more descriptors than maxPushDescriptors guarantees");
+
+	if (SupportsPushDescriptors())
+	{
+		for (int i = 0; i < MAX_UNIFORM_BUFFER_SLOTS; ++i)
+			bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+
+		layoutCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR;
+
+		VK_CHECK(vkCreateDescriptorSetLayout(m_device, &layoutCreateInfo, nullptr, &m_pushDescriptorSetLayout));
+	}
+
 	return true;
 }
 
 void DeviceVK::DestroyDescriptorSetLayouts()
 {
 	vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayout, nullptr);
+
+	if (m_pushDescriptorSetLayout != VK_NULL_HANDLE)
+		vkDestroyDescriptorSetLayout(m_device, m_pushDescriptorSetLayout, nullptr);
+
+	m_pushDescriptorSetLayout = VK_NULL_HANDLE;
+
+	for (VkSampler& sampler : m_immutableSamplers)
+	{
+		vkDestroySampler(m_device, sampler, nullptr);
+		sampler = VK_NULL_HANDLE;
+	}
+}
+
+bool DeviceVK::CreatePipelineCache()
+{
+	m_pipelineCacheStats = {};
+
+	std::vector<char> data;
+	std::ifstream file(s_pipelineCacheFileName, std::ios::in | std::ios::binary | std::ios::ate);
+
+	if (file.is_open())
+	{
+		data.resize(size_t(file.tellg()));
+		file.seekg(0, std::ios::beg);
+		file.read(data.data(), data.size());
+	}
+
+	// the driver should reject incompatible data, but not all of them do: check the header (VkPipelineCacheHeaderVersionOne) first
+	const size_t headerSize = 16 + VK_UUID_SIZE;
+
+	if (!data.empty())
+	{
+		uint32_t header[4];
+		std::memcpy(header, data.data(), std::min(data.size(), sizeof(header)));
+
+		bool valid = data.size() >= headerSize && header[0] >= headerSize && header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+			header[2] == m_physicalDeviceProperties.vendorID && header[3] == m_physicalDeviceProperties.deviceID &&
+			std::memcmp(data.data() + 16, m_physicalDeviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+
+		if (!valid)
+		{
+			std::cout << "Pipeline cache " << s_pipelineCacheFileName << " was written by another device or driver, discarded" << std::endl;
+			data.clear();
+		}
+	}
+
+	VkPipelineCacheCreateInfo createInfo = { VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+	createInfo.pNext = nullptr;
+	createInfo.flags = 0;
+	createInfo.initialDataSize = data.size();
+	createInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+	VK_CHECK(vkCreatePipelineCache(m_device, &createInfo, nullptr, &m_pipelineCache));
+
+	m_pipelineCacheStats.m_loadedSize = data.size();
+
+	if (data.empty())
+		std::cout << "Pipeline cache: cold start" << std::endl;
+	else
+		std::cout << "Pipeline cache: loaded " << data.size() << " bytes" << std::endl;
+
+	std::cout << "Pipeline creation feedback " << (SupportsPipelineCreationFeedback() ? "enabled" : "not supported") << std::endl;
+
+	return m_pipelineCache != VK_NULL_HANDLE;
+}
+
+void DeviceVK::DestroyPipelineCache()
+{
+	size_t size = 0;
+	VK_CHECK(vkGetPipelineCacheData(m_device, m_pipelineCache, &size, nullptr));
+
+	std::vector<char> data(size);
+	VK_CHECK(vkGetPipelineCacheData(m_device, m_pipelineCache, &size, data.data()));
+
+	// an empty or failed read keeps last run's file. Written aside then renamed: a crash mid-write doesn't leave a partial cache behind
+	if (size > 0)
+	{
+		std::string tempFileName = std::string(s_pipelineCacheFileName) + ".tmp";
+		bool written = false;
+
+		{
+			std::ofstream file(tempFileName, std::ios::out | std::ios::binary | std::ios::trunc);
+
+			if (file.is_open())
+			{
+				file.write(data.data(), size);
+				written = file.good();
+			}
+		}
+
+		if (written)
+		{
+			std::remove(s_pipelineCacheFileName);
+			std::rename(tempFileName.c_str(), s_pipelineCacheFileName);
+
+			std::cout << "Pipeline cache: saved " << size << " bytes" << std::endl;
+		}
+		else
+		{
+			std::remove(tempFileName.c_str());
+
+			std::cout << "failed to save the pipeline cache to " << s_pipelineCacheFileName << std::endl;
+		}
+	}
+
+	vkDestroyPipelineCache(m_device, m_pipelineCache, nullptr);
+	m_pipelineCache = VK_NULL_HANDLE;
+}
+
+void DeviceVK::ReportPipelineCreation(const char* type, const VkPipelineCreationFeedbackEXT* feedback, double cpuTime)
+{
+	bool hasFeedback = feedback && (feedback->flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT);
+	bool cacheHit = hasFeedback && (feedback->flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT);
+	double time = hasFeedback ? double(feedback->duration) / 1000000.0 : cpuTime;
+
+	std::lock_guard<std::mutex> lock(m_pipelineCacheStatsMutex);
+
+	m_pipelineCacheStats.m_numPipelines++;
+	m_pipelineCacheStats.m_cacheHits += cacheHit ? 1 : 0;
+	m_pipelineCacheStats.m_creationTime += time;
+
+	std::cout << "[DeviceVK::ReportPipelineCreation] " << type << " pipeline: " << time << " ms" << (hasFeedback ? (cacheHit ? ", cache hit" : ", cache miss") : "") << std::endl;
 }
 
+bool DeviceVK::CreateImmutableSamplers()
+{
+	VkSamplerCreateInfo samplerInfo = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+	samplerInfo.pNext = nullptr;
+	samplerInfo.flags = 0;
+	samplerInfo.mipLodBias = 0.0f;
+	samplerInfo.anisotropyEnable = VK_FALSE;
+	samplerInfo.maxAnisotropy = 1.0f;
+	samplerInfo.compareEnable = VK_FALSE;
+	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+	samplerInfo.minLod = 0.0f;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+	samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_WHITE;
+	samplerInfo.unnormalizedCoordinates = VK_FALSE;
+
+	for (uint32_t i = 0; i < NUM_IMMUTABLE_SAMPLERS; ++i)
+	{
+		bool point = (i == SAMPLER_POINT_WRAP || i == SAMPLER_POINT_CLAMP);
+		bool clamp = (i == SAMPLER_LINEAR_CLAMP || i == SAMPLER_POINT_CLAMP);
+
+		samplerInfo.magFilter = point ? VK_FILTER_NEAREST : VK_FILTER_LINEAR;
+		samplerInfo.minFilter = samplerInfo.magFilter;
+		samplerInfo.mipmapMode = point ? VK_SAMPLER_MIPMAP_MODE_NEAREST : VK_SAMPLER_MIPMAP_MODE_LINEAR;
+		samplerInfo.addressModeU = clamp ? VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE : VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		samplerInfo.addressModeV = samplerInfo.addressModeU;
+		samplerInfo.addressModeW = samplerInfo.addressModeU;
+
+		// falls back to plain linear filtering without the feature
+		samplerInfo.anisotropyEnable = (i == SAMPLER_ANISOTROPIC) ? m_enabledFeatures.samplerAnisotropy : VK_FALSE;
+		samplerInfo.maxAnisotropy = samplerInfo.anisotropyEnable ? std::min(16.0f, m_physicalDeviceProperties.limits.maxSamplerAnisotropy) : 1.0f;
+
+		VK_CHECK(vkCreateSampler(m_device, &samplerInfo, nullptr, &m_immutableSamplers[i]));
+
+		if (m_immutableSamplers[i] == VK_NULL_HANDLE)
+			return false;
+	}
+
+	return true;
+}
+
+DescriptorPoolVK DeviceVK::AcquireDescriptorPool()
+{
+	// reuse a free pool, dropping the ones that are too small for the current sizing
+	while (!m_freeDescriptorPools.empty())
+	{
+		DescriptorPoolVK pool = m_freeDescriptorPools.back();
+		m_freeDescriptorPools.pop_back();
+
+		if (pool.m_maxSets >= m_descriptorPoolSize)
+			return pool;
+
+		vkDestroyDescriptorPool(m_device, pool.m_pool, nullptr);
+		m_numDescriptorPools--;
+	}
+
+	DescriptorPoolVK pool;
+	pool.m_maxSets = m_descriptorPoolSize;
+	pool.m_numAllocatedSets = 0;
+
+	// room for maxSets full sets of the main layout
+	VkDescriptorPoolSize poolSizes[8];
+	// UBOs
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	poolSizes[0].descriptorCount = MAX_UNIFORM_BUFFER_SLOTS * pool.m_maxSets;
+	// Texture + Samplers
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[1].descriptorCount = MAX_TEXTURE_SLOTS * pool.m_maxSets;
+	// Storage Images
+	poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	poolSizes[2].descriptorCount = MAX_STORAGE_IMAGE_SLOTS * pool.m_maxSets;
+	// Storage Buffers
+	poolSizes[3].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[3].descriptorCount = MAX_STORAGE_BUFFER_SLOTS * pool.m_maxSets;
+	// Texel Buffers
+	poolSizes[4].type = VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+	poolSizes[4].descriptorCount = MAX_UNIFORM_TEXEL_BUFFER_SLOTS * pool.m_maxSets;
+	poolSizes[5].type = VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER;
+	poolSizes[5].descriptorCount = MAX_STORAGE_TEXEL_BUFFER_SLOTS * pool.m_maxSets;
+	// Sampled Images, and the immutable samplers which take room in the pool too
+	poolSizes[6].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	poolSizes[6].descriptorCount = MAX_SAMPLED_IMAGE_SLOTS * pool.m_maxSets;
+	poolSizes[7].type = VK_DESCRIPTOR_TYPE_SAMPLER;
+	poolSizes[7].descriptorCount = NUM_IMMUTABLE_SAMPLERS * pool.m_maxSets;
+
+	VkDescriptorPoolCreateInfo createInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+	createInfo.pNext = nullptr;
+	createInfo.flags = 0;
+	createInfo.maxSets = pool.m_maxSets;
+	createInfo.poolSizeCount = sizeof(poolSizes) / sizeof(VkDescriptorPoolSize);
+	createInfo.pPoolSizes = poolSizes;
+
+	VK_CHECK(vkCreateDescriptorPool(m_device, &createInfo, nullptr, &pool.m_pool));
+
+	m_numDescriptorPools++;
+
+	return pool;
+}
+
+void DeviceVK::ReleaseDescriptorPool(const DescriptorPoolVK& pool)
+{
+	assert(pool.m_numAllocatedSets == 0);
+
+	m_freeDescriptorPools.push_back(pool);
+}
+
+void DeviceVK::ReportDescriptorSetUsage(uint32_t numSets)
+{
+	m_descriptorSetUsagePeak = std::max(m_descriptorSetUsagePeak, numSets);
+
+	if (++m_numDescriptorUsageReports < s_descriptorUsageWindow)
+		return;
+
+	// next power of two above the peak, with some headroom
+	uint32_t size = s_minDescriptorPoolSize;
+
+	while (size < m_descriptorSetUsagePeak + m_descriptorSetUsagePeak / 4 && size < s_maxDescriptorPoolSize)
+		size *= 2;
+
+	if (size != m_descriptorPoolSize)
+		std::cout << "[DeviceVK::ReportDescriptorSetUsage] Descriptor pool size: " << m_descriptorPoolSize << " -> " << size << " sets (peak " << m_descriptorSetUsagePeak << " sets per frame)" << std::endl;
+
+	m_descriptorPoolSize = size;
+	m_descriptorSetUsagePeak = 0;
+	m_numDescriptorUsageReports = 0;
+}
+
+void DeviceVK::DestroyDescriptorPools()
+{
+	for (DescriptorPoolVK& pool : m_freeDescriptorPools)
+		vkDestroyDescriptorPool(m_device, pool.m_pool, nullptr);
+
+	m_freeDescriptorPools.clear();
+	m_numDescriptorPools = 0;
+}
+
+VkDescriptorUpdateTemplateKHR DeviceVK::GetDescriptorUpdateTemplate(const uint32_t* boundSlots)
+{
+	static_assert(MAX_NUM_BINDINGS <= 64, "The bound slot masks don't fit the template key");
+
+	// the slot masks side by side, in binding order
+	uint64_t key = uint64_t(boundSlots[ContextVK::BINDING_TYPE_UNIFORM_BUFFER]) |
+		(uint64_t(boundSlots[ContextVK::BINDING_TYPE_TEXTURE]) << (TEXTURE_SLOT(0))) |
+		(uint64_t(boundSlots[ContextVK::BINDING_TYPE_STORAGE_IMAGE]) << (STORAGE_IMAGE_SLOT(0))) |
+		(uint64_t(boundSlots[ContextVK::BINDING_TYPE_STORAGE_BUFFER]) << (STORAGE_BUFFER_SLOT(0))) |
+		(uint64_t(boundSlots[ContextVK::BINDING_TYPE_UNIFORM_TEXEL_BUFFER]) << (UNIFORM_TEXEL_BUFFER_SLOT(0))) |
+		(uint64_t(boundSlots[ContextVK::BINDING_TYPE_STORAGE_TEXEL_BUFFER]) << (STORAGE_TEXEL_BUFFER_SLOT(0))) |
+		(uint64_t(boundSlots[ContextVK::BINDING_TYPE_SAMPLED_IMAGE]) << (SAMPLED_IMAGE_SLOT(0)));
+
+	auto it = m_descriptorUpdateTemplates.find(key);
+
+	if (it != m_descriptorUpdateTemplates.end())
+		return it->second;
+
+	VkDescriptorUpdateTemplateEntryKHR entries[MAX_NUM_BINDINGS];
+	uint32_t numEntries = 0;
+
+	// one entry per run of consecutive bound slots: the bindings of a type only differ by number, so a run updates them in one go
+	auto addEntries = [&](ContextVK::BindingType type, VkDescriptorType descriptorType, uint32_t firstBinding, size_t offset, size_t stride)
+	{
+		uint32_t slots = boundSlots[type];
+
+		for (uint32_t slot = 0; slot < 32 && (slots >> slot); ++slot)
+		{
+			if (!(slots & (1u << slot)))
+				continue;
+
+			uint32_t count = 1;
+			while (slot + count < 32 && (slots & (1u << (slot + count))))
+				count++;
+
+			VkDescriptorUpdateTemplateEntryKHR& entry = entries[numEntries++];
+			entry.dstBinding = firstBinding + slot;
+			entry.dstArrayElement = 0;
+			entry.descriptorCount = count;
+			entry.descriptorType = descriptorType;
+			entry.offset = offset + slot * stride;
+			entry.stride = stride;
+
+			slot += count - 1;
+		}
+	};
+
+	addEntries(ContextVK::BINDING_TYPE_UNIFORM_BUFFER, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, UNIFORM_BUFFER_SLOT(0), offsetof(DescriptorPayloadVK, m_uniformBuffers), sizeof(VkDescriptorBufferInfo));
+	addEntries(ContextVK::BINDING_TYPE_TEXTURE, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, TEXTURE_SLOT(0), offsetof(DescriptorPayloadVK, m_textures), sizeof(VkDescriptorImageInfo));
+	addEntries(ContextVK::BINDING_TYPE_STORAGE_IMAGE, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, STORAGE_IMAGE_SLOT(0), offsetof(DescriptorPayloadVK, m_storageImages), sizeof(VkDescriptorImageInfo));
+	addEntries(ContextVK::BINDING_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, STORAGE_BUFFER_SLOT(0), offsetof(DescriptorPayloadVK, m_storageBuffers), sizeof(VkDescriptorBufferInfo));
+	addEntries(ContextVK::BINDING_TYPE_UNIFORM_TEXEL_BUFFER, VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER, UNIFORM_TEXEL_BUFFER_SLOT(0), offsetof(DescriptorPayloadVK, m_uniformTexelBuffers), sizeof(VkBufferView));
+	addEntries(ContextVK::BINDING_TYPE_STORAGE_TEXEL_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER, STORAGE_TEXEL_BUFFER_SLOT(0), offsetof(DescriptorPayloadVK, m_storageTexelBuffers), sizeof(VkBufferView));
+	addEntries(ContextVK::BINDING_TYPE_SAMPLED_IMAGE, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, SAMPLED_IMAGE_SLOT(0), offsetof(DescriptorPayloadVK, m_sampledImages), sizeof(VkDescriptorImageInfo));
+
+	assert(numEntries > 0);
+
+	VkDescriptorUpdateTemplateCreateInfoKHR createInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO_KHR };
+	createInfo.pNext = nullptr;
+	createInfo.flags = 0;
+	createInfo.descriptorUpdateEntryCount = numEntries;
+	createInfo.pDescriptorUpdateEntries = entries;
+	createInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET_KHR;
+	createInfo.descriptorSetLayout = m_descriptorSetLayout;
+	// only used by push descriptor templates
+	createInfo.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	createInfo.pipelineLayout = VK_NULL_HANDLE;
+	createInfo.set = 0;
+
+	VkDescriptorUpdateTemplateKHR updateTemplate = VK_NULL_HANDLE;
+
+	VK_CHECK(m_vkCreateDescriptorUpdateTemplateKHR(m_device, &createInfo, nullptr, &updateTemplate));
+
+	m_descriptorUpdateTemplates[key] = updateTemplate;
+
+	return updateTemplate;
+}
+
+void DeviceVK::DestroyDescriptorUpdateTemplates()
+{
+	for (auto& updateTemplate : m_descriptorUpdateTemplates)
+		m_vkDestroyDescriptorUpdateTemplateKHR(m_device, updateTemplate.second, nullptr);
+
+	m_descriptorUpdateTemplates.clear();
+}
+
+bool DeviceVK::CreateBindlessDescriptors()
+{
+	if (!m_bindlessEnabled)
+		return true;
+
+	VkShaderStageFlags stages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkDescriptorSetLayoutBinding bindings[NUM_BINDLESS_TYPES];
+
+	bindings[BINDLESS_TYPE_TEXTURE].binding = BINDLESS_TEXTURE_BINDING;
+	bindings[BINDLESS_TYPE_TEXTURE].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	bindings[BINDLESS_TYPE_TEXTURE].descriptorCount = MAX_BINDLESS_TEXTURES;
+	bindings[BINDLESS_TYPE_TEXTURE].stageFlags = stages;
+	bindings[BINDLESS_TYPE_TEXTURE].pImmutableSamplers = nullptr;
+
+	bindings[BINDLESS_TYPE_SAMPLER].binding = BINDLESS_SAMPLER_BINDING;
+	bindings[BINDLESS_TYPE_SAMPLER].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+	bindings[BINDLESS_TYPE_SAMPLER].descriptorCount = MAX_BINDLESS_SAMPLERS;
+	bindings[BINDLESS_TYPE_SAMPLER].stageFlags = stages;
+	bindings[BINDLESS_TYPE_SAMPLER].pImmutableSamplers = nullptr;
+
+	bindings[BINDLESS_TYPE_STORAGE_BUFFER].binding = BINDLESS_STORAGE_BUFFER_BINDING;
+	bindings[BINDLESS_TYPE_STORAGE_BUFFER].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[BINDLESS_TYPE_STORAGE_BUFFER].descriptorCount = MAX_BINDLESS_STORAGE_BUFFERS;
+	bindings[BINDLESS_TYPE_STORAGE_BUFFER].stageFlags = stages;
+	bindings[BINDLESS_TYPE_STORAGE_BUFFER].pImmutableSamplers = nullptr;
+
+	// unused entries can be left empty, and entries can be written while the set is bound or in use by pending command buffers, as long as they are not accessed by them.
+	// Samplers are covered by the sampled image update after bind feature
+	VkDescriptorBindingFlagsEXT bindingFlags[NUM_BINDLESS_TYPES];
+
+	for (uint32_t i = 0; i < NUM_BINDLESS_TYPES; ++i)
+		bindingFlags[i] = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsCreateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT };
+	bindingFlagsCreateInfo.pNext = nullptr;
+	bindingFlagsCreateInfo.bindingCount = NUM_BINDLESS_TYPES;
+	bindingFlagsCreateInfo.pBindingFlags = bindingFlags;
+
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+	layoutCreateInfo.pNext = &bindingFlagsCreateInfo;
+	layoutCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+	layoutCreateInfo.bindingCount = NUM_BINDLESS_TYPES;
+	layoutCreateInfo.pBindings = bindings;
+
+	VK_CHECK(vkCreateDescriptorSetLayout(m_device, &layoutCreateInfo, nullptr, &m_bindlessDescriptorSetLayout));
+
+	VkDescriptorPoolSize poolSizes[NUM_BINDLESS_TYPES];
+
+	for (uint32_t i = 0; i < NUM_BINDLESS_TYPES; ++i)
+	{
+		poolSizes[i].type = bindings[i].descriptorType;
+		poolSizes[i].descriptorCount = bindings[i].descriptorCount;
+	}
+
+	VkDescriptorPoolCreateInfo poolCreateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+	poolCreateInfo.pNext = nullptr;
+	poolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+	poolCreateInfo.maxSets = 1;
+	poolCreateInfo.poolSizeCount = NUM_BINDLESS_TYPES;
+	poolCreateInfo.pPoolSizes = poolSizes;
+
+	VK_CHECK(vkCreateDescriptorPool(m_device, &poolCreateInfo, nullptr, &m_bindlessDescriptorPool));
+
+	VkDescriptorSetAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+	allocateInfo.pNext = nullptr;
+	allocateInfo.descriptorPool = m_bindlessDescriptorPool;
+	allocateInfo.descriptorSetCount = 1;
+	allocateInfo.pSetLayouts = &m_bindlessDescriptorSetLayout;
+
+	VK_CHECK(vkAllocateDescriptorSets(m_device, &allocateInfo, &m_bindlessDescriptorSet));
+
+	for (uint32_t i = 0; i < NUM_BINDLESS_TYPES; ++i)
+	{
+		m_bindlessNextIndices[i] = 0;
+		m_bindlessFreeIndices[i].clear();
+	}
+
+	return true;
+}
+
+void DeviceVK::DestroyBindlessDescriptors()
+{
+	if (!m_bindlessEnabled)
+		return;
+
+	vkDestroyDescriptorPool(m_device, m_bindlessDescriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(m_device, m_bindlessDescriptorSetLayout, nullptr);
+
+	m_bindlessDescriptorPool = VK_NULL_HANDLE;
+	m_bindlessDescriptorSetLayout = VK_NULL_HANDLE;
+	m_bindlessDescriptorSet = VK_NULL_HANDLE;
+}
+
+uint32_t DeviceVK::AllocateBindlessIndex(BindlessType type)
+{
+	static const uint32_t maxIndices[NUM_BINDLESS_TYPES] = { MAX_BINDLESS_TEXTURES, MAX_BINDLESS_SAMPLERS, MAX_BINDLESS_STORAGE_BUFFERS };
+
+	if (!m_bindlessEnabled)
+		return s_invalidBindlessIndex;
+
+	std::vector<uint32_t>& freeIndices = m_bindlessFreeIndices[type];
+
+	if (!freeIndices.empty())
+	{
+		uint32_t index = freeIndices.back();
+		freeIndices.pop_back();
+
+		return index;
+	}
+
+	if (m_bindlessNextIndices[type] >= maxIndices[type])
+	{
+		std::cout << "[DeviceVK::AllocateBindlessIndex] Out of bindless indices of type " << type << std::endl;
+		return s_invalidBindlessIndex;
+	}
+
+	return m_bindlessNextIndices[type]++;
+}
+
+void DeviceVK::WriteBindlessDescriptor(BindlessType type, uint32_t index, const VkDescriptorImageInfo* imageInfo, const VkDescriptorBufferInfo* bufferInfo)
+{
+	static const uint32_t bindings[NUM_BINDLESS_TYPES] = { BINDLESS_TEXTURE_BINDING, BINDLESS_SAMPLER_BINDING, BINDLESS_STORAGE_BUFFER_BINDING };
+	static const VkDescriptorType types[NUM_BINDLESS_TYPES] = { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, VK_DESCRIPTOR_TYPE_SAMPLER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER };
+
+	VkWriteDescriptorSet write = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+	write.pNext = nullptr;
+	write.dstSet = m_bindlessDescriptorSet;
+	write.dstBinding = bindings[type];
+	write.dstArrayElement = index;
+	write.descriptorCount = 1;
+	write.descriptorType = types[type];
+	write.pImageInfo = imageInfo;
+	write.pBufferInfo = bufferInfo;
+	write.pTexelBufferView = nullptr;
+
+	vkUpdateDescriptorSets(m_device, 1, &write, 0, nullptr);
+}
+
+uint32_t DeviceVK::AllocateBindlessTexture(VkImageView imageView)
+{
+	uint32_t index = AllocateBindlessIndex(BINDLESS_TYPE_TEXTURE);
+
+	if (index == s_invalidBindlessIndex)
+		return index;
+
+	VkDescriptorImageInfo imageInfo;
+	imageInfo.sampler = VK_NULL_HANDLE;
+	imageInfo.imageView = imageView;
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	WriteBindlessDescriptor(BINDLESS_TYPE_TEXTURE, index, &imageInfo, nullptr);
+
+	return index;
+}
+
+uint32_t DeviceVK::AllocateBindlessSampler(VkSampler sampler)
+{
+	uint32_t index = AllocateBindlessIndex(BINDLESS_TYPE_SAMPLER);
+
+	if (index == s_invalidBindlessIndex)
+		return index;
+
+	VkDescriptorImageInfo imageInfo;
+	imageInfo.sampler = sampler;
+	imageInfo.imageView = VK_NULL_HANDLE;
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	WriteBindlessDescriptor(BINDLESS_TYPE_SAMPLER, index, &imageInfo, nullptr);
+
+	return index;
+}
+
+uint32_t DeviceVK::AllocateBindlessStorageBuffer(VkBuffer buffer)
+{
+	uint32_t index = AllocateBindlessIndex(BINDLESS_TYPE_STORAGE_BUFFER);
+
+	if (index == s_invalidBindlessIndex)
+		return index;
+
+	VkDescriptorBufferInfo bufferInfo;
+	bufferInfo.buffer = buffer;
+	bufferInfo.offset = 0;
+	bufferInfo.range = VK_WHOLE_SIZE;
+
+	WriteBindlessDescriptor(BINDLESS_TYPE_STORAGE_BUFFER, index, nullptr, &bufferInfo);
+
+	return index;
+}
+
+void DeviceVK::FreeBindlessIndex(BindlessType type, uint32_t index)
+{
+	if (index == s_invalidBindlessIndex)
+		return;
+
+	// the descriptor is left pointing to the destroyed resource: partially bound arrays allow that, as long as it is not accessed
+	AddFrameCompletionCallback(GetCurrentFrameValue(), [this, type, index]()
+	{
+		m_bindlessFreeIndices[type].push_back(index);
+	});
+}
+
+// one layout per number of frequency sets, plus one with all of them and the bindless set. They only differ in the number of sets, so they are all
+// compatible with each other for the sets they have in common and for the push constants (see ContextVK::BindDescriptorSets).
+// The push descriptors ones have the push descriptors set layout at DRAW_SET, so they are only compatible with the others for the sets before it
+bool DeviceVK::CreatePipelineLayouts()
+{
+	static_assert(BINDLESS_SET == NUM_DESCRIPTOR_SETS, "The bindless set must follow the frequency sets");
+	static_assert(DRAW_SET == NUM_DESCRIPTOR_SETS - 1, "The push descriptors set must be the last frequency set");
+
+	// the same layout for all the frequencies, see shaderCommon.h
+	VkDescriptorSetLayout setLayouts[NUM_DESCRIPTOR_SETS + 1];
+
+	for (uint32_t i = 0; i < NUM_DESCRIPTOR_SETS; ++i)
+		setLayouts[i] = m_descriptorSetLayout;
+
+	setLayouts[BINDLESS_SET] = m_bindlessDescriptorSetLayout;
+
+	VkPushConstantRange pushConstantRange;
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = GetPushConstantsSize();
+
+	VkPipelineLayoutCreateInfo layoutCreateInfo = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+	layoutCreateInfo.pNext = nullptr;
+	layoutCreateInfo.flags = 0;
+	layoutCreateInfo.pSetLayouts = setLayouts;
+	layoutCreateInfo.pushConstantRangeCount = 1;
+	layoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+	uint32_t numLayouts = m_bindlessEnabled ? NUM_DESCRIPTOR_SETS + 2 : NUM_DESCRIPTOR_SETS + 1;
+
+	for (uint32_t i = 0; i < numLayouts; ++i)
+	{
+		layoutCreateInfo.setLayoutCount = i;
+
+		VK_CHECK(vkCreatePipelineLayout(m_device, &layoutCreateInfo, nullptr, &m_pipelineLayouts[i]));
+	}
+
+	if (SupportsPushDescriptors())
+	{
+		setLayouts[DRAW_SET] = m_pushDescriptorSetLayout;
+
+		for (uint32_t i = 0; i < (m_bindlessEnabled ? 2u : 1u); ++i)
+		{
+			layoutCreateInfo.setLayoutCount = NUM_DESCRIPTOR_SETS + i;
+
+			VK_CHECK(vkCreatePipelineLayout(m_device, &layoutCreateInfo, nullptr, &m_pushPipelineLayouts[i]));
+		}
+	}
+
+	return true;
+}
+
+void DeviceVK::DestroyPipelineLayouts()
+{
+	for (VkPipelineLayout& layout : m_pipelineLayouts)
+	{
+		if (layout != VK_NULL_HANDLE)
+			vkDestroyPipelineLayout(m_device, layout, nullptr);
+
+		layout = VK_NULL_HANDLE;
+	}
+
+	for (VkPipelineLayout& layout : m_pushPipelineLayouts)
+	{
+		if (layout != VK_NULL_HANDLE)
+			vkDestroyPipelineLayout(m_device, layout, nullptr);
+
+		layout = VK_NULL_HANDLE;
+	}
+}
+
+VkPipelineLayout DeviceVK::GetPipelineLayout(uint32_t numSets, bool bindless, bool pushDescriptors) const
+{
+	assert(numSets <= NUM_DESCRIPTOR_SETS && (!bindless || m_bindlessEnabled) && (!pushDescriptors || SupportsPushDescriptors()));
+
+	if (pushDescriptors)
+		return m_pushPipelineLayouts[bindless ? 1 : 0];
+
+	return bindless ? m_pipelineLayouts[BINDLESS_SET + 1] : m_pipelineLayouts[numSets];
+}
+
+// contexts are indexed by frame in flight, independently from the swapchain images
 bool DeviceVK::CreateGraphicsContexts()
 {
-	m_graphicsContexts.resize(m_swapchain->m_imageCount);
+	m_graphicsContexts.resize(m_maxFramesInFlight);
 
 	for (auto &graphicContext : m_graphicsContexts)
 		graphicContext.Create(this);
@@ -504,7 +1535,45 @@ void DeviceVK::DestroyGraphicsContexts()
 		graphicContext.Destroy(this);
 }
 
-void DeviceVK::TransitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkImageAspectFlags aspectFlags, VkImageLayout oldLayout, VkImageLayout newLayout)
+bool DeviceVK::CreateComputeContexts()
+{
+	m_computeContexts.resize(m_maxFramesInFlight);
+
+	for (auto &computeContext : m_computeContexts)
+		computeContext.Create(this, ContextVK::CONTEXT_TYPE_COMPUTE);
+
+	return true;
+}
+
+void DeviceVK::DestroyComputeContexts()
+{
+	for (auto &computeContext : m_computeContexts)
+		computeContext.Destroy(this);
+
+	m_currentComputeContext = nullptr;
+}
+
+// queues without graphics support (i.e. a dedicated compute queue) only accept compute and transfer stages
+static VkPipelineStageFlags FilterPipelineStages(VkPipelineStageFlags stages, VkQueueFlags queueFlags)
+{
+	if (queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		return stages;
+
+	const VkPipelineStageFlags shaderStages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_TESSELLATION_CONTROL_SHADER_BIT | VK_PIPELINE_STAGE_TESSELLATION_EVALUATION_SHADER_BIT |
+		VK_PIPELINE_STAGE_GEOMETRY_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	const VkPipelineStageFlags graphicsStages = shaderStages | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT;
+
+	VkPipelineStageFlags filteredStages = stages & ~graphicsStages;
+
+	if (stages & shaderStages)
+		filteredStages |= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+	return (filteredStages != 0) ? filteredStages : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+}
+
+void DeviceVK::TransitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkImageAspectFlags aspectFlags, VkImageLayout oldLayout, VkImageLayout newLayout,
+	uint32_t srcQueueFamily, uint32_t dstQueueFamily, bool acquire)
 {
 	VkAccessFlags srcAccessMask = 0;
 	VkAccessFlags dstAccessMask = 0;
@@ -562,7 +1631,7 @@ void DeviceVK::TransitionImageLayout(VkCommandBuffer commandBuffer, VkImage imag
 
 		break;
 	case VK_IMAGE_LAYOUT_GENERAL:
-		dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
 		dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
 
 		break;
@@ -588,14 +1657,35 @@ void DeviceVK::TransitionImageLayout(VkCommandBuffer commandBuffer, VkImage imag
 		break;
 	}
 
+	// queue family ownership transfer: the release half only has to make the writes available, the acquire half only has to make them visible.
+	// The acquire is ordered after the release by a semaphore, waited on at the acquire destination stage
+	bool ownershipTransfer = (srcQueueFamily != dstQueueFamily);
+
+	if (ownershipTransfer && acquire)
+	{
+		srcStageMask = dstStageMask;
+		srcAccessMask = 0;
+	}
+	else if (ownershipTransfer)
+	{
+		dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+		dstAccessMask = 0;
+	}
+
+	uint32_t queueFamily = acquire ? dstQueueFamily : srcQueueFamily;
+	VkQueueFlags queueFlags = m_queueFamilyProperties[(queueFamily == VK_QUEUE_FAMILY_IGNORED) ? m_graphicsQueueFamily : queueFamily].queueFlags;
+
+	srcStageMask = FilterPipelineStages(srcStageMask, queueFlags);
+	dstStageMask = FilterPipelineStages(dstStageMask, queueFlags);
+
 	VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
 	barrier.pNext = nullptr;
 	barrier.srcAccessMask = srcAccessMask;
 	barrier.dstAccessMask = dstAccessMask;
 	barrier.oldLayout = oldLayout;
 	barrier.newLayout = newLayout;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.srcQueueFamilyIndex = ownershipTransfer ? srcQueueFamily : VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = ownershipTransfer ? dstQueueFamily : VK_QUEUE_FAMILY_IGNORED;
 	barrier.image = image;
 	// subresource range
 	barrier.subresourceRange.aspectMask = aspectFlags;
@@ -614,11 +1704,11 @@ bool DeviceVK::WaitForDevice()
 	return true;
 }
 
-VkCommandBuffer DeviceVK::BeginNewCommandBuffer(VkCommandBufferUsageFlags usage)
+VkCommandBuffer DeviceVK::BeginNewCommandBuffer(VkCommandBufferUsageFlags usage, ContextVK::ContextType type)
 {
 	VkCommandBufferAllocateInfo allocInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
 	allocInfo.pNext = nullptr;
-	allocInfo.commandPool = m_graphicsCommandPool;
+	allocInfo.commandPool = GetCommandPool(type);
 	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
 	allocInfo.commandBufferCount = 1;
 
@@ -634,8 +1724,10 @@ VkCommandBuffer DeviceVK::BeginNewCommandBuffer(VkCommandBufferUsageFlags usage)
 	return commandBuffer;
 }
 
-void DeviceVK::SubmitCommandBufferAndWait(VkCommandBuffer commandBuffer, bool freeCommandBuffer)
+void DeviceVK::SubmitCommandBufferAndWait(VkCommandBuffer commandBuffer, bool freeCommandBuffer, ContextVK::ContextType type)
 {
+	VkQueue queue = GetQueue(type);
+
 	VK_CHECK(vkEndCommandBuffer(commandBuffer));
 
 	VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
@@ -643,12 +1735,12 @@ void DeviceVK::SubmitCommandBufferAndWait(VkCommandBuffer commandBuffer, bool fr
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &commandBuffer;
 
-	VK_CHECK(vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, nullptr));
+	VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, nullptr));
 
-	VK_CHECK(vkQueueWaitIdle(m_graphicsQueue));
+	VK_CHECK(vkQueueWaitIdle(queue));
 
 	if (freeCommandBuffer)
-		vkFreeCommandBuffers(m_device, m_graphicsCommandPool, 1, &commandBuffer);
+		vkFreeCommandBuffers(m_device, GetCommandPool(type), 1, &commandBuffer);
 }
 
 bool DeviceVK::Present()
@@ -671,6 +1763,16 @@ bool DeviceVK::BeginFrame()
 {
 	m_currentFrameData = &m_frameData[m_currentFrame];
 
+	m_currentGraphicsContext = &m_graphicsContexts[m_currentFrame];
+	m_currentComputeContext = nullptr;
+
+	// wait for the frame that last used this frame in flight slot (m_maxFramesInFlight frames ago), before reusing its semaphores and contexts
+	m_currentGraphicsContext->WaitForLastFrame(this);
+	m_computeContexts[m_currentFrame].WaitForLastFrame(this);
+
+	ProcessFrameCompletionCallbacks(false);
+	UpdateAsyncComputeStats();
+
 	m_currentImageIndex = m_swapchain->AcquireNextImage(this);
 
 	if (m_swapchain->m_outOfDate)
@@ -678,16 +1780,69 @@ bool DeviceVK::BeginFrame()
 
 	assert(m_currentImageIndex != UINT32_MAX);
 
-	m_currentGraphicsContext = &m_graphicsContexts[m_currentImageIndex];
+	return true;
+}
 
-	m_currentGraphicsContext->WaitForLastFrame(this);
+ContextVK* DeviceVK::GetCurrentComputeContext()
+{
+	if (m_currentComputeContext == nullptr)
+	{
+		m_currentComputeContext = &m_computeContexts[m_currentFrame];
+		m_currentComputeContext->Begin(this);
+	}
 
-	return true;
+	return m_currentComputeContext;
+}
+
+void DeviceVK::UpdateAsyncComputeStats()
+{
+	auto beginFrameTime = std::chrono::steady_clock::now();
+
+	m_asyncComputeStats.m_frameTime = std::chrono::duration<double, std::milli>(beginFrameTime - m_lastBeginFrameTime).count();
+	m_lastBeginFrameTime = beginFrameTime;
+
+	ContextVK* computeContext = &m_computeContexts[m_currentFrame];
+
+	if (!m_currentGraphicsContext->HasGPUTimings() || !computeContext->HasGPUTimings())
+		return;
+
+	m_asyncComputeStats.m_graphicsTime = m_currentGraphicsContext->GetGPUEndTime() - m_currentGraphicsContext->GetGPUBeginTime();
+	m_asyncComputeStats.m_computeTime = computeContext->GetGPUEndTime() - computeContext->GetGPUBeginTime();
+
+	double overlapTime = m_asyncComputeStats.m_graphicsTime + m_asyncComputeStats.m_computeTime - m_asyncComputeStats.m_frameTime;
+	m_asyncComputeStats.m_overlapTime = std::max(0.0, std::min(overlapTime, std::min(m_asyncComputeStats.m_graphicsTime, m_asyncComputeStats.m_computeTime)));
 }
 
 bool DeviceVK::EndFrame()
 {
-	m_currentGraphicsContext->Submit(m_graphicsQueue, m_currentFrameData->m_acquireSemaphore, m_currentFrameData->m_renderSemaphore);
+	bool computeSubmitted = (m_currentComputeContext != nullptr);
+
+	if (computeSubmitted)
+	{
+		// don't overwrite resources the last frame's graphics work might still be reading
+		uint64_t lastFrameValue = m_timelineValues[ContextVK::CONTEXT_TYPE_GRAPHICS];
+
+		m_currentComputeContext->End();
+		m_currentComputeContext->Submit(this, { m_timelineSemaphores[ContextVK::CONTEXT_TYPE_GRAPHICS] }, { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT }, { lastFrameValue }, {});
+	}
+
+	std::vector<VkSemaphore> waitSemaphores = { m_currentFrameData->m_acquireSemaphore };
+	std::vector<VkPipelineStageFlags> waitStages = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+	std::vector<uint64_t> waitValues = { 0 };
+
+	// the last frame's async compute results are consumed by shaders
+	if (m_pendingComputeValue != 0)
+	{
+		waitSemaphores.emplace_back(m_timelineSemaphores[ContextVK::CONTEXT_TYPE_COMPUTE]);
+		waitStages.emplace_back(VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+		waitValues.emplace_back(m_pendingComputeValue);
+	}
+
+	m_pendingComputeValue = computeSubmitted ? m_currentComputeContext->GetSubmittedValue() : 0;
+
+	m_currentGraphicsContext->Submit(this, waitSemaphores, waitStages, waitValues, { m_currentFrameData->m_renderSemaphore });
+
+	m_currentComputeContext = nullptr;
 
 	bool success = Present();
 
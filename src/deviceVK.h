@@ -5,6 +5,14 @@
 
 #include "glfw/glfw3.h"
 
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE // use the Vulkan range of 0.0 to 1.0, instead of the -1 to 1.0 OpenGL range
 #include "glm.hpp"
@@ -22,10 +30,33 @@ public:
 	bool Create(DeviceVK* device);
 	void Destroy(DeviceVK* device);
 
+	// swapchain acquire/present still need binary semaphores
 	VkSemaphore m_acquireSemaphore = VK_NULL_HANDLE;
 	VkSemaphore m_renderSemaphore = VK_NULL_HANDLE;
 };
 
+// ms. Timestamps of different queues aren't comparable, the overlap is derived from the per queue durations instead: the part of the work of both queues
+// that doesn't fit in the frame wall time ran concurrently. A lower bound, 0 when the frame isn't GPU bound
+struct AsyncComputeStatsVK
+{
+	double m_frameTime = 0.0;
+	double m_graphicsTime = 0.0;
+	double m_computeTime = 0.0;
+	double m_overlapTime = 0.0;
+};
+
+struct PipelineCacheStatsVK
+{
+	// size of the cache data loaded at Init, 0 for a cold start
+	size_t m_loadedSize = 0;
+
+	uint32_t m_numPipelines = 0;
+	// pipelines found in the cache, as reported by VK_EXT_pipeline_creation_feedback (0 without it)
+	uint32_t m_cacheHits = 0;
+	// ms spent creating pipelines: the driver reported durations with the feedback extension, CPU time otherwise
+	double m_creationTime = 0.0;
+};
+
 class DeviceVK
 {
 public:
@@ -48,25 +79,47 @@ public:
 	bool CreateFrameData();
 	void DestroyFrameData();
 
+	bool CreateTimelineSemaphores();
+	void DestroyTimelineSemaphores();
+
 	bool CreateCommandPools();
 	void DestroyCommandPools();
 
 	bool CreateDescriptorSetLayouts();
 	void DestroyDescriptorSetLayouts();
 
+	bool CreatePipelineCache();
+	void DestroyPipelineCache();
+	bool CreateImmutableSamplers();
+
+	bool CreateBindlessDescriptors();
+	void DestroyBindlessDescriptors();
+
+	bool CreatePipelineLayouts();
+	void DestroyPipelineLayouts();
+
+	void DestroyDescriptorPools();
+	void DestroyDescriptorUpdateTemplates();
+
 	bool CreateGraphicsContexts();
 	void DestroyGraphicsContexts();
 
-	void TransitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkImageAspectFlags aspectFlags, VkImageLayout oldLayout, VkImageLayout newLayout);
+	bool CreateComputeContexts();
+	void DestroyComputeContexts();
+
+	// srcQueueFamily/dstQueueFamily: leave to VK_QUEUE_FAMILY_IGNORED for a plain transition recorded on the graphics queue, or set both to the same family to record it on another queue.
+	// A queue family ownership transfer is recorded twice: the release on the source queue and the acquire on the destination queue
+	void TransitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkImageAspectFlags aspectFlags, VkImageLayout oldLayout, VkImageLayout newLayout,
+		uint32_t srcQueueFamily = VK_QUEUE_FAMILY_IGNORED, uint32_t dstQueueFamily = VK_QUEUE_FAMILY_IGNORED, bool acquire = false);
 
 	bool WaitForDevice();
 
-	VkCommandBuffer BeginNewCommandBuffer(VkCommandBufferUsageFlags usage);
-	void SubmitCommandBufferAndWait(VkCommandBuffer commandBuffer, bool freeCommandBuffer);
+	VkCommandBuffer BeginNewCommandBuffer(VkCommandBufferUsageFlags usage, ContextVK::ContextType type = ContextVK::CONTEXT_TYPE_GRAPHICS);
+	void SubmitCommandBufferAndWait(VkCommandBuffer commandBuffer, bool freeCommandBuffer, ContextVK::ContextType type = ContextVK::CONTEXT_TYPE_GRAPHICS);
 
 	bool Present();
 
-	uint32_t FindDeviceQueueFamilyIndex(VkPhysicalDevice device, VkQueueFlags desiredCapabilities, bool queryPresentationSupport);
+	uint32_t FindDeviceQueueFamilyIndex(VkPhysicalDevice device, VkQueueFlags desiredCapabilities, bool queryPresentationSupport, VkQueueFlags excludedCapabilities = 0);
 	uint32_t FindDevicePresentationQueueFamilyIndex(VkPhysicalDevice device);
 
 	VkInstance GetInstance() { return m_instance; };
@@ -74,15 +127,123 @@ public:
 	VkDevice GetDevice() { return m_device; };
 
 	VkDescriptorSetLayout GetDescriptorSetLayout() { return m_descriptorSetLayout; };
+	// the samplers at IMMUTABLE_SAMPLERS_BINDING of every set, indexed by SAMPLER_LINEAR_WRAP etc. (see shaderCommon.h)
+	VkSampler GetImmutableSampler(uint32_t index) const { return m_immutableSamplers[index]; };
+
+	// Free list of descriptor pools for the main layout, shared by the context allocators (see DescriptorAllocatorVK). New pools are sized from the
+	// peak number of sets a context allocated per frame in the recent frames, so that a frame usually fits in a single pool
+	DescriptorPoolVK AcquireDescriptorPool();
+	// the pool must have been reset
+	void ReleaseDescriptorPool(const DescriptorPoolVK& pool);
+	void ReportDescriptorSetUsage(uint32_t numSets);
+	uint32_t GetDescriptorPoolSize() const { return m_descriptorPoolSize; };
+	uint32_t GetNumDescriptorPools() const { return m_numDescriptorPools; };
+
+	// Descriptor update templates (VK_KHR_descriptor_update_template) for the main layout, writing the given slots of a DescriptorPayloadVK.
+	// One per combination of slots (indexed by ContextVK::BindingType), created on first use and kept until Cleanup
+	bool SupportsDescriptorUpdateTemplates() const { return m_vkUpdateDescriptorSetWithTemplateKHR != nullptr; };
+	VkDescriptorUpdateTemplateKHR GetDescriptorUpdateTemplate(const uint32_t* boundSlots);
+	void UpdateDescriptorSetWithTemplate(VkDescriptorSet descriptorSet, VkDescriptorUpdateTemplateKHR updateTemplate, const DescriptorPayloadVK* descriptors)
+	{
+		m_vkUpdateDescriptorSetWithTemplateKHR(m_device, descriptorSet, updateTemplate, descriptors);
+	};
+
+	// pipeline layouts with the first numSets frequency sets (all of them plus the bindless set when bindless), all with GetPushConstantsSize bytes of
+	// push constants. Created at Init, pipelines take the smallest one covering the sets their shaders use (see PipelineVK).
+	// pushDescriptors: all the frequency sets, with DRAW_SET written with vkCmdPushDescriptorSetKHR
+	VkPipelineLayout GetPipelineLayout(uint32_t numSets, bool bindless, bool pushDescriptors = false) const;
+
+	// pipeline cache loaded from s_pipelineCacheFileName at Init, if it was written by the same device and driver, and saved back at Cleanup
+	VkPipelineCache GetPipelineCache() const { return m_pipelineCache; };
+	bool SupportsPipelineCreationFeedback() const { return IsExtensionEnabled(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME); };
+	// feedback: nullptr without VK_EXT_pipeline_creation_feedback. cpuTime in ms
+	void ReportPipelineCreation(const char* type, const VkPipelineCreationFeedbackEXT* feedback, double cpuTime);
+	const PipelineCacheStatsVK& GetPipelineCacheStats() const { return m_pipelineCacheStats; };
+
+	// Push descriptors (VK_KHR_push_descriptor): DRAW_SET of the pipelines created with them is written straight into the command buffer,
+	// without allocating a set (see ContextVK::CommitBindings)
+	bool SupportsPushDescriptors() const { return m_vkCmdPushDescriptorSetKHR != nullptr; };
+	void CmdPushDescriptorSet(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t set, uint32_t numWrites, const VkWriteDescriptorSet* descriptorWrites)
+	{
+		m_vkCmdPushDescriptorSetKHR(commandBuffer, bindPoint, layout, set, numWrites, descriptorWrites);
+	};
+
+	// Graphics pipeline library (VK_EXT_graphics_pipeline_library, declared in commonVK.h): enabled automatically when the device supports it, graphics pipelines are then
+	// fast linked from independently cached parts and optimized in the background (see PipelineLibraryCache). Full pipelines otherwise
+	bool SupportsGraphicsPipelineLibrary() const { return m_graphicsPipelineLibraryEnabled; };
+
+	uint32_t GetPushConstantsSize() const { return std::min(m_physicalDeviceProperties.limits.maxPushConstantsSize, uint32_t(MAX_PUSH_CONSTANTS_SIZE)); };
+
+	enum BindlessType
+	{
+		BINDLESS_TYPE_TEXTURE,
+		BINDLESS_TYPE_SAMPLER,
+		BINDLESS_TYPE_STORAGE_BUFFER,
+		NUM_BINDLESS_TYPES
+	};
+
+	static const uint32_t s_invalidBindlessIndex = 0xFFFFFFFF;
+
+	// Bindless (VK_EXT_descriptor_indexing): enabled automatically when the device supports it. One update after bind set, bound at BINDLESS_SET,
+	// holds arrays of all the sampled images, samplers and storage buffers. Resources get a stable index at creation, written straight to the set
+	bool IsBindlessEnabled() const { return m_bindlessEnabled; };
+	VkDescriptorSetLayout GetBindlessDescriptorSetLayout() const { return m_bindlessDescriptorSetLayout; };
+	VkDescriptorSet GetBindlessDescriptorSet() const { return m_bindlessDescriptorSet; };
+
+	// return s_invalidBindlessIndex when bindless is disabled or the array is full
+	uint32_t AllocateBindlessTexture(VkImageView imageView);
+	uint32_t AllocateBindlessSampler(VkSampler sampler);
+	uint32_t AllocateBindlessStorageBuffer(VkBuffer buffer);
+	// the index is reused once the frames that could still access it have completed
+	void FreeBindlessIndex(BindlessType type, uint32_t index);
 
 	VkCommandPool GetGraphicsCommandPool() { return m_graphicsCommandPool; };
+	VkCommandPool GetCommandPool(ContextVK::ContextType type) { return (type == ContextVK::CONTEXT_TYPE_COMPUTE) ? m_computeCommandPool : m_graphicsCommandPool; };
+	VkQueue GetQueue(ContextVK::ContextType type) { return (type == ContextVK::CONTEXT_TYPE_COMPUTE) ? m_computeQueue : m_graphicsQueue; };
+	uint32_t GetQueueFamily(ContextVK::ContextType type) const { return (type == ContextVK::CONTEXT_TYPE_COMPUTE) ? m_computeQueueFamily : m_graphicsQueueFamily; };
+	const VkQueueFamilyProperties& GetQueueFamilyProperties(uint32_t queueFamily) const { return m_queueFamilyProperties[queueFamily]; };
 	FrameDataVK* GetCurrentFrameData() const { return m_currentFrameData; };
 
+	// Frame pacing: every queue has a timeline semaphore, signaled with increasing values by each context submission.
+	// The graphics timeline is the frame timeline: it is signaled once per frame, with a value equal to the frame number (starting from 1).
+	// Async compute work of frame N is waited on by the graphics work of frame N+1, so it is complete once frame N+1 is
+	uint64_t GetCurrentFrameValue() const { return m_timelineValues[ContextVK::CONTEXT_TYPE_GRAPHICS] + 1; };
+	uint64_t GetCompletedFrameValue() { return GetCompletedTimelineValue(ContextVK::CONTEXT_TYPE_GRAPHICS); };
+	bool IsFrameComplete(uint64_t frameValue) { return GetCompletedFrameValue() >= frameValue; };
+	void WaitForFrame(uint64_t frameValue) { WaitForTimeline(ContextVK::CONTEXT_TYPE_GRAPHICS, frameValue); };
+
+	// the callback is called at the beginning of the first frame that finds frameValue completed (or at Cleanup). Used for deferred deletion, readbacks etc
+	void AddFrameCompletionCallback(uint64_t frameValue, std::function<void()> const &callback);
+
+	VkSemaphore GetTimelineSemaphore(ContextVK::ContextType type) const { return m_timelineSemaphores[type]; };
+	uint64_t GetCompletedTimelineValue(ContextVK::ContextType type);
+	void WaitForTimeline(ContextVK::ContextType type, uint64_t value);
+	// returns the value the next submission on the queue is going to signal
+	uint64_t AdvanceTimeline(ContextVK::ContextType type) { return ++m_timelineValues[type]; };
+
+	uint32_t GetMaxFramesInFlight() const { return m_maxFramesInFlight; };
+
 
 	VkPhysicalDeviceProperties GetPhysicalDeviceProperties() const { return m_physicalDeviceProperties; };
+	const VkPhysicalDeviceFeatures& GetEnabledFeatures() const { return m_enabledFeatures; };
+
+	bool IsExtensionEnabled(const char* extension) const { return m_enabledExtensions.find(extension) != m_enabledExtensions.end(); };
+
+	bool SupportsDrawIndirectCount() const { return m_vkCmdDrawIndexedIndirectCountKHR != nullptr; };
+	void CmdDrawIndexedIndirectCount(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countOffset, uint32_t maxDrawCount, uint32_t stride)
+	{
+		m_vkCmdDrawIndexedIndirectCountKHR(commandBuffer, buffer, offset, countBuffer, countOffset, maxDrawCount, stride);
+	};
 	
 
 	ContextVK* GetCurrentGraphicsContext() { return m_currentGraphicsContext; };
+	// the async compute context is begun the first time it is requested in a frame, and only submitted on the frames that requested it.
+	// Its results are consumed by the graphics queue in the following frame, so compute and graphics work of the same frame can overlap
+	ContextVK* GetCurrentComputeContext();
+
+	// true when compute work runs on a different queue than graphics
+	bool HasAsyncComputeQueue() const { return m_computeQueue != m_graphicsQueue; };
+	const AsyncComputeStatsVK& GetAsyncComputeStats() const { return m_asyncComputeStats; };
 
 //private:
 	std::vector<FrameDataVK> m_frameData;
@@ -91,6 +252,9 @@ public:
 	std::vector<ContextVK> m_graphicsContexts;
 	ContextVK* m_currentGraphicsContext = nullptr;
 
+	std::vector<ContextVK> m_computeContexts;
+	ContextVK* m_currentComputeContext = nullptr;
+
 	uint32_t m_swapchainImageCount = 0;
 	uint32_t m_currentFrame = 0;
 	uint32_t m_currentImageIndex = 0;
@@ -98,6 +262,14 @@ public:
 	uint32_t m_maxFramesInFlight = 2;
 
 private:
+	void UpdateAsyncComputeStats();
+	void ProcessFrameCompletionCallbacks(bool flushAll);
+
+	bool CheckBindlessSupport(const std::vector<VkExtensionProperties>& availableExtensions);
+	bool CheckGraphicsPipelineLibrarySupport(const std::vector<VkExtensionProperties>& availableExtensions);
+	uint32_t AllocateBindlessIndex(BindlessType type);
+	void WriteBindlessDescriptor(BindlessType type, uint32_t index, const VkDescriptorImageInfo* imageInfo, const VkDescriptorBufferInfo* bufferInfo);
+
 	bool m_validationLayerEnabled;
 
 	SwapchainVK* m_swapchain;
@@ -108,16 +280,92 @@ private:
 	VkPhysicalDevice m_physicalDevice;
 	VkPhysicalDeviceProperties m_physicalDeviceProperties;
 	VkPhysicalDeviceFeatures m_physicalDeviceFeatures;
+	VkPhysicalDeviceFeatures m_enabledFeatures = {};
+
+	std::set<std::string> m_enabledExtensions;
 
 	VkDevice m_device;
 
+	std::vector<VkQueueFamilyProperties> m_queueFamilyProperties;
+
 	uint32_t m_graphicsQueueFamily;
+	uint32_t m_computeQueueFamily;
+	uint32_t m_computeQueueIndex = 0;
 
 	VkQueue m_graphicsQueue;
+	VkQueue m_computeQueue;
 
 	VkCommandPool m_graphicsCommandPool;
+	VkCommandPool m_computeCommandPool;
+
+	// VK_KHR_timeline_semaphore entry points
+	PFN_vkWaitSemaphoresKHR m_vkWaitSemaphoresKHR = nullptr;
+	PFN_vkGetSemaphoreCounterValueKHR m_vkGetSemaphoreCounterValueKHR = nullptr;
+	// VK_KHR_draw_indirect_count
+	PFN_vkCmdDrawIndexedIndirectCountKHR m_vkCmdDrawIndexedIndirectCountKHR = nullptr;
+	// VK_KHR_descriptor_update_template
+	PFN_vkCreateDescriptorUpdateTemplateKHR m_vkCreateDescriptorUpdateTemplateKHR = nullptr;
+	PFN_vkDestroyDescriptorUpdateTemplateKHR m_vkDestroyDescriptorUpdateTemplateKHR = nullptr;
+	PFN_vkUpdateDescriptorSetWithTemplateKHR m_vkUpdateDescriptorSetWithTemplateKHR = nullptr;
+	// VK_KHR_push_descriptor
+	PFN_vkCmdPushDescriptorSetKHR m_vkCmdPushDescriptorSetKHR = nullptr;
+
+	// key: the bound slot masks, packed
+	std::unordered_map<uint64_t, VkDescriptorUpdateTemplateKHR> m_descriptorUpdateTemplates;
+
+	VkSemaphore m_timelineSemaphores[ContextVK::NUM_CONTEXT_TYPES] = {};
+	// last value submitted for signaling on each timeline
+	uint64_t m_timelineValues[ContextVK::NUM_CONTEXT_TYPES] = {};
+
+	// compute timeline value signaled by the last frame's async compute submission, to be waited on by graphics. 0 if there was none
+	uint64_t m_pendingComputeValue = 0;
+
+	struct FrameCompletionCallback
+	{
+		uint64_t m_frameValue;
+		std::function<void()> m_callback;
+	};
+
+	std::vector<FrameCompletionCallback> m_frameCompletionCallbacks;
+
+	AsyncComputeStatsVK m_asyncComputeStats;
+	std::chrono::steady_clock::time_point m_lastBeginFrameTime;
+
+	static const uint32_t s_minDescriptorPoolSize = 64;
+	static const uint32_t s_maxDescriptorPoolSize = 4096;
+	// number of ReportDescriptorSetUsage calls the peak is measured over
+	static const uint32_t s_descriptorUsageWindow = 120;
+
+	std::vector<DescriptorPoolVK> m_freeDescriptorPools;
+	uint32_t m_numDescriptorPools = 0;
+	uint32_t m_descriptorPoolSize = s_minDescriptorPoolSize;
+	uint32_t m_descriptorSetUsagePeak = 0;
+	uint32_t m_numDescriptorUsageReports = 0;
 
 	VkDescriptorSetLayout m_descriptorSetLayout;
+	VkDescriptorSetLayout m_pushDescriptorSetLayout = VK_NULL_HANDLE;
+	VkSampler m_immutableSamplers[NUM_IMMUTABLE_SAMPLERS] = {};
+
+	static const char* s_pipelineCacheFileName;
+	VkPipelineCache m_pipelineCache = VK_NULL_HANDLE;
+	PipelineCacheStatsVK m_pipelineCacheStats;
+	// pipelines are also created by the PipelineStateCache workers
+	std::mutex m_pipelineCacheStatsMutex;
+
+	bool m_graphicsPipelineLibraryEnabled = false;
+
+	bool m_bindlessEnabled = false;
+	VkDescriptorSetLayout m_bindlessDescriptorSetLayout = VK_NULL_HANDLE;
+	VkDescriptorPool m_bindlessDescriptorPool = VK_NULL_HANDLE;
+	VkDescriptorSet m_bindlessDescriptorSet = VK_NULL_HANDLE;
+
+	// indexed by number of sets, the last one has the bindless set too. The push descriptors ones without and with the bindless set
+	VkPipelineLayout m_pipelineLayouts[NUM_DESCRIPTOR_SETS + 2] = {};
+	VkPipelineLayout m_pushPipelineLayouts[2] = {};
+
+	// per type: first never used index, and the freed ones
+	uint32_t m_bindlessNextIndices[NUM_BINDLESS_TYPES] = {};
+	std::vector<uint32_t> m_bindlessFreeIndices[NUM_BINDLESS_TYPES];
 };
 
 }
@@ -4,9 +4,43 @@
 #include "frameBufferVK.h"
 #include "vertexFormatVK.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
 namespace MBRF
 {
 
+// VK_EXT_pipeline_creation_feedback, when enabled: chained to the pipeline create info, then reported to the device stats with the CPU time as fallback
+struct CreationFeedbackVK
+{
+	CreationFeedbackVK(DeviceVK* device, uint32_t stageCount) : m_enabled(device->SupportsPipelineCreationFeedback()), m_stages(stageCount)
+	{
+		m_createInfo.pNext = nullptr;
+		m_createInfo.pPipelineCreationFeedback = &m_pipeline;
+		m_createInfo.pipelineStageCreationFeedbackCount = stageCount;
+		m_createInfo.pPipelineStageCreationFeedbacks = m_stages.data();
+
+		m_start = std::chrono::steady_clock::now();
+	}
+
+	const void* GetNext() const { return m_enabled ? &m_createInfo : nullptr; };
+
+	void Report(DeviceVK* device, const char* type) const
+	{
+		double cpuTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+
+		device->ReportPipelineCreation(type, m_enabled ? &m_pipeline : nullptr, cpuTime);
+	}
+
+	bool m_enabled;
+	VkPipelineCreationFeedbackEXT m_pipeline = {};
+	std::vector<VkPipelineCreationFeedbackEXT> m_stages;
+	VkPipelineCreationFeedbackCreateInfoEXT m_createInfo = { VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT };
+	std::chrono::steady_clock::time_point m_start;
+};
+
 // ------------------------------- PipelineVK -------------------------------
 
 void PipelineVK::Destroy(DeviceVK* device)
@@ -30,6 +64,104 @@ VkPipelineBindPoint PipelineVK::GetBindPoint()
 	}
 }
 
+bool PipelineVK::SelectLayout(DeviceVK* device, const std::vector<const ShaderVK*>& shaders, bool pushDescriptors)
+{
+	std::memset(m_usedSlots, 0, sizeof(m_usedSlots));
+	m_numDescriptorSets = 0;
+	std::memset(m_usesImmutableSamplers, 0, sizeof(m_usesImmutableSamplers));
+	m_usesBindless = false;
+	m_usesPushDescriptors = pushDescriptors && device->SupportsPushDescriptors();
+
+	for (const ShaderVK* shader : shaders)
+	{
+		if (!AddShaderResources(device, shader->GetReflection()))
+			return false;
+	}
+
+	// the bindless set comes after all the frequency sets, and the push descriptors one is DRAW_SET, the last
+	if (m_usesBindless || m_usesPushDescriptors)
+		m_numDescriptorSets = NUM_DESCRIPTOR_SETS;
+
+	m_layout = device->GetPipelineLayout(m_numDescriptorSets, m_usesBindless, m_usesPushDescriptors);
+
+	return true;
+}
+
+bool PipelineVK::AddShaderResources(DeviceVK* device, const ShaderReflectionVK& reflection)
+{
+	for (const ShaderBindingVK& binding : reflection.GetBindings())
+	{
+		bool valid = false;
+
+		if (binding.m_set < NUM_DESCRIPTOR_SETS)
+		{
+			// binding ranges of the slot types, in binding order (see shaderCommon.h)
+			static const uint32_t firstBindings[ContextVK::NUM_BINDING_TYPES] = { UNIFORM_BUFFER_SLOT(0), TEXTURE_SLOT(0), STORAGE_IMAGE_SLOT(0), STORAGE_BUFFER_SLOT(0),
+				UNIFORM_TEXEL_BUFFER_SLOT(0), STORAGE_TEXEL_BUFFER_SLOT(0), SAMPLED_IMAGE_SLOT(0) };
+			static const uint32_t numSlots[ContextVK::NUM_BINDING_TYPES] = { MAX_UNIFORM_BUFFER_SLOTS, MAX_TEXTURE_SLOTS, MAX_STORAGE_IMAGE_SLOTS, MAX_STORAGE_BUFFER_SLOTS,
+				MAX_UNIFORM_TEXEL_BUFFER_SLOTS, MAX_STORAGE_TEXEL_BUFFER_SLOTS, MAX_SAMPLED_IMAGE_SLOTS };
+			// the UBO slots are dynamic in the layout, which the shaders can't tell
+			static const VkDescriptorType descriptorTypes[ContextVK::NUM_BINDING_TYPES] = { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+				VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER,
+				VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE };
+
+			for (uint32_t type = 0; type < ContextVK::NUM_BINDING_TYPES; ++type)
+			{
+				if (binding.m_binding < firstBindings[type] || binding.m_binding >= firstBindings[type] + numSlots[type])
+					continue;
+
+				valid = (binding.m_descriptorType == descriptorTypes[type]) && (binding.m_count == 1);
+
+				if (valid)
+					m_usedSlots[binding.m_set][type] |= 1u << (binding.m_binding - firstBindings[type]);
+			}
+
+			if (binding.m_binding == IMMUTABLE_SAMPLERS_BINDING)
+			{
+				valid = (binding.m_descriptorType == VK_DESCRIPTOR_TYPE_SAMPLER) && (binding.m_count <= NUM_IMMUTABLE_SAMPLERS);
+				m_usesImmutableSamplers[binding.m_set] |= valid;
+			}
+
+			m_numDescriptorSets = std::max(m_numDescriptorSets, binding.m_set + 1);
+		}
+		else if (binding.m_set == BINDLESS_SET && device->IsBindlessEnabled())
+		{
+			switch (binding.m_binding)
+			{
+			case BINDLESS_TEXTURE_BINDING:
+				valid = (binding.m_descriptorType == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE) && (binding.m_count <= MAX_BINDLESS_TEXTURES);
+				break;
+			case BINDLESS_SAMPLER_BINDING:
+				valid = (binding.m_descriptorType == VK_DESCRIPTOR_TYPE_SAMPLER) && (binding.m_count <= MAX_BINDLESS_SAMPLERS);
+				break;
+			case BINDLESS_STORAGE_BUFFER_BINDING:
+				valid = (binding.m_descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER) && (binding.m_count <= MAX_BINDLESS_STORAGE_BUFFERS);
+				break;
+			default:
+				break;
+			}
+
+			m_usesBindless = true;
+		}
+
+		if (!valid)
+		{
+			std::cout << "Shader binding (set " << binding.m_set << ", binding " << binding.m_binding << ", descriptor type " << binding.m_descriptorType << ", count " << binding.m_count <<
+				") doesn't match the descriptor set layouts" << std::endl;
+			return false;
+		}
+	}
+
+	if (reflection.GetPushConstantsSize() > device->GetPushConstantsSize())
+	{
+		std::cout << "Shader push constants (" << reflection.GetPushConstantsSize() << " bytes) don't fit the pipeline layout (" << device->GetPushConstantsSize() <<
+			" bytes), use the PUSH_CONSTANTS_FALLBACK variant" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
 // ------------------------------- GraphicsPipelineVK -------------------------------
 
 VkCullModeFlags CullModeToVk[NUM_CULL_MODES] = 
@@ -48,9 +180,15 @@ VkFrontFace FrontFaceToVk[NUM_FRONT_FACES] =
 bool GraphicsPipelineVK::Create(DeviceVK* device, const GraphicsPipelineDesc &desc)
 {
 	std::vector<VkPipelineShaderStageCreateInfo> shaderStageCreateInfos;
+	std::vector<const ShaderVK*> shaders;
 
-	for (auto shader: desc.m_shaders)
+	// shared by all the stages
+	VkSpecializationInfo specializationInfo = desc.m_specializationConstants.GetInfo();
+
+	for (const auto& shader: desc.m_shaders)
 	{
+		shaders.push_back(&shader);
+
 		VkPipelineShaderStageCreateInfo pssci = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
 
 		pssci.pNext = nullptr;
@@ -58,7 +196,7 @@ bool GraphicsPipelineVK::Create(DeviceVK* device, const GraphicsPipelineDesc &de
 		pssci.stage = shader.GetStage();
 		pssci.module = shader.GetShaderModule();
 		pssci.pName = "main";
-		pssci.pSpecializationInfo = nullptr;
+		pssci.pSpecializationInfo = desc.m_specializationConstants.IsEmpty() ? nullptr : &specializationInfo;
 
 		shaderStageCreateInfos.emplace_back(pssci);
 	}
@@ -66,6 +204,27 @@ bool GraphicsPipelineVK::Create(DeviceVK* device, const GraphicsPipelineDesc &de
 	VkVertexInputBindingDescription bindingDescription[] = { desc.m_vertexFormat->GetBindingDescription() };
 	std::vector<VkVertexInputAttributeDescription> attributeDescriptions = desc.m_vertexFormat->GetAttributeDescriptions();
 
+	// every input of the vertex shader must be fed by the vertex format
+	for (const auto& shader : desc.m_shaders)
+	{
+		if (shader.GetStage() != VK_SHADER_STAGE_VERTEX_BIT)
+			continue;
+
+		for (const ShaderInputVK& input : shader.GetReflection().GetInputs())
+		{
+			for (uint32_t location = input.m_location; location < input.m_location + input.m_numLocations; ++location)
+			{
+				auto isLocation = [location](const VkVertexInputAttributeDescription& attribute) { return attribute.location == location; };
+
+				if (std::find_if(attributeDescriptions.begin(), attributeDescriptions.end(), isLocation) == attributeDescriptions.end())
+				{
+					std::cout << "Vertex shader input at location " << location << " is missing from the vertex format" << std::endl;
+					return false;
+				}
+			}
+		}
+	}
+
 	VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo = { VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
 	vertexInputCreateInfo.pNext = nullptr;
 	vertexInputCreateInfo.flags = 0;
@@ -80,20 +239,22 @@ bool GraphicsPipelineVK::Create(DeviceVK* device, const GraphicsPipelineDesc &de
 	inputAssemblyCreateInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 	inputAssemblyCreateInfo.primitiveRestartEnable = VK_FALSE;
 
-	uint32_t width = desc.m_frameBuffer->GetWidth();
-	uint32_t height = desc.m_frameBuffer->GetHeight();
-
-	VkViewport viewport = { 0, 0, float(width), float(height), 0.0f, 1.0f };
-	VkExtent2D scissorExtent = { width , height };
-	VkRect2D scissor = { 0, 0, scissorExtent };
-
+	// viewport and scissor are dynamic (see ContextVK::BeginPass), so the pipeline doesn't depend on the frame buffer size
 	VkPipelineViewportStateCreateInfo viewportStateCreateInfo = { VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO };
 	viewportStateCreateInfo.pNext = nullptr;
 	viewportStateCreateInfo.flags = 0;
 	viewportStateCreateInfo.viewportCount = 1;
-	viewportStateCreateInfo.pViewports = &viewport;
+	viewportStateCreateInfo.pViewports = nullptr;
 	viewportStateCreateInfo.scissorCount = 1;
-	viewportStateCreateInfo.pScissors = &scissor;
+	viewportStateCreateInfo.pScissors = nullptr;
+
+	VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+	VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo = { VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
+	dynamicStateCreateInfo.pNext = nullptr;
+	dynamicStateCreateInfo.flags = 0;
+	dynamicStateCreateInfo.dynamicStateCount = sizeof(dynamicStates) / sizeof(VkDynamicState);
+	dynamicStateCreateInfo.pDynamicStates = dynamicStates;
 
 	VkPipelineRasterizationStateCreateInfo rasterizationCreateInfo = { VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
 	rasterizationCreateInfo.pNext = nullptr;
@@ -112,9 +273,9 @@ bool GraphicsPipelineVK::Create(DeviceVK* device, const GraphicsPipelineDesc &de
 	VkPipelineDepthStencilStateCreateInfo depthStencilStateCreateInfo = { VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
 	depthStencilStateCreateInfo.pNext = nullptr;
 	depthStencilStateCreateInfo.flags = 0;
-	depthStencilStateCreateInfo.depthTestEnable = VK_TRUE;
-	depthStencilStateCreateInfo.depthWriteEnable = VK_TRUE;
-	depthStencilStateCreateInfo.depthCompareOp = VK_COMPARE_OP_LESS;
+	depthStencilStateCreateInfo.depthTestEnable = desc.m_depthTest ? VK_TRUE : VK_FALSE;
+	depthStencilStateCreateInfo.depthWriteEnable = desc.m_depthWrite ? VK_TRUE : VK_FALSE;
+	depthStencilStateCreateInfo.depthCompareOp = desc.m_depthCompareOp;
 	depthStencilStateCreateInfo.depthBoundsTestEnable = VK_FALSE;
 	depthStencilStateCreateInfo.stencilTestEnable = VK_FALSE;
 	depthStencilStateCreateInfo.front = {};
@@ -142,6 +303,20 @@ bool GraphicsPipelineVK::Create(DeviceVK* device, const GraphicsPipelineDesc &de
 	blendAttachmentState.alphaBlendOp = VK_BLEND_OP_ADD;
 	blendAttachmentState.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
 
+	if (desc.m_blendMode == BLEND_MODE_ALPHA)
+	{
+		blendAttachmentState.blendEnable = VK_TRUE;
+		blendAttachmentState.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+		blendAttachmentState.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+		blendAttachmentState.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+	}
+	else if (desc.m_blendMode == BLEND_MODE_ADDITIVE)
+	{
+		blendAttachmentState.blendEnable = VK_TRUE;
+		blendAttachmentState.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		blendAttachmentState.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+	}
+
 	VkPipelineColorBlendStateCreateInfo colorBlendCreateInfo = { VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
 	colorBlendCreateInfo.pNext = nullptr;
 	colorBlendCreateInfo.flags = 0;
@@ -154,22 +329,11 @@ bool GraphicsPipelineVK::Create(DeviceVK* device, const GraphicsPipelineDesc &de
 	colorBlendCreateInfo.blendConstants[2] = 0.0f;
 	colorBlendCreateInfo.blendConstants[3] = 0.0f;
 
-	//VkPushConstantRange pushConstantRange;
-	//pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-	//pushConstantRange.offset = 0;
-	//pushConstantRange.size = sizeof(m_pushConstantTestColor);
+	if (!desc.m_specializationConstants.Validate(shaders))
+		return false;
 
-	VkDescriptorSetLayout descLayout = device->GetDescriptorSetLayout();
-
-	VkPipelineLayoutCreateInfo layoutCreateInfo = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
-	layoutCreateInfo.pNext = nullptr;
-	layoutCreateInfo.flags = 0;
-	layoutCreateInfo.setLayoutCount = 1;
-	layoutCreateInfo.pSetLayouts = &descLayout;
-	layoutCreateInfo.pushConstantRangeCount = 0; // 1;
-	layoutCreateInfo.pPushConstantRanges = nullptr; // &pushConstantRange;
-
-	VK_CHECK(vkCreatePipelineLayout(device->GetDevice(), &layoutCreateInfo, nullptr, &m_layout));
+	if (!SelectLayout(device, shaders, desc.m_pushDescriptors))
+		return false;
 
 	VkGraphicsPipelineCreateInfo pipelineCreateInfo = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
 	pipelineCreateInfo.pNext = nullptr;
@@ -184,7 +348,7 @@ bool GraphicsPipelineVK::Create(DeviceVK* device, const GraphicsPipelineDesc &de
 	pipelineCreateInfo.pMultisampleState = &multisampleCreateInfo;
 	pipelineCreateInfo.pDepthStencilState = &depthStencilStateCreateInfo;
 	pipelineCreateInfo.pColorBlendState = &colorBlendCreateInfo;
-	pipelineCreateInfo.pDynamicState = nullptr;
+	pipelineCreateInfo.pDynamicState = &dynamicStateCreateInfo;
 	pipelineCreateInfo.layout = m_layout;
 	pipelineCreateInfo.renderPass = desc.m_frameBuffer->GetRenderPass();
 	pipelineCreateInfo.subpass = 0;
@@ -193,60 +357,869 @@ bool GraphicsPipelineVK::Create(DeviceVK* device, const GraphicsPipelineDesc &de
 	// pass a valid index if the pipeline to derive from is in the same batch of pipelines passed to this vkCreateGraphicsPipelines call
 	pipelineCreateInfo.basePipelineIndex = -1;
 
-	VK_CHECK(vkCreateGraphicsPipelines(device->GetDevice(), VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &m_pipeline));
+	// a part that failed falls back to the full pipeline
+	if (device->SupportsGraphicsPipelineLibrary() && CreateFromLibraries(device, desc, pipelineCreateInfo))
+		return true;
+
+	CreationFeedbackVK feedback(device, uint32_t(shaderStageCreateInfos.size()));
+	pipelineCreateInfo.pNext = feedback.GetNext();
+
+	VK_CHECK(vkCreateGraphicsPipelines(device->GetDevice(), device->GetPipelineCache(), 1, &pipelineCreateInfo, nullptr, &m_pipeline));
+
+	feedback.Report(device, "graphics");
 
 	return true;
 }
 
 void GraphicsPipelineVK::Destroy(DeviceVK* device)
 {
-	vkDestroyPipelineLayout(device->GetDevice(), m_layout, nullptr);
 	PipelineVK::Destroy(device);
+
+	m_fastLinked = false;
+}
+
+bool GraphicsPipelineVK::CreateFromLibraries(DeviceVK* device, const GraphicsPipelineDesc& desc, const VkGraphicsPipelineCreateInfo& pipelineCreateInfo)
+{
+	for (uint32_t part = 0; part < PipelineLibraryCache::NUM_LIBRARY_PARTS; ++part)
+	{
+		m_libraries[part] = PipelineLibraryCache::GetLibrary(device, PipelineLibraryCache::LibraryPart(part), desc, pipelineCreateInfo);
+
+		if (m_libraries[part] == VK_NULL_HANDLE)
+			return false;
+	}
+
+	m_pipeline = Link(device, false);
+	m_fastLinked = (m_pipeline != VK_NULL_HANDLE);
+
+	return m_fastLinked;
+}
+
+VkPipeline GraphicsPipelineVK::CreateOptimized(DeviceVK* device) const
+{
+	assert(m_fastLinked);
+
+	return Link(device, true);
+}
+
+void GraphicsPipelineVK::SetOptimized(DeviceVK* device, VkPipeline pipeline)
+{
+	assert(m_fastLinked && pipeline != VK_NULL_HANDLE);
+
+	// the command buffers of the frames in flight may still reference it
+	VkDevice logicDevice = device->GetDevice();
+	VkPipeline fastLinkedPipeline = m_pipeline;
+
+	device->AddFrameCompletionCallback(device->GetCurrentFrameValue(), [logicDevice, fastLinkedPipeline]()
+	{
+		vkDestroyPipeline(logicDevice, fastLinkedPipeline, nullptr);
+	});
+
+	m_pipeline = pipeline;
+	m_fastLinked = false;
+}
+
+VkPipeline GraphicsPipelineVK::Link(DeviceVK* device, bool optimize) const
+{
+	CreationFeedbackVK feedback(device, 0);
+
+	VkPipelineLibraryCreateInfoKHR libraryCreateInfo = { VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR };
+	libraryCreateInfo.pNext = feedback.GetNext();
+	libraryCreateInfo.libraryCount = PipelineLibraryCache::NUM_LIBRARY_PARTS;
+	libraryCreateInfo.pLibraries = m_libraries;
+
+	// all the states come from the libraries, the layout has to match theirs
+	VkGraphicsPipelineCreateInfo pipelineCreateInfo = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+	pipelineCreateInfo.pNext = &libraryCreateInfo;
+	pipelineCreateInfo.flags = optimize ? VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT : 0;
+	pipelineCreateInfo.layout = m_layout;
+	pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineCreateInfo.basePipelineIndex = -1;
+
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	VK_CHECK(vkCreateGraphicsPipelines(device->GetDevice(), device->GetPipelineCache(), 1, &pipelineCreateInfo, nullptr, &pipeline));
+
+	feedback.Report(device, optimize ? "optimized link" : "fast link");
+
+	return pipeline;
+}
+
+// ------------------------------- PipelineLibraryCache -------------------------------
+
+std::unordered_map<std::vector<uint64_t>, VkPipeline, PipelineKeyHash> PipelineLibraryCache::m_libraries;
+std::unordered_multimap<VkShaderModule, std::vector<uint64_t>> PipelineLibraryCache::m_shaderLibraries;
+std::mutex PipelineLibraryCache::m_mutex;
+
+std::vector<uint64_t> PipelineLibraryCache::GetLibraryKey(LibraryPart part, const GraphicsPipelineDesc& desc, VkPipelineLayout layout)
+{
+	std::vector<uint64_t> key;
+
+	key.push_back(part);
+
+	// only what the part is created from, so that it's shared by as many pipelines as possible
+	switch (part)
+	{
+	case LIBRARY_PART_VERTEX_INPUT:
+		key.push_back(desc.m_vertexFormat->GetHash());
+		break;
+
+	case LIBRARY_PART_PRE_RASTERIZATION:
+	case LIBRARY_PART_FRAGMENT_SHADER:
+		for (const ShaderVK& shader : desc.m_shaders)
+		{
+			if ((shader.GetStage() == VK_SHADER_STAGE_FRAGMENT_BIT) == (part == LIBRARY_PART_FRAGMENT_SHADER))
+			{
+				key.push_back((uint64_t)shader.GetShaderModule());
+				key.push_back(shader.GetStage());
+			}
+		}
+
+		desc.m_specializationConstants.AppendKey(key);
+		// both shader parts must be created with the layout of the linked pipeline
+		key.push_back((uint64_t)layout);
+		key.push_back((uint64_t)desc.m_frameBuffer->GetRenderPass());
+
+		if (part == LIBRARY_PART_PRE_RASTERIZATION)
+		{
+			key.push_back(desc.m_cullMode);
+			key.push_back(desc.m_frontFace);
+		}
+		else
+		{
+			key.push_back(desc.m_depthTest);
+			key.push_back(desc.m_depthWrite);
+			key.push_back(desc.m_depthCompareOp);
+		}
+		break;
+
+	case LIBRARY_PART_FRAGMENT_OUTPUT:
+		key.push_back((uint64_t)desc.m_frameBuffer->GetRenderPass());
+		key.push_back(desc.m_blendMode);
+		break;
+
+	default:
+		assert(0);
+		break;
+	}
+
+	return key;
+}
+
+VkPipeline PipelineLibraryCache::GetLibrary(DeviceVK* device, LibraryPart part, const GraphicsPipelineDesc& desc, const VkGraphicsPipelineCreateInfo& pipelineCreateInfo)
+{
+	std::vector<uint64_t> libraryKey = GetLibraryKey(part, desc, pipelineCreateInfo.layout);
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		auto it = m_libraries.find(libraryKey);
+
+		if (it != m_libraries.end())
+			return it->second;
+	}
+
+	VkPipeline library = CreateLibrary(device, part, pipelineCreateInfo);
+
+	if (library == VK_NULL_HANDLE)
+		return VK_NULL_HANDLE;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto result = m_libraries.emplace(libraryKey, library);
+
+	// created by another worker meanwhile, keep the first one
+	if (!result.second)
+	{
+		vkDestroyPipeline(device->GetDevice(), library, nullptr);
+		return result.first->second;
+	}
+
+	if (part == LIBRARY_PART_PRE_RASTERIZATION || part == LIBRARY_PART_FRAGMENT_SHADER)
+	{
+		for (const ShaderVK& shader : desc.m_shaders)
+		{
+			if ((shader.GetStage() == VK_SHADER_STAGE_FRAGMENT_BIT) == (part == LIBRARY_PART_FRAGMENT_SHADER))
+				m_shaderLibraries.emplace(shader.GetShaderModule(), libraryKey);
+		}
+	}
+
+	return library;
+}
+
+VkPipeline PipelineLibraryCache::CreateLibrary(DeviceVK* device, LibraryPart part, const VkGraphicsPipelineCreateInfo& pipelineCreateInfo)
+{
+	static const VkGraphicsPipelineLibraryFlagsEXT partFlags[NUM_LIBRARY_PARTS] =
+	{
+		VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT,
+		VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT,
+		VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT,
+		VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT
+	};
+
+	// the states of the other parts are ignored, but the stages have to be filtered
+	std::vector<VkPipelineShaderStageCreateInfo> shaderStageCreateInfos;
+
+	for (uint32_t i = 0; i < pipelineCreateInfo.stageCount; ++i)
+	{
+		bool isFragment = (pipelineCreateInfo.pStages[i].stage == VK_SHADER_STAGE_FRAGMENT_BIT);
+
+		if ((part == LIBRARY_PART_PRE_RASTERIZATION && !isFragment) || (part == LIBRARY_PART_FRAGMENT_SHADER && isFragment))
+			shaderStageCreateInfos.push_back(pipelineCreateInfo.pStages[i]);
+	}
+
+	CreationFeedbackVK feedback(device, uint32_t(shaderStageCreateInfos.size()));
+
+	VkGraphicsPipelineLibraryCreateInfoEXT libraryCreateInfo = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT };
+	libraryCreateInfo.pNext = feedback.GetNext();
+	libraryCreateInfo.flags = partFlags[part];
+
+	VkGraphicsPipelineCreateInfo createInfo = pipelineCreateInfo;
+	createInfo.pNext = &libraryCreateInfo;
+	// keep what the optimized link needs
+	createInfo.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+	createInfo.stageCount = uint32_t(shaderStageCreateInfos.size());
+	createInfo.pStages = shaderStageCreateInfos.data();
+
+	VkPipeline library = VK_NULL_HANDLE;
+	VK_CHECK(vkCreateGraphicsPipelines(device->GetDevice(), device->GetPipelineCache(), 1, &createInfo, nullptr, &library));
+
+	feedback.Report(device, "library");
+
+	return library;
+}
+
+void PipelineLibraryCache::InvalidateShader(DeviceVK* device, VkShaderModule shaderModule)
+{
+	VkDevice logicDevice = device->GetDevice();
+	uint64_t frameValue = device->GetCurrentFrameValue();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto range = m_shaderLibraries.equal_range(shaderModule);
+
+	// the entries of the other modules of these parts are left, they can't match anymore
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		auto library = m_libraries.find(it->second);
+
+		if (library == m_libraries.end())
+			continue;
+
+		VkPipeline pipeline = library->second;
+		m_libraries.erase(library);
+
+		device->AddFrameCompletionCallback(frameValue, [logicDevice, pipeline]()
+		{
+			vkDestroyPipeline(logicDevice, pipeline, nullptr);
+		});
+	}
+
+	m_shaderLibraries.erase(range.first, range.second);
+}
+
+void PipelineLibraryCache::Cleanup(DeviceVK* device)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (auto& library : m_libraries)
+		vkDestroyPipeline(device->GetDevice(), library.second, nullptr);
+
+	m_libraries.clear();
+	m_shaderLibraries.clear();
 }
 
 // ------------------------------- ComputePipelineVK -------------------------------
 
-bool ComputePipelineVK::Create(DeviceVK* device, ShaderVK* computeShader)
+bool ComputePipelineVK::Create(DeviceVK* device, ShaderVK* computeShader, bool pushDescriptors, const SpecializationConstantsVK& specializationConstants)
 {
 	assert(computeShader->GetStage() == VK_SHADER_STAGE_COMPUTE_BIT);
 
+	if (!specializationConstants.Validate({ computeShader }))
+		return false;
+
+	const uint32_t* workgroupSize = computeShader->GetReflection().GetWorkgroupSize();
+	const uint32_t* workgroupSizeConstantIds = computeShader->GetReflection().GetWorkgroupSizeConstantIds();
+
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		m_workgroupSize[i] = workgroupSize[i];
+
+		if (workgroupSizeConstantIds[i] != ShaderReflectionVK::s_noConstantId)
+			specializationConstants.GetValue(workgroupSizeConstantIds[i], m_workgroupSize[i]);
+	}
+
+	VkSpecializationInfo specializationInfo = specializationConstants.GetInfo();
+
 	VkPipelineShaderStageCreateInfo shaderStageCreateInfo = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
 	shaderStageCreateInfo.pNext = nullptr;
 	shaderStageCreateInfo.flags = 0;
 	shaderStageCreateInfo.stage = computeShader->GetStage();
 	shaderStageCreateInfo.module = computeShader->GetShaderModule();
 	shaderStageCreateInfo.pName = "main";
-	shaderStageCreateInfo.pSpecializationInfo = nullptr;
-
-	VkDescriptorSetLayout descLayout = device->GetDescriptorSetLayout();
+	shaderStageCreateInfo.pSpecializationInfo = specializationConstants.IsEmpty() ? nullptr : &specializationInfo;
 
-	VkPipelineLayoutCreateInfo layoutCreateInfo = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
-	layoutCreateInfo.pNext = nullptr;
-	layoutCreateInfo.flags = 0;
-	layoutCreateInfo.setLayoutCount = 1;
-	layoutCreateInfo.pSetLayouts = &descLayout;
-	layoutCreateInfo.pushConstantRangeCount = 0;
-	layoutCreateInfo.pPushConstantRanges = nullptr;
+	if (!SelectLayout(device, { computeShader }, pushDescriptors))
+		return false;
 
-	VK_CHECK(vkCreatePipelineLayout(device->GetDevice(), &layoutCreateInfo, nullptr, &m_layout));
+	CreationFeedbackVK feedback(device, 1);
 
 	VkComputePipelineCreateInfo createInfo = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
-	createInfo.pNext = nullptr;
+	createInfo.pNext = feedback.GetNext();
 	createInfo.flags = 0;
 	createInfo.stage = shaderStageCreateInfo;
 	createInfo.layout = m_layout;
 	createInfo.basePipelineHandle = VK_NULL_HANDLE;
 	createInfo.basePipelineIndex = -1;
 
-	VK_CHECK(vkCreateComputePipelines(device->GetDevice(), VK_NULL_HANDLE, 1, &createInfo, nullptr, &m_pipeline));
+	VK_CHECK(vkCreateComputePipelines(device->GetDevice(), device->GetPipelineCache(), 1, &createInfo, nullptr, &m_pipeline));
+
+	feedback.Report(device, "compute");
 
 	return true;
 }
 
 void ComputePipelineVK::Destroy(DeviceVK* device)
 {
-	vkDestroyPipelineLayout(device->GetDevice(), m_layout, nullptr);
 	PipelineVK::Destroy(device);
 }
 
+// ------------------------------- PipelineStateCache -------------------------------
+
+std::unordered_map<std::vector<uint64_t>, GraphicsPipelineVK*, PipelineKeyHash> PipelineStateCache::m_graphicsPipelines;
+std::unordered_map<std::vector<uint64_t>, ComputePipelineVK*, PipelineKeyHash> PipelineStateCache::m_computePipelines;
+uint32_t PipelineStateCache::m_numHits = 0;
+uint32_t PipelineStateCache::m_numMisses = 0;
+std::unordered_multimap<VkShaderModule, std::pair<PipelineVK::PipelineType, std::vector<uint64_t>>> PipelineStateCache::m_shaderPipelines;
+std::unordered_set<std::vector<uint64_t>, PipelineKeyHash> PipelineStateCache::m_pendingGraphicsPipelines;
+std::unordered_set<std::vector<uint64_t>, PipelineKeyHash> PipelineStateCache::m_pendingComputePipelines;
+uint32_t PipelineStateCache::m_numStalls = 0;
+double PipelineStateCache::m_stallTime = 0.0;
+std::atomic<uint32_t> PipelineStateCache::m_compileTimeHistogram[s_numCompileTimeBuckets] = {};
+std::vector<std::thread> PipelineStateCache::m_workers;
+std::mutex PipelineStateCache::m_mutex;
+std::condition_variable PipelineStateCache::m_jobsCondition;
+std::condition_variable PipelineStateCache::m_doneCondition;
+std::deque<std::function<void()>> PipelineStateCache::m_jobs;
+uint32_t PipelineStateCache::m_numRunningJobs = 0;
+bool PipelineStateCache::m_stopWorkers = false;
+std::vector<std::pair<std::vector<uint64_t>, GraphicsPipelineVK*>> PipelineStateCache::m_readyGraphicsPipelines;
+std::vector<std::pair<std::vector<uint64_t>, ComputePipelineVK*>> PipelineStateCache::m_readyComputePipelines;
+std::vector<std::function<void()>> PipelineStateCache::m_readyOptimizations;
+
+// FNV-1a over the key words
+size_t PipelineKeyHash::operator()(const std::vector<uint64_t>& key) const
+{
+	uint64_t hash = 14695981039346656037ull;
+
+	for (uint64_t word : key)
+	{
+		hash ^= word;
+		hash *= 1099511628211ull;
+	}
+
+	return size_t(hash);
+}
+
+std::vector<uint64_t> PipelineStateCache::GetPipelineKey(const GraphicsPipelineDesc& desc)
+{
+	std::vector<uint64_t> key;
+
+	key.push_back(desc.m_shaders.size());
+
+	for (const ShaderVK& shader : desc.m_shaders)
+	{
+		key.push_back((uint64_t)shader.GetShaderModule());
+		key.push_back(shader.GetStage());
+	}
+
+	key.push_back(desc.m_vertexFormat->GetHash());
+
+	// render passes are shared by the frame buffers with compatible attachments (see RenderPassCache), and the viewport is dynamic:
+	// the same pipeline is used for any size
+	key.push_back((uint64_t)desc.m_frameBuffer->GetRenderPass());
+
+	key.push_back(desc.m_cullMode);
+	key.push_back(desc.m_frontFace);
+	key.push_back(desc.m_depthTest);
+	key.push_back(desc.m_depthWrite);
+	key.push_back(desc.m_depthCompareOp);
+	key.push_back(desc.m_blendMode);
+	key.push_back(desc.m_pushDescriptors);
+	desc.m_specializationConstants.AppendKey(key);
+
+	return key;
+}
+
+std::vector<uint64_t> PipelineStateCache::GetPipelineKey(const ShaderVK* computeShader, bool pushDescriptors, const SpecializationConstantsVK& specializationConstants)
+{
+	std::vector<uint64_t> key;
+
+	key.push_back((uint64_t)computeShader->GetShaderModule());
+	key.push_back(pushDescriptors);
+	specializationConstants.AppendKey(key);
+
+	return key;
+}
+
+GraphicsPipelineVK* PipelineStateCache::GetGraphicsPipeline(DeviceVK* device, const GraphicsPipelineDesc& desc)
+{
+	std::vector<uint64_t> pipelineKey = GetPipelineKey(desc);
+
+	auto startTime = std::chrono::steady_clock::now();
+
+	if (IsGraphicsPipelinePending(pipelineKey))
+	{
+		WaitForGraphicsPipeline(pipelineKey);
+		AddStall(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count());
+	}
+
+	auto it = m_graphicsPipelines.find(pipelineKey);
+
+	if (it != m_graphicsPipelines.end())
+	{
+		m_numHits++;
+		return it->second;
+	}
+
+	m_numMisses++;
+
+	for (const ShaderVK& shader : desc.m_shaders)
+		m_shaderPipelines.emplace(shader.GetShaderModule(), std::make_pair(PipelineVK::PIPELINE_TYPE_GRAPHICS, pipelineKey));
+
+	GraphicsPipelineVK* pipeline = CreateGraphicsPipeline(device, desc);
+
+	m_graphicsPipelines[pipelineKey] = pipeline;
+
+	OptimizeGraphicsPipeline(device, pipeline);
+
+	AddStall(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count());
+
+	return pipeline;
+}
+
+ComputePipelineVK* PipelineStateCache::GetComputePipeline(DeviceVK* device, ShaderVK* computeShader, bool pushDescriptors, const SpecializationConstantsVK& specializationConstants)
+{
+	std::vector<uint64_t> pipelineKey = GetPipelineKey(computeShader, pushDescriptors, specializationConstants);
+
+	auto startTime = std::chrono::steady_clock::now();
+
+	if (IsComputePipelinePending(pipelineKey))
+	{
+		WaitForComputePipeline(pipelineKey);
+		AddStall(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count());
+	}
+
+	auto it = m_computePipelines.find(pipelineKey);
+
+	if (it != m_computePipelines.end())
+	{
+		m_numHits++;
+		return it->second;
+	}
+
+	m_numMisses++;
+
+	m_shaderPipelines.emplace(computeShader->GetShaderModule(), std::make_pair(PipelineVK::PIPELINE_TYPE_COMPUTE, pipelineKey));
+
+	ComputePipelineVK* pipeline = CreateComputePipeline(device, computeShader, pushDescriptors, specializationConstants);
+
+	m_computePipelines[pipelineKey] = pipeline;
+
+	AddStall(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count());
+
+	return pipeline;
+}
+
+GraphicsPipelineVK* PipelineStateCache::RequestGraphicsPipeline(DeviceVK* device, const GraphicsPipelineDesc& desc, bool& pending)
+{
+	std::vector<uint64_t> pipelineKey = GetPipelineKey(desc);
+
+	pending = IsGraphicsPipelinePending(pipelineKey);
+
+	if (pending)
+		return nullptr;
+
+	auto it = m_graphicsPipelines.find(pipelineKey);
+
+	if (it != m_graphicsPipelines.end())
+	{
+		m_numHits++;
+		return it->second;
+	}
+
+	m_numMisses++;
+
+	for (const ShaderVK& shader : desc.m_shaders)
+		m_shaderPipelines.emplace(shader.GetShaderModule(), std::make_pair(PipelineVK::PIPELINE_TYPE_GRAPHICS, pipelineKey));
+
+	m_pendingGraphicsPipelines.insert(pipelineKey);
+	pending = true;
+
+	// the desc is copied: the request can come from a temporary
+	AddJob([device, desc, pipelineKey]()
+	{
+		GraphicsPipelineVK* pipeline = CreateGraphicsPipeline(device, desc);
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_readyGraphicsPipelines.emplace_back(pipelineKey, pipeline);
+		}
+
+		OptimizeGraphicsPipeline(device, pipeline);
+	});
+
+	return nullptr;
+}
+
+ComputePipelineVK* PipelineStateCache::RequestComputePipeline(DeviceVK* device, ShaderVK* computeShader, bool pushDescriptors, const SpecializationConstantsVK& specializationConstants, bool& pending)
+{
+	std::vector<uint64_t> pipelineKey = GetPipelineKey(computeShader, pushDescriptors, specializationConstants);
+
+	pending = IsComputePipelinePending(pipelineKey);
+
+	if (pending)
+		return nullptr;
+
+	auto it = m_computePipelines.find(pipelineKey);
+
+	if (it != m_computePipelines.end())
+	{
+		m_numHits++;
+		return it->second;
+	}
+
+	m_numMisses++;
+
+	m_shaderPipelines.emplace(computeShader->GetShaderModule(), std::make_pair(PipelineVK::PIPELINE_TYPE_COMPUTE, pipelineKey));
+
+	m_pendingComputePipelines.insert(pipelineKey);
+	pending = true;
+
+	AddJob([device, computeShader, pushDescriptors, specializationConstants, pipelineKey]()
+	{
+		ComputePipelineVK* pipeline = CreateComputePipeline(device, computeShader, pushDescriptors, specializationConstants);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_readyComputePipelines.emplace_back(pipelineKey, pipeline);
+	});
+
+	return nullptr;
+}
+
+void PipelineStateCache::Update()
+{
+	std::vector<std::pair<std::vector<uint64_t>, GraphicsPipelineVK*>> readyGraphicsPipelines;
+	std::vector<std::pair<std::vector<uint64_t>, ComputePipelineVK*>> readyComputePipelines;
+	std::vector<std::function<void()>> readyOptimizations;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		readyGraphicsPipelines.swap(m_readyGraphicsPipelines);
+		readyComputePipelines.swap(m_readyComputePipelines);
+		readyOptimizations.swap(m_readyOptimizations);
+	}
+
+	for (auto& ready : readyGraphicsPipelines)
+	{
+		m_graphicsPipelines[ready.first] = ready.second;
+		m_pendingGraphicsPipelines.erase(ready.first);
+	}
+
+	for (auto& ready : readyComputePipelines)
+	{
+		m_computePipelines[ready.first] = ready.second;
+		m_pendingComputePipelines.erase(ready.first);
+	}
+
+	// between frames: the handle change re-records the static recordings using it
+	for (auto& optimization : readyOptimizations)
+		optimization();
+}
+
+void PipelineStateCache::WaitForPendingPipelines()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_doneCondition.wait(lock, []() { return m_jobs.empty() && m_numRunningJobs == 0; });
+	}
+
+	Update();
+}
+
+void PipelineStateCache::WaitForGraphicsPipeline(const std::vector<uint64_t>& pipelineKey)
+{
+	GraphicsPipelineVK* pipeline = nullptr;
+
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		auto it = m_readyGraphicsPipelines.end();
+
+		m_doneCondition.wait(lock, [&]()
+		{
+			it = std::find_if(m_readyGraphicsPipelines.begin(), m_readyGraphicsPipelines.end(), [&](const std::pair<std::vector<uint64_t>, GraphicsPipelineVK*>& ready) { return ready.first == pipelineKey; });
+			return it != m_readyGraphicsPipelines.end();
+		});
+
+		pipeline = it->second;
+		m_readyGraphicsPipelines.erase(it);
+	}
+
+	m_graphicsPipelines[pipelineKey] = pipeline;
+	m_pendingGraphicsPipelines.erase(pipelineKey);
+}
+
+void PipelineStateCache::WaitForComputePipeline(const std::vector<uint64_t>& pipelineKey)
+{
+	ComputePipelineVK* pipeline = nullptr;
+
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		auto it = m_readyComputePipelines.end();
+
+		m_doneCondition.wait(lock, [&]()
+		{
+			it = std::find_if(m_readyComputePipelines.begin(), m_readyComputePipelines.end(), [&](const std::pair<std::vector<uint64_t>, ComputePipelineVK*>& ready) { return ready.first == pipelineKey; });
+			return it != m_readyComputePipelines.end();
+		});
+
+		pipeline = it->second;
+		m_readyComputePipelines.erase(it);
+	}
+
+	m_computePipelines[pipelineKey] = pipeline;
+	m_pendingComputePipelines.erase(pipelineKey);
+}
+
+void PipelineStateCache::Cleanup(DeviceVK* device)
+{
+	StopWorkers();
+	Update();
+
+	for (auto& pipeline : m_graphicsPipelines)
+	{
+		if (pipeline.second)
+		{
+			pipeline.second->Destroy(device);
+			delete pipeline.second;
+		}
+	}
+
+	for (auto& pipeline : m_computePipelines)
+	{
+		if (pipeline.second)
+		{
+			pipeline.second->Destroy(device);
+			delete pipeline.second;
+		}
+	}
+
+	m_graphicsPipelines.clear();
+	m_computePipelines.clear();
+	m_shaderPipelines.clear();
+}
+
+void PipelineStateCache::InvalidateShader(DeviceVK* device, VkShaderModule shaderModule)
+{
+	assert(m_pendingGraphicsPipelines.empty() && m_pendingComputePipelines.empty());
+
+	uint64_t frameValue = device->GetCurrentFrameValue();
+	auto range = m_shaderPipelines.equal_range(shaderModule);
+
+	// the entries of the other modules of these pipelines are left, they can't match anymore
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		if (it->second.first == PipelineVK::PIPELINE_TYPE_GRAPHICS)
+		{
+			auto pipeline = m_graphicsPipelines.find(it->second.second);
+
+			if (pipeline == m_graphicsPipelines.end())
+				continue;
+
+			GraphicsPipelineVK* graphicsPipeline = pipeline->second;
+			m_graphicsPipelines.erase(pipeline);
+
+			if (graphicsPipeline)
+			{
+				device->AddFrameCompletionCallback(frameValue, [device, graphicsPipeline]()
+				{
+					graphicsPipeline->Destroy(device);
+					delete graphicsPipeline;
+				});
+			}
+		}
+		else
+		{
+			auto pipeline = m_computePipelines.find(it->second.second);
+
+			if (pipeline == m_computePipelines.end())
+				continue;
+
+			ComputePipelineVK* computePipeline = pipeline->second;
+			m_computePipelines.erase(pipeline);
+
+			if (computePipeline)
+			{
+				device->AddFrameCompletionCallback(frameValue, [device, computePipeline]()
+				{
+					computePipeline->Destroy(device);
+					delete computePipeline;
+				});
+			}
+		}
+	}
+
+	m_shaderPipelines.erase(range.first, range.second);
+}
+
+void PipelineStateCache::PrintStats()
+{
+	std::cout << "[PipelineStateCache] " << m_numHits << " hits, " << m_numMisses << " misses, " << m_numStalls << " stalls (" << m_stallTime << " ms). Compile times:";
+
+	for (uint32_t bucket = 0; bucket < s_numCompileTimeBuckets; ++bucket)
+	{
+		if (bucket == 0)
+			std::cout << " <1 ms: ";
+		else if (bucket == s_numCompileTimeBuckets - 1)
+			std::cout << ", >=" << (1u << (bucket - 1)) << " ms: ";
+		else
+			std::cout << ", " << (1u << (bucket - 1)) << "-" << (1u << bucket) << " ms: ";
+
+		std::cout << m_compileTimeHistogram[bucket];
+	}
+
+	std::cout << std::endl;
+}
+
+GraphicsPipelineVK* PipelineStateCache::CreateGraphicsPipeline(DeviceVK* device, const GraphicsPipelineDesc& desc)
+{
+	auto startTime = std::chrono::steady_clock::now();
+
+	GraphicsPipelineVK* pipeline = new GraphicsPipelineVK();
+
+	if (!pipeline->Create(device, desc))
+	{
+		delete pipeline;
+		pipeline = nullptr;
+	}
+
+	AddCompileTime(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count());
+
+	return pipeline;
+}
+
+ComputePipelineVK* PipelineStateCache::CreateComputePipeline(DeviceVK* device, ShaderVK* computeShader, bool pushDescriptors, const SpecializationConstantsVK& specializationConstants)
+{
+	auto startTime = std::chrono::steady_clock::now();
+
+	ComputePipelineVK* pipeline = new ComputePipelineVK();
+
+	if (!pipeline->Create(device, computeShader, pushDescriptors, specializationConstants))
+	{
+		delete pipeline;
+		pipeline = nullptr;
+	}
+
+	AddCompileTime(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count());
+
+	return pipeline;
+}
+
+void PipelineStateCache::OptimizeGraphicsPipeline(DeviceVK* device, GraphicsPipelineVK* pipeline)
+{
+	if (!pipeline || !pipeline->IsFastLinked())
+		return;
+
+	AddJob([device, pipeline]()
+	{
+		VkPipeline optimizedPipeline = pipeline->CreateOptimized(device);
+
+		if (optimizedPipeline == VK_NULL_HANDLE)
+			return;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_readyOptimizations.emplace_back([device, pipeline, optimizedPipeline]() { pipeline->SetOptimized(device, optimizedPipeline); });
+	});
+}
+
+void PipelineStateCache::AddCompileTime(double time)
+{
+	uint32_t bucket = 0;
+
+	while (bucket < s_numCompileTimeBuckets - 1 && time >= double(1u << bucket))
+		bucket++;
+
+	m_compileTimeHistogram[bucket]++;
+}
+
+void PipelineStateCache::AddStall(double time)
+{
+	m_numStalls++;
+	m_stallTime += time;
+}
+
+void PipelineStateCache::AddJob(std::function<void()> job)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (m_workers.empty())
+	{
+		// leave a core to the render thread
+		uint32_t numWorkers = std::max(1u, std::min(4u, std::thread::hardware_concurrency() - 1));
+
+		m_stopWorkers = false;
+
+		for (uint32_t i = 0; i < numWorkers; ++i)
+			m_workers.emplace_back(WorkerThread);
+	}
+
+	m_jobs.emplace_back(std::move(job));
+	m_jobsCondition.notify_one();
+}
+
+void PipelineStateCache::WorkerThread()
+{
+	while (true)
+	{
+		std::function<void()> job;
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_jobsCondition.wait(lock, []() { return m_stopWorkers || !m_jobs.empty(); });
+
+			// the queue is drained before stopping
+			if (m_jobs.empty())
+				return;
+
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+			m_numRunningJobs++;
+		}
+
+		job();
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_numRunningJobs--;
+		}
+
+		m_doneCondition.notify_all();
+	}
+}
+
+void PipelineStateCache::StopWorkers()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopWorkers = true;
+	}
+
+	m_jobsCondition.notify_all();
+
+	for (std::thread& worker : m_workers)
+		worker.join();
+
+	m_workers.clear();
+}
+
 }
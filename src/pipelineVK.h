@@ -1,8 +1,18 @@
 #pragma once
 
 #include "commonVK.h"
+#include "contextVK.h"
 #include "shaderVK.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
 namespace MBRF
 {
 
@@ -27,14 +37,37 @@ public:
 
 	VkPipelineBindPoint GetBindPoint();
 
-	virtual VkPipelineLayout GetLayout() const = 0;
+	VkPipelineLayout GetLayout() const { return m_layout; };
+
+	// from the shaders reflection: slots read per set (indexed by ContextVK::BindingType), sets in the layout and whether the bindless set is used.
+	// ContextVK::CommitBindings only writes and binds those
+	const uint32_t* GetUsedSlots(uint32_t set) const { return m_usedSlots[set]; };
+	uint32_t GetNumDescriptorSets() const { return m_numDescriptorSets; };
+	bool UsesBindless() const { return m_usesBindless; };
+	// the set needs to be bound for its immutable samplers, even without any used slot
+	bool UsesImmutableSamplers(uint32_t set) const { return m_usesImmutableSamplers[set]; };
+	// DRAW_SET is pushed instead of allocated (see DeviceVK::SupportsPushDescriptors)
+	bool UsesPushDescriptors() const { return m_usesPushDescriptors; };
 
 protected:
 	void Destroy(DeviceVK* device);
 
+	// merges the resources of the shaders and picks the smallest layout covering them. Returns false if they don't match the layouts of shaderCommon.h.
+	// pushDescriptors is ignored when the device doesn't support them
+	bool SelectLayout(DeviceVK* device, const std::vector<const ShaderVK*>& shaders, bool pushDescriptors);
+	bool AddShaderResources(DeviceVK* device, const ShaderReflectionVK& reflection);
+
 protected:
 	PipelineType m_type;
 	VkPipeline m_pipeline = VK_NULL_HANDLE;
+	// shared, owned by the device
+	VkPipelineLayout m_layout = VK_NULL_HANDLE;
+
+	uint32_t m_usedSlots[NUM_DESCRIPTOR_SETS][ContextVK::NUM_BINDING_TYPES] = {};
+	uint32_t m_numDescriptorSets = 0;
+	bool m_usesImmutableSamplers[NUM_DESCRIPTOR_SETS] = {};
+	bool m_usesBindless = false;
+	bool m_usesPushDescriptors = false;
 };
 
 enum CullMode
@@ -52,6 +85,15 @@ enum FrontFace
 	NUM_FRONT_FACES
 };
 
+// of all the color attachments
+enum BlendMode
+{
+	BLEND_MODE_NONE,
+	BLEND_MODE_ALPHA,
+	BLEND_MODE_ADDITIVE,
+	NUM_BLEND_MODES
+};
+
 struct GraphicsPipelineDesc
 {
 	VertexFormatVK* m_vertexFormat = nullptr;
@@ -59,10 +101,53 @@ struct GraphicsPipelineDesc
 	std::vector<ShaderVK> m_shaders;
 	CullMode m_cullMode = CULL_MODE_NONE;
 	FrontFace m_frontFace = FRONT_FACE_CCW;
+	bool m_depthTest = true;
+	bool m_depthWrite = true;
+	VkCompareOp m_depthCompareOp = VK_COMPARE_OP_LESS;
+	BlendMode m_blendMode = BLEND_MODE_NONE;
+	// for pipelines whose DRAW_SET bindings change at almost every draw, falls back to allocated sets without VK_KHR_push_descriptor
+	bool m_pushDescriptors = false;
+	SpecializationConstantsVK m_specializationConstants;
 };
 
-// TODO: for now using a different layout per pipeline, even though they are actually using the same layout, 
-// but might be handy in the future if we want to differentiate?
+// the caches below key on everything the pipeline is created from, compared in full on lookup: a hash collision can't return another pipeline
+struct PipelineKeyHash
+{
+	size_t operator()(const std::vector<uint64_t>& key) const;
+};
+
+// Graphics pipeline library parts (VK_EXT_graphics_pipeline_library), each created from the subset of the desc it depends on, so that a new combination
+// only needs a fast link (see DeviceVK::SupportsGraphicsPipelineLibrary). Thread safe: the libraries are also created by the PipelineStateCache workers.
+// Owns the libraries until Cleanup, after the pipelines linked from them
+class PipelineLibraryCache
+{
+public:
+	enum LibraryPart
+	{
+		LIBRARY_PART_VERTEX_INPUT,
+		LIBRARY_PART_PRE_RASTERIZATION,
+		LIBRARY_PART_FRAGMENT_SHADER,
+		LIBRARY_PART_FRAGMENT_OUTPUT,
+		NUM_LIBRARY_PARTS
+	};
+
+	// pipelineCreateInfo: the full pipeline one, only the stages and states of the part are used. VK_NULL_HANDLE if the part can't be created
+	static VkPipeline GetLibrary(DeviceVK* device, LibraryPart part, const GraphicsPipelineDesc& desc, const VkGraphicsPipelineCreateInfo& pipelineCreateInfo);
+	static void Cleanup(DeviceVK* device);
+
+	// drops the shader parts created from the module (reloaded shader, see ShaderCompilerVK), destroyed once the frames in flight are done with them.
+	// The pipelines linked from them must be invalidated too (see PipelineStateCache::InvalidateShader)
+	static void InvalidateShader(DeviceVK* device, VkShaderModule shaderModule);
+
+private:
+	static std::vector<uint64_t> GetLibraryKey(LibraryPart part, const GraphicsPipelineDesc& desc, VkPipelineLayout layout);
+	static VkPipeline CreateLibrary(DeviceVK* device, LibraryPart part, const VkGraphicsPipelineCreateInfo& pipelineCreateInfo);
+
+	static std::unordered_map<std::vector<uint64_t>, VkPipeline, PipelineKeyHash> m_libraries;
+	// shader parts by module, for InvalidateShader
+	static std::unordered_multimap<VkShaderModule, std::vector<uint64_t>> m_shaderLibraries;
+	static std::mutex m_mutex;
+};
 
 class GraphicsPipelineVK: public PipelineVK
 {
@@ -70,13 +155,24 @@ public:
 	GraphicsPipelineVK() : PipelineVK(PIPELINE_TYPE_GRAPHICS) {};
 
 	// TODO: add all needed states
+	// returns false if the shaders don't match the descriptor layouts, the push constants size or the vertex format.
+	// With the graphics pipeline library, the pipeline is fast linked from the PipelineLibraryCache parts instead of compiled as a whole
 	bool Create(DeviceVK* device, const GraphicsPipelineDesc &desc);
 	void Destroy(DeviceVK* device);
 
-	VkPipelineLayout GetLayout() const { return m_layout; };
+	// fast linked pipelines run slower than fully compiled ones: the PipelineStateCache relinks them with link time optimization in the background
+	bool IsFastLinked() const { return m_fastLinked; };
+	VkPipeline CreateOptimized(DeviceVK* device) const;
+	// replaces the fast linked handle, destroyed once the current frame is done with it
+	void SetOptimized(DeviceVK* device, VkPipeline pipeline);
 
 private:
-	VkPipelineLayout m_layout = VK_NULL_HANDLE;
+	bool CreateFromLibraries(DeviceVK* device, const GraphicsPipelineDesc& desc, const VkGraphicsPipelineCreateInfo& pipelineCreateInfo);
+	VkPipeline Link(DeviceVK* device, bool optimize) const;
+
+	bool m_fastLinked = false;
+	// owned by the PipelineLibraryCache
+	VkPipeline m_libraries[PipelineLibraryCache::NUM_LIBRARY_PARTS] = {};
 };
 
 class ComputePipelineVK : public PipelineVK
@@ -84,13 +180,102 @@ class ComputePipelineVK : public PipelineVK
 public:
 	ComputePipelineVK() : PipelineVK(PIPELINE_TYPE_COMPUTE) {};
 
-	bool Create(DeviceVK* device, ShaderVK* computeShader);
+	// pushDescriptors: see GraphicsPipelineDesc. The workgroup size dimensions declared with local_size_*_id can be specialized too
+	bool Create(DeviceVK* device, ShaderVK* computeShader, bool pushDescriptors = false, const SpecializationConstantsVK& specializationConstants = SpecializationConstantsVK());
 	void Destroy(DeviceVK* device);
 
-	VkPipelineLayout GetLayout() const { return m_layout; };
+	// local size of the shader after specialization, for computing the dispatch sizes
+	const uint32_t* GetWorkgroupSize() const { return m_workgroupSize; };
 
 private:
-	VkPipelineLayout m_layout = VK_NULL_HANDLE;
+	uint32_t m_workgroupSize[3] = {};
+};
+
+// Pipelines by everything they are created from (shader modules, vertex format, render pass, raster, depth and blend states, specialization constants), so that the call sites
+// asking for the same state share a single pipeline. The layouts are shared already (see DeviceVK::GetPipelineLayout).
+// Owns the pipelines until Cleanup: the shaders of a cached pipeline must outlive it.
+// The Request functions compile on worker threads instead (the VkPipelineCache is internally synchronized), the results are collected once per frame by Update.
+// Fast linked graphics pipelines are optimized on the workers too, and swapped by Update
+class PipelineStateCache
+{
+public:
+	// nullptr if the creation failed, which is remembered too. Blocks if the pipeline is still compiling on a worker, until that one is done
+	static GraphicsPipelineVK* GetGraphicsPipeline(DeviceVK* device, const GraphicsPipelineDesc& desc);
+	static ComputePipelineVK* GetComputePipeline(DeviceVK* device, ShaderVK* computeShader, bool pushDescriptors = false, const SpecializationConstantsVK& specializationConstants = SpecializationConstantsVK());
+
+	// non-blocking: queues the compilation on the first request and returns nullptr with pending set until it's done. The frame buffer, vertex format and shaders of
+	// the desc must stay alive meanwhile (see WaitForPendingPipelines)
+	static GraphicsPipelineVK* RequestGraphicsPipeline(DeviceVK* device, const GraphicsPipelineDesc& desc, bool& pending);
+	static ComputePipelineVK* RequestComputePipeline(DeviceVK* device, ShaderVK* computeShader, bool pushDescriptors, const SpecializationConstantsVK& specializationConstants, bool& pending);
+
+	static bool IsGraphicsPipelinePending(const std::vector<uint64_t>& pipelineKey) { return m_pendingGraphicsPipelines.count(pipelineKey) > 0; };
+	static bool IsComputePipelinePending(const std::vector<uint64_t>& pipelineKey) { return m_pendingComputePipelines.count(pipelineKey) > 0; };
+
+	// collects the pipelines done by the workers, at the beginning of the frame
+	static void Update();
+	// before destroying resources a pending request may read (frame buffers on resize, shaders at cleanup). Waits for the pending optimizations too
+	static void WaitForPendingPipelines();
+	static void Cleanup(DeviceVK* device);
+
+	// drops the pipelines created from the module (reloaded shader, see ShaderCompilerVK), destroyed once the frames in flight are done with them.
+	// No pipeline must be pending
+	static void InvalidateShader(DeviceVK* device, VkShaderModule shaderModule);
+
+	static std::vector<uint64_t> GetPipelineKey(const GraphicsPipelineDesc& desc);
+	static std::vector<uint64_t> GetPipelineKey(const ShaderVK* computeShader, bool pushDescriptors, const SpecializationConstantsVK& specializationConstants);
+
+	static uint32_t GetNumHits() { return m_numHits; };
+	static uint32_t GetNumMisses() { return m_numMisses; };
+
+	// times the render thread waited for a compilation (synchronous misses and Get of a pending pipeline), and for how long (ms)
+	static uint32_t GetNumStalls() { return m_numStalls; };
+	static double GetStallTime() { return m_stallTime; };
+
+	// compilation times, synchronous or not: bucket 0 is under 1 ms, bucket i in [2^(i-1), 2^i) ms and the last one everything above
+	static const uint32_t s_numCompileTimeBuckets = 10;
+	static uint32_t GetCompileTimeCount(uint32_t bucket) { return m_compileTimeHistogram[bucket]; };
+	static void PrintStats();
+
+private:
+	static GraphicsPipelineVK* CreateGraphicsPipeline(DeviceVK* device, const GraphicsPipelineDesc& desc);
+	static ComputePipelineVK* CreateComputePipeline(DeviceVK* device, ShaderVK* computeShader, bool pushDescriptors, const SpecializationConstantsVK& specializationConstants);
+	static void OptimizeGraphicsPipeline(DeviceVK* device, GraphicsPipelineVK* pipeline);
+	// block until the worker is done with this pipeline only and collect it, the other results are left to Update
+	static void WaitForGraphicsPipeline(const std::vector<uint64_t>& pipelineKey);
+	static void WaitForComputePipeline(const std::vector<uint64_t>& pipelineKey);
+	static void AddCompileTime(double time);
+	static void AddStall(double time);
+
+	static void AddJob(std::function<void()> job);
+	static void WorkerThread();
+	static void StopWorkers();
+
+	static std::unordered_map<std::vector<uint64_t>, GraphicsPipelineVK*, PipelineKeyHash> m_graphicsPipelines;
+	static std::unordered_map<std::vector<uint64_t>, ComputePipelineVK*, PipelineKeyHash> m_computePipelines;
+	static uint32_t m_numHits;
+	static uint32_t m_numMisses;
+	// pipelines by shader module, for InvalidateShader
+	static std::unordered_multimap<VkShaderModule, std::pair<PipelineVK::PipelineType, std::vector<uint64_t>>> m_shaderPipelines;
+
+	// render thread only: requested, not collected yet
+	static std::unordered_set<std::vector<uint64_t>, PipelineKeyHash> m_pendingGraphicsPipelines;
+	static std::unordered_set<std::vector<uint64_t>, PipelineKeyHash> m_pendingComputePipelines;
+
+	static uint32_t m_numStalls;
+	static double m_stallTime;
+	static std::atomic<uint32_t> m_compileTimeHistogram[s_numCompileTimeBuckets];
+
+	// workers, started with the first request. The mutex guards the jobs and the results
+	static std::vector<std::thread> m_workers;
+	static std::mutex m_mutex;
+	static std::condition_variable m_jobsCondition;
+	static std::condition_variable m_doneCondition;
+	static std::deque<std::function<void()>> m_jobs;
+	static uint32_t m_numRunningJobs;
+	static bool m_stopWorkers;
+	static std::vector<std::pair<std::vector<uint64_t>, GraphicsPipelineVK*>> m_readyGraphicsPipelines;
+	static std::vector<std::pair<std::vector<uint64_t>, ComputePipelineVK*>> m_readyComputePipelines;
+	static std::vector<std::function<void()>> m_readyOptimizations;
 };
 
 }
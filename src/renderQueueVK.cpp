@@ -0,0 +1,280 @@
+#include "renderQueueVK.h"
+
+#include "contextVK.h"
+#include "deviceVK.h"
+#include "vertexBufferVK.h"
+
+#include <cstring>
+
+namespace MBRF
+{
+
+// sort key layout, most significant first
+static const uint32_t s_passShift = 56;
+static const uint32_t s_pipelineShift = 44;
+static const uint32_t s_materialShift = 28;
+static const uint32_t s_meshShift = 16;
+
+static const uint32_t s_maxPipelineId = (1 << 12) - 1;
+static const uint32_t s_maxMaterialId = (1 << 16) - 1;
+static const uint32_t s_maxMeshId = (1 << 12) - 1;
+
+bool RenderQueueVK::Create(DeviceVK* device, uint32_t initialCapacity)
+{
+	uint32_t numBuffers = device->GetMaxFramesInFlight();
+
+	m_instanceBuffers.resize(numBuffers);
+	m_instanceCapacities.resize(numBuffers, initialCapacity);
+
+	bool result = true;
+
+	for (uint32_t i = 0; i < numBuffers; ++i)
+		result &= m_instanceBuffers[i].Create(device, initialCapacity * sizeof(glm::mat4), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	return result;
+}
+
+void RenderQueueVK::Destroy(DeviceVK* device)
+{
+	for (BufferVK& buffer : m_instanceBuffers)
+		buffer.Destroy(device);
+
+	m_instanceBuffers.clear();
+	m_instanceCapacities.clear();
+	m_currentInstanceBuffer = nullptr;
+
+	m_pipelineIds.clear();
+	m_materialIds.clear();
+	m_meshIds.clear();
+}
+
+void RenderQueueVK::Begin(const glm::mat4& view)
+{
+	m_view = view;
+
+	m_items.clear();
+	m_sortItems.clear();
+	m_batches.clear();
+
+	// the ids only need to be stable within the frame: starting over keeps them in range when objects come and go
+	m_pipelineIds.clear();
+	m_materialIds.clear();
+	m_meshIds.clear();
+}
+
+void RenderQueueVK::Submit(uint8_t pass, const MeshVK* mesh, const MaterialVK* material, const glm::mat4& transform)
+{
+	assert(mesh && material && material->m_pipeline);
+
+	float depth = -(m_view * transform[3]).z;
+
+	SortItem sortItem;
+	sortItem.m_key = BuildSortKey(pass, mesh, material, depth);
+	sortItem.m_itemIndex = uint32_t(m_items.size());
+
+	m_sortItems.emplace_back(sortItem);
+	m_items.push_back({ mesh, material, transform });
+}
+
+void RenderQueueVK::End(DeviceVK* device)
+{
+	RadixSort();
+	BuildBatches();
+	UpdateStats();
+
+	if (m_instanceData.empty())
+		return;
+
+	// the buffer of this frame slot was last used maxFramesInFlight frames ago, which has completed by now
+	uint32_t bufferIndex = uint32_t(device->GetCurrentFrameValue() % m_instanceBuffers.size());
+
+	m_currentInstanceBuffer = &m_instanceBuffers[bufferIndex];
+
+	uint32_t numInstances = uint32_t(m_instanceData.size());
+
+	if (numInstances > m_instanceCapacities[bufferIndex])
+	{
+		while (m_instanceCapacities[bufferIndex] < numInstances)
+			m_instanceCapacities[bufferIndex] *= 2;
+
+		m_currentInstanceBuffer->Destroy(device);
+		m_currentInstanceBuffer->Create(device, m_instanceCapacities[bufferIndex] * sizeof(glm::mat4), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	}
+
+	m_currentInstanceBuffer->Update(device, numInstances * sizeof(glm::mat4), m_instanceData.data());
+}
+
+void RenderQueueVK::Draw(DeviceVK* device, ContextVK* context, uint8_t pass, void* passData, uint32_t passDataSize)
+{
+	if (m_instanceData.empty())
+		return;
+
+	PipelineVK* currentPipeline = nullptr;
+	const MeshVK* currentMesh = nullptr;
+
+	// bindings persist across commits, only the material set changes per batch
+	context->SetUniformBuffer(passData, passDataSize, 0, PASS_SET);
+	context->SetStorageBuffer(m_currentInstanceBuffer, 0, PASS_SET);
+
+	for (const Batch& batch : m_batches)
+	{
+		if (batch.m_pass != pass)
+			continue;
+
+		if (batch.m_material->m_pipeline != currentPipeline)
+		{
+			currentPipeline = batch.m_material->m_pipeline;
+			context->SetPipeline(currentPipeline);
+		}
+
+		if (batch.m_mesh != currentMesh)
+		{
+			currentMesh = batch.m_mesh;
+			context->SetVertexBuffer(currentMesh->m_vertexBuffer, 0);
+			context->SetIndexBuffer(currentMesh->m_indexBuffer, 0);
+		}
+
+		for (uint32_t i = 0; i < batch.m_material->m_textures.size(); ++i)
+			context->SetTexture(batch.m_material->m_textures[i], i, MATERIAL_SET);
+
+		context->CommitBindings(device);
+
+		context->DrawIndexed(currentMesh->m_indexCount, batch.m_instanceCount, currentMesh->m_firstIndex, currentMesh->m_vertexOffset, batch.m_firstInstance);
+	}
+}
+
+uint64_t RenderQueueVK::BuildSortKey(uint8_t pass, const MeshVK* mesh, const MaterialVK* material, float depth)
+{
+	uint64_t pipelineId = GetId(m_pipelineIds, material->m_pipeline, s_maxPipelineId);
+	uint64_t materialId = GetId(m_materialIds, material, s_maxMaterialId);
+	uint64_t meshId = GetId(m_meshIds, mesh, s_maxMeshId);
+
+	// positive floats sort like their bit patterns. Keep sign, exponent and the top of the mantissa: front to back
+	depth = (depth > 0.0f) ? depth : 0.0f;
+
+	uint32_t depthBits;
+	std::memcpy(&depthBits, &depth, sizeof(depthBits));
+
+	return (uint64_t(pass) << s_passShift) | (pipelineId << s_pipelineShift) | (materialId << s_materialShift) | (meshId << s_meshShift) | uint64_t(depthBits >> 16);
+}
+
+// LSD radix sort, 8 bits per pass. Passes where all the keys share the same digit are skipped
+void RenderQueueVK::RadixSort()
+{
+	uint32_t numItems = uint32_t(m_sortItems.size());
+
+	if (numItems == 0)
+		return;
+
+	m_sortScratch.resize(numItems);
+
+	for (uint32_t shift = 0; shift < 64; shift += 8)
+	{
+		uint32_t histogram[256] = {};
+
+		for (const SortItem& item : m_sortItems)
+			histogram[(item.m_key >> shift) & 0xFF]++;
+
+		if (histogram[(m_sortItems[0].m_key >> shift) & 0xFF] == numItems)
+			continue;
+
+		uint32_t offset = 0;
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t count = histogram[i];
+			histogram[i] = offset;
+			offset += count;
+		}
+
+		for (const SortItem& item : m_sortItems)
+			m_sortScratch[histogram[(item.m_key >> shift) & 0xFF]++] = item;
+
+		m_sortItems.swap(m_sortScratch);
+	}
+}
+
+void RenderQueueVK::BuildBatches()
+{
+	m_batches.clear();
+	m_instanceData.clear();
+
+	for (const SortItem& sortItem : m_sortItems)
+	{
+		const DrawItem& item = m_items[sortItem.m_itemIndex];
+		uint8_t pass = uint8_t(sortItem.m_key >> s_passShift);
+
+		uint32_t instanceIndex = uint32_t(m_instanceData.size());
+		m_instanceData.push_back(item.m_transform);
+
+		if (m_instancing && !m_batches.empty())
+		{
+			Batch& last = m_batches.back();
+
+			if (last.m_pass == pass && last.m_mesh == item.m_mesh && last.m_material == item.m_material)
+			{
+				last.m_instanceCount++;
+				continue;
+			}
+		}
+
+		m_batches.push_back({ pass, item.m_mesh, item.m_material, instanceIndex, 1 });
+	}
+}
+
+// state changes: pipeline, material (textures) and mesh (vertex/index buffers) binds
+void RenderQueueVK::UpdateStats()
+{
+	m_stats = {};
+	m_stats.m_numItems = uint32_t(m_items.size());
+
+	const PipelineVK* pipeline = nullptr;
+	const MaterialVK* material = nullptr;
+	const MeshVK* mesh = nullptr;
+
+	for (const DrawItem& item : m_items)
+	{
+		m_stats.m_unsortedStateChanges += (item.m_material->m_pipeline != pipeline) + (item.m_material != material) + (item.m_mesh != mesh);
+
+		pipeline = item.m_material->m_pipeline;
+		material = item.m_material;
+		mesh = item.m_mesh;
+	}
+
+	m_stats.m_unsortedDrawCalls = m_stats.m_numItems;
+
+	pipeline = nullptr;
+	material = nullptr;
+	mesh = nullptr;
+
+	for (const Batch& batch : m_batches)
+	{
+		m_stats.m_stateChanges += (batch.m_material->m_pipeline != pipeline) + (batch.m_material != material) + (batch.m_mesh != mesh);
+
+		pipeline = batch.m_material->m_pipeline;
+		material = batch.m_material;
+		mesh = batch.m_mesh;
+	}
+
+	m_stats.m_drawCalls = uint32_t(m_batches.size());
+}
+
+uint32_t RenderQueueVK::GetId(std::unordered_map<const void*, uint32_t>& ids, const void* object, uint32_t maxId)
+{
+	auto it = ids.find(object);
+
+	if (it != ids.end())
+		return it->second;
+
+	uint32_t id = uint32_t(ids.size());
+
+	// more objects in a frame than the key bits can tell apart: the extra ones share the last id, they are only sorted less precisely
+	// (the batches compare the objects themselves)
+	if (id > maxId)
+		return maxId;
+
+	ids[object] = id;
+
+	return id;
+}
+
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "bufferVK.h"
+#include "commonVK.h"
+
+#include "glm.hpp"
+
+#include <unordered_map>
+
+namespace MBRF
+{
+
+class ContextVK;
+class DeviceVK;
+class IndexBufferVK;
+class PipelineVK;
+class TextureVK;
+class VertexBufferVK;
+
+struct MeshVK
+{
+	const VertexBufferVK* m_vertexBuffer = nullptr;
+	const IndexBufferVK* m_indexBuffer = nullptr;
+	uint32_t m_indexCount = 0;
+	uint32_t m_firstIndex = 0;
+	uint32_t m_vertexOffset = 0;
+};
+
+// textures are bound to TEXTURE_SLOT(0), TEXTURE_SLOT(1)... of MATERIAL_SET
+struct MaterialVK
+{
+	PipelineVK* m_pipeline = nullptr;
+	std::vector<TextureVK*> m_textures;
+};
+
+struct RenderQueueStatsVK
+{
+	uint32_t m_numItems = 0;
+
+	// one draw per item, in submission order
+	uint32_t m_unsortedDrawCalls = 0;
+	uint32_t m_unsortedStateChanges = 0;
+
+	// after sorting and merging into instanced draws
+	uint32_t m_drawCalls = 0;
+	uint32_t m_stateChanges = 0;
+};
+
+// Draw items collected during the frame, sorted by a 64 bit key (pass, pipeline, material, mesh, depth). Consecutive items sharing mesh and material are drawn
+// as a single instanced draw. The item transforms are written to a per frame storage buffer bound at STORAGE_BUFFER_SLOT(0) of PASS_SET, indexed with gl_InstanceIndex
+class RenderQueueVK
+{
+public:
+	bool Create(DeviceVK* device, uint32_t initialCapacity = 1024);
+	void Destroy(DeviceVK* device);
+
+	// view transform, for the depth part of the sort keys
+	void Begin(const glm::mat4& view);
+	void Submit(uint8_t pass, const MeshVK* mesh, const MaterialVK* material, const glm::mat4& transform);
+	// sorts, merges and uploads the instance data. Call once after all the passes have been submitted
+	void End(DeviceVK* device);
+
+	// context must be inside a render pass. passData is bound at UNIFORM_BUFFER_SLOT(0) of PASS_SET for all the draws of the pass
+	void Draw(DeviceVK* device, ContextVK* context, uint8_t pass, void* passData, uint32_t passDataSize);
+
+	// without instancing every item is its own draw (still sorted)
+	void SetInstancing(bool enabled) { m_instancing = enabled; };
+	bool IsInstancing() const { return m_instancing; };
+
+	const RenderQueueStatsVK& GetStats() const { return m_stats; };
+
+private:
+	struct DrawItem
+	{
+		const MeshVK* m_mesh;
+		const MaterialVK* m_material;
+		glm::mat4 m_transform;
+	};
+
+	struct SortItem
+	{
+		uint64_t m_key;
+		uint32_t m_itemIndex;
+	};
+
+	struct Batch
+	{
+		uint8_t m_pass;
+		const MeshVK* m_mesh;
+		const MaterialVK* m_material;
+		uint32_t m_firstInstance;
+		uint32_t m_instanceCount;
+	};
+
+	uint64_t BuildSortKey(uint8_t pass, const MeshVK* mesh, const MaterialVK* material, float depth);
+	void RadixSort();
+	void BuildBatches();
+	void UpdateStats();
+
+	static uint32_t GetId(std::unordered_map<const void*, uint32_t>& ids, const void* object, uint32_t maxId);
+
+	std::vector<DrawItem> m_items;
+	std::vector<SortItem> m_sortItems;
+	std::vector<SortItem> m_sortScratch;
+	std::vector<Batch> m_batches;
+	std::vector<glm::mat4> m_instanceData;
+
+	// small ids for the sort keys, reset at Begin
+	std::unordered_map<const void*, uint32_t> m_pipelineIds;
+	std::unordered_map<const void*, uint32_t> m_materialIds;
+	std::unordered_map<const void*, uint32_t> m_meshIds;
+
+	glm::mat4 m_view = glm::mat4(1.0f);
+
+	// one per frame in flight, host visible. Grown when a frame has more instances than fit
+	std::vector<BufferVK> m_instanceBuffers;
+	std::vector<uint32_t> m_instanceCapacities;
+	BufferVK* m_currentInstanceBuffer = nullptr;
+
+	bool m_instancing = true;
+
+	RenderQueueStatsVK m_stats;
+};
+
+}
@@ -1,11 +1,13 @@
 #include "rendererVK.h"
 
 #include "frameBufferVK.h"
+#include "pipelineVK.h"
+#include "shaderCompilerVK.h"
 
 namespace MBRF
 {
 
-bool RendererVK::Init(GLFWwindow* window, uint32_t width, uint32_t height, bool enableValidation)
+bool RendererVK::Init(GLFWwindow* window, uint32_t width, uint32_t height, uint32_t maxFramesInFlight, bool enableValidation)
 {
 	m_pendingSwapchainResize = false;
 	m_swapchainWidth = width;
@@ -13,7 +15,7 @@ bool RendererVK::Init(GLFWwindow* window, uint32_t width, uint32_t height, bool
 
 	// Init Vulkan
 
-	m_device.Init(&m_swapchain, window, width, height, s_maxFramesInFlight, enableValidation);
+	m_device.Init(&m_swapchain, window, width, height, maxFramesInFlight, enableValidation);
 
 	CreateBackBuffer(); // swapchain framebuffer
 
@@ -24,6 +26,9 @@ void RendererVK::Cleanup()
 {
 	DestroyBackBuffer();
 
+	PipelineStateCache::Cleanup(&m_device);
+	PipelineLibraryCache::Cleanup(&m_device);
+	ShaderCompilerVK::Cleanup();
 	RenderPassCache::Cleanup(&m_device);
 	SamplerCache::Cleanup(&m_device);
 
@@ -33,6 +38,9 @@ void RendererVK::Cleanup()
 void RendererVK::WaitForDevice()
 {
 	m_device.WaitForDevice();
+
+	// and for the pipeline compilations, which may read the resources about to be destroyed
+	PipelineStateCache::WaitForPendingPipelines();
 }
 
 void RendererVK::RequestSwapchainResize(uint32_t width, uint32_t height, std::function<void()> const &onResizeCallback)
@@ -46,7 +54,7 @@ void RendererVK::RequestSwapchainResize(uint32_t width, uint32_t height, std::fu
 
 void RendererVK::ResizeSwapchain()
 {
-	m_device.WaitForDevice();
+	WaitForDevice();
 
 	DestroyBackBuffer();
 
@@ -67,6 +75,9 @@ bool RendererVK::BeginDraw()
 		return false;
 	}
 
+	// the pipelines compiled in the background since the last frame become available
+	PipelineStateCache::Update();
+
 	uint32_t currentFrameIndex = m_device.m_currentImageIndex;
 	VkImage currentSwapchainImage = m_swapchain.m_images[currentFrameIndex];
 
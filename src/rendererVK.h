@@ -11,7 +11,7 @@ namespace MBRF
 class RendererVK
 {
 public:
-	bool Init(GLFWwindow* window, uint32_t width, uint32_t height, bool enableValidation);
+	bool Init(GLFWwindow* window, uint32_t width, uint32_t height, uint32_t maxFramesInFlight, bool enableValidation);
 	void Cleanup();
 
 	void WaitForDevice();
@@ -41,8 +41,6 @@ private:
 	uint32_t m_swapchainWidth = 0;
 	uint32_t m_swapchainHeight = 0;
 
-	static const int s_maxFramesInFlight = 2;
-
 	struct BackBuffer
 	{
 		std::vector<FrameBufferVK> m_frameBuffers;
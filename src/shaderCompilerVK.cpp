@@ -0,0 +1,429 @@
+#include "shaderCompilerVK.h"
+
+#include "pipelineVK.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#ifdef MBRF_SHADERC
+#include <shaderc/shaderc.hpp>
+#endif
+
+namespace MBRF
+{
+
+const char* ShaderCompilerVK::s_includeDirectory = "../../data/shaders/";
+const char* ShaderCompilerVK::s_cacheDirectory = "shaderCache/";
+
+std::atomic<uint32_t> ShaderCompilerVK::m_numCacheHits(0);
+std::atomic<uint32_t> ShaderCompilerVK::m_numCompilations(0);
+std::mutex ShaderCompilerVK::m_mutex;
+std::condition_variable ShaderCompilerVK::m_stopCondition;
+std::thread ShaderCompilerVK::m_watcher;
+bool ShaderCompilerVK::m_stopWatcher = false;
+std::vector<ShaderCompilerVK::WatchedShader> ShaderCompilerVK::m_watchedShaders;
+std::vector<std::pair<ShaderVK*, std::vector<uint32_t>>> ShaderCompilerVK::m_reloadedShaders;
+
+// how often the watcher checks the write times of the sources
+static const std::chrono::milliseconds s_watchInterval(500);
+
+#ifdef MBRF_SHADERC
+
+// a source being saved can't be read for a moment: no assert, unlike Utils::ReadFile
+static bool ReadTextFile(const std::string& fileName, std::string& text)
+{
+	std::ifstream file(fileName, std::ios::in | std::ios::binary);
+
+	if (!file.is_open())
+		return false;
+
+	std::stringstream stream;
+	stream << file.rdbuf();
+	text = stream.str();
+
+	return true;
+}
+
+// part of the cache key: changing them must not hit the SPIR-V compiled with the previous ones
+static const char* s_compilerOptions = "vulkan1.0 O";
+
+static const shaderc_shader_kind ShaderStageToShaderc[NUM_SHADER_STAGES] =
+{
+	shaderc_glsl_vertex_shader,
+	shaderc_glsl_fragment_shader,
+	shaderc_glsl_compute_shader
+};
+
+// FNV-1a: the cache file names must be the same from a run to the next, which std::hash doesn't guarantee
+static void HashBytes(uint64_t& hash, const void* data, size_t size)
+{
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+}
+
+static void HashString(uint64_t& hash, const std::string& text)
+{
+	// with the terminator, so that the concatenated strings don't collide
+	HashBytes(hash, text.c_str(), text.size() + 1);
+}
+
+class ShaderIncluderVK : public shaderc::CompileOptions::IncluderInterface
+{
+public:
+	ShaderIncluderVK(std::vector<std::string>* dependencies) : m_dependencies(dependencies) {};
+
+	shaderc_include_result* GetInclude(const char* requestedSource, shaderc_include_type type, const char* requestingSource, size_t includeDepth) override
+	{
+		IncludeData* data = new IncludeData();
+
+		std::string requestingFile = requestingSource;
+		size_t separator = requestingFile.find_last_of("/\\");
+		std::string requestingDirectory = (separator != std::string::npos) ? requestingFile.substr(0, separator + 1) : std::string();
+
+		// #include "..." from the including file first, #include <...> from the include directory first
+		std::string candidates[2] = { requestingDirectory + requestedSource, std::string(ShaderCompilerVK::s_includeDirectory) + requestedSource };
+
+		if (type == shaderc_include_type_standard)
+			std::swap(candidates[0], candidates[1]);
+
+		for (const std::string& candidate : candidates)
+		{
+			if (ReadTextFile(candidate, data->m_content))
+			{
+				data->m_sourceName = candidate;
+
+				if (m_dependencies)
+					m_dependencies->push_back(candidate);
+
+				break;
+			}
+		}
+
+		// an empty source name reports the error, with the content as message
+		if (data->m_sourceName.empty())
+			data->m_content = std::string("can't find ") + requestedSource;
+
+		data->m_result.source_name = data->m_sourceName.c_str();
+		data->m_result.source_name_length = data->m_sourceName.size();
+		data->m_result.content = data->m_content.c_str();
+		data->m_result.content_length = data->m_content.size();
+		data->m_result.user_data = data;
+
+		return &data->m_result;
+	}
+
+	void ReleaseInclude(shaderc_include_result* result) override
+	{
+		delete static_cast<IncludeData*>(result->user_data);
+	}
+
+private:
+	struct IncludeData
+	{
+		shaderc_include_result m_result = {};
+		std::string m_sourceName;
+		std::string m_content;
+	};
+
+	std::vector<std::string>* m_dependencies;
+};
+
+static bool LoadCachedSpirv(const std::string& cacheFileName, std::vector<uint32_t>& spirv)
+{
+	std::ifstream file(cacheFileName, std::ios::in | std::ios::binary | std::ios::ate);
+
+	if (!file.is_open())
+		return false;
+
+	size_t size = (size_t)file.tellg();
+
+	if (size == 0 || size % sizeof(uint32_t) != 0)
+		return false;
+
+	spirv.resize(size / sizeof(uint32_t));
+
+	file.seekg(0, std::ios::beg);
+	file.read(reinterpret_cast<char*>(spirv.data()), size);
+
+	return bool(file);
+}
+
+static void SaveCachedSpirv(const std::string& cacheFileName, const std::vector<uint32_t>& spirv)
+{
+#ifdef _WIN32
+	_mkdir(ShaderCompilerVK::s_cacheDirectory);
+#else
+	mkdir(ShaderCompilerVK::s_cacheDirectory, 0755);
+#endif
+
+	// written aside then renamed: a concurrent reader never sees a partial file
+	std::string tempFileName = cacheFileName + ".tmp";
+
+	{
+		std::ofstream file(tempFileName, std::ios::out | std::ios::binary | std::ios::trunc);
+
+		if (!file.is_open())
+		{
+			std::cout << "failed to write the shader cache file " << cacheFileName << std::endl;
+			return;
+		}
+
+		file.write(reinterpret_cast<const char*>(spirv.data()), spirv.size() * sizeof(uint32_t));
+	}
+
+	std::remove(cacheFileName.c_str());
+	std::rename(tempFileName.c_str(), cacheFileName.c_str());
+}
+
+#endif
+
+// ------------------------------- ShaderCompilerVK -------------------------------
+
+bool ShaderCompilerVK::IsAvailable()
+{
+#ifdef MBRF_SHADERC
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool ShaderCompilerVK::Compile(const char* fileName, ShaderStage stage, const std::vector<ShaderDefineVK>& defines, std::vector<uint32_t>& spirv, std::vector<std::string>* dependencies)
+{
+#ifdef MBRF_SHADERC
+	std::string source;
+
+	if (!ReadTextFile(fileName, source))
+	{
+		std::cout << "failed to open file " << fileName << std::endl;
+		return false;
+	}
+
+	if (dependencies)
+		*dependencies = { fileName };
+
+	shaderc::CompileOptions options;
+	options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_0);
+	options.SetOptimizationLevel(shaderc_optimization_level_performance);
+	options.SetIncluder(std::unique_ptr<shaderc::CompileOptions::IncluderInterface>(new ShaderIncluderVK(dependencies)));
+
+	for (const ShaderDefineVK& define : defines)
+		options.AddMacroDefinition(define.m_name, define.m_value);
+
+	shaderc::Compiler compiler;
+	shaderc_shader_kind kind = ShaderStageToShaderc[stage];
+
+	// the includes are expanded and the defines applied: an edited include changes the key of all the shaders using it
+	shaderc::PreprocessedSourceCompilationResult preprocessed = compiler.PreprocessGlsl(source, kind, fileName, options);
+
+	if (preprocessed.GetCompilationStatus() != shaderc_compilation_status_success)
+	{
+		std::cout << "Failed to preprocess shader " << fileName << ":" << std::endl << preprocessed.GetErrorMessage();
+		return false;
+	}
+
+	std::string preprocessedSource(preprocessed.cbegin(), preprocessed.cend());
+
+	uint64_t hash = 0xcbf29ce484222325ull;
+	HashString(hash, preprocessedSource);
+	HashBytes(hash, &kind, sizeof(kind));
+	HashString(hash, s_compilerOptions);
+
+	for (const ShaderDefineVK& define : defines)
+	{
+		HashString(hash, define.m_name);
+		HashString(hash, define.m_value);
+	}
+
+	char cacheFileName[32];
+	std::snprintf(cacheFileName, sizeof(cacheFileName), "%016llx.spv", (unsigned long long)hash);
+
+	std::string cachePath = std::string(s_cacheDirectory) + cacheFileName;
+
+	if (LoadCachedSpirv(cachePath, spirv))
+	{
+		m_numCacheHits++;
+		return true;
+	}
+
+	shaderc::SpvCompilationResult result = compiler.CompileGlslToSpv(preprocessedSource, kind, fileName, options);
+
+	if (result.GetCompilationStatus() != shaderc_compilation_status_success)
+	{
+		std::cout << "Failed to compile shader " << fileName << ":" << std::endl << result.GetErrorMessage();
+		return false;
+	}
+
+	m_numCompilations++;
+
+	spirv.assign(result.cbegin(), result.cend());
+
+	SaveCachedSpirv(cachePath, spirv);
+
+	return true;
+#else
+	std::cout << "Runtime shader compilation not available (build with MBRF_SHADERC), can't compile " << fileName << std::endl;
+	return false;
+#endif
+}
+
+void ShaderCompilerVK::Watch(ShaderVK* shader, const char* fileName, ShaderStage stage, const std::vector<ShaderDefineVK>& defines, const std::vector<std::string>& dependencies)
+{
+	WatchedShader watchedShader;
+	watchedShader.m_shader = shader;
+	watchedShader.m_fileName = fileName;
+	watchedShader.m_stage = stage;
+	watchedShader.m_defines = defines;
+	watchedShader.m_dependencies = dependencies;
+	watchedShader.m_writeTimes = GetWriteTimes(dependencies);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_watchedShaders.push_back(watchedShader);
+
+	if (!m_watcher.joinable())
+	{
+		m_stopWatcher = false;
+		m_watcher = std::thread(WatcherThread);
+	}
+}
+
+void ShaderCompilerVK::Unwatch(ShaderVK* shader)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto isShader = [shader](const WatchedShader& watchedShader) { return watchedShader.m_shader == shader; };
+	m_watchedShaders.erase(std::remove_if(m_watchedShaders.begin(), m_watchedShaders.end(), isShader), m_watchedShaders.end());
+
+	auto isReloaded = [shader](const std::pair<ShaderVK*, std::vector<uint32_t>>& reloaded) { return reloaded.first == shader; };
+	m_reloadedShaders.erase(std::remove_if(m_reloadedShaders.begin(), m_reloadedShaders.end(), isReloaded), m_reloadedShaders.end());
+}
+
+bool ShaderCompilerVK::Update(DeviceVK* device)
+{
+	std::vector<std::pair<ShaderVK*, std::vector<uint32_t>>> reloadedShaders;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		reloadedShaders.swap(m_reloadedShaders);
+	}
+
+	if (reloadedShaders.empty())
+		return false;
+
+	// the compilations in flight may read the old modules
+	PipelineStateCache::WaitForPendingPipelines();
+
+	bool reloaded = false;
+
+	for (auto& reloadedShader : reloadedShaders)
+	{
+		VkShaderModule oldModule = reloadedShader.first->GetShaderModule();
+
+		if (!reloadedShader.first->Reload(device, reloadedShader.second))
+			continue;
+
+		PipelineStateCache::InvalidateShader(device, oldModule);
+		PipelineLibraryCache::InvalidateShader(device, oldModule);
+		reloaded = true;
+	}
+
+	std::cout << "[ShaderCompilerVK] " << reloadedShaders.size() << " shaders reloaded" << std::endl;
+
+	return reloaded;
+}
+
+void ShaderCompilerVK::Cleanup()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopWatcher = true;
+	}
+
+	m_stopCondition.notify_all();
+
+	if (m_watcher.joinable())
+		m_watcher.join();
+
+	m_watchedShaders.clear();
+	m_reloadedShaders.clear();
+}
+
+std::vector<time_t> ShaderCompilerVK::GetWriteTimes(const std::vector<std::string>& files)
+{
+	std::vector<time_t> writeTimes;
+
+	for (const std::string& file : files)
+	{
+		struct stat fileStat;
+		writeTimes.push_back(stat(file.c_str(), &fileStat) == 0 ? fileStat.st_mtime : 0);
+	}
+
+	return writeTimes;
+}
+
+void ShaderCompilerVK::WatcherThread()
+{
+	while (true)
+	{
+		std::vector<WatchedShader> changedShaders;
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+
+			if (m_stopCondition.wait_for(lock, s_watchInterval, []() { return m_stopWatcher; }))
+				return;
+
+			// copied: the compilation runs without the lock
+			for (const WatchedShader& watchedShader : m_watchedShaders)
+			{
+				if (GetWriteTimes(watchedShader.m_dependencies) != watchedShader.m_writeTimes)
+					changedShaders.push_back(watchedShader);
+			}
+		}
+
+		for (WatchedShader& changedShader : changedShaders)
+		{
+			std::vector<uint32_t> spirv;
+			std::vector<std::string> dependencies;
+
+			bool compiled = Compile(changedShader.m_fileName.c_str(), changedShader.m_stage, changedShader.m_defines, spirv, &dependencies);
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			auto isShader = [&changedShader](const WatchedShader& watchedShader) { return watchedShader.m_shader == changedShader.m_shader; };
+			auto it = std::find_if(m_watchedShaders.begin(), m_watchedShaders.end(), isShader);
+
+			// unwatched meanwhile
+			if (it == m_watchedShaders.end())
+				continue;
+
+			// on error, the next save compiles again: the shader keeps its previous module until then
+			if (compiled)
+			{
+				it->m_dependencies = dependencies;
+				m_reloadedShaders.emplace_back(changedShader.m_shader, std::move(spirv));
+			}
+
+			it->m_writeTimes = GetWriteTimes(it->m_dependencies);
+		}
+	}
+}
+
+}
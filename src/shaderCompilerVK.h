@@ -0,0 +1,72 @@
+#pragma once
+
+#include "shaderVK.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace MBRF
+{
+
+class DeviceVK;
+
+// Runtime GLSL to SPIR-V compilation with shaderc, when built with MBRF_SHADERC (defined by the property sheets when extern/vulkan/Lib has shaderc_shared.lib).
+// #include "..." is resolved from the including file directory, then from s_includeDirectory (shaderCommon.h, bindless.h).
+// The SPIR-V is cached in s_cacheDirectory by the hash of the preprocessed source, the defines and the compiler options: a warm start doesn't compile at all.
+// The watched shaders (see ShaderVK::CreateFromSource) are recompiled on a background thread when their source or includes change, and reloaded by Update
+class ShaderCompilerVK
+{
+public:
+	static bool IsAvailable();
+
+	// thread safe. Errors are printed. dependencies: the source and the files it includes
+	static bool Compile(const char* fileName, ShaderStage stage, const std::vector<ShaderDefineVK>& defines, std::vector<uint32_t>& spirv, std::vector<std::string>* dependencies = nullptr);
+
+	static void Watch(ShaderVK* shader, const char* fileName, ShaderStage stage, const std::vector<ShaderDefineVK>& defines, const std::vector<std::string>& dependencies);
+	static void Unwatch(ShaderVK* shader);
+
+	// render thread, once per frame: reloads the shaders recompiled since the last call and drops their PipelineStateCache pipelines and PipelineLibraryCache parts.
+	// Returns true if any was, the pipelines created outside of the cache have to be recreated
+	static bool Update(DeviceVK* device);
+	static void Cleanup();
+
+	// compilations skipped thanks to the SPIR-V cache, and the ones done
+	static uint32_t GetNumCacheHits() { return m_numCacheHits; };
+	static uint32_t GetNumCompilations() { return m_numCompilations; };
+
+	static const char* s_includeDirectory;
+	static const char* s_cacheDirectory;
+
+private:
+	struct WatchedShader
+	{
+		ShaderVK* m_shader = nullptr;
+		std::string m_fileName;
+		ShaderStage m_stage = SHADER_STAGE_VERTEX;
+		std::vector<ShaderDefineVK> m_defines;
+		std::vector<std::string> m_dependencies;
+		// of the dependencies, when last compiled
+		std::vector<time_t> m_writeTimes;
+	};
+
+	static std::vector<time_t> GetWriteTimes(const std::vector<std::string>& files);
+	static void WatcherThread();
+
+	static std::atomic<uint32_t> m_numCacheHits;
+	static std::atomic<uint32_t> m_numCompilations;
+
+	// the mutex guards the watched shaders and the reloaded ones
+	static std::mutex m_mutex;
+	static std::condition_variable m_stopCondition;
+	static std::thread m_watcher;
+	static bool m_stopWatcher;
+	static std::vector<WatchedShader> m_watchedShaders;
+	static std::vector<std::pair<ShaderVK*, std::vector<uint32_t>>> m_reloadedShaders;
+};
+
+}
@@ -0,0 +1,190 @@
+#include "shaderPermutationsVK.h"
+
+#include "shaderCompilerVK.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+namespace MBRF
+{
+
+void ShaderPermutationsVK::Create(const char* fileName, ShaderStage stage, const std::vector<std::string>& keywords)
+{
+	assert(keywords.size() <= s_maxKeywords);
+
+	m_fileName = fileName;
+	m_stage = stage;
+	m_keywords = keywords;
+
+	m_variants.assign(size_t(1) << keywords.size(), nullptr);
+	m_numOnDemandCompilations = 0;
+}
+
+void ShaderPermutationsVK::Destroy(DeviceVK* device)
+{
+	for (ShaderVK*& variant : m_variants)
+	{
+		if (variant)
+		{
+			variant->Destroy(device);
+			delete variant;
+			variant = nullptr;
+		}
+	}
+}
+
+uint32_t ShaderPermutationsVK::GetMask(const std::vector<std::string>& keywords) const
+{
+	uint32_t mask = 0;
+
+	for (const std::string& keyword : keywords)
+	{
+		auto it = std::find(m_keywords.begin(), m_keywords.end(), keyword);
+
+		assert(it != m_keywords.end());
+
+		if (it != m_keywords.end())
+			mask |= 1u << uint32_t(it - m_keywords.begin());
+	}
+
+	return mask;
+}
+
+bool ShaderPermutationsVK::Prewarm(DeviceVK* device, const std::vector<uint32_t>& masks)
+{
+	std::vector<uint32_t> missingMasks;
+
+	for (uint32_t mask : masks)
+	{
+		assert(mask < m_variants.size());
+
+		if (!m_variants[mask] && std::find(missingMasks.begin(), missingMasks.end(), mask) == missingMasks.end())
+			missingMasks.push_back(mask);
+	}
+
+	if (missingMasks.empty())
+		return true;
+
+	std::vector<ShaderVK*> shaders(missingMasks.size());
+	// not vector<bool>: written concurrently
+	std::vector<char> results(missingMasks.size(), 0);
+
+	for (ShaderVK*& shader : shaders)
+		shader = new ShaderVK();
+
+	// compiling and creating the modules is thread safe (see ShaderCompilerVK::Compile)
+	std::atomic<uint32_t> nextVariant(0);
+
+	auto compileVariants = [&]()
+	{
+		for (uint32_t i = nextVariant++; i < missingMasks.size(); i = nextVariant++)
+			results[i] = CreateVariant(device, missingMasks[i], shaders[i]) ? 1 : 0;
+	};
+
+	uint32_t numThreads = std::max(1u, std::min(uint32_t(missingMasks.size()), std::thread::hardware_concurrency()));
+	std::vector<std::thread> threads;
+
+	for (uint32_t i = 1; i < numThreads; ++i)
+		threads.emplace_back(compileVariants);
+
+	compileVariants();
+
+	for (std::thread& thread : threads)
+		thread.join();
+
+	bool result = true;
+
+	for (size_t i = 0; i < missingMasks.size(); ++i)
+	{
+		if (results[i])
+		{
+			m_variants[missingMasks[i]] = shaders[i];
+		}
+		else
+		{
+			delete shaders[i];
+			result = false;
+		}
+	}
+
+	return result;
+}
+
+bool ShaderPermutationsVK::PrewarmFromManifest(DeviceVK* device, const char* manifestFileName)
+{
+	std::ifstream file(manifestFileName);
+
+	if (!file.is_open())
+	{
+		std::cout << "failed to open file " << manifestFileName << std::endl;
+		return false;
+	}
+
+	std::vector<uint32_t> masks;
+	std::string line;
+
+	while (std::getline(file, line))
+	{
+		std::istringstream stream(line);
+		std::string shaderPath;
+
+		if (!(stream >> shaderPath) || shaderPath[0] == '#')
+			continue;
+
+		if (std::string(ShaderCompilerVK::s_includeDirectory) + shaderPath != m_fileName)
+			continue;
+
+		std::vector<std::string> keywords;
+		std::string keyword;
+
+		while (stream >> keyword)
+			keywords.push_back(keyword);
+
+		masks.push_back(GetMask(keywords));
+	}
+
+	return Prewarm(device, masks);
+}
+
+ShaderVK* ShaderPermutationsVK::GetVariant(DeviceVK* device, uint32_t mask)
+{
+	assert(mask < m_variants.size());
+
+	if (m_variants[mask])
+		return m_variants[mask];
+
+	std::cout << "Shader " << m_fileName << " variant " << mask << " wasn't prewarmed, compiled on demand" << std::endl;
+
+	m_numOnDemandCompilations++;
+
+	if (!Prewarm(device, { mask }))
+		return nullptr;
+
+	return m_variants[mask];
+}
+
+bool ShaderPermutationsVK::CreateVariant(DeviceVK* device, uint32_t mask, ShaderVK* shader) const
+{
+	if (ShaderCompilerVK::IsAvailable())
+	{
+		std::vector<ShaderDefineVK> defines;
+
+		for (uint32_t i = 0; i < m_keywords.size(); ++i)
+		{
+			if (mask & (1u << i))
+				defines.push_back({ m_keywords[i], "1" });
+		}
+
+		return shader->CreateFromSource(device, m_fileName.c_str(), m_stage, defines);
+	}
+
+	std::string spirvFileName = (mask == 0) ? m_fileName + ".spv" : m_fileName + "." + std::to_string(mask) + ".spv";
+
+	return shader->CreateFromFile(device, spirvFileName.c_str(), m_stage);
+}
+
+}
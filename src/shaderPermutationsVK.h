@@ -0,0 +1,52 @@
+#pragma once
+
+#include "shaderVK.h"
+
+#include <string>
+#include <vector>
+
+namespace MBRF
+{
+
+class DeviceVK;
+
+// Variants of a GLSL shader by feature keyword: bit i of the variant mask is keywords[i], compiled with #define <keyword> 1 (test them with #ifdef).
+// Each variant is its own ShaderVK, indexed by mask. With runtime compilation (see ShaderCompilerVK) the variants are compiled from the source and watched,
+// without it they are loaded from fileName.spv for mask 0 and fileName.<mask>.spv otherwise, built by the project custom build step
+class ShaderPermutationsVK
+{
+public:
+	static const uint32_t s_maxKeywords = 8;
+
+	void Create(const char* fileName, ShaderStage stage, const std::vector<std::string>& keywords);
+	void Destroy(DeviceVK* device);
+
+	// asserts on unknown keywords
+	uint32_t GetMask(const std::vector<std::string>& keywords) const;
+
+	// compiles the missing variants in parallel. Returns false if any failed
+	bool Prewarm(DeviceVK* device, const std::vector<uint32_t>& masks);
+	// the variants of this shader listed in the manifest: one per line, the shader path (from ShaderCompilerVK::s_includeDirectory) followed by its keywords.
+	// Empty lines and the ones starting with # are skipped
+	bool PrewarmFromManifest(DeviceVK* device, const char* manifestFileName);
+
+	// O(1) once prewarmed. A missing variant is compiled on the spot, stalling the frame: nullptr if that fails
+	ShaderVK* GetVariant(DeviceVK* device, uint32_t mask);
+
+	uint32_t GetNumVariants() const { return uint32_t(m_variants.size()); };
+	// variants that weren't prewarmed, add them to the manifest
+	uint32_t GetNumOnDemandCompilations() const { return m_numOnDemandCompilations; };
+
+private:
+	bool CreateVariant(DeviceVK* device, uint32_t mask, ShaderVK* shader) const;
+
+	std::string m_fileName;
+	ShaderStage m_stage = SHADER_STAGE_VERTEX;
+	std::vector<std::string> m_keywords;
+
+	// by mask, nullptr until compiled. Allocated: watched shaders must not move
+	std::vector<ShaderVK*> m_variants;
+	uint32_t m_numOnDemandCompilations = 0;
+};
+
+}
@@ -0,0 +1,380 @@
+#include "shaderReflectionVK.h"
+
+#include "vulkan/spirv.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace MBRF
+{
+
+bool ShaderReflectionVK::Parse(const uint32_t* code, size_t numWords)
+{
+	m_ids.clear();
+	m_bindings.clear();
+	m_inputs.clear();
+	m_specializationConstants.clear();
+	m_pushConstantsSize = 0;
+	m_workgroupSize[0] = m_workgroupSize[1] = m_workgroupSize[2] = 0;
+	m_workgroupSizeConstantIds[0] = m_workgroupSizeConstantIds[1] = m_workgroupSizeConstantIds[2] = s_noConstantId;
+
+	// header: magic, version, generator, id bound, schema
+	if (numWords < 5 || code[0] != SpvMagicNumber)
+	{
+		std::cout << "invalid SPIR-V module" << std::endl;
+		return false;
+	}
+
+	m_ids.resize(code[3]);
+
+	bool hasLocalSize = false;
+
+	// first pass: collect the types, variables and decorations
+	for (size_t i = 5; i < numWords;)
+	{
+		uint32_t opcode = code[i] & SpvOpCodeMask;
+		uint32_t wordCount = code[i] >> SpvWordCountShift;
+		const uint32_t* operands = code + i + 1;
+
+		if (wordCount == 0 || i + wordCount > numWords)
+		{
+			std::cout << "invalid SPIR-V instruction" << std::endl;
+			return false;
+		}
+
+		switch (opcode)
+		{
+		case SpvOpExecutionMode:
+			if (operands[1] == SpvExecutionModeLocalSize && !hasLocalSize)
+			{
+				m_workgroupSize[0] = operands[2];
+				m_workgroupSize[1] = operands[3];
+				m_workgroupSize[2] = operands[4];
+				hasLocalSize = true;
+			}
+			break;
+
+		case SpvOpDecorate:
+		{
+			IdInfo& id = m_ids[operands[0]];
+
+			switch (operands[1])
+			{
+			case SpvDecorationDescriptorSet: id.m_set = operands[2]; id.m_hasSet = true; break;
+			case SpvDecorationBinding: id.m_binding = operands[2]; id.m_hasBinding = true; break;
+			case SpvDecorationLocation: id.m_location = operands[2]; id.m_hasLocation = true; break;
+			case SpvDecorationSpecId: id.m_specId = operands[2]; id.m_hasSpecId = true; break;
+			case SpvDecorationBufferBlock: id.m_isBufferBlock = true; break;
+			case SpvDecorationArrayStride: id.m_arrayStride = operands[2]; break;
+			case SpvDecorationBuiltIn:
+				id.m_isBuiltIn = true;
+				id.m_isWorkgroupSize = (operands[2] == SpvBuiltInWorkgroupSize);
+				break;
+			default:
+				break;
+			}
+			break;
+		}
+
+		case SpvOpMemberDecorate:
+		{
+			IdInfo& id = m_ids[operands[0]];
+			uint32_t member = operands[1];
+
+			if (id.m_members.size() <= member)
+				id.m_members.resize(member + 1);
+
+			if (operands[2] == SpvDecorationOffset)
+				id.m_members[member].m_offset = operands[3];
+			else if (operands[2] == SpvDecorationMatrixStride)
+				id.m_members[member].m_matrixStride = operands[3];
+			break;
+		}
+
+		case SpvOpTypeBool:
+			m_ids[operands[0]].m_opcode = opcode;
+			m_ids[operands[0]].m_count = 32;
+			break;
+
+		case SpvOpTypeInt:
+		case SpvOpTypeFloat:
+			m_ids[operands[0]].m_opcode = opcode;
+			m_ids[operands[0]].m_count = operands[1];
+			m_ids[operands[0]].m_isSigned = (opcode == SpvOpTypeInt) && operands[2];
+			break;
+
+		case SpvOpTypeVector:
+		case SpvOpTypeMatrix:
+			m_ids[operands[0]].m_opcode = opcode;
+			m_ids[operands[0]].m_type = operands[1];
+			m_ids[operands[0]].m_count = operands[2];
+			break;
+
+		case SpvOpTypeImage:
+			m_ids[operands[0]].m_opcode = opcode;
+			m_ids[operands[0]].m_dim = operands[2];
+			m_ids[operands[0]].m_sampled = operands[6];
+			break;
+
+		case SpvOpTypeSampler:
+			m_ids[operands[0]].m_opcode = opcode;
+			break;
+
+		case SpvOpTypeSampledImage:
+		case SpvOpTypeRuntimeArray:
+			m_ids[operands[0]].m_opcode = opcode;
+			m_ids[operands[0]].m_type = operands[1];
+			break;
+
+		case SpvOpTypeArray:
+			m_ids[operands[0]].m_opcode = opcode;
+			m_ids[operands[0]].m_type = operands[1];
+			m_ids[operands[0]].m_length = operands[2];
+			break;
+
+		case SpvOpTypeStruct:
+		{
+			IdInfo& id = m_ids[operands[0]];
+			id.m_opcode = opcode;
+
+			uint32_t numMembers = wordCount - 2;
+
+			if (id.m_members.size() < numMembers)
+				id.m_members.resize(numMembers);
+
+			for (uint32_t member = 0; member < numMembers; ++member)
+				id.m_members[member].m_type = operands[1 + member];
+			break;
+		}
+
+		case SpvOpTypePointer:
+			m_ids[operands[0]].m_opcode = opcode;
+			m_ids[operands[0]].m_storageClass = operands[1];
+			m_ids[operands[0]].m_type = operands[2];
+			break;
+
+		case SpvOpConstant:
+		case SpvOpSpecConstant:
+			m_ids[operands[1]].m_opcode = opcode;
+			m_ids[operands[1]].m_type = operands[0];
+			m_ids[operands[1]].m_value = operands[2];
+			break;
+
+		case SpvOpSpecConstantTrue:
+		case SpvOpSpecConstantFalse:
+			m_ids[operands[1]].m_opcode = opcode;
+			m_ids[operands[1]].m_type = operands[0];
+			m_ids[operands[1]].m_value = (opcode == SpvOpSpecConstantTrue) ? 1 : 0;
+			break;
+
+		case SpvOpConstantComposite:
+		case SpvOpSpecConstantComposite:
+			m_ids[operands[1]].m_opcode = opcode;
+			m_ids[operands[1]].m_type = operands[0];
+			m_ids[operands[1]].m_constituents.assign(operands + 2, operands + wordCount - 1);
+			break;
+
+		case SpvOpVariable:
+			m_ids[operands[1]].m_opcode = opcode;
+			m_ids[operands[1]].m_type = operands[0];
+			m_ids[operands[1]].m_storageClass = operands[2];
+			break;
+
+		default:
+			break;
+		}
+
+		i += wordCount;
+	}
+
+	// second pass: the interface variables and the specialization constants
+	for (const IdInfo& id : m_ids)
+	{
+		// local_size_x_id etc.: the workgroup size builtin constant overrides the execution mode
+		if (id.m_isWorkgroupSize && id.m_constituents.size() == 3)
+		{
+			for (uint32_t c = 0; c < 3; ++c)
+			{
+				const IdInfo& constituent = m_ids[id.m_constituents[c]];
+
+				m_workgroupSize[c] = constituent.m_value;
+				m_workgroupSizeConstantIds[c] = constituent.m_hasSpecId ? constituent.m_specId : s_noConstantId;
+			}
+		}
+
+		if (id.m_hasSpecId && (id.m_opcode == SpvOpSpecConstant || id.m_opcode == SpvOpSpecConstantTrue || id.m_opcode == SpvOpSpecConstantFalse))
+		{
+			const IdInfo& type = m_ids[id.m_type];
+
+			ShaderSpecializationConstantVK constant;
+			constant.m_constantId = id.m_specId;
+
+			// bools have m_count = 32 too
+			if (type.m_count != 32)
+			{
+				std::cout << "unsupported specialization constant type, constant_id " << id.m_specId << std::endl;
+				continue;
+			}
+
+			if (type.m_opcode == SpvOpTypeBool)
+				constant.m_type = SPECIALIZATION_CONSTANT_TYPE_BOOL;
+			else if (type.m_opcode == SpvOpTypeFloat)
+				constant.m_type = SPECIALIZATION_CONSTANT_TYPE_FLOAT;
+			else
+				constant.m_type = type.m_isSigned ? SPECIALIZATION_CONSTANT_TYPE_INT : SPECIALIZATION_CONSTANT_TYPE_UINT;
+
+			m_specializationConstants.emplace_back(constant);
+		}
+
+		if (id.m_opcode != SpvOpVariable)
+			continue;
+
+		uint32_t type = m_ids[id.m_type].m_type;
+
+		switch (id.m_storageClass)
+		{
+		case SpvStorageClassUniformConstant:
+		case SpvStorageClassUniform:
+		case SpvStorageClassStorageBuffer:
+		{
+			if (!id.m_hasBinding)
+				break;
+
+			ShaderBindingVK binding;
+			binding.m_set = id.m_set;
+			binding.m_binding = id.m_binding;
+			binding.m_descriptorType = GetDescriptorType(id, binding.m_count);
+
+			if (binding.m_descriptorType != VK_DESCRIPTOR_TYPE_MAX_ENUM)
+				m_bindings.emplace_back(binding);
+			break;
+		}
+
+		case SpvStorageClassPushConstant:
+			m_pushConstantsSize = GetTypeSize(type, 0);
+			break;
+
+		case SpvStorageClassInput:
+			if (id.m_hasLocation && !id.m_isBuiltIn)
+			{
+				const IdInfo& inputType = m_ids[type];
+
+				ShaderInputVK input;
+				input.m_location = id.m_location;
+
+				if (inputType.m_opcode == SpvOpTypeMatrix)
+				{
+					input.m_numLocations = inputType.m_count;
+					input.m_numComponents = m_ids[inputType.m_type].m_count;
+				}
+				else if (inputType.m_opcode == SpvOpTypeVector)
+				{
+					input.m_numComponents = inputType.m_count;
+				}
+
+				m_inputs.emplace_back(input);
+			}
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	std::sort(m_bindings.begin(), m_bindings.end(), [](const ShaderBindingVK& a, const ShaderBindingVK& b) { return (a.m_set != b.m_set) ? a.m_set < b.m_set : a.m_binding < b.m_binding; });
+	std::sort(m_inputs.begin(), m_inputs.end(), [](const ShaderInputVK& a, const ShaderInputVK& b) { return a.m_location < b.m_location; });
+	std::sort(m_specializationConstants.begin(), m_specializationConstants.end(), [](const ShaderSpecializationConstantVK& a, const ShaderSpecializationConstantVK& b) { return a.m_constantId < b.m_constantId; });
+
+	std::vector<IdInfo>().swap(m_ids);
+
+	return true;
+}
+
+// size of a type in a block with explicit layout (push constants): offsets and strides come from the decorations
+uint32_t ShaderReflectionVK::GetTypeSize(uint32_t type, uint32_t matrixStride) const
+{
+	const IdInfo& info = m_ids[type];
+
+	switch (info.m_opcode)
+	{
+	case SpvOpTypeBool:
+	case SpvOpTypeInt:
+	case SpvOpTypeFloat:
+		return info.m_count / 8;
+
+	case SpvOpTypeVector:
+		return info.m_count * GetTypeSize(info.m_type, 0);
+
+	case SpvOpTypeMatrix:
+		return info.m_count * (matrixStride ? matrixStride : GetTypeSize(info.m_type, 0));
+
+	case SpvOpTypeArray:
+	{
+		uint32_t length = m_ids[info.m_length].m_value;
+		return length * (info.m_arrayStride ? info.m_arrayStride : GetTypeSize(info.m_type, matrixStride));
+	}
+
+	case SpvOpTypeStruct:
+	{
+		uint32_t size = 0;
+
+		for (const MemberInfo& member : info.m_members)
+			size = std::max(size, member.m_offset + GetTypeSize(member.m_type, member.m_matrixStride));
+
+		return size;
+	}
+
+	default:
+		// runtime arrays and opaque types have no size
+		return 0;
+	}
+}
+
+VkDescriptorType ShaderReflectionVK::GetDescriptorType(const IdInfo& variable, uint32_t& count) const
+{
+	uint32_t type = m_ids[variable.m_type].m_type;
+
+	count = 1;
+
+	// arrays of resources
+	if (m_ids[type].m_opcode == SpvOpTypeArray)
+	{
+		count = m_ids[m_ids[type].m_length].m_value;
+		type = m_ids[type].m_type;
+	}
+	else if (m_ids[type].m_opcode == SpvOpTypeRuntimeArray)
+	{
+		count = 0;
+		type = m_ids[type].m_type;
+	}
+
+	const IdInfo& info = m_ids[type];
+
+	switch (info.m_opcode)
+	{
+	case SpvOpTypeSampledImage:
+		return (m_ids[info.m_type].m_dim == SpvDimBuffer) ? VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+	case SpvOpTypeSampler:
+		return VK_DESCRIPTOR_TYPE_SAMPLER;
+
+	case SpvOpTypeImage:
+		// sampled: 1 = used with a sampler, 2 = storage
+		if (info.m_dim == SpvDimBuffer)
+			return (info.m_sampled == 2) ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+
+		return (info.m_sampled == 2) ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+
+	case SpvOpTypeStruct:
+		// before SPIR-V 1.3 storage buffers are Uniform blocks decorated with BufferBlock
+		if (variable.m_storageClass == SpvStorageClassStorageBuffer || info.m_isBufferBlock)
+			return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+
+		return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+
+	default:
+		return VK_DESCRIPTOR_TYPE_MAX_ENUM;
+	}
+}
+
+}
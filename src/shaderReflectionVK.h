@@ -0,0 +1,115 @@
+#pragma once
+
+#include "commonVK.h"
+
+namespace MBRF
+{
+
+struct ShaderBindingVK
+{
+	uint32_t m_set = 0;
+	uint32_t m_binding = 0;
+	VkDescriptorType m_descriptorType = VK_DESCRIPTOR_TYPE_MAX_ENUM;
+	// array size, 0 for runtime sized arrays
+	uint32_t m_count = 1;
+};
+
+// 32-bit scalars only, bools are passed as VkBool32
+enum SpecializationConstantType
+{
+	SPECIALIZATION_CONSTANT_TYPE_BOOL,
+	SPECIALIZATION_CONSTANT_TYPE_INT,
+	SPECIALIZATION_CONSTANT_TYPE_UINT,
+	SPECIALIZATION_CONSTANT_TYPE_FLOAT,
+	NUM_SPECIALIZATION_CONSTANT_TYPES
+};
+
+// layout(constant_id = N) const in GLSL
+struct ShaderSpecializationConstantVK
+{
+	uint32_t m_constantId = 0;
+	SpecializationConstantType m_type = SPECIALIZATION_CONSTANT_TYPE_INT;
+};
+
+struct ShaderInputVK
+{
+	uint32_t m_location = 0;
+	// matrices take a location per column
+	uint32_t m_numLocations = 1;
+	// per location: 1 to 4
+	uint32_t m_numComponents = 1;
+};
+
+// Resources of a SPIR-V module, read from its types, decorations and execution modes: descriptor bindings, push constants block size,
+// input locations (the vertex attributes, for vertex shaders), specialization constants and compute workgroup size. Only the first entry point is considered
+class ShaderReflectionVK
+{
+public:
+	static const uint32_t s_noConstantId = ~0u;
+
+	bool Parse(const uint32_t* code, size_t numWords);
+
+	const std::vector<ShaderBindingVK>& GetBindings() const { return m_bindings; };
+	uint32_t GetPushConstantsSize() const { return m_pushConstantsSize; };
+	const std::vector<ShaderInputVK>& GetInputs() const { return m_inputs; };
+	const std::vector<ShaderSpecializationConstantVK>& GetSpecializationConstants() const { return m_specializationConstants; };
+	// default values. Each dimension declared with local_size_*_id can be specialized, its constant id is given by GetWorkgroupSizeConstantIds (s_noConstantId otherwise)
+	const uint32_t* GetWorkgroupSize() const { return m_workgroupSize; };
+	const uint32_t* GetWorkgroupSizeConstantIds() const { return m_workgroupSizeConstantIds; };
+
+private:
+	struct MemberInfo
+	{
+		uint32_t m_type = 0;
+		uint32_t m_offset = 0;
+		uint32_t m_matrixStride = 0;
+	};
+
+	// SPIR-V ids, only what's needed for the above. Released at the end of Parse
+	struct IdInfo
+	{
+		uint32_t m_opcode = 0;
+		// pointee for pointers and variables, element for arrays, component for vectors, column for matrices, sampled image for sampled images
+		uint32_t m_type = 0;
+		uint32_t m_storageClass = 0;
+		// components for vectors, columns for matrices, bits for scalars
+		uint32_t m_count = 0;
+		bool m_isSigned = false;
+		// arrays: id of the length constant. Images: dim and sampled operands
+		uint32_t m_length = 0;
+		uint32_t m_dim = 0;
+		uint32_t m_sampled = 0;
+		uint32_t m_arrayStride = 0;
+		// constants (first word)
+		uint32_t m_value = 0;
+
+		uint32_t m_set = 0;
+		uint32_t m_binding = 0;
+		uint32_t m_location = 0;
+		uint32_t m_specId = 0;
+		bool m_hasSet = false;
+		bool m_hasBinding = false;
+		bool m_hasLocation = false;
+		bool m_hasSpecId = false;
+		bool m_isBuiltIn = false;
+		bool m_isBufferBlock = false;
+		bool m_isWorkgroupSize = false;
+
+		std::vector<MemberInfo> m_members;
+		std::vector<uint32_t> m_constituents;
+	};
+
+	uint32_t GetTypeSize(uint32_t type, uint32_t matrixStride) const;
+	VkDescriptorType GetDescriptorType(const IdInfo& variable, uint32_t& count) const;
+
+	std::vector<IdInfo> m_ids;
+
+	std::vector<ShaderBindingVK> m_bindings;
+	uint32_t m_pushConstantsSize = 0;
+	std::vector<ShaderInputVK> m_inputs;
+	std::vector<ShaderSpecializationConstantVK> m_specializationConstants;
+	uint32_t m_workgroupSize[3] = {};
+	uint32_t m_workgroupSizeConstantIds[3] = { s_noConstantId, s_noConstantId, s_noConstantId };
+};
+
+}
@@ -1,8 +1,11 @@
 #include "shaderVK.h"
 
 #include "deviceVK.h"
+#include "shaderCompilerVK.h"
 #include "utils.h"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 
 namespace MBRF
@@ -15,11 +18,55 @@ bool ShaderVK::CreateFromFile(DeviceVK* device, const char* fileName, ShaderStag
 	if (!Utils::ReadFile(fileName, shaderCode))
 		return false;
 
+	if (!CreateFromSpirv(device, reinterpret_cast<uint32_t*>(shaderCode.data()), shaderCode.size(), stage))
+	{
+		std::cout << "Failed to parse shader " << fileName << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool ShaderVK::CreateFromSource(DeviceVK* device, const char* fileName, ShaderStage stage, const std::vector<ShaderDefineVK>& defines)
+{
+	if (!ShaderCompilerVK::IsAvailable())
+	{
+		if (!defines.empty())
+		{
+			std::cout << "Shader " << fileName << " has defines and needs runtime compilation" << std::endl;
+			return false;
+		}
+
+		return CreateFromFile(device, (std::string(fileName) + ".spv").c_str(), stage);
+	}
+
+	std::vector<uint32_t> spirv;
+	std::vector<std::string> dependencies;
+
+	if (!ShaderCompilerVK::Compile(fileName, stage, defines, spirv, &dependencies))
+		return false;
+
+	if (!CreateFromSpirv(device, spirv.data(), spirv.size() * sizeof(uint32_t), stage))
+	{
+		std::cout << "Failed to parse shader " << fileName << std::endl;
+		return false;
+	}
+
+	ShaderCompilerVK::Watch(this, fileName, stage, defines, dependencies);
+
+	return true;
+}
+
+bool ShaderVK::CreateFromSpirv(DeviceVK* device, const uint32_t* code, size_t codeSize, ShaderStage stage)
+{
+	if (!m_reflection.Parse(code, codeSize / sizeof(uint32_t)))
+		return false;
+
 	VkShaderModuleCreateInfo createInfo = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
 	createInfo.pNext = nullptr;
 	createInfo.flags = 0;
-	createInfo.codeSize = shaderCode.size();
-	createInfo.pCode = reinterpret_cast<uint32_t*>(shaderCode.data());
+	createInfo.codeSize = codeSize;
+	createInfo.pCode = code;
 
 	VK_CHECK(vkCreateShaderModule(device->GetDevice(), &createInfo, nullptr, &m_shaderModule));
 
@@ -43,11 +90,136 @@ bool ShaderVK::CreateFromFile(DeviceVK* device, const char* fileName, ShaderStag
 	return true;
 }
 
+bool ShaderVK::Reload(DeviceVK* device, const std::vector<uint32_t>& spirv)
+{
+	ShaderReflectionVK reflection;
+
+	if (!reflection.Parse(spirv.data(), spirv.size()))
+		return false;
+
+	VkShaderModuleCreateInfo createInfo = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
+	createInfo.pNext = nullptr;
+	createInfo.flags = 0;
+	createInfo.codeSize = spirv.size() * sizeof(uint32_t);
+	createInfo.pCode = spirv.data();
+
+	VkShaderModule shaderModule = VK_NULL_HANDLE;
+	VK_CHECK(vkCreateShaderModule(device->GetDevice(), &createInfo, nullptr, &shaderModule));
+
+	// the pipelines created from the old module don't need it anymore
+	vkDestroyShaderModule(device->GetDevice(), m_shaderModule, nullptr);
+
+	m_shaderModule = shaderModule;
+	m_reflection = reflection;
+
+	return true;
+}
+
 void ShaderVK::Destroy(DeviceVK* device)
 {
+	ShaderCompilerVK::Unwatch(this);
+
 	vkDestroyShaderModule(device->GetDevice(), m_shaderModule, nullptr);
 
 	m_shaderModule = VK_NULL_HANDLE;
 }
 
+// ------------------------------- SpecializationConstantsVK -------------------------------
+
+void SpecializationConstantsVK::SetFloat(uint32_t constantId, float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+
+	Set(constantId, SPECIALIZATION_CONSTANT_TYPE_FLOAT, bits);
+}
+
+void SpecializationConstantsVK::Set(uint32_t constantId, SpecializationConstantType type, uint32_t value)
+{
+	auto isBefore = [](const VkSpecializationMapEntry& entry, uint32_t id) { return entry.constantID < id; };
+	auto it = std::lower_bound(m_entries.begin(), m_entries.end(), constantId, isBefore);
+	size_t index = it - m_entries.begin();
+
+	if (it != m_entries.end() && it->constantID == constantId)
+	{
+		m_types[index] = type;
+		m_data[index] = value;
+		return;
+	}
+
+	m_entries.insert(it, { constantId, 0, sizeof(uint32_t) });
+	m_types.insert(m_types.begin() + index, type);
+	m_data.insert(m_data.begin() + index, value);
+
+	// the data is packed in id order
+	for (size_t i = index; i < m_entries.size(); ++i)
+		m_entries[i].offset = uint32_t(i * sizeof(uint32_t));
+}
+
+bool SpecializationConstantsVK::GetValue(uint32_t constantId, uint32_t& value) const
+{
+	for (size_t i = 0; i < m_entries.size(); ++i)
+	{
+		if (m_entries[i].constantID == constantId)
+		{
+			value = m_data[i];
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool SpecializationConstantsVK::Validate(const std::vector<const ShaderVK*>& shaders) const
+{
+	for (size_t i = 0; i < m_entries.size(); ++i)
+	{
+		bool found = false;
+
+		for (const ShaderVK* shader : shaders)
+		{
+			for (const ShaderSpecializationConstantVK& constant : shader->GetReflection().GetSpecializationConstants())
+			{
+				if (constant.m_constantId != m_entries[i].constantID)
+					continue;
+
+				if (constant.m_type != m_types[i])
+				{
+					std::cout << "specialization constant " << constant.m_constantId << " is set with a different type than declared in the shader" << std::endl;
+					return false;
+				}
+
+				found = true;
+			}
+		}
+
+		if (!found)
+		{
+			std::cout << "specialization constant " << m_entries[i].constantID << " isn't declared by the shaders" << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void SpecializationConstantsVK::AppendKey(std::vector<uint64_t>& key) const
+{
+	key.push_back(m_entries.size());
+
+	for (size_t i = 0; i < m_entries.size(); ++i)
+		key.push_back((uint64_t(m_entries[i].constantID) << 32) | m_data[i]);
+}
+
+VkSpecializationInfo SpecializationConstantsVK::GetInfo() const
+{
+	VkSpecializationInfo info;
+	info.mapEntryCount = uint32_t(m_entries.size());
+	info.pMapEntries = m_entries.data();
+	info.dataSize = m_data.size() * sizeof(uint32_t);
+	info.pData = m_data.data();
+
+	return info;
+}
+
 }
\ No newline at end of file
@@ -1,8 +1,10 @@
 #pragma once
 
 #include "commonVK.h"
+#include "shaderReflectionVK.h"
 
-//TODO: add any reflection?
+#include <string>
+#include <vector>
 
 namespace MBRF
 {
@@ -17,18 +19,69 @@ enum ShaderStage
 	NUM_SHADER_STAGES,
 };
 
+// #define passed to the runtime compilation, m_value can be empty
+struct ShaderDefineVK
+{
+	std::string m_name;
+	std::string m_value;
+};
+
 class ShaderVK
 {
 public:
+	// SPIR-V compiled offline (the .spv next to the GLSL source)
 	bool CreateFromFile(DeviceVK* device, const char* fileName, ShaderStage stage);
+	// GLSL compiled at runtime and watched for changes (see ShaderCompilerVK). Without runtime compilation, loads the offline fileName.spv when there are no defines.
+	// A watched shader must not move in memory until it's destroyed
+	bool CreateFromSource(DeviceVK* device, const char* fileName, ShaderStage stage, const std::vector<ShaderDefineVK>& defines = {});
 	void Destroy(DeviceVK* device);
 
-	VkShaderModule GetShaderModule() { return m_shaderModule; };
+	// replaces the module and the reflection, keeps the previous ones on failure
+	bool Reload(DeviceVK* device, const std::vector<uint32_t>& spirv);
+
+	VkShaderModule GetShaderModule() const { return m_shaderModule; };
 	VkShaderStageFlagBits GetStage() const { return m_stage; };
 
+	// what the module uses, merged and validated against the layouts at pipeline creation
+	const ShaderReflectionVK& GetReflection() const { return m_reflection; };
+
 private:
+	bool CreateFromSpirv(DeviceVK* device, const uint32_t* code, size_t codeSize, ShaderStage stage);
+
 	VkShaderModule m_shaderModule = VK_NULL_HANDLE;
 	VkShaderStageFlagBits m_stage;
+	ShaderReflectionVK m_reflection;
+};
+
+// values of the specialization constants by constant id, for all the stages of a pipeline (the ids a module doesn't declare are ignored by it).
+// Part of the pipeline cache key: each set of values is its own pipeline, with the constants folded by the compiler
+class SpecializationConstantsVK
+{
+public:
+	void SetBool(uint32_t constantId, bool value) { Set(constantId, SPECIALIZATION_CONSTANT_TYPE_BOOL, value ? VK_TRUE : VK_FALSE); };
+	void SetInt(uint32_t constantId, int32_t value) { Set(constantId, SPECIALIZATION_CONSTANT_TYPE_INT, uint32_t(value)); };
+	void SetUInt(uint32_t constantId, uint32_t value) { Set(constantId, SPECIALIZATION_CONSTANT_TYPE_UINT, value); };
+	void SetFloat(uint32_t constantId, float value);
+
+	bool IsEmpty() const { return m_entries.empty(); };
+	// raw 32 bits of the value, false if the constant isn't set
+	bool GetValue(uint32_t constantId, uint32_t& value) const;
+
+	// every constant must be declared by at least one of the shaders, with the same type
+	bool Validate(const std::vector<const ShaderVK*>& shaders) const;
+	// appends the ids and values, for the pipeline cache keys
+	void AppendKey(std::vector<uint64_t>& key) const;
+
+	// points to the values: only valid until they change
+	VkSpecializationInfo GetInfo() const;
+
+private:
+	void Set(uint32_t constantId, SpecializationConstantType type, uint32_t value);
+
+	// sorted by constant id, one 32 bits value each
+	std::vector<VkSpecializationMapEntry> m_entries;
+	std::vector<SpecializationConstantType> m_types;
+	std::vector<uint32_t> m_data;
 };
 
 }
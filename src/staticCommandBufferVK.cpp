@@ -0,0 +1,78 @@
+#include "staticCommandBufferVK.h"
+
+#include "deviceVK.h"
+#include "frameBufferVK.h"
+
+namespace MBRF
+{
+
+bool StaticCommandBufferVK::Create(DeviceVK* device, ContextVK::ContextType type)
+{
+	m_valid = false;
+	m_recording = false;
+	m_lastUsedFrameValue = 0;
+
+	return m_context.Create(device, type, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+}
+
+void StaticCommandBufferVK::Destroy(DeviceVK* device)
+{
+	device->WaitForFrame(m_lastUsedFrameValue);
+
+	m_context.Destroy(device);
+
+	m_valid = false;
+}
+
+bool StaticCommandBufferVK::IsValid(FrameBufferVK* renderTarget) const
+{
+	if (!m_valid)
+		return false;
+
+	// the recording is made against the render pass only, but clears and other commands might depend on the size
+	if (renderTarget->GetRenderPass() != m_renderPass || renderTarget->GetWidth() != m_width || renderTarget->GetHeight() != m_height)
+		return false;
+
+	return m_context.AreRecordedResourcesValid();
+}
+
+ContextVK* StaticCommandBufferVK::BeginRecording(DeviceVK* device, FrameBufferVK* renderTarget)
+{
+	assert(!m_recording);
+
+	// the command buffer can't be reset while it's still executing. It can't be re-recorded in the same frame it has been executed
+	assert(m_lastUsedFrameValue < device->GetCurrentFrameValue());
+	device->WaitForFrame(m_lastUsedFrameValue);
+
+	m_renderPass = renderTarget->GetRenderPass();
+	m_width = renderTarget->GetWidth();
+	m_height = renderTarget->GetHeight();
+
+	m_context.BeginSecondary(device, renderTarget);
+
+	m_recording = true;
+	m_valid = false;
+
+	return &m_context;
+}
+
+void StaticCommandBufferVK::EndRecording()
+{
+	assert(m_recording);
+
+	m_context.End();
+
+	m_recording = false;
+	m_valid = true;
+}
+
+void StaticCommandBufferVK::Execute(DeviceVK* device, ContextVK* context)
+{
+	assert(m_valid);
+
+	context->ExecuteCommands(&m_context);
+
+	m_lastUsedFrameValue = device->GetCurrentFrameValue();
+}
+
+}
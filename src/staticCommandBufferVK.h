@@ -0,0 +1,45 @@
+#pragma once
+
+#include "commonVK.h"
+#include "contextVK.h"
+
+namespace MBRF
+{
+
+class DeviceVK;
+class FrameBufferVK;
+
+// Commands recorded once in a secondary command buffer (with their descriptor sets and uniform data) and replayed every frame with vkCmdExecuteCommands.
+// The recording has to be redone when it's invalidated (i.e. on resize), when the render pass changes or when any bound resource has been recreated
+class StaticCommandBufferVK
+{
+public:
+	bool Create(DeviceVK* device, ContextVK::ContextType type = ContextVK::CONTEXT_TYPE_GRAPHICS);
+	void Destroy(DeviceVK* device);
+
+	bool IsValid(FrameBufferVK* renderTarget) const;
+	void Invalidate() { m_valid = false; };
+
+	// waits for the frames still executing the previous recording. The returned context is inside renderTarget's render pass: don't call BeginPass/EndPass on it
+	ContextVK* BeginRecording(DeviceVK* device, FrameBufferVK* renderTarget);
+	void EndRecording();
+
+	// context must be inside a pass begun with secondaryContents = true
+	void Execute(DeviceVK* device, ContextVK* context);
+
+private:
+	ContextVK m_context;
+
+	bool m_valid = false;
+	bool m_recording = false;
+
+	// what the recording depends on
+	VkRenderPass m_renderPass = VK_NULL_HANDLE;
+	uint32_t m_width = 0;
+	uint32_t m_height = 0;
+
+	// last frame that executed the recording
+	uint64_t m_lastUsedFrameValue = 0;
+};
+
+}
@@ -19,6 +19,7 @@ namespace MBRF
 // ---------------------------- SamplerCache ----------------------------
 
 std::unordered_map<size_t, VkSampler> SamplerCache::m_samplers;
+std::unordered_map<VkSampler, uint32_t> SamplerCache::m_bindlessIndices;
 
 size_t SamplerCache::GetSamplerIndex(VkFilter filter, float minLod, float maxLod)
 {
@@ -60,16 +61,25 @@ VkSampler SamplerCache::GetSampler(DeviceVK* device, VkFilter filter, float minL
 	VK_CHECK(vkCreateSampler(device->GetDevice(), &samplerInfo, nullptr, &sampler));
 
 	m_samplers[samplerIndex] = sampler;
+	m_bindlessIndices[sampler] = device->AllocateBindlessSampler(sampler);
 
 	return sampler;
 }
 
+uint32_t SamplerCache::GetBindlessIndex(VkSampler sampler)
+{
+	auto it = m_bindlessIndices.find(sampler);
+
+	return (it != m_bindlessIndices.end()) ? it->second : DeviceVK::s_invalidBindlessIndex;
+}
+
 void SamplerCache::Cleanup(DeviceVK* device)
 {
 	for (auto sampler : m_samplers)
 		vkDestroySampler(device->GetDevice(), sampler.second, nullptr);
 
 	m_samplers.clear();
+	m_bindlessIndices.clear();
 };
 
 // ---------------------------- TextureViewVK ----------------------------
@@ -143,6 +153,7 @@ bool TextureVK::Create(DeviceVK* device, VkFormat format, uint32_t width, uint32
 	m_tiling = tiling;
 	m_usage = usage;
 	m_currentLayout = initialLayout;
+	m_ownershipTransfer = OwnershipTransfer();
 
 	assert(!m_isCubemap || (m_isCubemap && m_layers == 6));
 
@@ -231,6 +242,12 @@ bool TextureVK::Create(DeviceVK* device, VkFormat format, uint32_t width, uint32
 
 	UpdateDescriptor();
 
+	if (m_usage & VK_IMAGE_USAGE_SAMPLED_BIT)
+	{
+		m_bindlessIndex = device->AllocateBindlessTexture(m_view.GetImageView());
+		m_bindlessSamplerIndex = SamplerCache::GetBindlessIndex(m_sampler);
+	}
+
 	return true;
 }
 
@@ -285,6 +302,9 @@ void TextureVK::Destroy(DeviceVK* device)
 {
 	VkDevice logicDevice = device->GetDevice();
 
+	device->FreeBindlessIndex(DeviceVK::BINDLESS_TYPE_TEXTURE, m_bindlessIndex);
+	m_bindlessIndex = DeviceVK::s_invalidBindlessIndex;
+
 	m_view.Destroy(device);
 
 	vkFreeMemory(logicDevice, m_memory, nullptr);
@@ -377,9 +397,9 @@ void TextureVK::LoadFromKTXFile(DeviceVK* device, const char* fileName, VkFormat
 	ktxTexture_Destroy(ktxTexture);
 }
 
-void TextureVK::TransitionImageLayout(DeviceVK* device, VkCommandBuffer commandBuffer, VkImageLayout newLayout)
+void TextureVK::TransitionImageLayout(DeviceVK* device, VkCommandBuffer commandBuffer, VkImageLayout newLayout, uint32_t queueFamily)
 {
-	device->TransitionImageLayout(commandBuffer, m_image, m_view.GetAspectMask(), m_currentLayout, newLayout);
+	device->TransitionImageLayout(commandBuffer, m_image, m_view.GetAspectMask(), m_currentLayout, newLayout, queueFamily, queueFamily);
 
 	m_currentLayout = newLayout;
 
@@ -395,6 +415,60 @@ void TextureVK::TransitionImageLayoutAndSubmit(DeviceVK* device, VkImageLayout n
 	device->SubmitCommandBufferAndWait(commandBuffer, true);
 }
 
+void TextureVK::ReleaseOwnership(DeviceVK* device, VkCommandBuffer commandBuffer, uint32_t srcQueueFamily, uint32_t dstQueueFamily, VkImageLayout newLayout)
+{
+	assert(!m_ownershipTransfer.m_pending);
+
+	if (srcQueueFamily == dstQueueFamily)
+	{
+		TransitionImageLayout(device, commandBuffer, newLayout, srcQueueFamily);
+		return;
+	}
+
+	device->TransitionImageLayout(commandBuffer, m_image, m_view.GetAspectMask(), m_currentLayout, newLayout, srcQueueFamily, dstQueueFamily, false);
+
+	m_ownershipTransfer.m_srcQueueFamily = srcQueueFamily;
+	m_ownershipTransfer.m_dstQueueFamily = dstQueueFamily;
+	m_ownershipTransfer.m_oldLayout = m_currentLayout;
+	m_ownershipTransfer.m_newLayout = newLayout;
+	m_ownershipTransfer.m_pending = true;
+
+	m_currentLayout = newLayout;
+
+	UpdateDescriptor();
+}
+
+void TextureVK::AcquireOwnership(DeviceVK* device, VkCommandBuffer commandBuffer, uint32_t dstQueueFamily)
+{
+	if (!m_ownershipTransfer.m_pending)
+		return;
+
+	assert(m_ownershipTransfer.m_dstQueueFamily == dstQueueFamily);
+
+	device->TransitionImageLayout(commandBuffer, m_image, m_view.GetAspectMask(), m_ownershipTransfer.m_oldLayout, m_ownershipTransfer.m_newLayout,
+		m_ownershipTransfer.m_srcQueueFamily, m_ownershipTransfer.m_dstQueueFamily, true);
+
+	m_ownershipTransfer.m_pending = false;
+}
+
+void TextureVK::TransferOwnershipAndSubmit(DeviceVK* device, ContextVK::ContextType srcType, ContextVK::ContextType dstType, VkImageLayout newLayout)
+{
+	uint32_t srcQueueFamily = device->GetQueueFamily(srcType);
+	uint32_t dstQueueFamily = device->GetQueueFamily(dstType);
+
+	VkCommandBuffer commandBuffer = device->BeginNewCommandBuffer(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT, srcType);
+	ReleaseOwnership(device, commandBuffer, srcQueueFamily, dstQueueFamily, newLayout);
+	device->SubmitCommandBufferAndWait(commandBuffer, true, srcType);
+
+	if (srcQueueFamily == dstQueueFamily)
+		return;
+
+	// the release has completed on the CPU timeline already, no need for a semaphore
+	commandBuffer = device->BeginNewCommandBuffer(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT, dstType);
+	AcquireOwnership(device, commandBuffer, dstQueueFamily);
+	device->SubmitCommandBufferAndWait(commandBuffer, true, dstType);
+}
+
 void TextureVK::UpdateDescriptor()
 {
 	m_descriptor.sampler = m_sampler;
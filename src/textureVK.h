@@ -1,6 +1,7 @@
 #pragma once
 
 #include "commonVK.h"
+#include "contextVK.h"
 #include "resource.h"
 
 #include <unordered_map>
@@ -18,9 +19,12 @@ public:
 	static void Cleanup(DeviceVK* device);
 
 	static size_t GetSamplerIndex(VkFilter filter, float minLod, float maxLod);
+	// index in the bindless sampler array, DeviceVK::s_invalidBindlessIndex if bindless is disabled
+	static uint32_t GetBindlessIndex(VkSampler sampler);
 
 private:
 	static std::unordered_map<size_t, VkSampler> m_samplers;
+	static std::unordered_map<VkSampler, uint32_t> m_bindlessIndices;
 };
 
 class TextureViewVK
@@ -70,9 +74,18 @@ public:
 
 	const VkDescriptorImageInfo& GetDescriptor() const { return m_descriptor; };
 
-	void TransitionImageLayout(DeviceVK* device, VkCommandBuffer commandBuffer, VkImageLayout newLayout);
+	// stable indices in the bindless arrays, for the textures with sampled usage. DeviceVK::s_invalidBindlessIndex if bindless is disabled
+	uint32_t GetBindlessIndex() const { return m_bindlessIndex; };
+	uint32_t GetBindlessSamplerIndex() const { return m_bindlessSamplerIndex; };
+
+	void TransitionImageLayout(DeviceVK* device, VkCommandBuffer commandBuffer, VkImageLayout newLayout, uint32_t queueFamily = VK_QUEUE_FAMILY_IGNORED);
 	void TransitionImageLayoutAndSubmit(DeviceVK* device, VkImageLayout newLayout);
 
+	// queue family ownership transfer. The acquire reuses the layouts of the pending release
+	void ReleaseOwnership(DeviceVK* device, VkCommandBuffer commandBuffer, uint32_t srcQueueFamily, uint32_t dstQueueFamily, VkImageLayout newLayout);
+	void AcquireOwnership(DeviceVK* device, VkCommandBuffer commandBuffer, uint32_t dstQueueFamily);
+	void TransferOwnershipAndSubmit(DeviceVK* device, ContextVK::ContextType srcType, ContextVK::ContextType dstType, VkImageLayout newLayout);
+
 	uint32_t GetWidth() const { return m_width; };
 	uint32_t GetHeight() const { return m_height; };
 
@@ -89,6 +102,9 @@ private:
 	// TODO: decouple from the sampler? Could just have some global samplers
 	VkSampler m_sampler;
 
+	uint32_t m_bindlessIndex = 0xFFFFFFFF;
+	uint32_t m_bindlessSamplerIndex = 0xFFFFFFFF;
+
 	VkImageType m_imageType;
 	VkFormat m_format;
 	uint32_t m_width = 0;
@@ -104,6 +120,17 @@ private:
 
 	bool m_isCubemap = false;
 	bool m_isArray = false;
+
+	struct OwnershipTransfer
+	{
+		uint32_t m_srcQueueFamily = VK_QUEUE_FAMILY_IGNORED;
+		uint32_t m_dstQueueFamily = VK_QUEUE_FAMILY_IGNORED;
+		VkImageLayout m_oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkImageLayout m_newLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		bool m_pending = false;
+	};
+
+	OwnershipTransfer m_ownershipTransfer;
 };
 
 }
@@ -33,6 +33,17 @@ bool UtilsVK::CheckExtensionsSupport(const std::vector<const char*>& requiredExt
 	return true;
 }
 
+bool UtilsVK::IsExtensionSupported(const char* extension, const std::vector<VkExtensionProperties>& availableExtensions)
+{
+	for (const VkExtensionProperties& extensionProperties : availableExtensions)
+	{
+		if (strcmp(extension, extensionProperties.extensionName) == 0)
+			return true;
+	}
+
+	return false;
+}
+
 bool UtilsVK::CheckLayersSupport(const std::vector<const char*>& requiredLayers, const std::vector<VkLayerProperties>& availableLayers)
 {
 	for (const char* layerName : requiredLayers)
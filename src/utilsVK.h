@@ -9,6 +9,8 @@ class UtilsVK
 {
 public:
 	static bool CheckExtensionsSupport(const std::vector<const char*>& requiredExtensions, const std::vector<VkExtensionProperties>& availableExtensions);
+	// same as CheckExtensionsSupport for a single extension, without asserting. Used for the optional extensions
+	static bool IsExtensionSupported(const char* extension, const std::vector<VkExtensionProperties>& availableExtensions);
 	static bool CheckLayersSupport(const std::vector<const char*>& requiredLayers, const std::vector<VkLayerProperties>& availableLayers);
 
 	static uint32_t FindMemoryType(VkMemoryPropertyFlags requiredProperties, VkMemoryRequirements memoryRequirements, VkPhysicalDeviceMemoryProperties deviceMemoryProperties);
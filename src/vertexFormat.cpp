@@ -1,5 +1,7 @@
 #include "vertexFormatVK.h"
 
+#include "utils.h"
+
 namespace MBRF
 {
 
@@ -9,6 +11,23 @@ void VertexFormatVK::AddAttribute(const VertexAttributeVK &attribute)
 	m_stride += attribute.m_size;
 }
 
+size_t VertexFormatVK::GetHash() const
+{
+	size_t hash = 0;
+
+	Utils::HashCombine(hash, m_binding);
+	Utils::HashCombine(hash, m_stride);
+
+	for (const VertexAttributeVK& attribute : m_attributes)
+	{
+		Utils::HashCombine(hash, attribute.m_location);
+		Utils::HashCombine(hash, attribute.m_format);
+		Utils::HashCombine(hash, attribute.m_offset);
+	}
+
+	return hash;
+}
+
 VkVertexInputBindingDescription VertexFormatVK::GetBindingDescription() const
 {
 	VkVertexInputBindingDescription bindingDescription;
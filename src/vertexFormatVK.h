@@ -31,6 +31,9 @@ public:
 
 	void SetBinding(uint32_t binding) { m_binding = binding; };
 
+	// of the binding and attributes, for the pipeline state cache
+	size_t GetHash() const;
+
 private:
 	uint32_t m_binding = 0;
 	uint32_t m_stride = 0;